@@ -0,0 +1,226 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: alloc.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Allocator for the big buffers (ray arrays, compact bundles, histogram
+   tiles).  Buffers are 2 MB aligned and backed by huge pages where the
+   system allows: explicit MAP_HUGETLB pages first, then transparent huge
+   pages via madvise(), then plain pages.  Each buffer is first touched
+   through the thread pool using the same static partition that the pool
+   will later use to work on it, so under the kernel's first-touch policy
+   every slice lives on the NUMA node of the thread that owns it. */
+
+#define _GNU_SOURCE                    // For MAP_ANONYMOUS, MAP_HUGETLB
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+/* Local headers */
+#include "alloc.h"
+#include "pool.h"
+
+
+/* Registry of live buffers, so alloc_free() knows how each was obtained */
+typedef struct alloc_block{
+  void               *ptr;
+  size_t              size;
+  int                 kind;
+  struct alloc_block *next;
+} alloc_block;
+
+static alloc_block *alloc_list = NULL;
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+/* Arguments for the first-touch job */
+typedef struct{
+  char  *ptr;
+  size_t elsize;
+} alloc_touch_arg;
+
+
+/* Allocate a buffer of n items of elsize bytes each, for work split over
+   pool with the given grain (see pool_run()) */
+/* The buffer is zeroed.  pool may be NULL, in which case the calling
+   thread touches everything.  Returns NULL on failure.  IMPORTANT: returned
+   buffer must be freed with alloc_free(), NOT free(). */
+void *alloc_buffer(long n, size_t elsize, scope_pool *pool, long grain){
+
+  /* Variable Declarations */
+  size_t size;
+  int    kind=ALLOC_MALLOC;
+  void  *ptr=NULL;
+  alloc_block    *blk;
+  alloc_touch_arg arg;
+
+  size = ((n * elsize + ALLOC_HUGEPAGE - 1) / ALLOC_HUGEPAGE) * ALLOC_HUGEPAGE;
+  if(size == 0)
+    size = ALLOC_HUGEPAGE;
+
+  /* Explicit huge pages, if the administrator has reserved any */
+#if HAVE_SYS_MMAN_H && defined(MAP_HUGETLB)
+  ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if(ptr == MAP_FAILED)
+    ptr = NULL;
+  else
+    kind = ALLOC_HUGETLB;
+#endif
+
+  /* Otherwise aligned memory, with a hint to use transparent huge pages */
+  if(ptr == NULL){
+#if HAVE_POSIX_MEMALIGN
+    if(posix_memalign(&ptr, ALLOC_HUGEPAGE, size))
+      ptr = NULL;
+#else
+    ptr = malloc(size);
+#endif
+    if(ptr == NULL){
+      fprintf(stderr,"Error: unable to allocate %0.3e bytes.\n",(double)size);
+      return NULL;
+    }
+    kind = ALLOC_MALLOC;
+#if HAVE_MADVISE && defined(MADV_HUGEPAGE)
+    if(madvise(ptr, size, MADV_HUGEPAGE) == 0)
+      kind = ALLOC_THP;
+#endif
+  }
+
+  /* First touch, slice by slice, from the threads that will use them */
+  arg.ptr    = (char *)ptr;
+  arg.elsize = elsize;
+  pool_run(pool, alloc_touch, &arg, n, grain);
+
+  /* Remember how to give it back */
+  blk = (alloc_block *)malloc(sizeof(alloc_block));
+  blk->ptr  = ptr;
+  blk->size = size;
+  blk->kind = kind;
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+  pthread_mutex_lock(&alloc_lock);
+#endif
+  blk->next  = alloc_list;
+  alloc_list = blk;
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+  pthread_mutex_unlock(&alloc_lock);
+#endif
+
+  return ptr;
+}
+
+
+/* Free a buffer obtained from alloc_buffer() */
+void alloc_free(void *ptr){
+
+  /* Variable Declarations */
+  alloc_block *blk,**prev;
+
+  if(ptr == NULL)
+    return;
+
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+  pthread_mutex_lock(&alloc_lock);
+#endif
+  for(prev=&alloc_list; *prev != NULL; prev=&(*prev)->next)
+    if((*prev)->ptr == ptr)
+      break;
+  blk = *prev;
+  if(blk != NULL)
+    *prev = blk->next;
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+  pthread_mutex_unlock(&alloc_lock);
+#endif
+
+  if(blk == NULL){
+    fprintf(stderr,"Warning: alloc_free() of unknown buffer %p\n",ptr);
+    return;
+  }
+
+#if HAVE_SYS_MMAN_H
+  if(blk->kind == ALLOC_HUGETLB)
+    munmap(blk->ptr, blk->size);
+  else
+#endif
+    free(blk->ptr);
+
+  free(blk);
+
+  return;
+}
+
+
+/* Describe how a buffer is backed ("hugetlb", "thp" or "4k") */
+const char *alloc_kind(void *ptr){
+
+  /* Variable Declarations */
+  alloc_block *blk;
+  int kind=-1;
+
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+  pthread_mutex_lock(&alloc_lock);
+#endif
+  for(blk=alloc_list; blk != NULL; blk=blk->next)
+    if(blk->ptr == ptr){
+      kind = blk->kind;
+      break;
+    }
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+  pthread_mutex_unlock(&alloc_lock);
+#endif
+
+  switch(kind){
+  case ALLOC_HUGETLB:
+    return "hugetlb";
+  case ALLOC_THP:
+    return "thp";
+  case ALLOC_MALLOC:
+    return "4k";
+  default:
+    return "unknown";
+  }
+}
+
+
+/* First-touch job: zero this thread's slice of the buffer */
+void alloc_touch(void *data, long i0, long i1, int tid){
+
+  alloc_touch_arg *arg = (alloc_touch_arg *)data;
+
+  memset(arg->ptr + i0 * arg->elsize, 0, (i1 - i0) * arg->elsize);
+
+  return;
+}
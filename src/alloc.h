@@ -0,0 +1,52 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: alloc.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include "pool.h"
+
+#define ALLOC_HUGEPAGE (2UL*1024*1024)   // Alignment & rounding: 2 MB pages
+
+/* How a buffer is backed */
+#define ALLOC_MALLOC   0        // Aligned malloc, ordinary pages
+#define ALLOC_THP      1        // Aligned malloc, transparent huge pages
+#define ALLOC_HUGETLB  2        // mmap() of explicit huge pages
+
+
+/* Function declarations */
+
+/* Public Functions */
+void       *alloc_buffer(long n, size_t elsize, scope_pool *pool, long grain);
+void        alloc_free(void *ptr);
+const char *alloc_kind(void *ptr);
+
+/* Internal Functions */
+void        alloc_touch(void *data, long i0, long i1, int tid);
+
+#endif  /* ALLOC_H */
+
+
+
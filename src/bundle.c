@@ -0,0 +1,423 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: bundle.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Compact ray bundles.  A scope_ray is 72 bytes; a compact ray is 20 bytes
+   plus one bit (and one byte more if the bundle is polychromatic).  All the
+   arithmetic is still done in double precision: rays are expanded a chunk
+   at a time into a scratch array of scope_ray, traced, and re-encoded
+   relative to the surface they end up on.  Keeping the float offsets small
+   (at most the size of that surface) keeps their absolute precision at the
+   ~10 nm level, which is plenty for geometric spots.  Compact rays do not
+   carry an optical path length, so wavefront work needs full rays. */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_rng.h>               // Includes GSL's rng routine defs
+
+/* Local headers */
+#include "bundle.h"
+#include "rays.h"
+#include "kernels.h"
+#include "mirrors.h"
+#include "setup.h"
+#include "alloc.h"
+#include "pool.h"
+#include "progress.h"
+
+
+/* Arguments for a bundle_trace() job */
+typedef struct{
+  scope_bundle  *b;
+  scope_optic   *old;
+  scope_optic   *last;
+  scope_scope   *scope;
+  scope_element *elements;
+  int            nelem;
+  scope_progress *progress;
+  int            status;
+} bundle_trace_arg;
+
+
+/* Allocate space for a compact bundle of n rays */
+/* The anchor starts as the launch plane z = RAYS_START_Z, with the global
+   axes as its frame.  Every ray starts out not lost.  The arrays are first
+   touched through the pool, slice by slice as bundle_trace() will use
+   them. */
+scope_bundle *bundle_alloc(long n, scope_pool *pool, int *status){
+
+  /* Variable Declarations */
+  scope_bundle *b;
+
+  *status = 0;
+
+  b = (scope_bundle *)calloc(1, sizeof(scope_bundle));
+  b->n    = n;
+  b->pos  = (float *)alloc_buffer(n, 3 * sizeof(float), pool, POOL_GRAIN);
+  b->dir  = (float *)alloc_buffer(n, 2 * sizeof(float), pool, POOL_GRAIN);
+  b->lost = (unsigned long long *)alloc_buffer(BUNDLE_NWORDS(n),
+					       sizeof(unsigned long long),
+					       pool, 1);
+  b->lam  = NULL;
+  b->npalette = 0;
+
+  if(b->pos == NULL || b->dir == NULL || b->lost == NULL){
+    fprintf(stderr,"Error: unable to allocate a bundle of %ld rays.\n",n);
+    bundle_free(b);
+    *status = -1;
+    return NULL;
+  }
+
+  b->anchor.cz = RAYS_START_Z;
+  b->anchor.frame[0][0] = b->anchor.frame[1][1] = b->anchor.frame[2][2] = 1.;
+
+  return b;
+}
+
+
+/* Free space occupied by a compact bundle */
+void bundle_free(scope_bundle *b){
+
+  if(b == NULL)
+    return;
+
+  alloc_free(b->pos);
+  alloc_free(b->dir);
+  free(b->lam);
+  alloc_free(b->lost);
+  free(b);
+
+  return;
+}
+
+
+/* Function to store n full rays into slots i0 ... i0+n-1 of the bundle */
+/* Positions are taken relative to the current anchor.  Returns non-zero if
+   the rays bring more than 256 distinct wavelengths into the bundle. */
+int bundle_pack(scope_bundle *b, long i0, scope_ray *rays, long n){
+
+  /* Variable Declarations */
+  long i;
+  int  status=0;
+
+  for(i=0;i<n;i++)
+    if(bundle_encode(b, &b->anchor, i0 + i, &rays[i]))
+      status = -1;
+
+  return status;
+}
+
+
+/* Function to expand slots i0 ... i0+n-1 of the bundle into full rays */
+void bundle_unpack(scope_bundle *b, long i0, scope_ray *rays, long n){
+
+  /* Variable Declarations */
+  long i;
+
+  for(i=0;i<n;i++)
+    bundle_decode(b, &b->anchor, i0 + i, &rays[i]);
+
+  return;
+}
+
+
+/* Function to fill the bundle uniformly across the aperture of an optic,
+   with rays arriving from field angle (ax,ay) radians */
+int bundle_fill_pupil(scope_bundle *b, scope_optic *pupil, double ax,
+		      double ay, double lambda, gsl_rng *r){
+
+  /* Variable Declarations */
+  long i0,n;
+  int  status=0;
+  scope_ray *scratch;
+
+  scratch = (scope_ray *)malloc(BUNDLE_CHUNK * sizeof(scope_ray));
+
+  for(i0=0; i0 < b->n; i0 += BUNDLE_CHUNK){
+    n = GSL_MIN(BUNDLE_CHUNK, b->n - i0);
+    rays_fill_pupil(scratch, n, pupil, ax, ay, lambda, r);
+    status |= bundle_pack(b, i0, scratch, n);
+  }
+
+  free(scratch);
+
+  return status;
+}
+
+
+/* Function to fill the bundle with rays k0 .. k0+b->n-1 of a trace, seeded
+   by counter (see rays_fill_counter()) */
+/* The anchor is reset to the launch plane, so the bundle can be refilled
+   after a trace. */
+int bundle_fill_counter(scope_bundle *b, unsigned long k0, unsigned long seed,
+			scope_optic *pupil, double ax, double ay,
+			double lambda){
+
+  /* Variable Declarations */
+  long i0,n;
+  int  status=0;
+  scope_ray *scratch;
+
+  memset(&b->anchor, 0, sizeof(scope_optic));
+  b->anchor.cz = RAYS_START_Z;
+  b->anchor.frame[0][0] = b->anchor.frame[1][1] = b->anchor.frame[2][2] = 1.;
+
+  scratch = (scope_ray *)malloc(BUNDLE_CHUNK * sizeof(scope_ray));
+
+  for(i0=0; i0 < b->n; i0 += BUNDLE_CHUNK){
+    n = GSL_MIN(BUNDLE_CHUNK, b->n - i0);
+    rays_fill_counter(scratch, n, k0 + i0, seed, pupil, ax, ay, lambda);
+    status |= bundle_pack(b, i0, scratch, n);
+  }
+
+  free(scratch);
+
+  return status;
+}
+
+
+/* Function to trace the whole bundle through the ordered list of elements */
+/* Each thread of the pool takes its own static slice of the bundle, and
+   each chunk of BUNDLE_CHUNK rays in it is expanded into doubles, traced
+   through every element, and re-encoded relative to the final element,
+   which then becomes the anchor for the whole bundle.  If progress is
+   not NULL, every chunk is also added to the progressive display. */
+int bundle_trace(scope_bundle *b, scope_pool *pool, scope_scope *scope,
+		 scope_element *elements, int nelem, scope_progress *progress){
+
+  /* Variable Declarations */
+  scope_optic old,*last;
+  bundle_trace_arg arg;
+
+  last = setup_get_optic(scope, elements[nelem-1].elem);
+  if(last == NULL){
+    fprintf(stderr,"Error: final element %d has no matching optic.\n",
+	    elements[nelem-1].elem);
+    return -1;
+  }
+  old = b->anchor;
+
+  arg.b        = b;
+  arg.old      = &old;
+  arg.last     = last;
+  arg.scope    = scope;
+  arg.elements = elements;
+  arg.nelem    = nelem;
+  arg.progress = progress;
+  arg.status   = 0;
+  pool_run(pool, bundle_trace_slice, &arg, b->n, POOL_GRAIN);
+
+  b->anchor = *last;
+
+  return arg.status;
+}
+
+
+/* bundle_trace() job: trace rays [i0, i1) of the bundle */
+void bundle_trace_slice(void *data, long i0, long i1, int tid){
+
+  /* Variable Declarations */
+  long i,c,n;
+  bundle_trace_arg *arg = (bundle_trace_arg *)data;
+  scope_ray *scratch;
+
+  scratch = (scope_ray *)malloc(BUNDLE_CHUNK * sizeof(scope_ray));
+
+  for(c=i0; c < i1; c += BUNDLE_CHUNK){
+    n = GSL_MIN(BUNDLE_CHUNK, i1 - c);
+    for(i=0;i<n;i++)
+      bundle_decode(arg->b, arg->old, c + i, &scratch[i]);
+    kernels_trace(scratch, n, arg->scope, arg->elements, arg->nelem);
+    for(i=0;i<n;i++)
+      if(bundle_encode(arg->b, arg->last, c + i, &scratch[i]))
+	arg->status = -1;               // Only ever set, so no lock needed
+    if(arg->progress != NULL)
+      progress_add(arg->progress, tid, arg->b, c, n);
+  }
+
+  free(scratch);
+
+  return;
+}
+
+
+/* Function to summarize the spot of the rays that were not lost */
+/* Positions are in the frame of the anchor, i.e. (u,v) on the detector
+   after bundle_trace().  Returns the number of rays in the spot. */
+long bundle_spot(scope_bundle *b, double cen[2], double *rms){
+
+  /* Variable Declarations */
+  long i,ngood=0;
+  double su=0.,sv=0.,suu=0.,svv=0.;
+
+  for(i=0;i<b->n;i++){
+    if(BUNDLE_LOST(b, i))
+      continue;
+    su  += b->pos[3*i];
+    sv  += b->pos[3*i+1];
+    suu += (double)b->pos[3*i] * b->pos[3*i];
+    svv += (double)b->pos[3*i+1] * b->pos[3*i+1];
+    ngood++;
+  }
+
+  cen[0] = cen[1] = *rms = 0.;
+  if(ngood == 0)
+    return 0;
+
+  cen[0] = su / ngood;
+  cen[1] = sv / ngood;
+  *rms   = sqrt(GSL_MAX(0., suu/ngood - cen[0]*cen[0] +
+			svv/ngood - cen[1]*cen[1]));
+
+  return ngood;
+}
+
+
+/* Bytes of storage per compact ray (monochromatic bundle) */
+double bundle_raysize(void){
+
+  return 5. * sizeof(float) + 1./8.;
+}
+
+
+/* Function to encode one full ray into slot i, relative to anchor */
+/* Returns non-zero if the palette is full and the wavelength is new. */
+int bundle_encode(scope_bundle *b, scope_optic *anchor, long i,
+		  scope_ray *ray){
+
+  /* Variable Declarations */
+  int    k,status=0;
+  double loc[3];
+
+  mirrors_to_local(anchor, ray->x - anchor->cx, ray->y - anchor->cy,
+		   ray->z - anchor->cz, loc);
+  b->pos[3*i]   = (float)loc[0];
+  b->pos[3*i+1] = (float)loc[1];
+  b->pos[3*i+2] = (float)loc[2];
+
+  bundle_oct_encode(ray->vx, ray->vy, ray->vz, &b->dir[2*i]);
+
+  /* Wavelength palette; the index array appears with the second entry */
+  for(k=0;k<b->npalette;k++)
+    if(b->palette[k] == ray->lambda)
+      break;
+  if(k == b->npalette){
+    if(k == 256){
+      k = 0;
+      status = -1;
+    } else {
+      b->palette[b->npalette++] = ray->lambda;
+      if(k == 1)
+	b->lam = (unsigned char *)calloc(b->n, sizeof(unsigned char));
+    }
+  }
+  if(b->lam != NULL)
+    b->lam[i] = (unsigned char)k;
+
+  if(ray->lost)
+    b->lost[i / 64] |=  (1ULL << (i % 64));
+  else
+    b->lost[i / 64] &= ~(1ULL << (i % 64));
+
+  return status;
+}
+
+
+/* Function to decode slot i, relative to anchor, into a full ray */
+void bundle_decode(scope_bundle *b, scope_optic *anchor, long i,
+		   scope_ray *ray){
+
+  /* Variable Declarations */
+  double loc[3],x,y,z;
+
+  loc[0] = b->pos[3*i];
+  loc[1] = b->pos[3*i+1];
+  loc[2] = b->pos[3*i+2];
+  mirrors_to_global(anchor, loc, &x, &y, &z);
+  ray->x = x + anchor->cx;
+  ray->y = y + anchor->cy;
+  ray->z = z + anchor->cz;
+
+  bundle_oct_decode(&b->dir[2*i], &ray->vx, &ray->vy, &ray->vz);
+
+  ray->lambda = b->palette[(b->lam != NULL) ? b->lam[i] : 0];
+  ray->opl    = 0.;
+  ray->lost   = BUNDLE_LOST(b, i);
+
+  return;
+}
+
+
+/* Octahedral encoding of a unit vector into two floats */
+/* The unit sphere is projected onto the octahedron |x|+|y|+|z| = 1, and
+   the lower half is folded out over the corners of the square.  Unlike
+   storing (vx,vy) and recovering vz, the precision is uniform over the
+   sphere. */
+void bundle_oct_encode(double vx, double vy, double vz, float *oct){
+
+  /* Variable Declarations */
+  double s,px,py;
+
+  s  = fabs(vx) + fabs(vy) + fabs(vz);
+  px = vx / s;
+  py = vy / s;
+  if(vz < 0.){
+    s  = px;
+    px = (1. - fabs(py)) * (px >= 0. ? 1. : -1.);
+    py = (1. - fabs(s))  * (py >= 0. ? 1. : -1.);
+  }
+  oct[0] = (float)px;
+  oct[1] = (float)py;
+
+  return;
+}
+
+
+/* Inverse of bundle_oct_encode(); the result is renormalized */
+void bundle_oct_decode(float *oct, double *vx, double *vy, double *vz){
+
+  /* Variable Declarations */
+  double x,y,z,t,norm;
+
+  x = oct[0];
+  y = oct[1];
+  z = 1. - fabs(x) - fabs(y);
+  if(z < 0.){
+    t = x;
+    x = (1. - fabs(y)) * (x >= 0. ? 1. : -1.);
+    y = (1. - fabs(t)) * (y >= 0. ? 1. : -1.);
+  }
+  norm = sqrt(x*x + y*y + z*z);
+  *vx = x / norm;
+  *vy = y / norm;
+  *vz = z / norm;
+
+  return;
+}
@@ -0,0 +1,73 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: bundle.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <gsl/gsl_rng.h>        // GSL's rng routine defs
+#include "pool.h"
+#include "progress.h"
+
+#define BUNDLE_CHUNK 1024       // Rays expanded to doubles at a time (72 kB)
+
+/* Number of 64-bit words in the lost bitmask, and the lost bit of ray i */
+#define BUNDLE_NWORDS(n)  (((n) + 63) / 64)
+#define BUNDLE_LOST(b,i)  ((int)(((b)->lost[(i) / 64] >> ((i) % 64)) & 1ULL))
+
+
+/* Function declarations */
+
+/* Public Functions */
+scope_bundle *bundle_alloc(long n, scope_pool *pool, int *status);
+void          bundle_free(scope_bundle *b);
+int           bundle_pack(scope_bundle *b, long i0, scope_ray *rays, long n);
+void          bundle_unpack(scope_bundle *b, long i0, scope_ray *rays,
+			    long n);
+int           bundle_fill_pupil(scope_bundle *b, scope_optic *pupil,
+				double ax, double ay, double lambda,
+				gsl_rng *r);
+int           bundle_fill_counter(scope_bundle *b, unsigned long k0,
+				  unsigned long seed, scope_optic *pupil,
+				  double ax, double ay, double lambda);
+int           bundle_trace(scope_bundle *b, scope_pool *pool,
+			   scope_scope *scope, scope_element *elements,
+			   int nelem, scope_progress *progress);
+long          bundle_spot(scope_bundle *b, double cen[2], double *rms);
+double        bundle_raysize(void);
+
+/* Internal Functions */
+void          bundle_trace_slice(void *data, long i0, long i1, int tid);
+int           bundle_encode(scope_bundle *b, scope_optic *anchor, long i,
+			    scope_ray *ray);
+void          bundle_decode(scope_bundle *b, scope_optic *anchor, long i,
+			    scope_ray *ray);
+void          bundle_oct_encode(double vx, double vy, double vz, float *oct);
+void          bundle_oct_decode(float *oct, double *vx, double *vy,
+				double *vz);
+
+#endif  /* BUNDLE_H */
+
+
+
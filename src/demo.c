@@ -29,72 +29,259 @@
 /* Include packages */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <gsl/gsl_math.h>              // Includes Constants
 
 /* Local headers */
 #include "demo.h"
 #include "setup.h"
+#include "glass.h"
+
+/* Lenses for the converging beam, indexed by DEMO_LENS_*: the Barlow's
+   radii make it a -100 mm singlet in N-BK7, doubling the focal length */
+static demo_lens_rx demo_lens_catalog[DEMO_NLENS] = {
+  /* name      c1            c2           thick   diam    gap */
+  {"barlow",  -1. / 0.104,   1. / 0.104,  0.002,  0.025,  0.05},
+  {"window",   0.,           0.,          0.005,  0.030,  0.03}
+};
+
+static void demo_lens_surface(scope_optic *s, scope_optic *fp, double d,
+			      double curv, double diam, int glass);
 
 /* Have a hard-wired Newtonian telescope as a DEMO, but also for code testing */
 void demo_newtonian(scope_scope *telescope,
-		    scope_element *elements,
+		    scope_element **elements,
 		    int *nelem){
+  
+  scope_newtonian par;
+  
+  demo_newtonian_defaults(&par);
+  demo_newtonian_design(telescope, elements, nelem, &par);
+  
+  return;
+}
+
 
+/* Fill in the prescription of the demo Newtonian: a 10" f/6 paraboloid with
+   a 2" flat folding the focus DEMO_BACKFOCUS f off axis */
+void demo_newtonian_defaults(scope_newtonian *par){
+  
+  par->fratio    = 6.;
+  par->dmaj      = 10. *(2.54/100.);
+  par->dsec      = 2. *(2.54/100.);
+  par->offset    = 0.;
+  par->backfocus = DEMO_BACKFOCUS * par->fratio * par->dmaj;
+  
+  return;
+}
+
+
+/* Build a Newtonian telescope from its prescription */
+/* The flat sits backfocus below the prime focus, so the folded focus lands
+   on the focal plane backfocus off axis whatever the f/ratio.  The offset
+   slides the flat in its own plane (toward the primary and away from the
+   focuser), which moves the obstruction without moving the image. */
+void demo_newtonian_design(scope_scope *telescope,
+			   scope_element **elements,
+			   int *nelem, scope_newtonian *par){
+  
+  /* Variable Declarations */
+  double zfold;
+  
   telescope->name = (char *)malloc(sizeof(char) * 256);
   sprintf(telescope->name,"Newtonian Demo");
   
   /* Set up the primary mirror */
   telescope->primary.type = OPTIC_PARABOLA;
-  telescope->primary.dmaj = 10. *(2.54/100.);   // 10" mirror, keep everything in meters
-  telescope->primary.dmin = 10. *(2.54/100.);   // 10" mirror, keep everything in meters
+  telescope->primary.dmaj = par->dmaj;          // Keep everything in meters
+  telescope->primary.dmin = par->dmaj;
   telescope->primary.vmin = 0.;                 // Axially symmetric
-  telescope->primary.f    = telescope->primary.dmaj * 6.; // f/6 parabola
+  telescope->primary.f    = telescope->primary.dmaj * par->fratio;
+  telescope->primary.k    = -1.;                // Paraboloid
+  telescope->primary.glass = GLASS_AIR;         // Mirrors: nothing behind them
   telescope->primary.cx   = 0.;                 // Center mirror at (0,0,0)
   telescope->primary.cy   = 0.;
   telescope->primary.cz   = 0.;
   telescope->primary.nx   = 0.;                 // Point mirror straight up along z-hat
   telescope->primary.ny   = 0.;
   telescope->primary.nz   = 1.;
-  telescope->primary.nhat = setup_orient_optic(&telescope->primary);
+  setup_orient_optic(&telescope->primary);
   
   /* Set up the secondary mirror */
+  zfold = telescope->primary.f - par->backfocus;
   telescope->secondary.type = OPTIC_PLANE;
-  telescope->secondary.dmaj = 2. *(2.54/100.) * M_SQRT2; // 2" plane mirror -- projection
-  telescope->secondary.dmin = 2. *(2.54/100.);           // 2" plane mirror -- projection
+  telescope->secondary.dmaj = par->dsec * M_SQRT2;       // Plane mirror -- projection
+  telescope->secondary.dmin = par->dsec;                 // Plane mirror -- projection
   telescope->secondary.vmin = NHAT_Y;                    // Minor axis along y-direction
   telescope->secondary.f    = posinf;
-  telescope->secondary.cx   = 0.;
+  telescope->secondary.k    = 0.;
+  telescope->secondary.glass = GLASS_AIR;
+  telescope->secondary.cx   = -par->offset;
   telescope->secondary.cy   = 0.;
-  telescope->secondary.cz   = telescope->primary.dmaj * 0.9;       // 90% of the way to focus?
+  telescope->secondary.cz   = zfold - par->offset;
   telescope->secondary.nx   = M_SQRT1_2;                 // (1,0,-1)
   telescope->secondary.ny   = 0.;
   telescope->secondary.nz   = -M_SQRT1_2;
-  telescope->secondary.nhat = setup_orient_optic(&telescope->secondary);
+  setup_orient_optic(&telescope->secondary);
+  
+  /* Set up the focal plane, where the secondary folds the focus to +x */
+  telescope->focalplane.type = OPTIC_PLANE;
+  telescope->focalplane.dmaj = 2. *(2.54/100.);           // 2" focuser
+  telescope->focalplane.dmin = 2. *(2.54/100.);
+  telescope->focalplane.vmin = NHAT_Y;
+  telescope->focalplane.f    = posinf;
+  telescope->focalplane.k    = 0.;
+  telescope->focalplane.glass = GLASS_AIR;
+  telescope->focalplane.cx   = par->backfocus;
+  telescope->focalplane.cy   = 0.;
+  telescope->focalplane.cz   = zfold;
+  telescope->focalplane.nx   = -1.;                      // Facing the secondary
+  telescope->focalplane.ny   = 0.;
+  telescope->focalplane.nz   = 0.;
+  setup_orient_optic(&telescope->focalplane);
+  
+  /* Four-vane spider holding the secondary, just above it */
+  telescope->spider.nvanes = 4;
+  telescope->spider.width  = 1.0e-3;                     // 1-mm vanes
+  telescope->spider.angle  = M_PI_4;                     // Clear of the fold
+  telescope->spider.cx     = telescope->secondary.cx;
+  telescope->spider.cy     = telescope->secondary.cy;
+  telescope->spider.cz     = telescope->secondary.cz + telescope->secondary.dmin;
   
   /* Tell the calling function how many elements light passed by or reflects
      off of before coming to the focal plane */
-  *nelem = 3;
-  elements = (scope_element *)calloc( *nelem, sizeof(scope_element) );
+  *nelem = 4;
+  *elements = (scope_element *)calloc( *nelem, sizeof(scope_element) );
   
   /* Define elements */
   
   /* Light passes the secondary first, blocking some rays, but no reflections */
-  elements[0].elem    = OPTIC_SEC;
-  elements[0].block   = true;      // lost=true for those that hit
-  elements[0].reflect = false;
-  elements[0].refract = false;
+  (*elements)[0].elem    = OPTIC_SEC;
+  (*elements)[0].block   = true;      // lost=true for those that hit
+  (*elements)[0].reflect = false;
+  (*elements)[0].refract = false;
   
   /* Light hits the primary next, reflecting those that hit it */
-  elements[1].elem    = OPTIC_PRI;
-  elements[1].block   = false;     // lost=true for those that miss
-  elements[1].reflect = true;
-  elements[1].refract = false;
+  (*elements)[1].elem    = OPTIC_PRI;
+  (*elements)[1].block   = false;     // lost=true for those that miss
+  (*elements)[1].reflect = true;
+  (*elements)[1].refract = false;
   
   /* Light hits the secondary next, reflecting those that hit it */
-  elements[2].elem    = OPTIC_SEC;
-  elements[2].block   = false;     // lost=true for those that miss
-  elements[2].reflect = true;
-  elements[2].refract = false;
+  (*elements)[2].elem    = OPTIC_SEC;
+  (*elements)[2].block   = false;     // lost=true for those that miss
+  (*elements)[2].reflect = true;
+  (*elements)[2].refract = false;
+  
+  /* Light finally lands on the focal plane */
+  (*elements)[3].elem    = OPTIC_NFP;
+  (*elements)[3].block   = false;     // lost=true for those that miss
+  (*elements)[3].reflect = false;
+  (*elements)[3].refract = false;
+  
+  return;
+}
+
+
+/* Put a lens in the converging beam of a telescope, ahead of its focal
+   plane, and move the focal plane to the new paraxial focus */
+/* The focal plane must be the last element.  The two lens surfaces are the
+   tertiary and quaternary optics, refracting elements inserted just ahead
+   of it; the glass changes the power of a curved lens (the Barlow is
+   figured for N-BK7) and the focal plane follows.  Returns non-zero, with
+   the telescope untouched, if the lens leaves no real focus. */
+int demo_lens(scope_scope *telescope, scope_element **elements, int *nelem,
+	      int lens, int glass){
+  
+  /* Variable Declarations */
+  int    e;
+  double n,y,u,bfd;
+  demo_lens_rx *rx;
+  scope_optic  *fp = &telescope->focalplane;
+  
+  if(lens <= DEMO_LENS_NONE || lens >= DEMO_NLENS)
+    return 0;
+  rx = &demo_lens_catalog[lens];
+  
+  /* Paraxial marginal ray (y-u trace), converging on the unlensed focus */
+  n = glass_index(glass, DEMO_LAMBDA);
+  y = 1.;
+  u = -y / rx->gap;
+  u = (u - y * (n - 1.) * rx->c1) / n;
+  y += rx->thick * u;
+  u = n * u - y * (1. - n) * rx->c2;
+  if(u >= 0.){
+    fprintf(stderr,"Error: the %s leaves no real focus.\n",rx->name);
+    return 1;
+  }
+  bfd = -y / u;                        // Second vertex to the new focus
+  
+  /* Surfaces along the focal-plane normal, which faces the incoming beam */
+  demo_lens_surface(&telescope->tertiary, fp, rx->gap, rx->c1, rx->diam,
+		    glass);
+  demo_lens_surface(&telescope->quaternary, fp, rx->gap - rx->thick,
+		    rx->c2, rx->diam, GLASS_AIR);
+  
+  fp->cx += (rx->gap - rx->thick - bfd) * fp->nx;
+  fp->cy += (rx->gap - rx->thick - bfd) * fp->ny;
+  fp->cz += (rx->gap - rx->thick - bfd) * fp->nz;
+  
+  /* Two refracting elements ahead of the focal plane */
+  *nelem += 2;
+  *elements = (scope_element *)realloc(*elements,
+				       *nelem * sizeof(scope_element));
+  (*elements)[*nelem-1] = (*elements)[*nelem-3];
+  for(e = *nelem-3; e < *nelem-1; e++){
+    (*elements)[e].elem      = (e == *nelem-3) ? OPTIC_TRI : OPTIC_QUA;
+    (*elements)[e].block     = false;   // lost=true for those that miss
+    (*elements)[e].reflect   = false;
+    (*elements)[e].refract   = true;    // Into the glass, then back out
+    (*elements)[e].footprint = NULL;
+  }
+  
+  sprintf(telescope->name + strlen(telescope->name)," with %s",rx->name);
+  
+  return 0;
+}
+
+
+/* Function to find a demo_lens() lens by (case-insensitive) name */
+/* Returns the DEMO_LENS_* integer, or DEMO_LENS_NONE if there is none. */
+int demo_lens_lookup(char *name){
+  
+  /* Variable Declarations */
+  int l;
+  
+  for(l=0; l < DEMO_NLENS; l++)
+    if(strcasecmp(name, demo_lens_catalog[l].name) == 0)
+      return l;
+  
+  return DEMO_LENS_NONE;
+}
+
+
+/* Set up a lens surface d ahead of (the center of) the focal plane fp, in
+   its frame, with curvature curv in the direction of the light */
+/* The normal faces the incoming beam, so the sag w = r^2 / 4f runs against
+   the light and f = -R / 2. */
+static void demo_lens_surface(scope_optic *s, scope_optic *fp, double d,
+			      double curv, double diam, int glass){
+  
+  s->type  = (curv == 0.) ? OPTIC_PLANE : OPTIC_SHPERE;
+  s->dmaj  = diam;
+  s->dmin  = diam;
+  s->vmin  = fp->vmin;
+  s->f     = (curv == 0.) ? posinf : -0.5 / curv;
+  s->k     = 0.;                          // Sphere
+  s->glass = glass;                       // Medium behind the surface
+  s->cx    = fp->cx + d * fp->nx;
+  s->cy    = fp->cy + d * fp->ny;
+  s->cz    = fp->cz + d * fp->nz;
+  s->nx    = fp->nx;
+  s->ny    = fp->ny;
+  s->nz    = fp->nz;
+  setup_orient_optic(s);
   
   return;
 }
@@ -26,9 +26,32 @@
 #ifndef DEMO_H
 #define DEMO_H
 
+#define DEMO_BACKFOCUS 0.1      // Fold point to focal plane, as a fraction of f
+#define DEMO_LAMBDA    5500.    // Wavelength the lenses are focused at (A)
+
+/* Define symbolic integers for the lenses demo_lens() can add */
+#define DEMO_LENS_NONE   -1
+#define DEMO_LENS_BARLOW  0     // 2x Barlow (biconcave singlet)
+#define DEMO_LENS_WINDOW  1     // Plane-parallel filter / window
+#define DEMO_NLENS        2
+
+/* A singlet: curvatures (1/R, 0 = flat) in the direction of the light */
+typedef struct{
+  char  *name;
+  double c1;                    // First surface curvature (1/m)
+  double c2;                    // Second surface curvature (1/m)
+  double thick;                 // Center thickness (m)
+  double diam;                  // Clear aperture (m)
+  double gap;                   // First vertex to the unlensed focus (m)
+} demo_lens_rx;
 
 /* Function declarations */
-void demo_newtonian(scope_scope *, scope_element *, int *);
+void demo_newtonian(scope_scope *, scope_element **, int *);
+void demo_newtonian_defaults(scope_newtonian *par);
+void demo_newtonian_design(scope_scope *, scope_element **, int *,
+			   scope_newtonian *par);
+int  demo_lens(scope_scope *, scope_element **, int *, int lens, int glass);
+int  demo_lens_lookup(char *name);
 
 
 #endif  /* DEMO_H */
@@ -34,14 +34,30 @@
 #include <fitsio.h>                    // CFITSIO version #
 #include <gsl/gsl_version.h>           // GSL version #
 #include <sys/ioctl.h>                 // Contains the TIOCGWINSZ definition
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 
 /* Local headers */
 #include "display.h"
+#include "images.h"
 
 /* External-Scope Variables -- DS9 XPA Port Information */
 char *active_ports[NXPA];              // Port information for open DS9 windows
 char *ds9_port;                        // This is the port we are using
 
+/* Persistent XPA client connection, shared by all updates */
+static XPA ds9_xpa = NULL;
+static XPA display_ds9_xpa_conn(void);
+
+/* DS9 is found (or launched) on the first display call, not at startup;
+   with display_enable(false), XPA is never touched at all */
+static int ds9_enabled = 1;
+static int ds9_tried   = 0;            // display_ds9_connect() has run
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+static pthread_mutex_t ds9_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 
 /* Procure an open DS9 window for use with ScopeDesign, check status via XPA */
 void *display_ds9_open(void *status){
@@ -66,7 +82,8 @@ void *display_ds9_open(void *status){
   /* Check for the existance of currently-open DS9 window */
   /* Note: the XPAGet() routine searches ONLY for windows owned by the current
      username... it ignores windows owned by other users of the machine. */
-  got = XPAGet(NULL, "ds9", "file", NULL, bufs, lens, names, messages, NXPA);
+  got = XPAGet(display_ds9_xpa_conn(), "ds9", "file", NULL, bufs, lens, names,
+	       messages, NXPA);
   nopen = got;
   
   /* If active_ports DS9 windows found, get connection information */
@@ -111,18 +128,17 @@ void *display_ds9_open(void *status){
       sstat = system(command);                  // Execute the command
                                                 // Possibly check the return?
       
-      /* Wait until the new window opens, then register its port information */
-      do{
-	usleep(500);  // Cool your heels while waiting for new window to open
-	
-	/* Get the DS9 frame information for window with this title */
-	got = XPAGet(NULL, ds9_title, "frame", "frameno", 
-		     bufs, lens, names, messages, NXPA);
-	
-	
-	if(got == 1)  // If a window appears with the proper title...
-	  break;
-      }while(1);
+      /* Wait until the new window opens, then register its port information;
+	 poll with exponential backoff rather than spinning, and give up
+	 after DS9_START_TIMEOUT */
+      got = display_ds9_wait(ds9_title, bufs, lens, names, messages);
+      if(got != 1){
+	fprintf(stderr,"Error: DS9 window %s did not appear within %d s.\n",
+		ds9_title, DS9_START_TIMEOUT);
+	ds9_port = NULL;
+	wombat = 0;
+	break;
+      }
       
       /* Extract port information for all open DS9 windows */
       display_get_ports(names,got,false);
@@ -226,9 +242,13 @@ void display_ds9_close(){
   char *messages[NXPA];
   extern char *ds9_port;
   
+  if(ds9_port == NULL)                  // Never connected: nothing to close
+    return;
+  
   printf("Closing DS9 window at port %s...\n",ds9_port);
   
-  got = XPASet(NULL, ds9_port, "exit", NULL, buf, len, names, messages, NXPA);
+  got = XPASet(ds9_xpa, ds9_port, "exit", NULL, buf, len, names, messages,
+	       NXPA);
   /* error processing */
   for(i=0; i<got; i++){
     if( messages[i] ){
@@ -238,6 +258,11 @@ void display_ds9_close(){
     if( messages[i] ) free(messages[i]);
   }
   
+  /* Done with the persistent connection */
+  if(ds9_xpa != NULL){
+    XPAClose(ds9_xpa);
+    ds9_xpa = NULL;
+  }
   
   return;
 }
@@ -259,6 +284,10 @@ int display_ds9_talk(int action, scope_display *display){
   int retval;
   char *handle = "Fun times.";
   
+  /* Find or open the DS9 window the first time through */
+  if(display_ds9_connect())
+    return -1;
+  
   /* Choose the necessary evil */
   switch(action)
     {
@@ -269,6 +298,9 @@ int display_ds9_talk(int action, scope_display *display){
       /* Determine which handle changed */
       display_ds9_xpa_set(display, handle);
       break;
+    case DS9_ARRAY:
+      retval = display_ds9_xpa_array(display);
+      break;
     default:
       printf("Danger, Will Robinson, no correct action specified!\n");
       retval = -1;
@@ -340,7 +372,7 @@ int display_ds9_xpa_set(scope_display *display, char *handle){
   /* printf("Holding horses...\n"); */
   /* sleep(5);  // Hold your horses! */
   
-  xpa = XPAOpen(NULL);
+  xpa = display_ds9_xpa_conn();
   sprintf(template,"file %s/new-image.fits",DATADIR);
   
   printf("%s (%ld)",template,len);
@@ -402,16 +434,237 @@ int display_ds9_xpa_set(scope_display *display, char *handle){
 }
 
 
+/* Push display->image to DS9 as an in-memory array, over the persistent
+   connection */
+/* The pixels go straight from the image buffer into the XPA socket, so
+   there is no FITS file to write and no FITS parse on the DS9 side; only a
+   strided view has to be packed first.  The colormap is set too, if one
+   is given.  Returns 0 on success, -1 if DS9 is not there or complains. */
+int display_ds9_xpa_array(scope_display *display){
+  
+  /* Declare Variables */
+  int  i,got,copied,status=0;
+  char template[128];
+  char *names[NXPA],*messages[NXPA];
+  double *buf;
+  scope_image *img = display->image;
+  extern char *ds9_port;
+  
+  if(ds9_port == NULL || img == NULL)
+    return -1;
+  
+  /* DS9 reads the raw pixels in the byte order we say they are in */
+  buf = images_flatten(img, &copied);
+  snprintf(template, sizeof(template),
+	   "array [xdim=%ld,ydim=%ld,bitpix=-64,arch=%s]",
+	   img->nx, img->ny, display_arch());
+  
+  got = XPASet(display_ds9_xpa_conn(), ds9_port, template, NULL, (char *)buf,
+	       img->nx * img->ny * sizeof(double), names, messages, NXPA);
+  
+  /* error processing */
+  if(got == 0)
+    status = -1;
+  for(i=0; i<got; i++){
+    if( messages[i] ){
+      fprintf(stderr, "ERROR: %s (%s)\n", messages[i], names[i]);
+      status = -1;
+    }
+    if( names[i] )    free(names[i]);
+    if( messages[i] ) free(messages[i]);
+  }
+  if(copied)
+    free(buf);
+  
+  /* Colormap, on the same connection */
+  if(!status && display->cmap != NULL){
+    snprintf(template, sizeof(template), "cmap %s", display->cmap);
+    got = XPASet(ds9_xpa, ds9_port, template, NULL, NULL, 0,
+		 names, messages, NXPA);
+    for(i=0; i<got; i++){
+      if( names[i] )    free(names[i]);
+      if( messages[i] ) free(messages[i]);
+    }
+  }
+  
+  return status;
+}
+
+
+/* Turn DS9 output on or off; while it is off (headless batch runs), no
+   display call touches XPA */
+void display_enable(int enable){
+  
+  ds9_enabled = enable;
+  
+  return;
+}
+
+
+/* Function to connect to a DS9 window, the first time it is needed */
+/* Runs display_ds9_open() once, in the calling thread.  Returns 0 if there
+   is a window to talk to, -1 if display is off or DS9 could not be had
+   (which is not retried). */
+int display_ds9_connect(void){
+  
+  /* Variable Declarations */
+  int ds9stat = DS9_WHATEVER;
+  extern char *ds9_port;
+  
+  if(!ds9_enabled)
+    return -1;
+  
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+  pthread_mutex_lock(&ds9_lock);
+#endif
+  if(!ds9_tried){
+    ds9_tried = 1;
+    display_ds9_open(&ds9stat);
+  }
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+  pthread_mutex_unlock(&ds9_lock);
+#endif
+  
+  return (ds9_port == NULL) ? -1 : 0;
+}
+
+
+/* Is there a DS9 window in use? */
+int display_ds9_active(void){
+  
+  extern char *ds9_port;
+  
+  return (ds9_port != NULL);
+}
+
+
+/* Return the persistent XPA client connection, opening it on first use */
+/* A NULL XPA handle would make every XPASet() set up and tear down its own
+   connection to DS9. */
+static XPA display_ds9_xpa_conn(void){
+  
+  if(ds9_xpa == NULL)
+    ds9_xpa = XPAOpen(NULL);
+  
+  return ds9_xpa;
+}
+
+
+/* Byte order of this machine, in DS9's array-spec terms */
+const char *display_arch(void){
+  
+  const unsigned short one = 1;
+  
+  return (*(const unsigned char *)&one) ? "littleendian" : "bigendian";
+}
+
+
+/* Wait for a newly launched DS9 window called title to register with XPA */
+/* Polls with exponential backoff (DS9_POLL_MIN doubling up to DS9_POLL_MAX
+   microseconds) for at most DS9_START_TIMEOUT seconds, so the wait neither
+   burns a core nor delays a fast start.  Returns the XPAGet() count (1 once
+   the window is there), with bufs/names/messages filled as by XPAGet(). */
+int display_ds9_wait(char *title, char **bufs, size_t *lens, char **names,
+		     char **messages){
+  
+  /* Declare Variables */
+  int    i,got;
+  long   delay=DS9_POLL_MIN;
+  double waited=0.;
+  
+  for(;;){
+    /* Get the DS9 frame information for window with this title */
+    got = XPAGet(display_ds9_xpa_conn(), title, "frame", "frameno",
+		 bufs, lens, names, messages, NXPA);
+    if(got == 1)  // If a window appears with the proper title...
+      return got;
+    
+    /* Free arrays from XPAGet(), otherwise memory fills... */
+    for(i=0;i<got;i++){
+      if( bufs[i] )     free(bufs[i]);
+      if( names[i] )    free(names[i]);
+      if( messages[i] ) free(messages[i]);
+    }
+    
+    if(waited >= DS9_START_TIMEOUT)
+      return 0;
+    usleep(delay);  // Cool your heels while waiting for new window to open
+    waited += delay * 1.e-6;
+    delay   = GSL_MIN(2 * delay, DS9_POLL_MAX);
+  }
+}
+
+
+/* Read the current DS9 settings into the display structure */
+/* Uses the persistent connection and the cached port, so there is no name
+   server lookup.  Returns the number of handles that could not be read. */
 int display_ds9_xpa_read(scope_display *display){
   
   /* Declare Variables */
+  int  nbad=0;
+  char *val;
   
-  printf("We're deep within the bowels of the code, executing display_ds9_xpa_read().\n");
   /* Go through the handles, executing XPAGet() for each one and loading them
      into the display structure */
+  if((val = display_ds9_xpa_get("file")) != NULL){
+    free(display->file);
+    display->file = val;
+  } else nbad++;
+  if((val = display_ds9_xpa_get("frame")) != NULL){
+    display->frame = atoi(val);
+    free(val);
+  } else nbad++;
+  if((val = display_ds9_xpa_get("cmap")) != NULL){
+    free(display->cmap);
+    display->cmap = val;
+  } else nbad++;
+  if((val = display_ds9_xpa_get("scale")) != NULL){
+    free(display->scale);
+    display->scale = val;
+  } else nbad++;
+  if((val = display_ds9_xpa_get("scale limits")) != NULL){
+    sscanf(val, "%lf %lf", &display->min_scale, &display->max_scale);
+    free(val);
+  } else nbad++;
+  if((val = display_ds9_xpa_get("zoom")) != NULL){
+    display->zoom = atoi(val);
+    free(val);
+  } else nbad++;
+  
+  return nbad;
+}
+
+
+/* Function to XPAGet() one DS9 handle from the window we are using */
+/* Returns the value (trailing newline removed), or NULL on failure.
+   IMPORTANT: returned string must be freed by calling function. */
+char *display_ds9_xpa_get(char *param){
   
+  /* Declare Variables */
+  int  i,got;
+  size_t lens[NXPA];
+  char *bufs[NXPA],*names[NXPA],*messages[NXPA];
+  char *val=NULL;
+  extern char *ds9_port;
   
-  return 0;
+  if(ds9_port == NULL)
+    return NULL;
+  
+  got = XPAGet(display_ds9_xpa_conn(), ds9_port, param, NULL, bufs, lens,
+	       names, messages, NXPA);
+  for(i=0; i<got; i++){
+    if( messages[i] == NULL && val == NULL && bufs[i] != NULL ){
+      val = bufs[i];
+      val[strcspn(val, "\n")] = '\0';
+    } else if( bufs[i] )
+      free(bufs[i]);
+    if( messages[i] )
+      fprintf(stderr, "ERROR: %s (%s)\n", messages[i], names[i]);
+    if( names[i] )    free(names[i]);
+    if( messages[i] ) free(messages[i]);
+  }
+  
+  return val;
 }
 
 
@@ -437,7 +690,9 @@ void display_get_ports(char **namstr, int ngot, bool verbose){
       cp = strdup(namstr[i]);           // Make a copy of the name/port sequence
       token = strtok_r(cp," ",&save);   // This is the DS9:ds9 'name'
       token = strtok_r(NULL," ",&save); // This is the port information
+      free(active_ports[i]);            // Replace any earlier cached port
       active_ports[i] = strdup(token);
+      free(cp);
     }
     
     /* Print out information if verbose set */
@@ -34,6 +34,10 @@
 
 #define NXPA 10
 
+#define DS9_START_TIMEOUT 30      // Seconds to wait for a new DS9 window
+#define DS9_POLL_MIN      1000    // First poll interval (usec)...
+#define DS9_POLL_MAX      250000  // ...doubling up to this
+
 /* Assumed screen width if we can't find the real value.  */
 #define DEFAULT_SCREEN_WIDTH 80
 /* Minimum screen width we'll try to work with. */
@@ -47,6 +51,9 @@
 void *display_ds9_open(void *status);
 int   display_ds9_talk(int action, scope_display *display);
 void  display_ds9_close();
+int   display_ds9_connect(void);
+int   display_ds9_active(void);
+void  display_enable(int enable);
 int   display_splash(int input);
 
 
@@ -59,6 +66,11 @@ int   display_determine_screen_width(void);
 
 int   display_ds9_xpa_set(scope_display *display, char *handle);
 int   display_ds9_xpa_read(scope_display *display);
+int   display_ds9_xpa_array(scope_display *display);
+char *display_ds9_xpa_get(char *param);
+int   display_ds9_wait(char *title, char **bufs, size_t *lens, char **names,
+		       char **messages);
+const char *display_arch(void);
 
 #endif  /* DISPLAY_H */
 
@@ -29,62 +29,47 @@
 /* Include packages */
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <time.h>                      // To update FITS headers
+#include <fcntl.h>                     // To map images: open()
+#include <unistd.h>                    //   close(), sysconf()
+#include <sys/stat.h>                  //   fstat()
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>                 //   mmap()
+#endif
 
 /* Local headers */
 #include "fitsw.h"                  // Contains <fitsio.h> include
 #include "images.h"
+#include "pool.h"
+
+/* Big-endian (FITS order) 32- and 64-bit words */
+#define FW_BE32(p) ((uint32_t)(p)[0] << 24 | (uint32_t)(p)[1] << 16 |	\
+		    (uint32_t)(p)[2] << 8  | (uint32_t)(p)[3])
+#define FW_BE64(p) ((uint64_t)FW_BE32(p) << 32 | FW_BE32((p) + 4))
+
+/* Pool used to decode / decompress large reads (NULL: calling thread only) */
+static scope_pool *fitsw_pool = NULL;
+
 
 /***** Public-Facing Functions *****/
 
 /* Function to write array to FITS file */
-/* NOTE: FUNCTION CURRENTLY COPIES HEADER FROM ANOTHER FILE... MODIFY TO 
-   CREATE NEW HEADER AND POPULATE IT WITH REASONABLE THINGS! */
+/* The rows of array need not be contiguous; use fitsw_write_image() for a
+   scope_image, which goes out in a single call. */
 void fitsw_write2file(char *fileout, long naxes[2], double **array, 
 		      int bitpix, char *telname, int *status){
   
   /* Variable Declarations & Initializations */
   int k;
   long fpixel[2];
-  char buf_date[FLEN_VALUE],buf_time[FLEN_VALUE],fn[FLEN_FILENAME];
   fitsfile *fitsfp;
-  time_t now;
-  struct tm *ptr;
-
+  
   /* Set CFITSIO status = 0 before we begin */
   *status = 0;
   
-  
-  /* Open FITS file for writing, overwrite existing file */
-  snprintf(fn,FLEN_FILENAME, "!%s",fileout);
-                                 // CFITSIO will overwrite file prepended w/ "!"
-  if( fits_create_file(&fitsfp, fn, status) )
-    fw_catcherror(status);       // Send pointer not value
-  
-  /* Create image HDU */
-  int naxis = 2;                 // Routine is specific for 2-D images
-  if( fits_create_img(fitsfp, bitpix, naxis, naxes, status) )
-    fw_catcherror(status);       // Send pointer not value
-  
-  /* Write the UT date and time of file creation */
-  time(&now);
-  ptr = gmtime(&now);
-  strftime(buf_date, FLEN_VALUE, "%Y-%m-%d", ptr);
-  strftime(buf_time, FLEN_VALUE, "%H:%M:%S", ptr);
-  fits_update_key(fitsfp, TSTRING, "DATE-OBS", buf_date,
-		  "UT date of observation", status);
-  fits_update_key(fitsfp, TSTRING, "TIME-OBS", buf_time,
-		  "UT time of observation", status);
-  
-  /* Add various FITS keywords, specific to ScopeDesign */
-  fits_write_key(fitsfp, TSTRING, "OBSERVAT",
-		 "ScopeDesign Ray-Tracing Program", NULL, status);
-  fits_write_key(fitsfp, TSTRING, "TELESCOP", telname,
-		 "modeled telescope for ray trace", status);
-  fits_write_key(fitsfp, TSTRING, "FILENAME", fileout, NULL, status);
-  
-  /* Catch any CFITSIO errors from keyword writing */
-  fw_catcherror(status);    // Send pointer not value
+  /* Create the file, image HDU and header */
+  fitsfp = fw_create_image(fileout, naxes, bitpix, telname, status);
   
   /* Write array to file */
   fpixel[0] = 1;
@@ -106,77 +91,528 @@ void fitsw_write2file(char *fileout, long naxes[2], double **array,
 }
 
 
+/* Function to write an image to FITS file */
+/* A contiguous image is written with one fits_write_pix() call; a strided
+   view goes row by row. */
+void fitsw_write_image(char *fileout, scope_image *img, int bitpix,
+		       char *telname, int *status){
+  
+  /* Variable Declarations & Initializations */
+  long k,naxes[2],fpixel[2];
+  fitsfile *fitsfp;
+  
+  /* Set CFITSIO status = 0 before we begin */
+  *status = 0;
+  
+  naxes[0] = img->nx;
+  naxes[1] = img->ny;
+  fitsfp = fw_create_image(fileout, naxes, bitpix, telname, status);
+  
+  /* Write image to file */
+  fpixel[0] = 1;
+  fpixel[1] = 1;
+  if(img->stride == img->nx){
+    if( fits_write_pix(fitsfp, TDOUBLE, fpixel, img->nx * img->ny,
+		       img->data, status) )
+      fw_catcherror(status);
+  } else {
+    for(k=0; k < img->ny; k++){
+      fpixel[1] = k + 1;
+      if( fits_write_pix(fitsfp, TDOUBLE, fpixel, img->nx,
+			 img->data + k * img->stride, status) ){
+	fw_catcherror(status);
+	break;
+      }
+    }
+  }
+  
+  /* Clean up */
+  if( fits_close_file(fitsfp, status) )
+    fw_catcherror(status);    // Send pointer not value
+  
+  return;
+}
+
+
+/* Function to write an image to FITS file, returning CFITSIO errors
+   rather than exiting */
+/* As fitsw_write_image(), but with no fw_catcherror(): a background writer
+   must not end the whole run over a full disk.  If keys is not NULL,
+   keys(fitsfp, keyarg, status) adds header keywords before the file is
+   closed.  On failure the error is reported, whatever was created of
+   fileout is deleted, and the CFITSIO status is returned (0: success). */
+int fitsw_try_write_image(char *fileout, scope_image *img, int bitpix,
+			  char *telname,
+			  void (*keys)(fitsfile *, void *, int *),
+			  void *keyarg, int *status){
+  
+  /* Variable Declarations & Initializations */
+  int  cstat=0;
+  long k,naxes[2],fpixel[2];
+  char fn[FLEN_FILENAME];
+  fitsfile *fitsfp;
+  
+  *status = 0;
+  
+  /* CFITSIO calls do nothing once *status is set, so errors fall through */
+  snprintf(fn,FLEN_FILENAME, "!%s",fileout);
+  if( fits_create_file(&fitsfp, fn, status) ){
+    fits_report_error(stderr,*status);
+    return *status;
+  }
+  naxes[0] = img->nx;
+  naxes[1] = img->ny;
+  fits_create_img(fitsfp, bitpix, 2, naxes, status);
+  fw_header_keys(fitsfp, fileout, telname, status);
+  if(keys != NULL && !*status)
+    keys(fitsfp, keyarg, status);
+  
+  fpixel[0] = 1;
+  fpixel[1] = 1;
+  if(img->stride == img->nx)
+    fits_write_pix(fitsfp, TDOUBLE, fpixel, img->nx * img->ny, img->data,
+		   status);
+  else
+    for(k=0; k < img->ny && !*status; k++){
+      fpixel[1] = k + 1;
+      fits_write_pix(fitsfp, TDOUBLE, fpixel, img->nx,
+		     img->data + k * img->stride, status);
+    }
+  
+  /* Clean up, leaving no partial file behind */
+  if(*status){
+    fits_report_error(stderr,*status);
+    fits_delete_file(fitsfp, &cstat);
+  } else if( fits_close_file(fitsfp, status) ){
+    fits_report_error(stderr,*status);
+    remove(fileout);
+  }
+  
+  return *status;
+}
+
+
+
+
+/* Function to write ncol double columns of nrow rows each as a binary
+   table extension named extname */
+/* ttype and tunit hold the column names and units.  The primary HDU is
+   left empty, and the header of the table is populated as for images. */
+void fitsw_write_table(char *fileout, char *extname, int ncol, char **ttype,
+		       char **tunit, double **cols, long nrow, char *telname,
+		       int *status){
+  
+  /* Variable Declarations & Initializations */
+  char fn[FLEN_FILENAME];
+  fitsfile *fitsfp;
+  
+  /* Set CFITSIO status = 0 before we begin */
+  *status = 0;
+  
+  /* Open FITS file for writing, overwrite existing file */
+  snprintf(fn,FLEN_FILENAME, "!%s",fileout);
+  if( fits_create_file(&fitsfp, fn, status) )
+    fw_catcherror(status);       // Send pointer not value
+  
+  /* Create the table HDU (CFITSIO adds an empty primary first) */
+  fitsw_append_table(fitsfp, extname, ncol, ttype, tunit, cols, nrow, status);
+  fw_make_header(fitsfp, fileout, telname, status);
+  
+  /* Clean up */
+  if( fits_close_file(fitsfp, status) )
+    fw_catcherror(status);    // Send pointer not value
+  
+  return;
+}
+
+
+/* Function to append ncol double columns of nrow rows each to an open
+   file, as a binary table extension named extname */
+void fitsw_append_table(fitsfile *fitsfp, char *extname, int ncol,
+			char **ttype, char **tunit, double **cols, long nrow,
+			int *status){
+  
+  /* Variable Declarations & Initializations */
+  int  c;
+  char **tform;
+  
+  if(*status)
+    return;
+  
+  tform = (char **)malloc(ncol * sizeof(char *));
+  for(c=0; c < ncol; c++)
+    tform[c] = "1D";
+  
+  if( fits_create_tbl(fitsfp, BINARY_TBL, nrow, ncol, ttype, tform, tunit,
+		      extname, status) )
+    fw_catcherror(status);
+  
+  /* Write the columns */
+  for(c=0; c < ncol && *status == 0; c++)
+    if( fits_write_col(fitsfp, TDOUBLE, c+1, 1, 1, nrow, cols[c], status) )
+      fw_catcherror(status);
+  
+  free(tform);
+  
+  return;
+}
 
 
 
 
 /* Routine for reading FITS into array, starting at point, and w/ size */
-/* This version assumes an open FITS file, and accepts the fitsfile pointer */
-double **fitsw_read2array(fitsfile *fitsfp, long xystart[2], long xysize[2],
-			      int data_type, int *status){
+/* This version assumes an open FITS file, and accepts the fitsfile pointer.
+   Returns NULL (with *status set) on error.  IMPORTANT: returned image must
+   be freed with images_free(). */
+scope_image *fitsw_read2array(fitsfile *fitsfp, long xystart[2],
+			      long xysize[2], int data_type, int *status){
+  
+  /* Allocate space for image */
+  scope_image *img = images_alloc(xysize[0], xysize[1]);
+  if(img == NULL){
+    *status = MEMORY_ALLOCATION;
+    return NULL;
+  }
+  
+  if(fitsw_read_image(fitsfp, xystart, img, data_type, status)){
+    images_free(img);
+    return NULL;
+  }
+  
+  return img;
+}
+
+
+/* Routine for reading the img->nx x img->ny subsection of a FITS image
+   starting at xystart straight into an existing image (or view) */
+/* Tile-compressed images are decompressed in parallel over the fitsw pool,
+   one band of tile rows per thread.  Uncompressed images in plain files are
+   mmap'd and decoded straight from the page cache into img.  Anything else
+   is read with fits_read_subset() in strips of FITSW_STRIP pixels.  Errors
+   (including an out-of-bounds subsection) are reported and returned rather
+   than fatal; the return value is *status. */
+int fitsw_read_image(fitsfile *fitsfp, long xystart[2], scope_image *img,
+		     int data_type, int *status){
   
   /* Variable declarations & Initilaztion */
-  int i,naxis,bitpix;
-  long fpixel[2],naxes[2];
+  int naxis,bitpix;
+  long naxes[2];
   *status=0;
   
-  /* Allocate space for array */
-  double **array = images_alloc_2darray(xysize);
-  
   
   /* Read in FITS file using CFITSIO library routines - w/ error checking */
-  /* Note: xystart[2] SHOULD be in 'array' notation (i.e. 0-1023), and this
-     routine needs to convert these into 'human' notation (i.e. 1-1024). */
-  
-  /* ERROR CHECKING & CONVERTING NOTATION */
-    /* Get image file parameters */
-    if(fits_get_img_param(fitsfp, 2, &bitpix, &naxis, naxes, status)){
-      fw_catcherror(status);    // Send pointer not value
-    }    
-    /* Error catching -- number of axes */
-    if(naxis != 2){
-      fprintf(stderr,"Error: only 2D images are supported.\n\n");
-      fits_close_file(fitsfp,status);
-      exit(1);
-    }
-
-    /* Notation Shift */
-    long xstart = xystart[0] + 1;
-    long ystart = xystart[1] + 1;
-    
-
-  /* Check to see if subsection goes beyond image bounds */
-  // First Check x
-  if( xstart < 1 || (xstart + xysize[0] - 1) > naxes[0]){
-    fprintf(stderr,"Error: subsection is out of bounds\n");
-    fits_close_file(fitsfp,status);
-    exit(1);
+  /* Note: xystart[2] SHOULD be in 'array' notation (i.e. 0-1023); the
+     routines below convert these into 'human' notation (i.e. 1-1024). */
+  
+  /* Get image file parameters */
+  if(fits_get_img_param(fitsfp, 2, &bitpix, &naxis, naxes, status)){
+    fits_report_error(stderr,*status);
+    return *status;
+  }
+  /* Error catching -- number of axes */
+  if(naxis != 2){
+    fprintf(stderr,"Error: only 2D images are supported.\n\n");
+    return (*status = BAD_NAXIS);
   }
-  // Then Check y
-  if( ystart < 1 || (ystart + xysize[1] - 1) > naxes[1]){
+  
+  /* Check to see if subsection goes beyond image bounds */
+  if( xystart[0] < 0 || xystart[0] + img->nx > naxes[0] ||
+      xystart[1] < 0 || xystart[1] + img->ny > naxes[1] ){
     fprintf(stderr,"Error: subsection is out of bounds\n");
-    fits_close_file(fitsfp,status);
-    exit(1);
+    return (*status = BAD_PIX_NUM);
   }
+  if(img->nx == 0 || img->ny == 0)
+    return 0;
   
   
   /* Read in the FITS file */  
-  fpixel[0] = xstart;              // Set initial coordinate in the x-axis.
-  for(i=0; i < xysize[1]; i++){    // Loop over xysize[1] (i.e. y) rows
-    fpixel[1] = ystart + i;        // Set initial y-coordinate here...
-    
-    if( fits_read_pix(fitsfp, data_type, fpixel, xysize[0], NULL,
-		      array[i], NULL, status)){
+  if(fits_is_compressed_image(fitsfp, status))
+    fw_read_tiles(fitsfp, xystart, img, data_type, status);
+  else if(data_type != TDOUBLE ||
+	  fw_read_mmap(fitsfp, naxes, bitpix, xystart, img, status))
+    fw_read_strips(fitsfp, xystart, img, data_type, status);
+  
+  return *status;
+}
+
+
+/* Set the thread pool used to decompress / decode large reads */
+/* With no pool (the default) everything happens in the calling thread. */
+void fitsw_set_pool(scope_pool *pool){
+  
+  fitsw_pool = pool;
+  
+  return;
+}
+  
+
+/***** Private Functions Internal to Fitsw *****/
+
+/* Read a subsection with fits_read_subset() in strips of ~FITSW_STRIP pixels
+   (one row at a time for a strided view) */
+int fw_read_strips(fitsfile *fitsfp, long xystart[2], scope_image *img,
+		   int data_type, int *status){
+  
+  /* Variable Declarations */
+  long k,rows,fpixel[2],lpixel[2],inc[2]={1,1};
+  
+  rows = (img->stride == img->nx) ? GSL_MAX(1, FITSW_STRIP / img->nx) : 1;
+  
+  fpixel[0] = xystart[0] + 1;                // 'Human' notation
+  lpixel[0] = xystart[0] + img->nx;          // Last pixel is inclusive
+  for(k=0; k < img->ny && !*status; k += rows){
+    fpixel[1] = xystart[1] + k + 1;
+    lpixel[1] = xystart[1] + GSL_MIN(k + rows, img->ny);
+    if( fits_read_subset(fitsfp, data_type, fpixel, lpixel, inc, NULL,
+			 img->data + k * img->stride, NULL, status) )
       fits_report_error(stderr,*status);
-      break;
-    }
   }
   
-  return array;
+  return *status;
 }
+
+
+/* Read a subsection of a tile-compressed image, spreading the tile
+   decompression over the fitsw pool */
+/* Each thread opens its own handle on the file and reads a band of whole
+   tile rows of the image (see fw_tile_rows()), so no tile is decompressed
+   twice, wherever the subsection starts.  Falls back to a serial read if
+   there is no pool, CFITSIO is not reentrant, the subsection lies in a
+   single tile row, or the file cannot be re-opened by name. */
+int fw_read_tiles(fitsfile *fitsfp, long xystart[2], scope_image *img,
+		  int data_type, int *status){
+  
+  /* Variable Declarations */
+  int  t,nt,hdu,kstat=0;
+  long tile[2]={0,0},nrow=0;
+  char fn[FLEN_FILENAME];
+  fw_read_arg arg;
   
+  nt = (fitsw_pool == NULL) ? 1 : fitsw_pool->nthreads;
+  fits_get_tile_dim(fitsfp, 2, tile, &kstat);
+  fits_file_name(fitsfp, fn, &kstat);
+  fits_get_hdu_num(fitsfp, &hdu);
+  
+  if(!kstat && tile[1] >= 1)              // Image tile rows touched
+    nrow = (xystart[1] + img->ny - 1) / tile[1] - xystart[1] / tile[1] + 1;
+  if(kstat || nt <= 1 || !fits_is_reentrant() || nrow < 2)
+    return fw_read_strips(fitsfp, xystart, img, data_type, status);
+  
+  arg.fn        = fn;
+  arg.hdu       = hdu;
+  arg.x0        = xystart[0];
+  arg.y0        = xystart[1];
+  arg.tiley     = tile[1];
+  arg.data_type = data_type;
+  arg.img       = img;
+  arg.status    = (int *)calloc(nt, sizeof(int));
+  
+  /* The items handed out are the image's tile rows, not subsection rows */
+  pool_run(fitsw_pool, fw_tiles_job, &arg, nrow, 1);
+  
+  for(t=0; t < nt && !*status; t++)
+    *status = arg.status[t];
+  free(arg.status);
+  
+  return *status;
+}
 
-/***** Private Functions Internal to Fitsw *****/
+
+/* Tile job: read tile rows [i0, i1) touched by the subsection (counted
+   from the one holding its first row) through a private handle */
+void fw_tiles_job(void *data, long i0, long i1, int tid){
+  
+  /* Variable Declarations */
+  fw_read_arg *arg = (fw_read_arg *)data;
+  int  *status = arg->status + tid;
+  int  hdutype,cstat=0;
+  long xystart[2];
+  fitsfile *fitsfp;
+  scope_image band;
+  
+  fw_tile_rows(arg->y0, arg->img->ny, arg->tiley, i0, i1, &i0, &i1);
+  if(i1 <= i0)
+    return;
+  if(fits_open_file(&fitsfp, arg->fn, READONLY, status)){
+    fits_report_error(stderr,*status);
+    return;
+  }
+  if(fits_movabs_hdu(fitsfp, arg->hdu, &hdutype, status) == 0){
+    band = images_view(arg->img, 0, i0, arg->img->nx, i1 - i0, status);
+    xystart[0] = arg->x0;
+    xystart[1] = arg->y0 + i0;
+    fw_read_strips(fitsfp, xystart, &band, arg->data_type, status);
+  } else
+    fits_report_error(stderr,*status);
+  fits_close_file(fitsfp, &cstat);
+  
+  return;
+}
+
+
+/* Function to find the rows [r0, r1) of a subsection of ny rows starting
+   at image row y0 that lie in its tile rows [i0, i1) */
+/* Tile rows are those of the image (tiley rows each, from image row 0),
+   counted from the one holding y0; so the first band is only the
+   tiley - y0 % tiley rows left in that tile row, and every later band
+   starts on a tile boundary. */
+void fw_tile_rows(long y0, long ny, long tiley, long i0, long i1, long *r0,
+		  long *r1){
+  
+  /* Variable Declarations */
+  long first = (y0 / tiley) * tiley;    // Image row of tile row 0
+  
+  *r0 = GSL_MIN(ny, GSL_MAX(0, first + i0 * tiley - y0));
+  *r1 = GSL_MIN(ny, GSL_MAX(0, first + i1 * tiley - y0));
+  
+  return;
+}
+
+
+/* Read a subsection of an uncompressed image by mapping the file */
+/* The data unit is decoded (big-endian, BSCALE/BZERO applied) directly from
+   the mapping into img, in parallel over the fitsw pool; CFITSIO's own
+   buffering and copies are skipped.  Returns non-zero, without touching
+   *status, if the HDU is not in a plain file that can be mapped, in which
+   case the caller should read it some other way. */
+int fw_read_mmap(fitsfile *fitsfp, long naxes[2], int bitpix, long xystart[2],
+		 scope_image *img, int *status){
+  
+#if HAVE_SYS_MMAN_H
+  /* Variable Declarations */
+  int  fd,kstat=0;
+  long page;
+  LONGLONG headstart,datastart,dataend;
+  size_t off,len;
+  char fn[FLEN_FILENAME];
+  const unsigned char *map,*hdr;
+  struct stat st;
+  fw_read_arg arg;
+  
+  if(fits_file_name(fitsfp, fn, &kstat) ||
+     fits_get_hduaddrll(fitsfp, &headstart, &datastart, &dataend, &kstat))
+    return -1;
+  
+  /* Only plain files on disk (no extended syntax, URLs or stdin) */
+  if(strpbrk(fn, "[(") != NULL || strstr(fn, "://") != NULL ||
+     strcmp(fn, "-") == 0 || (fd = open(fn, O_RDONLY)) < 0)
+    return -1;
+  if(fstat(fd, &st) || st.st_size < dataend){
+    close(fd);
+    return -1;
+  }
+  
+  page = sysconf(_SC_PAGESIZE);
+  off  = (headstart / page) * page;
+  len  = dataend - off;
+  map  = (const unsigned char *)mmap(NULL, len, PROT_READ, MAP_SHARED, fd,
+				     off);
+  close(fd);
+  if(map == (const unsigned char *)MAP_FAILED)
+    return -1;
+  
+  /* Make sure this really is the HDU CFITSIO has open (e.g. not the
+     uncompressed image of a gzip'd file) */
+  hdr = map + (headstart - off);
+  if(strncmp((const char *)hdr, "SIMPLE  ", 8) &&
+     strncmp((const char *)hdr, "XTENSION", 8)){
+    munmap((void *)map, len);
+    return -1;
+  }
+  
+  /* Scaling (defaults if the keywords are absent) */
+  arg.bscale = 1.;
+  arg.bzero  = 0.;
+  fits_read_key(fitsfp, TDOUBLE, "BSCALE", &arg.bscale, NULL, &kstat);
+  kstat = 0;
+  fits_read_key(fitsfp, TDOUBLE, "BZERO", &arg.bzero, NULL, &kstat);
+  
+  arg.map    = map + (datastart - off);
+  arg.naxis1 = naxes[0];
+  arg.bitpix = bitpix;
+  arg.x0     = xystart[0];
+  arg.y0     = xystart[1];
+  arg.img    = img;
+  
+#if HAVE_MADVISE
+  madvise((void *)map, len, MADV_SEQUENTIAL);
+#endif
+  pool_run(fitsw_pool, fw_mmap_job, &arg, img->ny, 1);
+  
+  munmap((void *)map, len);
+  *status = 0;
+  
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+
+/* Mmap job: decode rows [i0, i1) of the subsection */
+void fw_mmap_job(void *data, long i0, long i1, int tid){
+  
+  /* Variable Declarations */
+  fw_read_arg *arg = (fw_read_arg *)data;
+  long i,bytepix = abs(arg->bitpix) / 8;
+  
+  for(i=i0;i<i1;i++)
+    fw_decode_row(arg->map + ((arg->y0 + i) * arg->naxis1 + arg->x0) * bytepix,
+		  arg->img->data + i * arg->img->stride, arg->img->nx,
+		  arg->bitpix, arg->bscale, arg->bzero);
+  
+  return;
+}
+
+
+/* Convert n big-endian FITS pixels of type bitpix to (scaled) doubles */
+void fw_decode_row(const unsigned char *src, double *dst, long n, int bitpix,
+		   double bscale, double bzero){
+  
+  /* Variable Declarations */
+  long k;
+  uint32_t u32;
+  uint64_t u64;
+  float    f;
+  
+  switch(bitpix){
+  case BYTE_IMG:
+    for(k=0;k<n;k++)
+      dst[k] = src[k];
+    break;
+  case SHORT_IMG:
+    for(k=0;k<n;k++, src+=2)
+      dst[k] = (int16_t)((src[0] << 8) | src[1]);
+    break;
+  case LONG_IMG:
+    for(k=0;k<n;k++, src+=4)
+      dst[k] = (int32_t)FW_BE32(src);
+    break;
+  case LONGLONG_IMG:
+    for(k=0;k<n;k++, src+=8)
+      dst[k] = (double)(int64_t)FW_BE64(src);
+    break;
+  case FLOAT_IMG:
+    for(k=0;k<n;k++, src+=4){
+      u32 = FW_BE32(src);
+      memcpy(&f, &u32, 4);
+      dst[k] = f;
+    }
+    break;
+  case DOUBLE_IMG:
+    for(k=0;k<n;k++, src+=8){
+      u64 = FW_BE64(src);
+      memcpy(dst + k, &u64, 8);
+    }
+    break;
+  }
+  
+  if(bscale != 1. || bzero != 0.)
+    for(k=0;k<n;k++)
+      dst[k] = bscale * dst[k] + bzero;
+  
+  return;
+}
 
 /* Routine for opening FITS file READONLY with error checking */
 fitsfile *fw_open_r(char *filename, int *status){
@@ -204,9 +640,72 @@ fitsfile *fw_open_rw(char *filename, int *status){
 }
 
 
+/* Function to create a FITS file (overwriting any existing file) with a
+   2-D image HDU of size naxes, and populate its header */
+fitsfile *fw_create_image(char *fileout, long naxes[2], int bitpix,
+			  char *telname, int *status){
+  
+  /* Variable Declarations & Initializations */
+  char fn[FLEN_FILENAME];
+  fitsfile *fitsfp;
+  
+  /* Open FITS file for writing, overwrite existing file */
+  snprintf(fn,FLEN_FILENAME, "!%s",fileout);
+				 // CFITSIO will overwrite file prepended w/ "!"
+  if( fits_create_file(&fitsfp, fn, status) )
+    fw_catcherror(status);       // Send pointer not value
+  
+  /* Create image HDU */
+  int naxis = 2;                 // Routine is specific for 2-D images
+  if( fits_create_img(fitsfp, bitpix, naxis, naxes, status) )
+    fw_catcherror(status);       // Send pointer not value
+  
+  fw_make_header(fitsfp, fileout, telname, status);
+  
+  return fitsfp;
+}
+
+
 /* Function to create basic header for FITS file */
-void fw_make_header(){
+void fw_make_header(fitsfile *fitsfp, char *fileout, char *telname,
+		    int *status){
+  
+  fw_header_keys(fitsfp, fileout, telname, status);
+  
+  /* Catch any CFITSIO errors from keyword writing */
+  fw_catcherror(status);    // Send pointer not value
+  
+  return;
+}
 
+
+/* Function to write the keywords of fw_make_header(), leaving any error
+   in *status */
+void fw_header_keys(fitsfile *fitsfp, char *fileout, char *telname,
+		    int *status){
+  
+  /* Variable Declarations */
+  char buf_date[FLEN_VALUE],buf_time[FLEN_VALUE];
+  time_t now;
+  struct tm *ptr;
+  
+  /* Write the UT date and time of file creation */
+  time(&now);
+  ptr = gmtime(&now);
+  strftime(buf_date, FLEN_VALUE, "%Y-%m-%d", ptr);
+  strftime(buf_time, FLEN_VALUE, "%H:%M:%S", ptr);
+  fits_update_key(fitsfp, TSTRING, "DATE-OBS", buf_date,
+		  "UT date of observation", status);
+  fits_update_key(fitsfp, TSTRING, "TIME-OBS", buf_time,
+		  "UT time of observation", status);
+  
+  /* Add various FITS keywords, specific to ScopeDesign */
+  fits_write_key(fitsfp, TSTRING, "OBSERVAT",
+		 "ScopeDesign Ray-Tracing Program", NULL, status);
+  fits_write_key(fitsfp, TSTRING, "TELESCOP", telname,
+		 "modeled telescope for ray trace", status);
+  fits_write_key(fitsfp, TSTRING, "FILENAME", fileout, NULL, status);
+  
   return;
 }
 
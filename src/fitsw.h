@@ -27,11 +27,31 @@
 #define FITSW_H
 
 #include <fitsio.h>             // CFITSIO
+#include "pool.h"
 
 #define FITSW_NOFILE_EXIT 2104  // Codes used by fitsw_catcherror()
 #define FITSW_NOFILE_CONT 2105
 #define FITSW_EOF_ERROR   2106
 
+#define FITSW_STRIP (4L*1024*1024)  // Pixels per fits_read_subset() call
+
+/* Arguments for the parallel (tile or mmap) read jobs */
+typedef struct{
+  char                *fn;        // File to re-open (tile reads)
+  int                  hdu;       // HDU number within it
+  const unsigned char *map;       // Mapped data unit (mmap reads)
+  long                 naxis1;    // Full image width
+  int                  bitpix;
+  double               bscale;
+  double               bzero;
+  long                 x0;        // Origin of the subsection (0-based)
+  long                 y0;
+  long                 tiley;     // Tile height (tile reads)
+  int                  data_type;
+  scope_image         *img;       // Destination
+  int                 *status;    // One per thread (tile reads)
+} fw_read_arg;
+
 
 /* ========================= */
 /*   Function Declarations   */
@@ -39,16 +59,48 @@
 
 /***** Public-Facing Functions *****/
 
-double  **fitsw_read2array(fitsfile *fitsfp, long xystart[2], long xysize[2],
+scope_image *fitsw_read2array(fitsfile *fitsfp, long xystart[2],
+			      long xysize[2], int data_type, int *status);
+int       fitsw_read_image(fitsfile *fitsfp, long xystart[2], scope_image *img,
 			   int data_type, int *status);
+void      fitsw_set_pool(scope_pool *pool);
 void      fitsw_write2file(char *fileout, long naxes[2], double **array, 
 			   int bitpix, char *telname, int *status);
+void      fitsw_write_image(char *fileout, scope_image *img, int bitpix,
+			    char *telname, int *status);
+int       fitsw_try_write_image(char *fileout, scope_image *img, int bitpix,
+				char *telname,
+				void (*keys)(fitsfile *, void *, int *),
+				void *keyarg, int *status);
+void      fitsw_write_table(char *fileout, char *extname, int ncol,
+			    char **ttype, char **tunit, double **cols,
+			    long nrow, char *telname, int *status);
+void      fitsw_append_table(fitsfile *fitsfp, char *extname, int ncol,
+			     char **ttype, char **tunit, double **cols,
+			     long nrow, int *status);
 
 /***** Private Functions Internal to Fitsw *****/
 
 fitsfile *fw_open_r(char *filename, int *status);
 fitsfile *fw_open_rw(char *filename, int *status);
-void      fw_make_header();
+fitsfile *fw_create_image(char *fileout, long naxes[2], int bitpix,
+			  char *telname, int *status);
+void      fw_make_header(fitsfile *fitsfp, char *fileout, char *telname,
+			 int *status);
+void      fw_header_keys(fitsfile *fitsfp, char *fileout, char *telname,
+			 int *status);
 void      fw_catcherror(int *status);
+int       fw_read_strips(fitsfile *fitsfp, long xystart[2], scope_image *img,
+			 int data_type, int *status);
+int       fw_read_tiles(fitsfile *fitsfp, long xystart[2], scope_image *img,
+			int data_type, int *status);
+void      fw_tiles_job(void *data, long i0, long i1, int tid);
+void      fw_tile_rows(long y0, long ny, long tiley, long i0, long i1,
+		       long *r0, long *r1);
+int       fw_read_mmap(fitsfile *fitsfp, long naxes[2], int bitpix,
+		       long xystart[2], scope_image *img, int *status);
+void      fw_mmap_job(void *data, long i0, long i1, int tid);
+void      fw_decode_row(const unsigned char *src, double *dst, long n,
+			int bitpix, double bscale, double bzero);
 
 #endif  /* FITSW_H */
@@ -0,0 +1,308 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: footprint.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* Footprint maps: where the rays struck each chosen element, recorded as
+   they pass during the one trace rather than by dumping and re-running
+   element by element.  Any subset of the element sequence may carry a map
+   (the same optic can appear twice, e.g. a secondary that first shadows
+   the primary and then reflects, and each appearance gets its own). */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fitsio.h>                    // CFITSIO
+
+/* Local headers */
+#include "footprint.h"
+#include "rays.h"
+#include "mirrors.h"
+#include "setup.h"
+#include "images.h"
+#include "writer.h"
+
+
+/* Header keywords of a written map (see footprint_write_keys()) */
+typedef struct{
+  int    index;
+  int    elem;
+  int    block;
+  double lo[2];
+  double pix;
+  long   nray;
+} footprint_keys;
+
+
+/* Function to give elements of the sequence footprint maps */
+/* list is "all" or comma-separated positions in the sequence (0 is the
+   first element the rays meet).  Returns 0 on success, -1 on a bad list
+   (any maps attached so far are then detached again). */
+int footprint_attach(scope_scope *scope, scope_element *elements, int nelem,
+		     char *list){
+  
+  /* Variable Declarations */
+  int   e,all;
+  long  idx;
+  char *p,*end;
+  scope_optic *optic;
+  
+  all = (strcmp(list, "all") == 0);
+  p   = list;
+  for(e=0; all ? e < nelem : *p != '\0'; e++){
+    if(!all){
+      idx = strtol(p, &end, 10);
+      if(end == p || (*end != ',' && *end != '\0') || idx < 0 ||
+	 idx >= nelem){
+	fprintf(stderr,"Error: bad footprint element list \"%s\" (positions "
+		"0 to %d, or all).\n",list,nelem-1);
+	footprint_detach(elements, nelem);
+	return -1;
+      }
+      p = (*end == ',') ? end + 1 : end;
+    } else
+      idx = e;
+    
+    if(elements[idx].footprint != NULL)
+      continue;
+    if((optic = setup_get_optic(scope, elements[idx].elem)) == NULL){
+      fprintf(stderr,"Error: element %ld (%d) has no matching optic.\n",
+	      idx,elements[idx].elem);
+      footprint_detach(elements, nelem);
+      return -1;
+    }
+    elements[idx].footprint = footprint_create(optic, &elements[idx],
+					       (int)idx);
+  }
+  
+  return 0;
+}
+
+
+/* Function to free the footprint maps of a sequence */
+void footprint_detach(scope_element *elements, int nelem){
+  
+  int e;
+  
+  for(e=0;e<nelem;e++){
+    footprint_free(elements[e].footprint);
+    elements[e].footprint = NULL;
+  }
+  
+  return;
+}
+
+
+/* Function to empty the footprint maps of a sequence (e.g. after a pilot
+   trace that should not count) */
+void footprint_clear(scope_element *elements, int nelem){
+  
+  int e;
+  scope_footprint *fp;
+  
+  for(e=0;e<nelem;e++){
+    if((fp = elements[e].footprint) == NULL)
+      continue;
+    memset(fp->hist, 0, fp->nx * fp->ny * sizeof(double));
+    fp->nray = 0;
+  }
+  
+  return;
+}
+
+
+/* Function to record n rays that have just met the element of fp */
+/* live[i] says whether ray i was still going before the element.  For a
+   blocking element the rays it stopped are recorded, at the point where
+   they hit it; otherwise those that landed on it.  n must be at most
+   RAYS_BATCH. */
+void footprint_add(scope_footprint *fp, scope_optic *optic, scope_ray *rays,
+		   long n, const char *live){
+  
+  /* Variable Declarations */
+  long   i,ix,iy,ng=0;
+  long   bins[RAYS_BATCH];
+  double t,p[3];
+  
+  /* Bins of this batch, outside the lock */
+  for(i=0;i<n;i++){
+    if(!live[i] || rays[i].lost != fp->block)
+      continue;
+    if(fp->block){
+      t = mirrors_intersect(optic, &rays[i]);
+      mirrors_to_local(optic, rays[i].x + t*rays[i].vx - optic->cx,
+		       rays[i].y + t*rays[i].vy - optic->cy,
+		       rays[i].z + t*rays[i].vz - optic->cz, p);
+    } else
+      mirrors_to_local(optic, rays[i].x - optic->cx, rays[i].y - optic->cy,
+		       rays[i].z - optic->cz, p);
+    
+    /* Rays on the very edge of the outline go in the edge pixels */
+    ix = (long)floor((p[0] - fp->lo[0]) / fp->pix);
+    iy = (long)floor((p[1] - fp->lo[1]) / fp->pix);
+    ix = GSL_MAX(0, GSL_MIN(ix, fp->nx - 1));
+    iy = GSL_MAX(0, GSL_MIN(iy, fp->ny - 1));
+    bins[ng++] = iy * fp->nx + ix;
+  }
+  if(ng == 0)
+    return;
+  
+#if FOOTPRINT_THREADS
+  pthread_mutex_lock(&fp->lock);
+#endif
+  for(i=0;i<ng;i++)
+    fp->hist[bins[i]] += 1.;
+  fp->nray += ng;
+#if FOOTPRINT_THREADS
+  pthread_mutex_unlock(&fp->lock);
+#endif
+  
+  return;
+}
+
+
+/* Function to write every footprint map of a sequence through the writer */
+/* Map e goes to root_e.fits.  Returns the first nonzero writer status. */
+int footprint_write_all(scope_element *elements, int nelem, scope_writer *w,
+			char *root, char *telname){
+  
+  /* Variable Declarations */
+  int  e,status=0,s;
+  char fn[FLEN_FILENAME];            // CFITSIO max length of filename
+  
+  for(e=0;e<nelem;e++){
+    if(elements[e].footprint == NULL)
+      continue;
+    snprintf(fn, FLEN_FILENAME, "%s_%d.fits", root, e);
+    s = footprint_write(elements[e].footprint, w, fn, telname);
+    if(s && !status)
+      status = s;
+    printf("Footprint of element %d: %ld rays, %s\n",e,
+	   elements[e].footprint->nray,fn);
+  }
+  
+  return status;
+}
+
+
+/***** Internal Functions *****/
+
+/* Function to create an empty map over the outline of optic, for the
+   element at position index of the sequence */
+scope_footprint *footprint_create(scope_optic *optic, scope_element *element,
+				  int index){
+  
+  /* Variable Declarations */
+  scope_footprint *fp;
+  
+  fp = (scope_footprint *)calloc(1, sizeof(scope_footprint));
+  fp->index = index;
+  fp->elem  = element->elem;
+  fp->block = (element->block != 0);
+  fp->pix   = optic->dmaj / FOOTPRINT_NPIX;
+  fp->nx    = FOOTPRINT_NPIX;
+  fp->ny    = GSL_MAX(1, (long)ceil(optic->dmin / fp->pix - 1.e-9));
+  fp->lo[0] = -0.5 * fp->nx * fp->pix;
+  fp->lo[1] = -0.5 * fp->ny * fp->pix;
+  fp->hist  = (double *)calloc(fp->nx * fp->ny, sizeof(double));
+#if FOOTPRINT_THREADS
+  pthread_mutex_init(&fp->lock, NULL);
+#endif
+  
+  return fp;
+}
+
+
+/* Function to free a footprint map */
+void footprint_free(scope_footprint *fp){
+  
+  if(fp == NULL)
+    return;
+  
+#if FOOTPRINT_THREADS
+  pthread_mutex_destroy(&fp->lock);
+#endif
+  free(fp->hist);
+  free(fp);
+  
+  return;
+}
+
+
+/* Function to queue one map on the writer, with where it is in the header */
+int footprint_write(scope_footprint *fp, scope_writer *w, char *fileout,
+		    char *telname){
+  
+  /* Variable Declarations */
+  long y;
+  scope_image    *img;
+  footprint_keys *keys;
+  
+  if((img = writer_get_buffer(w, fp->nx, fp->ny)) == NULL)
+    return -1;
+  for(y=0; y < fp->ny; y++)
+    memcpy(img->data + y * img->stride, fp->hist + y * fp->nx,
+	   fp->nx * sizeof(double));
+  
+  keys = (footprint_keys *)malloc(sizeof(footprint_keys));
+  keys->index = fp->index;
+  keys->elem  = fp->elem;
+  keys->block = fp->block;
+  keys->lo[0] = fp->lo[0];
+  keys->lo[1] = fp->lo[1];
+  keys->pix   = fp->pix;
+  keys->nray  = fp->nray;
+  
+  return writer_submit_keys(w, img, fileout, DOUBLE_IMG, telname,
+			    footprint_write_keys, keys);
+}
+
+
+/* Header hook for footprint_write() */
+void footprint_write_keys(fitsfile *fitsfp, void *data, int *status){
+  
+  footprint_keys *k = (footprint_keys *)data;
+  
+  fits_update_key(fitsfp, TINT, "ELEMENT", &k->index,
+		  "position of the element in the sequence", status);
+  fits_update_key(fitsfp, TINT, "OPTIC", &k->elem,
+		  "optic of the element (OPTIC_*)", status);
+  fits_update_key(fitsfp, TLOGICAL, "SHADOW", &k->block,
+		  "rays stopped by the element, not landing on it", status);
+  fits_update_key_dbl(fitsfp, "LOU", k->lo[0], -17,
+		      "local u of the lower-left map corner (m)", status);
+  fits_update_key_dbl(fitsfp, "LOV", k->lo[1], -17,
+		      "local v of the lower-left map corner (m)", status);
+  fits_update_key_dbl(fitsfp, "PIX", k->pix, -17,
+		      "pixel size (m)", status);
+  fits_update_key(fitsfp, TLONG, "NRAY", &k->nray,
+		  "rays recorded", status);
+  
+  return;
+}
@@ -0,0 +1,90 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: footprint.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef FOOTPRINT_H
+#define FOOTPRINT_H
+
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+# include <pthread.h>
+# define FOOTPRINT_THREADS 1
+#else
+# define FOOTPRINT_THREADS 0
+#endif
+
+#include "writer.h"
+
+#define FOOTPRINT_NPIX 512      // Pixels across the major axis of a map
+
+/* Where the rays struck one element of the sequence: a histogram in the
+   local (u,v) frame of its optic, spanning the outline (dmaj along u, dmin
+   along v) in square pixels.  For a blocking element these are the rays
+   it stopped, i.e. its shadow; for any other, the rays that landed on it.
+   Attached to scope_element.footprint, it is filled by rays_trace() as
+   the rays pass, so every recorded element comes out of the one trace.
+   Threads tracing different slices share it; the lock is only held while
+   a batch of bins is added. */
+typedef struct scope_footprint{
+  int            index;         // Position of the element in the sequence
+  int            elem;          // Which optic (OPTIC_*)
+  int            block;         // Recording a shadow rather than a footprint
+  long           nx;
+  long           ny;
+  double         lo[2];         // Lower-left corner of the map (m)
+  double         pix;           // Pixel size (m)
+  double        *hist;          // nx x ny counts
+  long           nray;          // Rays recorded
+#if FOOTPRINT_THREADS
+  pthread_mutex_t lock;
+#endif
+} scope_footprint;
+
+
+/* Function declarations */
+
+/* Public Functions */
+int              footprint_attach(scope_scope *scope, scope_element *elements,
+				  int nelem, char *list);
+void             footprint_detach(scope_element *elements, int nelem);
+void             footprint_clear(scope_element *elements, int nelem);
+void             footprint_add(scope_footprint *fp, scope_optic *optic,
+			       scope_ray *rays, long n, const char *live);
+int              footprint_write_all(scope_element *elements, int nelem,
+				     scope_writer *w, char *root,
+				     char *telname);
+
+/* Internal Functions */
+scope_footprint *footprint_create(scope_optic *optic, scope_element *element,
+				  int index);
+void             footprint_free(scope_footprint *fp);
+int              footprint_write(scope_footprint *fp, scope_writer *w,
+				 char *fileout, char *telname);
+void             footprint_write_keys(fitsfile *fitsfp, void *data,
+				      int *status);
+
+#endif  /* FOOTPRINT_H */
+
+
+
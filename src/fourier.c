@@ -0,0 +1,121 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: fourier.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <gsl/gsl_errno.h>             // Contains GSL's error-handling
+#include <gsl/gsl_fft_complex.h>       // GSL's mixed-radix complex FFTs
+
+/* Local headers */
+#include "fourier.h"
+
+
+/* Function to allocate the wavetables & workspaces for an (nx x ny) FFT */
+scope_fft *fourier_plan_alloc(long nx, long ny){
+  
+  scope_fft *plan;
+  
+  plan = (scope_fft *)malloc(sizeof(scope_fft));
+  plan->nx    = nx;
+  plan->ny    = ny;
+  plan->wx    = gsl_fft_complex_wavetable_alloc(nx);
+  plan->wy    = gsl_fft_complex_wavetable_alloc(ny);
+  plan->workx = gsl_fft_complex_workspace_alloc(nx);
+  plan->worky = gsl_fft_complex_workspace_alloc(ny);
+  
+  return plan;
+}
+
+
+/* Function to free space occupied by an FFT plan */
+void fourier_plan_free(scope_fft *plan){
+  
+  if(plan == NULL)
+    return;
+  
+  gsl_fft_complex_wavetable_free(plan->wx);
+  gsl_fft_complex_wavetable_free(plan->wy);
+  gsl_fft_complex_workspace_free(plan->workx);
+  gsl_fft_complex_workspace_free(plan->worky);
+  free(plan);
+  
+  return;
+}
+
+
+/* In-place 2-D complex FFT of data, stored as packed (re,im) pairs with
+   index [j][i] -> 2*(j*nx + i).  The inverse transform is normalized. */
+int fourier_fft2d(scope_fft *plan, double *data, int sign){
+  
+  /* Variable Declarations */
+  long i,j;
+  int  status=0;
+  
+  /* Transform each row... */
+  for(j=0;j<plan->ny;j++){
+    if(sign == FOURIER_FORWARD)
+      status |= gsl_fft_complex_forward(data + 2*plan->nx*j, 1, plan->nx,
+					plan->wx, plan->workx);
+    else
+      status |= gsl_fft_complex_inverse(data + 2*plan->nx*j, 1, plan->nx,
+					plan->wx, plan->workx);
+  }
+  
+  /* ...then each column */
+  for(i=0;i<plan->nx;i++){
+    if(sign == FOURIER_FORWARD)
+      status |= gsl_fft_complex_forward(data + 2*i, plan->nx, plan->ny,
+					plan->wy, plan->worky);
+    else
+      status |= gsl_fft_complex_inverse(data + 2*i, plan->nx, plan->ny,
+					plan->wy, plan->worky);
+  }
+  
+  return status;
+}
+
+
+/* Function to return the smallest n' >= n whose only prime factors are
+   2, 3 and 5, for which GSL's mixed-radix transforms are fastest */
+long fourier_good_size(long n){
+  
+  long m,r;
+  
+  if(n < 2)
+    return 2;
+  
+  for(m=n;;m++){
+    r = m;
+    while(r % 2 == 0) r /= 2;
+    while(r % 3 == 0) r /= 3;
+    while(r % 5 == 0) r /= 5;
+    if(r == 1)
+      return m;
+  }
+}
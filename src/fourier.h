@@ -0,0 +1,56 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: fourier.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef FOURIER_H
+#define FOURIER_H
+
+#include <gsl/gsl_fft_complex.h>   // GSL's mixed-radix complex FFTs
+
+#define FOURIER_FORWARD  -1        // Sign of the exponent, as in GSL
+#define FOURIER_INVERSE  +1
+
+/* Wavetables and workspaces for a 2-D complex transform of one size.
+   GSL only provides 1-D transforms, so the 2-D transform is done as rows
+   then columns.  A plan may only be used by one thread at a time. */
+typedef struct{
+  long nx;                          // Size of the fast (row) axis
+  long ny;                          // Size of the slow (column) axis
+  gsl_fft_complex_wavetable *wx;
+  gsl_fft_complex_wavetable *wy;
+  gsl_fft_complex_workspace *workx;
+  gsl_fft_complex_workspace *worky;
+} scope_fft;
+
+
+/* Function declarations */
+scope_fft *fourier_plan_alloc(long nx, long ny);
+void       fourier_plan_free(scope_fft *plan);
+int        fourier_fft2d(scope_fft *plan, double *data, int sign);
+long       fourier_good_size(long n);
+
+#endif  /* FOURIER_H */
+
+
+
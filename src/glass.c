@@ -0,0 +1,139 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: glass.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Optical glasses for refracting surfaces.  Refractive indices come from
+   Sellmeier coefficients, but are worked out once per run for each
+   wavelength in use (glass_tabulate()) and then only looked up while
+   tracing, so the per-ray cost is a compare and a load rather than three
+   divisions and a square root. */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+/* Local headers */
+#include "glass.h"
+
+
+/* Catalog, indexed by GLASS_* (Schott data sheets; Malitson 1963, 1965) */
+static glass_sellmeier glass_catalog[GLASS_NGLASS] = {
+  {"air",    {0., 0., 0.},                       {0., 0., 0.}},
+  {"N-BK7",  {1.03961212, 0.231792344, 1.01046945},
+	     {0.00600069867, 0.0200179144, 103.560653}},
+  {"F2",     {1.34533359, 0.209073176, 0.937357162},
+	     {0.00997743871, 0.0470450767, 111.886764}},
+  {"N-SF11", {1.73759695, 0.313747346, 1.89878101},
+	     {0.013188707, 0.0623068142, 155.23629}},
+  {"silica", {0.6961663, 0.4079426, 0.8974794},
+	     {0.00467914826, 0.0135120631, 97.9340025}},
+  {"CaF2",   {0.5675888, 0.4710914, 3.8484723},
+	     {0.00252642999, 0.0100783328, 1200.55597}}
+};
+
+/* Index tables: glass_n[g][j] is the index of glass g at glass_lam[j] */
+static int    glass_nlam = 0;
+static double glass_lam[GLASS_MAXLAM];
+static double glass_n[GLASS_NGLASS][GLASS_MAXLAM];
+
+
+/* Function to tabulate the index of every glass at the wavelengths
+   (Angstroms) of a run */
+/* Call before tracing (the tables are read, never written, by the trace
+   threads).  Returns the number of wavelengths tabulated. */
+int glass_tabulate(double *lambda, int nlam){
+  
+  /* Variable Declarations */
+  int g,j;
+  
+  glass_nlam = 0;
+  for(j=0; j < nlam && glass_nlam < GLASS_MAXLAM; j++){
+    glass_lam[glass_nlam] = lambda[j];
+    for(g=0; g < GLASS_NGLASS; g++)
+      glass_n[g][glass_nlam] = glass_sellmeier_index(g, lambda[j]);
+    glass_nlam++;
+  }
+  
+  return glass_nlam;
+}
+
+
+/* Function to return the index of refraction of a glass at lambda (A) */
+/* From the tables if lambda was tabulated, else from the Sellmeier
+   formula directly.  Air, and anything not in the catalog, is n = 1. */
+double glass_index(int glass, double lambda){
+  
+  /* Variable Declarations */
+  int j;
+  
+  if(glass <= GLASS_AIR || glass >= GLASS_NGLASS)
+    return 1.;
+  
+  for(j=0; j < glass_nlam; j++)
+    if(glass_lam[j] == lambda)
+      return glass_n[glass][j];
+  
+  return glass_sellmeier_index(glass, lambda);
+}
+
+
+/* Function to evaluate the Sellmeier formula for a glass at lambda (A) */
+double glass_sellmeier_index(int glass, double lambda){
+  
+  /* Variable Declarations */
+  int    i;
+  double l2,n2=1.;
+  glass_sellmeier *g;
+  
+  if(glass <= GLASS_AIR || glass >= GLASS_NGLASS)
+    return 1.;
+  
+  g  = &glass_catalog[glass];
+  l2 = (lambda * 1.e-4) * (lambda * 1.e-4);            // Angstroms -> um
+  for(i=0;i<3;i++)
+    n2 += g->b[i] * l2 / (l2 - g->c[i]);
+  
+  return sqrt(n2);
+}
+
+
+/* Function to find a glass by (case-insensitive) name */
+/* Returns the GLASS_* integer, or -1 if there is no such glass. */
+int glass_lookup(char *name){
+  
+  /* Variable Declarations */
+  int g;
+  
+  for(g=0; g < GLASS_NGLASS; g++)
+    if(strcasecmp(name, glass_catalog[g].name) == 0)
+      return g;
+  
+  return -1;
+}
@@ -0,0 +1,60 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: glass.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef GLASS_H
+#define GLASS_H
+
+/* Define symbolic integers for the media light passes through */
+#define GLASS_AIR     0         // Vacuum / air, n = 1
+#define GLASS_BK7     1         // Schott N-BK7
+#define GLASS_F2      2         // Schott F2
+#define GLASS_SF11    3         // Schott N-SF11
+#define GLASS_SILICA  4         // Fused silica
+#define GLASS_CAF2    5         // Calcium fluoride
+#define GLASS_NGLASS  6
+
+#define GLASS_MAXLAM  256       // Wavelengths tabulated (one bundle palette)
+
+/* Sellmeier dispersion: n^2 = 1 + sum B_i l^2 / (l^2 - C_i), l in microns */
+typedef struct{
+  char  *name;
+  double b[3];
+  double c[3];                  // microns^2
+} glass_sellmeier;
+
+
+/* Function declarations */
+
+/* Public Functions */
+int    glass_tabulate(double *lambda, int nlam);
+double glass_index(int glass, double lambda);
+double glass_sellmeier_index(int glass, double lambda);
+int    glass_lookup(char *name);
+
+#endif  /* GLASS_H */
+
+
+
@@ -30,28 +30,31 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <gsl/gsl_errno.h>       // Contains GSL's error-handling
-#include <gsl/gsl_histogram2d.h> // Contains GSL's 2-D Histograms
 
 /* Local headers */
 #include "images.h"
 #include "fitsw.h"
+#include "alloc.h"
+#include "writer.h"
+#include "display.h"
 
 /***** Array Allocation and Freeing Functions *****/
 
 /* Function to allocate space for a 2-D array of double */
 /* Note: This function is compatible with FITS standards,
    which are COLUMN-MAJOR!  Therefore, indexing of the
-   output array goes: array[y][x]!!! */
+   output array goes: array[y][x]!!!  The rows all live in
+   one contiguous block, so array[0] is also the 1-D image. */
 double **images_alloc_2darray(long *size){
   
   /* Variable Declarations */
   int mm;
   double **new_array;
   
-  new_array = (double **)malloc(size[1] * sizeof(double *));
-  for(mm=0; mm<size[1]; mm++)
-    new_array[mm] = (double *)calloc(size[0], sizeof(double));
+  new_array    = (double **)malloc(size[1] * sizeof(double *));
+  new_array[0] = (double *)calloc(size[0] * size[1], sizeof(double));
+  for(mm=1; mm<size[1]; mm++)
+    new_array[mm] = new_array[0] + mm * size[0];
   
   return new_array;
 }
@@ -60,63 +63,348 @@ double **images_alloc_2darray(long *size){
 /* Function to free space occupied by 2-D array */
 void images_free_2darray(double **array, long *size){
   
-  /* Variable Declarations */
-  int mm;
-
-  for(mm=0; mm < size[1]; mm++)
-    free(array[mm]);
+  if(array == NULL)
+    return;
+  
+  free(array[0]);
   free(array);
     
   return;
 }
 
 
+/***** Contiguous Image Functions *****/
+
+/* Function to allocate a zeroed nx x ny image in one aligned block */
+/* Images of a huge page or more come from alloc_buffer(), smaller ones
+   from the heap.  Returns NULL on failure.  IMPORTANT: returned image must
+   be freed with images_free(). */
+scope_image *images_alloc(long nx, long ny){
+  
+  /* Variable Declarations */
+  size_t bytes = nx * ny * sizeof(double);
+  void  *data  = NULL;
+  scope_image *img;
+  
+  img = (scope_image *)malloc(sizeof(scope_image));
+  
+  if(bytes >= ALLOC_HUGEPAGE){
+    data = alloc_buffer(nx * ny, sizeof(double), NULL, 1);
+    img->owner = IMAGES_HUGE;
+  } else {
+    if(posix_memalign(&data, IMAGES_ALIGN, GSL_MAX(bytes, 1)))
+      data = NULL;
+    else
+      memset(data, 0, bytes);
+    img->owner = IMAGES_HEAP;
+  }
+  if(data == NULL){
+    fprintf(stderr,"Error: unable to allocate %ld x %ld image.\n",nx,ny);
+    free(img);
+    return NULL;
+  }
+  
+  img->data   = (double *)data;
+  img->nx     = nx;
+  img->ny     = ny;
+  img->stride = nx;
+  
+  return img;
+}
+
+
+/* Free space occupied by an image (views and arena images only lose the
+   header, if that was malloc'd) */
+void images_free(scope_image *img){
+  
+  if(img == NULL)
+    return;
+  
+  switch(img->owner){
+  case IMAGES_HEAP:
+    free(img->data);
+    break;
+  case IMAGES_HUGE:
+    alloc_free(img->data);
+    break;
+  case IMAGES_ARENA:
+    return;                          // Header lives in the arena too
+  default:
+    break;
+  }
+  free(img);
+  
+  return;
+}
+
+
+/* Wrap an existing row-major nx x ny array as an image (no copy) */
+scope_image images_wrap(double *data, long nx, long ny){
+  
+  scope_image img;
+  
+  img.data   = data;
+  img.nx     = nx;
+  img.ny     = ny;
+  img.stride = nx;
+  img.owner  = IMAGES_VIEW;
+  
+  return img;
+}
+
+
+/* Return a view of the nx x ny subsection of img starting at (x0,y0) */
+/* The view shares the pixels of img (no copy), so it must not outlive it.
+   *status is set non-zero if the subsection goes outside the image. */
+scope_image images_view(scope_image *img, long x0, long y0, long nx, long ny,
+			int *status){
+  
+  scope_image view;
+  
+  *status = 0;
+  if(x0 < 0 || y0 < 0 || nx < 0 || ny < 0 ||
+     x0 + nx > img->nx || y0 + ny > img->ny){
+    fprintf(stderr,"Image subsection goes outside bounds of image!\n");
+    *status = -1;
+    nx = ny = 0;
+    x0 = y0 = 0;
+  }
+  
+  view.data   = img->data + y0 * img->stride + x0;
+  view.nx     = nx;
+  view.ny     = ny;
+  view.stride = img->stride;
+  view.owner  = IMAGES_VIEW;
+  
+  return view;
+}
+
+
+/* Function to get the pixels of an image as one 1-D row-major array */
+/* Only strided views need a copy; *copied says whether the calling
+   function must free the returned array. */
+double *images_flatten(scope_image *img, int *copied){
+  
+  /* Variable Declarations */
+  long y;
+  double *one_d;
+  
+  *copied = 0;
+  if(img->stride == img->nx)
+    return img->data;
+  
+  one_d = (double *)malloc(img->nx * img->ny * sizeof(double));
+  for(y=0;y<img->ny;y++)
+    memcpy(one_d + y * img->nx, img->data + y * img->stride,
+	   img->nx * sizeof(double));
+  *copied = 1;
+  
+  return one_d;
+}
+
+
+/* Cache-blocked transpose: at(y,x) = a(x,y) */
+/* at must be a->ny x a->nx.  The images may be the same square image, in
+   which case the transpose is done in place; otherwise they must not
+   overlap.  Returns non-zero if the shapes do not match. */
+int images_transpose(scope_image *a, scope_image *at){
+  
+  /* Variable Declarations */
+  long bx,by,x,y,xe,ye;
+  double tmp,*pa,*pt;
+  
+  if(at->nx != a->ny || at->ny != a->nx){
+    fprintf(stderr,"Error: transpose of %ld x %ld into %ld x %ld image.\n",
+	    a->nx,a->ny,at->nx,at->ny);
+    return -1;
+  }
+  
+  /* In place (square): swap blocks across the diagonal */
+  if(a->data == at->data){
+    for(by=0; by < a->ny; by += IMAGES_BLOCK)
+      for(bx=by; bx < a->nx; bx += IMAGES_BLOCK){
+	ye = GSL_MIN(by + IMAGES_BLOCK, a->ny);
+	xe = GSL_MIN(bx + IMAGES_BLOCK, a->nx);
+	for(y=by; y<ye; y++)
+	  for(x=(bx == by ? y + 1 : bx); x<xe; x++){
+	    pa  = a->data + y * a->stride + x;
+	    pt  = a->data + x * a->stride + y;
+	    tmp = *pa;
+	    *pa = *pt;
+	    *pt = tmp;
+	  }
+      }
+    return 0;
+  }
+  
+  /* Out of place: one block of each at a time, so both stay in cache */
+  for(by=0; by < a->ny; by += IMAGES_BLOCK)
+    for(bx=0; bx < a->nx; bx += IMAGES_BLOCK){
+      ye = GSL_MIN(by + IMAGES_BLOCK, a->ny);
+      xe = GSL_MIN(bx + IMAGES_BLOCK, a->nx);
+      for(y=by; y<ye; y++)
+	for(x=bx; x<xe; x++)
+	  at->data[x * at->stride + y] = a->data[y * a->stride + x];
+    }
+  
+  return 0;
+}
+
+
+/***** Arena for Temporary Images *****/
+
+/* Create an arena of (at least) size bytes */
+scope_arena *images_arena_create(size_t size){
+  
+  scope_arena *arena;
+  
+  arena = (scope_arena *)malloc(sizeof(scope_arena));
+  arena->base = (char *)alloc_buffer(size, 1, NULL, 1);
+  arena->size = (arena->base == NULL) ? 0 : size;
+  arena->used = 0;
+  
+  return arena;
+}
+
+
+/* Hand out bytes from the arena (IMAGES_ALIGN aligned); NULL if full */
+void *images_arena_alloc(scope_arena *arena, size_t bytes){
+  
+  void *ptr;
+  
+  bytes = (bytes + IMAGES_ALIGN - 1) / IMAGES_ALIGN * IMAGES_ALIGN;
+  if(arena->used + bytes > arena->size)
+    return NULL;
+  
+  ptr = arena->base + arena->used;
+  arena->used += bytes;
+  
+  return ptr;
+}
+
+
+/* Allocate a zeroed nx x ny image in the arena; NULL if it does not fit */
+/* The image is released by images_arena_reset(), and images_free() on it
+   does nothing. */
+scope_image *images_arena_image(scope_arena *arena, long nx, long ny){
+  
+  /* Variable Declarations */
+  size_t used = arena->used;
+  scope_image *img;
+  
+  img = (scope_image *)images_arena_alloc(arena, sizeof(scope_image));
+  if(img == NULL)
+    return NULL;
+  img->data = (double *)images_arena_alloc(arena, nx * ny * sizeof(double));
+  if(img->data == NULL){
+    arena->used = used;
+    return NULL;
+  }
+  memset(img->data, 0, nx * ny * sizeof(double));
+  
+  img->nx     = nx;
+  img->ny     = ny;
+  img->stride = nx;
+  img->owner  = IMAGES_ARENA;
+  
+  return img;
+}
+
+
+/* Release everything handed out by the arena */
+void images_arena_reset(scope_arena *arena){
+  
+  arena->used = 0;
+  
+  return;
+}
+
+
+/* Free space occupied by the arena */
+void images_arena_free(scope_arena *arena){
+  
+  if(arena == NULL)
+    return;
+  
+  alloc_free(arena->base);
+  free(arena);
+  
+  return;
+}
+
+
 /***** High-Level Write-to-File Functions *****/
 
 /* Function (in progress) to write ray locations to a FITS file. */
+/* Rays that are not lost are binned straight into a 440x220 image of
+   square pixels, over a region centered on the rays and just wide (or
+   tall) enough to hold them all.  With a writer, the image is only
+   queued, and the file is written in the background (see writer_flush());
+   *status then reports any earlier write error.  With writer = NULL the
+   file is written before returning.  If display is given, the image is
+   also pushed to DS9 straight from memory. */
 char *images_write_locations(scope_ray *rays, int location, char *telname,
+			     scope_writer *writer, scope_display *display,
 			     int *status){
   
   /* Variable Declarations */
-  int  gsl_status, bitpix;
-  long i,j,nx,ny;
+  int  bitpix;
+  long i,ix,iy,nx,ny,nout=0;
+  double lo[2],hi[2],cen[2],ext[2],w,pix;
   char fn[FLEN_FILENAME];            // CFITSIO max length of filename
+  scope_image *img;
   
   
-  /* Allocate 2-D Histogram to accumulate locations */
-  /* NOTE: in the future, will need to pass in geometry descriptors... for now
-     just work on test situation in main(). */
-  
   nx = 440;          // NBINS in the x direction
   ny = 220;          // NBINS in the y direction
   
-  gsl_histogram2d *h = gsl_histogram2d_alloc(nx, ny);
-  long naxes[2] = {nx,ny};
-  double **imarr = images_alloc_2darray(naxes);
-  
-  
-  /* Set range for histogram */
-  gsl_histogram2d_set_ranges_uniform (h,           // NOTE: Need to
-                                      -2.2, 2.2,   // set these dynamically
-                                      -1.1, 1.1);  // based on situation
+  /* Extent of the rays */
+  lo[0] = lo[1] =  GSL_DBL_MAX;
+  hi[0] = hi[1] = -GSL_DBL_MAX;
+  for(i=0;i<N_RAYS;i++){
+    if(rays[i].lost)
+      continue;
+    lo[0] = GSL_MIN(lo[0], rays[i].x);
+    hi[0] = GSL_MAX(hi[0], rays[i].x);
+    lo[1] = GSL_MIN(lo[1], rays[i].y);
+    hi[1] = GSL_MAX(hi[1], rays[i].y);
+  }
+  if(lo[0] > hi[0])                   // No rays left: any region will do
+    lo[0] = lo[1] = hi[0] = hi[1] = 0.;
+  cen[0] = 0.5 * (lo[0] + hi[0]);
+  cen[1] = 0.5 * (lo[1] + hi[1]);
+  ext[0] = hi[0] - lo[0];
+  ext[1] = hi[1] - lo[1];
+  
+  /* Image region: the nx:ny box around the rays */
+  w = GSL_MAX(ext[0], (double)nx / ny * ext[1]);
+  w = (w > 0.) ? 1.0001 * w : 1.;     // Margin keeps the far edges inside
+  pix   = w / nx;
+  lo[0] = cen[0] - 0.5 * w;
+  lo[1] = cen[1] - 0.5 * pix * ny;
+  
+  img = (writer == NULL) ? images_alloc(nx, ny) :
+    writer_get_buffer(writer, nx, ny);
+  if(img == NULL){
+    *status = MEMORY_ALLOCATION;
+    return NULL;
+  }
   
   /* Loop through rays and accumulate into bins */
   for(i=0;i<N_RAYS;i++){
-    gsl_status = gsl_histogram2d_increment(h, rays[i].x, rays[i].y);
-    if(gsl_status)
-      printf("We have an error, errno=%d\n",gsl_status);
+    if(rays[i].lost)
+      continue;
+    ix = (long)floor((rays[i].x - lo[0]) / pix);
+    iy = (long)floor((rays[i].y - lo[1]) / pix);
+    if(ix < 0 || iy < 0 || ix >= nx || iy >= ny){
+      nout++;                         // Only by rounding at the margin
+      continue;
+    }
+    IMAGES_PIX(img, ix, iy) += 1.;
   }
+  if(nout)
+    printf("%ld rays fell outside the location image.\n",nout);
   
-  /* Convert 2-D Histogram into a standard array for writing to FITS */
-  for(i=0;i<nx;i++)
-    for(j=0;j<ny;j++)
-      imarr[j][i] = gsl_histogram2d_get(h, i, j);  // Column-Major IMAGE Array
-  
-  /* All done with gsl_histogram, free it */
-  gsl_histogram2d_free(h);
-  
-  
-  /* We now have a (column-major) array ready for writing. */
   
   /* Use SWITCH statement to get correct filename to correspond with location */
   switch(location)
@@ -137,11 +425,24 @@ char *images_write_locations(scope_ray *rays, int location, char *telname,
       
     default:
       sprintf(fn,"test_data.fits");
+      bitpix = DOUBLE_IMG;
     }
   
   
-  /* Write it out! */
-  fitsw_write2file(fn, naxes, imarr, bitpix, telname, status);
+  /* Show it (before the writer takes the buffer) */
+  if(display != NULL){
+    display->image = img;
+    if(display_ds9_talk(DS9_ARRAY, display))
+      printf("Could not push the locations image to DS9.\n");
+    display->image = NULL;
+  }
+  
+  /* Write it out (or hand it to the writer thread)! */
+  if(writer == NULL){
+    fitsw_write_image(fn, img, bitpix, telname, status);
+    images_free(img);
+  } else
+    *status = writer_submit(writer, img, fn, bitpix, telname);
   
   printf("In-function value of status: %d\n",*status);
   
@@ -169,85 +470,3 @@ int write_focal_plane(char *telname){
   
   
 }
-
-
-
-/* Function for reading 2-D image array into 1-D array for statistics */
-/* IMPORTANT: returned array must be freed by calling function */
-double *imutil_2d_to_1d(double **two_d, long *arrsize){
-  
-  /* Variable Declarations */
-  int p,q;
-  double *one_d;
-  
-  /* Allocate space for array */
-  one_d = (double *)calloc(arrsize[0] * arrsize[1], sizeof(double));
-  
-  /* Loop over array, reading into 1-D array */
-  for(p=0;p<arrsize[1];p++)
-    for(q=0;q<arrsize[0];q++)
-      one_d[p * arrsize[0] + q] = two_d[p][q];
-  
-  return one_d;
-}
-
-
-/* Function returns an image subsection of a given size */
-double **imutil_get_subsection(double **full, long *f_size, long *s_size, long *start){
-  
-  /* Variable Declarations */
-  int a,b;
-  double **sub;
-  
-  /* Allocate space for subsection array */
-  sub = images_alloc_2darray(s_size);
-  
-  /* Check that subsection does not go beyond the bounds of the image */
-  if(start[0] + s_size[0] - 1 > f_size[0] ||
-     start[1] + s_size[1] - 1 > f_size[1]){
-    fprintf(stderr,"Image subsection goes outside bounds of image!\n");
-    return sub;
-  }
-  
-  for(a = 0; a < s_size[1]; a++)                   // y rows
-    for(b =0; b < s_size[0]; b++)                  // x columns
-      sub[a][b] = full[a+start[1]][b+start[0]];
-  
-  return sub;    
-}
-
-
-
-
-/* imutil_transpose() takes an (n x m) array and builds the (m x n) transpose.
-   Care is taken in case input and transpose are the same array in calling
-   routine. */
-void imutil_transpose(double **a, double **at, int n, int m){
-
-  /* Variable Declarations */
-  int x,y;
-  long size[2]  = {n,m};
-  double **trans;
-  
-  /* Allocate transpose array */
-  trans = images_alloc_2darray(size);
-
-  /* Build the transpose array */
-  for(x=0;x<n;x++){
-    for(y=0;y<m;y++){
-      trans[y][x] = a[x][y];
-    }
-  }
-
-  /* Place the transpose in the output 'at' array */
-  for(x=0;x<n;x++){
-    for(y=0;y<m;y++){
-      at[y][x] = trans[y][x];
-    }
-  }
-  
-  /* Free the temproary transpose array */
-  images_free_2darray(trans,size);
-
-  return;
-}
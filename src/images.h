@@ -26,6 +26,19 @@
 #ifndef IMAGES_H
 #define IMAGES_H
 
+#include "writer.h"
+
+#define IMAGES_VIEW   0         // scope_image.owner: borrowed pixels
+#define IMAGES_HEAP   1         //   aligned heap block
+#define IMAGES_HUGE   2         //   alloc_buffer() (huge pages)
+#define IMAGES_ARENA  3         //   carved from a scope_arena
+
+#define IMAGES_ALIGN  64        // Row-block alignment (a cache line)
+#define IMAGES_BLOCK  32        // Tile edge for the blocked transpose
+
+/* Pixel (x,y) of a scope_image */
+#define IMAGES_PIX(img,x,y) ((img)->data[(long)(y) * (img)->stride + (x)])
+
 
 /* Function declarations */
 
@@ -33,15 +46,29 @@
 double **images_alloc_2darray(long *);
 void     images_free_2darray(double **, long *);
 
+/***** Contiguous Image Functions *****/
+scope_image *images_alloc(long nx, long ny);
+void         images_free(scope_image *img);
+scope_image  images_wrap(double *data, long nx, long ny);
+scope_image  images_view(scope_image *img, long x0, long y0, long nx, long ny,
+			 int *status);
+double      *images_flatten(scope_image *img, int *copied);
+int          images_transpose(scope_image *a, scope_image *at);
+
+/***** Arena for Temporary Images *****/
+scope_arena *images_arena_create(size_t size);
+void        *images_arena_alloc(scope_arena *arena, size_t bytes);
+scope_image *images_arena_image(scope_arena *arena, long nx, long ny);
+void         images_arena_reset(scope_arena *arena);
+void         images_arena_free(scope_arena *arena);
+
 /***** High-Level Write-to-File Functions *****/
 char    *images_write_locations(scope_ray *rays, int location, char *telname,
+				scope_writer *writer, scope_display *display,
 				int *status);
 
 /***** Other Left-Over Functions, Possibly to Use *****/
 int      write_focal_plane(char *);
-double  *imutil_2d_to_1d(double **, long *);
-double **imutil_get_subsection(double **, long *, long *, long *);
-void     imutil_transpose(double **, double **, int, int);
 
 
 #endif  /* IMAGES_H */
@@ -0,0 +1,403 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: imsim.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gsl/gsl_rng.h>               // Includes GSL's rng routine defs
+
+/* Local headers */
+#include "imsim.h"
+#include "rays.h"
+#include "kernels.h"
+#include "mirrors.h"
+#include "setup.h"
+#include "images.h"
+#include "fitsw.h"
+#include "fourier.h"
+#include "psfcache.h"
+
+
+/* Function to fill the image-simulation parameters with their defaults */
+void imsim_defaults(scope_imsim *par){
+  
+  par->ngrid[0] = IMSIM_NGRID;
+  par->ngrid[1] = IMSIM_NGRID;
+  par->npsf     = IMSIM_NPSF;
+  par->ntile    = IMSIM_NTILE;
+  par->nrays    = IMSIM_NRAYS;
+  par->lambda   = 5500.;
+  par->seed     = 0;
+  
+  return;
+}
+
+
+/* Simulate the focal-plane image of an extended source */
+/* Rather than tracing ~1e10 rays drawn from the source image, trace a modest
+   grid of field points to get per-field PSFs, and convolve the source image
+   with them by overlap-add FFT.  Each tile is convolved with the PSF
+   bilinearly interpolated to the tile center; since the Fourier transform is
+   linear, the interpolation is done on the precomputed PSF spectra.  The
+   output image is in the same (sky) orientation and pixel scale as the
+   input, and is written through fitsw_write_image().  PSFs are taken from
+   the (optional) cache when possible. */
+int imsim_simulate(scope_illum *illum, char *outfile, scope_scope *scope,
+		   scope_element *elements, int nelem, scope_imsim *par,
+		   scope_psfcache *cache){
+  
+  /* Variable Declarations */
+  int    status=0,cstat=0,bitpix,naxis;
+  long   i,j,g,ix,iy,tx,ty,x0,y0,nx,ny,npad,nc,c,npix;
+  long   naxes[2],xystart[2]={0,0},gx,gy;
+  double ax,ay,fx,fy,wx,wy,w[4],re,im,jinv[2][2];
+  scope_image *img,*out;
+  double *psf,*spectra,*kern,*work;
+  long   node[4];
+  fitsfile *fitsfp;
+  scope_fft *plan;
+  scope_arena *arena;
+  
+  gx = par->ngrid[0];
+  gy = par->ngrid[1];
+  c  = par->npsf / 2;
+  
+  /* Read in the source image; a bad file is an error returned, not an
+     exit (so no fw_open_r()) */
+  if(fits_open_file(&fitsfp, illum->image, READONLY, &status)){
+    fits_report_error(stderr,status);
+    fprintf(stderr,"Error: unable to open source image %s\n",illum->image);
+    return status;
+  }
+  if(fits_get_img_param(fitsfp, 2, &bitpix, &naxis, naxes, &status))
+    fits_report_error(stderr,status);
+  else
+    img = fitsw_read2array(fitsfp, xystart, naxes, TDOUBLE, &status);
+  fits_close_file(fitsfp, &cstat);
+  if(status)
+    return status;
+  
+  printf("Simulating %ld x %ld image with a %ld x %ld grid of PSFs...\n",
+	 naxes[0],naxes[1],gx,gy);
+  
+  /* Map from detector offsets to sky offsets */
+  status = imsim_plate_scale(scope, elements, nelem, par, illum->pixscale,
+			     jinv);
+  if(status){
+    images_free(img);
+    return status;
+  }
+  
+  /* Padded FFT size for linear (not circular) convolution of a tile */
+  npad = fourier_good_size(par->ntile + par->npsf - 1);
+  nc   = 2 * npad * npad;                   // doubles per complex array
+  plan = fourier_plan_alloc(npad, npad);
+  
+  /* Scratch arrays all come from one (freshly zeroed) arena, released
+     together */
+  arena   = images_arena_create((par->npsf * par->npsf + (gx*gy + 2) * nc) *
+				sizeof(double) + 4 * IMAGES_ALIGN);
+  psf     = (double *)images_arena_alloc(arena, par->npsf * par->npsf *
+					 sizeof(double));
+  spectra = (double *)images_arena_alloc(arena, gx * gy * nc * sizeof(double));
+  kern    = (double *)images_arena_alloc(arena, nc * sizeof(double));
+  work    = (double *)images_arena_alloc(arena, nc * sizeof(double));
+  if(work == NULL){
+    images_arena_free(arena);
+    images_free(img);
+    fourier_plan_free(plan);
+    return MEMORY_ALLOCATION;
+  }
+  
+  /* Trace the grid of field points, and transform each PSF */
+  /* Node (i,j) sits at the center of the i'th of gx equal strips in x. */
+  for(j=0;j<gy;j++)
+    for(i=0;i<gx;i++){
+      g  = j*gx + i;
+      ax = ((i + 0.5) * naxes[0] / gx - 0.5*naxes[0]) * illum->pixscale;
+      ay = ((j + 0.5) * naxes[1] / gy - 0.5*naxes[1]) * illum->pixscale;
+      imsim_get_psf(scope, elements, nelem, ax, ay, par, illum->pixscale,
+		    jinv, psf, cache);
+      
+      /* Wrap the PSF so its center lands on pixel (0,0) */
+      for(iy=0;iy<par->npsf;iy++)
+	for(ix=0;ix<par->npsf;ix++){
+	  npix = ((iy - c + npad) % npad) * npad + (ix - c + npad) % npad;
+	  spectra[g*nc + 2*npix] = psf[iy*par->npsf + ix];
+	}
+      fourier_fft2d(plan, spectra + g*nc, FOURIER_FORWARD);
+    }
+  
+  /* Overlap-add, one tile at a time */
+  out = images_alloc(naxes[0], naxes[1]);
+  
+  for(y0=0; y0 < naxes[1]; y0 += par->ntile)
+    for(x0=0; x0 < naxes[0]; x0 += par->ntile){
+      
+      nx = GSL_MIN(par->ntile, naxes[0] - x0);
+      ny = GSL_MIN(par->ntile, naxes[1] - y0);
+      
+      /* Fractional grid position of the tile center, and the bilinear
+	 weights of the four surrounding nodes */
+      fx = (x0 + 0.5*nx) * gx / (double)naxes[0] - 0.5;
+      fy = (y0 + 0.5*ny) * gy / (double)naxes[1] - 0.5;
+      fx = GSL_MAX(0., GSL_MIN(fx, gx - 1.));
+      fy = GSL_MAX(0., GSL_MIN(fy, gy - 1.));
+      tx = GSL_MIN((long)fx, gx - 2 < 0 ? 0 : gx - 2);
+      ty = GSL_MIN((long)fy, gy - 2 < 0 ? 0 : gy - 2);
+      wx = fx - tx;
+      wy = fy - ty;
+      node[0] = ty*gx + tx;
+      node[1] = ty*gx + GSL_MIN(tx + 1, gx - 1);
+      node[2] = GSL_MIN(ty + 1, gy - 1)*gx + tx;
+      node[3] = GSL_MIN(ty + 1, gy - 1)*gx + GSL_MIN(tx + 1, gx - 1);
+      w[0] = (1. - wx)*(1. - wy);
+      w[1] = wx*(1. - wy);
+      w[2] = (1. - wx)*wy;
+      w[3] = wx*wy;
+      
+      for(i=0;i<nc;i++)
+	kern[i] = w[0]*spectra[node[0]*nc + i] + w[1]*spectra[node[1]*nc + i] +
+	  w[2]*spectra[node[2]*nc + i] + w[3]*spectra[node[3]*nc + i];
+      
+      /* Transform the (zero-padded) tile */
+      memset(work, 0, nc * sizeof(double));
+      for(iy=0;iy<ny;iy++)
+	for(ix=0;ix<nx;ix++)
+	  work[2*(iy*npad + ix)] = IMAGES_PIX(img, x0 + ix, y0 + iy);
+      fourier_fft2d(plan, work, FOURIER_FORWARD);
+      
+      /* Multiply by the interpolated PSF spectrum, and transform back */
+      for(i=0;i<npad*npad;i++){
+	re = work[2*i]*kern[2*i] - work[2*i+1]*kern[2*i+1];
+	im = work[2*i]*kern[2*i+1] + work[2*i+1]*kern[2*i];
+	work[2*i]   = re;
+	work[2*i+1] = im;
+      }
+      fourier_fft2d(plan, work, FOURIER_INVERSE);
+      
+      /* Add into the output; the result spans [-c, n+c) about the tile,
+	 with the negative part wrapped to the top of the padded array */
+      for(iy=0;iy<npad;iy++){
+	if(iy < ny + c)
+	  j = y0 + iy;
+	else if(iy >= npad - c)
+	  j = y0 + iy - npad;
+	else
+	  continue;
+	if(j < 0 || j >= naxes[1])
+	  continue;
+	for(ix=0;ix<npad;ix++){
+	  if(ix < nx + c)
+	    i = x0 + ix;
+	  else if(ix >= npad - c)
+	    i = x0 + ix - npad;
+	  else
+	    continue;
+	  if(i < 0 || i >= naxes[0])
+	    continue;
+	  IMAGES_PIX(out, i, j) += work[2*(iy*npad + ix)];
+	}
+      }
+    }
+  
+  /* Write it out! */
+  fitsw_write_image(outfile, out, DOUBLE_IMG, scope->name, &status);
+  printf("Simulated image written to %s\n",outfile);
+  
+  /* Clean up */
+  images_free(img);
+  images_free(out);
+  images_arena_free(arena);
+  fourier_plan_free(plan);
+  
+  return status;
+}
+
+
+/* Function to fetch the PSF at field angle (ax,ay) from the cache, or to
+   build it by tracing (and cache it) if it is not there */
+/* Returns the number of rays reaching the detector, or -1 on a cache hit. */
+long imsim_get_psf(scope_scope *scope, scope_element *elements, int nelem,
+		   double ax, double ay, scope_imsim *par, double pixscale,
+		   double jinv[2][2], double *psf, scope_psfcache *cache){
+  
+  /* Variable Declarations */
+  long n;
+  unsigned long long key=0;
+  
+  if(cache != NULL){
+    key = psfcache_key(scope, elements, nelem, ax, ay, par, pixscale);
+    if(psfcache_get(cache, key, psf, par->npsf))
+      return -1;
+  }
+  
+  n = imsim_build_psf(scope, elements, nelem, ax, ay, par, pixscale, jinv,
+		      psf);
+  
+  if(cache != NULL)
+    psfcache_put(cache, key, psf, par->npsf, scope->name);
+  
+  return n;
+}
+
+
+/* Function to trace one field point, returning the number of surviving
+   rays and their (u,v) positions in the frame of the last element */
+/* Every call reseeds the RNG with par->seed, so all field points see the
+   same pupil sample (common random numbers).  uv must have space for
+   2*par->nrays doubles. */
+long imsim_trace_field(scope_scope *scope, scope_element *elements, int nelem,
+		       double ax, double ay, scope_imsim *par, double *uv){
+  
+  /* Variable Declarations */
+  long i,ngood=0;
+  double loc[3];
+  scope_ray *rays;
+  scope_optic *det;
+  gsl_rng *r;
+  
+  rays = (scope_ray *)malloc(par->nrays * sizeof(scope_ray));
+  r = gsl_rng_alloc(gsl_rng_taus2);
+  gsl_rng_set(r, par->seed);
+  
+  rays_fill_pupil(rays, par->nrays, &scope->primary, ax, ay, par->lambda, r);
+  kernels_trace(rays, par->nrays, scope, elements, nelem);
+  
+  det = setup_get_optic(scope, elements[nelem-1].elem);
+  for(i=0;i<par->nrays;i++){
+    if(rays[i].lost)
+      continue;
+    mirrors_to_local(det, rays[i].x - det->cx, rays[i].y - det->cy,
+		     rays[i].z - det->cz, loc);
+    uv[2*ngood]   = loc[0];
+    uv[2*ngood+1] = loc[1];
+    ngood++;
+  }
+  
+  gsl_rng_free(r);
+  free(rays);
+  
+  return ngood;
+}
+
+
+/* Function to find the inverse of the plate-scale Jacobian, d(u,v)/d(ax,ay),
+   at the center of the field.  This carries detector offsets back into sky
+   offsets (including any mirror flip from the fold) for PSF binning. */
+int imsim_plate_scale(scope_scope *scope, scope_element *elements, int nelem,
+		      scope_imsim *par, double pixscale, double jinv[2][2]){
+  
+  /* Variable Declarations */
+  int  k;
+  long i,n;
+  double h,cen[3][2],jac[2][2],det,*uv;
+  double fa[3][2] = {{0.,0.},{1.,0.},{0.,1.}};
+  
+  h  = 10. * pixscale;
+  uv = (double *)malloc(2 * par->nrays * sizeof(double));
+  
+  /* Centroids on-axis, and a small step off-axis in x and in y */
+  for(k=0;k<3;k++){
+    n = imsim_trace_field(scope, elements, nelem, fa[k][0]*h, fa[k][1]*h,
+			  par, uv);
+    if(n == 0){
+      fprintf(stderr,"Error: no rays reach the focal plane on-axis.\n");
+      free(uv);
+      return -1;
+    }
+    cen[k][0] = cen[k][1] = 0.;
+    for(i=0;i<n;i++){
+      cen[k][0] += uv[2*i];
+      cen[k][1] += uv[2*i+1];
+    }
+    cen[k][0] /= n;
+    cen[k][1] /= n;
+  }
+  free(uv);
+  
+  jac[0][0] = (cen[1][0] - cen[0][0]) / h;
+  jac[0][1] = (cen[2][0] - cen[0][0]) / h;
+  jac[1][0] = (cen[1][1] - cen[0][1]) / h;
+  jac[1][1] = (cen[2][1] - cen[0][1]) / h;
+  det = jac[0][0]*jac[1][1] - jac[0][1]*jac[1][0];
+  
+  jinv[0][0] =  jac[1][1] / det;
+  jinv[0][1] = -jac[0][1] / det;
+  jinv[1][0] = -jac[1][0] / det;
+  jinv[1][1] =  jac[0][0] / det;
+  
+  printf("Plate scale: %0.3f arcsec/mm\n",
+	 648000. / M_PI / sqrt(fabs(det)) / 1000.);
+  
+  return 0;
+}
+
+
+/* Function to build the PSF at field angle (ax,ay) as an (npsf x npsf)
+   image on the sky pixel grid, centered on the ray centroid */
+/* The PSF is normalized by the number of rays launched, so its sum is the
+   fraction of light reaching the detector at this field point. */
+long imsim_build_psf(scope_scope *scope, scope_element *elements, int nelem,
+		     double ax, double ay, scope_imsim *par, double pixscale,
+		     double jinv[2][2], double *psf){
+  
+  /* Variable Declarations */
+  long i,n,ix,iy,c;
+  double uc=0.,vc=0.,du,dv,*uv;
+  
+  memset(psf, 0, par->npsf * par->npsf * sizeof(double));
+  c  = par->npsf / 2;
+  uv = (double *)malloc(2 * par->nrays * sizeof(double));
+  
+  n = imsim_trace_field(scope, elements, nelem, ax, ay, par, uv);
+  
+  for(i=0;i<n;i++){
+    uc += uv[2*i];
+    vc += uv[2*i+1];
+  }
+  if(n > 0){
+    uc /= n;
+    vc /= n;
+  }
+  
+  /* Bin each ray on the sky pixel grid */
+  for(i=0;i<n;i++){
+    du = uv[2*i]   - uc;
+    dv = uv[2*i+1] - vc;
+    ix = (long)floor((jinv[0][0]*du + jinv[0][1]*dv) / pixscale + c + 0.5);
+    iy = (long)floor((jinv[1][0]*du + jinv[1][1]*dv) / pixscale + c + 0.5);
+    if(ix >= 0 && ix < par->npsf && iy >= 0 && iy < par->npsf)
+      psf[iy*par->npsf + ix] += 1. / (double)par->nrays;
+  }
+  
+  free(uv);
+  
+  return n;
+}
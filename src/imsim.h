@@ -0,0 +1,59 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: imsim.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef IMSIM_H
+#define IMSIM_H
+
+/* Defaults for the image simulation */
+#define IMSIM_NGRID  5          // 5 x 5 grid of field points
+#define IMSIM_NPSF   63         // PSF images are 63 x 63 pixels
+#define IMSIM_NTILE  128        // Overlap-add tiles are 128 x 128 pixels
+#define IMSIM_NRAYS  20000      // Rays traced per field point
+
+
+/* Function declarations */
+
+/* Public Functions */
+void imsim_defaults(scope_imsim *par);
+int  imsim_simulate(scope_illum *illum, char *outfile, scope_scope *scope,
+		    scope_element *elements, int nelem, scope_imsim *par,
+		    scope_psfcache *cache);
+long imsim_get_psf(scope_scope *scope, scope_element *elements, int nelem,
+		   double ax, double ay, scope_imsim *par, double pixscale,
+		   double jinv[2][2], double *psf, scope_psfcache *cache);
+
+/* Internal Functions */
+long imsim_trace_field(scope_scope *scope, scope_element *elements, int nelem,
+		       double ax, double ay, scope_imsim *par, double *uv);
+int  imsim_plate_scale(scope_scope *scope, scope_element *elements, int nelem,
+		       scope_imsim *par, double pixscale, double jinv[2][2]);
+long imsim_build_psf(scope_scope *scope, scope_element *elements, int nelem,
+		     double ax, double ay, scope_imsim *par, double pixscale,
+		     double jinv[2][2], double *psf);
+
+#endif  /* IMSIM_H */
+
+
+
@@ -42,6 +42,7 @@
 /* Local headers */
 #include "init.h"
 #include "rays.h"
+#include "bundle.h"
 
 
 int init_get_sysinfo(void){
@@ -71,10 +72,11 @@ int init_get_sysinfo(void){
 }
 
 
-int init_set_nrays(void){
+/* With compact set, N_RAYS is sized for compact ray bundles instead */
+int init_set_nrays(int compact){
   
   /* Variable Declarations */
-  size_t raysize;
+  double raysize;
   int memsize;
   
   /* Check against system type -- if SYS_RAM == 0, default to set value */
@@ -92,11 +94,11 @@ int init_set_nrays(void){
   memsize = GSL_MIN_INT( 4096, (int)floor((float)SYS_RAM / 4.) );
   
   /* Get size of a single ray */
-  raysize = sizeof(scope_ray);
+  raysize = compact ? bundle_raysize() : (double)sizeof(scope_ray);
   
   /* Compute number of rays that will fit within the RAM */
   N_RAYS = (unsigned int) floor( (double)memsize * 1024. * 1024. / 
-				 (double)raysize );
+				 raysize );
   
   return 0;
 }
@@ -29,7 +29,7 @@
 
 /* Function declarations */
 int init_get_sysinfo();
-int init_set_nrays(void);
+int init_set_nrays(int compact);
 
 #endif  /* INIT_H */
 
@@ -0,0 +1,421 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: kernels.cc
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* Trace kernels specialized at compile time for fixed prescriptions.  A
+   prescription is a type-level list of surfaces, each a shape (flat,
+   sphere, paraboloid, general conic) paired with a role (block, reflect,
+   detect).  Prescription<...>::trace() unrolls into straight-line code for
+   exactly that list: the conic terms that vanish for the shape are never
+   computed (a flat has no quadratic and a fixed normal, a paraboloid has
+   no k1 terms), and each surface is one branch-free loop over a
+   structure-of-arrays block of KERNELS_BATCH rays that the compiler can
+   vectorize.  kernels_trace() matches the element list against the table
+   of instantiations at runtime and falls back to the generic rays_trace()
+   for anything else (refracting elements, unusual orders, ...).
+
+   The arithmetic is that of mirrors_intersect(), mirrors_inside() and
+   mirrors_normal(), rearranged, so results agree with rays_trace() to
+   rounding. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+/* Include packages (the system headers must come before the C-linkage
+   block below, since the C++ versions of some of them hold templates) */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_rng.h>
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#define restrict __restrict__          // C99 keyword used in rays.h
+
+/* Local headers */
+extern "C" {
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+#include "rays.h"
+#include "mirrors.h"
+#include "setup.h"
+}
+#include "kernels.h"
+
+
+namespace {
+
+/* What the kernels need of an optic, hoisted out of the ray loops */
+struct Geom{
+  double o[3];          // Center
+  double f[3][3];       // Local u,v,w axes
+  double c;             // Vertex curvature 1/(2f)
+  double k1;            // 1 + conic constant
+  double ia,ib;         // 2/dmaj, 2/dmin: outline in units of the semi-axes
+};
+
+/* A block of rays, one array per component */
+struct Soa{
+  double x[KERNELS_BATCH],y[KERNELS_BATCH],z[KERNELS_BATCH];
+  double vx[KERNELS_BATCH],vy[KERNELS_BATCH],vz[KERNELS_BATCH];
+  double opl[KERNELS_BATCH];
+  double live[KERNELS_BATCH];           // 1 = still traced, 0 = lost
+};
+
+
+/* Surface shapes.  conic(g, s) is the k1 * s term of the conic. */
+struct Flat{
+  static const int  id     = KERNELS_FLAT;
+  static const bool curved = false;
+  static inline double conic(const Geom &g, double s){ return 0.; }
+};
+struct Sphere{
+  static const int  id     = KERNELS_SPHERE;
+  static const bool curved = true;
+  static inline double conic(const Geom &g, double s){ return s; }
+};
+struct Paraboloid{
+  static const int  id     = KERNELS_PARABOLOID;
+  static const bool curved = true;
+  static inline double conic(const Geom &g, double s){ return 0.; }
+};
+struct Conic{
+  static const int  id     = KERNELS_CONIC;
+  static const bool curved = true;
+  static inline double conic(const Geom &g, double s){ return g.k1 * s; }
+};
+typedef Conic Hyperboloid;
+
+/* Roles */
+struct Block  { static const int id = KERNELS_BLOCK;   };
+struct Reflect{ static const int id = KERNELS_REFLECT; };
+struct Detect { static const int id = KERNELS_DETECT;  };
+
+template<class S, class R> struct Surface{
+  typedef S shape;
+  typedef R role;
+};
+
+
+/* One surface over a block of m rays */
+template<class S, class R>
+inline void step(Soa &r, long m, const Geom &g){
+
+  /* Variable Declarations */
+  long   i;
+  double dx,dy,dz,p0,p1,p2,d0,d1,d2,a,b,cc,disc,t,ok,q0,q1,q2,in;
+  double l0,l1,l2,norm,n0,n1,n2,s;
+
+  for(i=0;i<m;i++){
+
+    /* The ray in the local frame of the optic */
+    dx = r.x[i] - g.o[0];
+    dy = r.y[i] - g.o[1];
+    dz = r.z[i] - g.o[2];
+    p0 = g.f[0][0]*dx + g.f[0][1]*dy + g.f[0][2]*dz;
+    p1 = g.f[1][0]*dx + g.f[1][1]*dy + g.f[1][2]*dz;
+    p2 = g.f[2][0]*dx + g.f[2][1]*dy + g.f[2][2]*dz;
+    d0 = g.f[0][0]*r.vx[i] + g.f[0][1]*r.vy[i] + g.f[0][2]*r.vz[i];
+    d1 = g.f[1][0]*r.vx[i] + g.f[1][1]*r.vy[i] + g.f[1][2]*r.vz[i];
+    d2 = g.f[2][0]*r.vx[i] + g.f[2][1]*r.vy[i] + g.f[2][2]*r.vz[i];
+
+    /* Distance to the surface; ok = 0 if it is missed or behind the ray */
+    if(!S::curved){
+      t  = -p2 / d2;
+      ok = (t > 0. && t <= GSL_DBL_MAX) ? 1. : 0.;
+    } else {
+      a    = g.c*(d0*d0 + d1*d1 + S::conic(g, d2*d2));
+      b    = 2.*(g.c*(p0*d0 + p1*d1 + S::conic(g, p2*d2)) - d2);
+      cc   = g.c*(p0*p0 + p1*p1 + S::conic(g, p2*p2)) - 2.*p2;
+      disc = b*b - 4.*a*cc;
+      ok   = (disc >= 0.) ? 1. : 0.;
+      t    = -2.*cc / (b + copysign(sqrt(disc*ok), b));
+      ok   = (ok > 0. && t > 0. && t <= GSL_DBL_MAX) ? 1. : 0.;
+    }
+
+    /* An obstruction only takes out the rays that hit it */
+    if(R::id == KERNELS_BLOCK){
+      q0 = p0 + t*d0;
+      q1 = p1 + t*d1;
+      in = ((q0*g.ia)*(q0*g.ia) + (q1*g.ib)*(q1*g.ib) <= 1.) ? 1. : 0.;
+      r.live[i] *= 1. - ok*in;
+      continue;
+    }
+
+    /* Anything else must be hit, inside the outline */
+    ok *= r.live[i];
+    t   = (ok > 0.) ? t : 0.;
+    r.x[i]   += t*r.vx[i];
+    r.y[i]   += t*r.vy[i];
+    r.z[i]   += t*r.vz[i];
+    r.opl[i] += t;
+    q0 = p0 + t*d0;
+    q1 = p1 + t*d1;
+    q2 = p2 + t*d2;
+    in = ((q0*g.ia)*(q0*g.ia) + (q1*g.ib)*(q1*g.ib) <= 1.) ? 1. : 0.;
+    r.live[i] = ok*in;
+
+    if(R::id == KERNELS_REFLECT){
+      if(!S::curved){
+	n0 = g.f[2][0];
+	n1 = g.f[2][1];
+	n2 = g.f[2][2];
+      } else {
+	l0   = -g.c*q0;
+	l1   = -g.c*q1;
+	l2   = 1. - g.c*S::conic(g, q2);
+	norm = 1. / sqrt(l0*l0 + l1*l1 + l2*l2);
+	l0  *= norm;
+	l1  *= norm;
+	l2  *= norm;
+	n0 = g.f[0][0]*l0 + g.f[1][0]*l1 + g.f[2][0]*l2;
+	n1 = g.f[0][1]*l0 + g.f[1][1]*l1 + g.f[2][1]*l2;
+	n2 = g.f[0][2]*l0 + g.f[1][2]*l1 + g.f[2][2]*l2;
+      }
+      s = 2.*(r.vx[i]*n0 + r.vy[i]*n1 + r.vz[i]*n2) * r.live[i];
+      r.vx[i] -= s*n0;
+      r.vy[i] -= s*n1;
+      r.vz[i] -= s*n2;
+    }
+  }
+
+  return;
+}
+
+
+/* A prescription: the ordered list of surfaces */
+template<class... S> struct Prescription;
+
+template<> struct Prescription<>{
+  static const int nelem = 0;
+  static inline void trace(Soa &r, long m, const Geom *g){}
+  static inline bool match(const int *shape, const int *role){ return true; }
+};
+
+template<class S, class... Rest> struct Prescription<S, Rest...>{
+  static const int nelem = 1 + sizeof...(Rest);
+  static inline void trace(Soa &r, long m, const Geom *g){
+    step<typename S::shape, typename S::role>(r, m, g[0]);
+    Prescription<Rest...>::trace(r, m, g + 1);
+  }
+  static inline bool match(const int *shape, const int *role){
+    return shape[0] == S::shape::id && role[0] == S::role::id &&
+      Prescription<Rest...>::match(shape + 1, role + 1);
+  }
+};
+
+
+/* Trace n rays through prescription P, a block at a time */
+template<class P>
+void kernel(scope_ray *rays, long n, const Geom *g){
+
+  /* Variable Declarations */
+  long i,i0,m;
+  Soa  r;
+
+  for(i0=0; i0 < n; i0 += KERNELS_BATCH){
+    m = GSL_MIN(KERNELS_BATCH, n - i0);
+    for(i=0;i<m;i++){
+      r.x[i]    = rays[i0+i].x;
+      r.y[i]    = rays[i0+i].y;
+      r.z[i]    = rays[i0+i].z;
+      r.vx[i]   = rays[i0+i].vx;
+      r.vy[i]   = rays[i0+i].vy;
+      r.vz[i]   = rays[i0+i].vz;
+      r.opl[i]  = rays[i0+i].opl;
+      r.live[i] = rays[i0+i].lost ? 0. : 1.;
+    }
+
+    P::trace(r, m, g);
+
+    for(i=0;i<m;i++){
+      rays[i0+i].x    = r.x[i];
+      rays[i0+i].y    = r.y[i];
+      rays[i0+i].z    = r.z[i];
+      rays[i0+i].vx   = r.vx[i];
+      rays[i0+i].vy   = r.vy[i];
+      rays[i0+i].vz   = r.vz[i];
+      rays[i0+i].opl  = r.opl[i];
+      rays[i0+i].lost = (r.live[i] == 0.);
+    }
+  }
+
+  return;
+}
+
+
+/* The instantiations.  Matching is on shape and role only, so e.g. any
+   hyperboloid or ellipsoid secondary takes the Conic slot. */
+typedef Prescription<Surface<Flat,        Block>,
+		     Surface<Paraboloid,  Reflect>,
+		     Surface<Flat,        Reflect>,
+		     Surface<Flat,        Detect> >   Newtonian;
+typedef Prescription<Surface<Hyperboloid, Block>,
+		     Surface<Paraboloid,  Reflect>,
+		     Surface<Hyperboloid, Reflect>,
+		     Surface<Flat,        Detect> >   Cassegrain;
+typedef Prescription<Surface<Hyperboloid, Block>,
+		     Surface<Hyperboloid, Reflect>,
+		     Surface<Hyperboloid, Reflect>,
+		     Surface<Flat,        Detect> >   RitcheyChretien;
+typedef Prescription<Surface<Paraboloid,  Reflect>,
+		     Surface<Flat,        Detect> >   PrimeFocus;
+
+struct Entry{
+  const char *name;
+  int         nelem;
+  bool      (*match)(const int *shape, const int *role);
+  void      (*trace)(scope_ray *rays, long n, const Geom *g);
+};
+
+#define KERNELS_ENTRY(name, P) { name, P::nelem, P::match, kernel<P> }
+
+const Entry table[] = {
+  KERNELS_ENTRY("newtonian",        Newtonian),
+  KERNELS_ENTRY("cassegrain",       Cassegrain),
+  KERNELS_ENTRY("ritchey-chretien", RitcheyChretien),
+  KERNELS_ENTRY("prime focus",      PrimeFocus)
+};
+
+const int ntable = sizeof(table) / sizeof(table[0]);
+
+}  // namespace
+
+
+/* Function to trace rays through the ordered list of elements, using the
+   specialized kernel for the prescription if there is one */
+/* Drop-in replacement for rays_trace(), which is what it calls otherwise. */
+void kernels_trace(scope_ray *rays, long n, scope_scope *scope,
+		   scope_element *elements, int nelem){
+
+  /* Variable Declarations */
+  int  e,j,k;
+  long i;
+  Geom g[KERNELS_MAXELEM];
+  scope_optic *optic;
+
+  k = kernels_match(scope, elements, nelem);
+  if(k < 0){
+    rays_trace(rays, n, scope, elements, nelem);
+    return;
+  }
+
+  for(e=0;e<nelem;e++){
+    optic = setup_get_optic(scope, elements[e].elem);
+    g[e].o[0] = optic->cx;
+    g[e].o[1] = optic->cy;
+    g[e].o[2] = optic->cz;
+    for(j=0;j<3;j++){
+      g[e].f[j][0] = optic->frame[j][0];
+      g[e].f[j][1] = optic->frame[j][1];
+      g[e].f[j][2] = optic->frame[j][2];
+    }
+    g[e].c  = mirrors_curvature(optic);
+    g[e].k1 = 1. + optic->k;
+    g[e].ia = 2. / optic->dmaj;
+    g[e].ib = 2. / optic->dmin;
+  }
+
+  /* The spider sits in the incoming beam, ahead of every element */
+  if(scope->spider.nvanes > 0)
+    for(i=0;i<n;i++)
+      rays_spider(&rays[i], &scope->spider);
+
+  table[k].trace(rays, n, g);
+
+  return;
+}
+
+
+/* Function to find the kernel for a prescription */
+/* Returns the index of the kernel, or -1 if only rays_trace() will do. */
+int kernels_match(scope_scope *scope, scope_element *elements, int nelem){
+
+  /* Variable Declarations */
+  int e,k;
+  int shape[KERNELS_MAXELEM],role[KERNELS_MAXELEM];
+  scope_optic *optic;
+
+  if(nelem <= 0 || nelem > KERNELS_MAXELEM)
+    return -1;
+
+  for(e=0;e<nelem;e++){
+    optic = setup_get_optic(scope, elements[e].elem);
+    if(optic == NULL)
+      return -1;
+    shape[e] = kernels_shape(optic);
+    role[e]  = kernels_role(&elements[e]);
+    if(role[e] < 0)
+      return -1;
+  }
+
+  for(k=0;k<ntable;k++)
+    if(table[k].nelem == nelem && table[k].match(shape, role))
+      return k;
+
+  return -1;
+}
+
+
+/* Function to name a kernel (-1: the generic trace) */
+const char *kernels_name(int kernel){
+
+  if(kernel < 0 || kernel >= ntable)
+    return "generic";
+
+  return table[kernel].name;
+}
+
+
+/* Function to classify the shape of an optic (KERNELS_FLAT, ...) */
+int kernels_shape(scope_optic *optic){
+
+  if(mirrors_curvature(optic) == 0.)
+    return KERNELS_FLAT;
+  if(optic->k == -1.)
+    return KERNELS_PARABOLOID;
+  if(optic->k == 0.)
+    return KERNELS_SPHERE;
+
+  return KERNELS_CONIC;
+}
+
+
+/* Function to classify the role of an element (-1: no kernel handles it) */
+/* Refraction and footprint maps are left to rays_trace(). */
+int kernels_role(scope_element *element){
+
+  if(element->refract || element->footprint != NULL)
+    return -1;
+  if(element->block)
+    return KERNELS_BLOCK;
+  if(element->reflect)
+    return KERNELS_REFLECT;
+
+  return KERNELS_DETECT;
+}
@@ -0,0 +1,69 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: kernels.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#define KERNELS_BATCH   256     // Rays per structure-of-arrays block
+#define KERNELS_MAXELEM 16      // Longest prescription with a kernel
+
+/* Surface shapes, as far as they matter to the specialized kernels */
+#define KERNELS_FLAT       0    // Zero curvature
+#define KERNELS_SPHERE     1    // k = 0
+#define KERNELS_PARABOLOID 2    // k = -1
+#define KERNELS_CONIC      3    // Any other k (hyperboloid, ellipsoid)
+
+/* What an element does to the rays that reach it */
+#define KERNELS_BLOCK      0    // Obstruction
+#define KERNELS_REFLECT    1    // Mirror
+#define KERNELS_DETECT     2    // Rays stop on it (detector)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Function declarations */
+
+/* Public Functions */
+void        kernels_trace(scope_ray *rays, long n, scope_scope *scope,
+			  scope_element *elements, int nelem);
+int         kernels_match(scope_scope *scope, scope_element *elements,
+			  int nelem);
+const char *kernels_name(int kernel);
+
+/* Internal Functions */
+int         kernels_shape(scope_optic *optic);
+int         kernels_role(scope_element *element);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* KERNELS_H */
+
+
+
@@ -30,7 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-//#include <string.h>
+#include <string.h>
 //#include <math.h>
 #include <argtable2.h>
 #if HAVE_PTHREAD_H
@@ -46,13 +46,68 @@
 #include "setup.h"
 #include "display.h"
 #include "ui.h"
+#include "sampler.h"
+#include "imsim.h"
+#include "psfcache.h"
+#include "pupil.h"
+#include "bundle.h"
+#include "pool.h"
+#include "alloc.h"
+#include "fitsw.h"
+#include "writer.h"
+#include "sweep.h"
+#include "optim.h"
+#include "tolerance.h"
+#include "vignet.h"
+#include "spot.h"
+#include "glass.h"
+#include "kernels.h"
+#include "server.h"
+#include "quadtree.h"
+#include "footprint.h"
+#include "demo.h"
 
 /* Test Code */
 
 
 /* Define the argument structure containing the relevant information... */
 typedef struct{
-  int i;
+  int    target;        // TARGET type for the illumination environment
+  char  *image;         // FITS image for TARGET_IMAGE illumination
+  double pixscale;      // Pixel scale of the image (arcsec / pixel)
+  char  *simulate;      // Output FITS for PSF-grid image simulation
+  char  *psfcache;      // PSF cache directory (NULL to disable)
+  double cachesize;     // PSF cache size cap (MB)
+  double field;         // Field angle of the point source (arcsec)
+  char  *diffraction;   // Root name for diffraction OPD / PSF / MTF output
+  int    compact;       // Trace the point source with compact ray bundles
+  double progress;      // Seconds between progressive snapshots (0 = off)
+  char  *sweep;         // Design-space sweep specification (NULL = none)
+  char  *sweepout;      // Output FITS table for the sweep
+  char  *optimize;      // Parameters to optimize (NULL = none)
+  char  *tolerance;     // Tolerances for Monte Carlo trials (NULL = none)
+  long   trials;        // Number of tolerancing trials
+  char  *vignetting;    // Output FITS relative-illumination map
+  double fov;           // Half-width of the flat field (arcsec, 0 = none)
+  int    shard[2];      // Trace slice i of N (--shard i/N)
+  long   nrays;         // Rays in the whole compact trace
+  char  *spot;          // Output FITS spot accumulator
+  char  *merge;         // Output FITS for merged shards (NULL = no merge)
+  char **parts;         // Shard accumulators to merge
+  int    nparts;
+  double checkpoint;    // Seconds between checkpoints (0 = none)
+  int    resume;        // Resume the trace from its checkpoint
+  long   nsample;       // Rays kept in the spot file for spot diagrams
+  int    batch;         // Headless: no splash, GUI, DS9 or closing pause
+  int    display;       // With --batch, send display output to DS9 anyway
+  int    serve;         // Stay up as an XPA server for re-traces
+  char  *render;        // Output FITS of the quadtree spot (NULL = none)
+  long   rnpix;         // Width of the --render image (pixels)
+  double region[4];     // --render region u0,u1,v0,v1 (m; u1 <= u0: all)
+  char  *footprint;     // Elements to map footprints on (NULL = none)
+  char  *footroot;      // Root name of the footprint maps
+  int    lens;          // Lens ahead of the focal plane (DEMO_LENS_*)
+  int    glass;         // Glass of the lens (GLASS_*)
 } args;
 
 
@@ -61,7 +116,10 @@ typedef struct{
 /* Declare functions to be consumed here only */
 static void  print_usage();            // Delaration for print_usage() function
 static void *print_it(void *data);     // print_it from the Jupiter project
-static void  parse_argtable(int argc, char *argv[]);
+static void  parse_argtable(int argc, char *argv[], args *opts);
+static int   main_trace_compact(scope_scope *scope, scope_element *elements,
+				int nelem, scope_illum *illum,
+				scope_pool *pool, args *opts);
 
 
 /* ================= */
@@ -77,10 +135,20 @@ int main(int argc, char *argv[])
   double        over;
   char         *fn_startpos;
   scope_display display_str;
+  scope_illum   illum;
+  scope_imsim   imsim;
+  scope_sweep   sweep;
+  scope_optim   optim;
+  scope_tolerance tolerance;
+  scope_psfcache *cache = NULL;
+  scope_pool   *pool;
+  scope_writer *writer;
+  args          opts;
+  double        tstart = progress_time();
   
   
-  /* TEST ARGTABLE */
-  parse_argtable(argc, argv);
+  /* Parse the command line */
+  parse_argtable(argc, argv, &opts);
   
   /************ CODE OUTLINE ************/
   /* 
@@ -96,25 +164,34 @@ int main(int argc, char *argv[])
      7.  Other?
   */
   
+  /* Merge mode: combine the partial accumulators of a sharded trace; no
+     telescope is needed */
+  if(opts.merge != NULL)
+    return spot_merge_files(opts.parts, opts.nparts, opts.merge);
+  
   /* Initialize system type and check available RAM */
   init_get_sysinfo();
   
-  /* Display a splash screen! */
-  display_splash(0);
+  /* Display a splash screen!  (Not in batch mode, where GTK and DS9 are
+     left alone unless display output is asked for) */
+  if(!opts.batch){
+    display_splash(0);
 #if HAVE_GTK3
-  ui_example_window();
+    ui_example_window();
 #endif
+  }
+  display_enable(!opts.batch || opts.display);
   
   /* Initialize N_RAYS */
-  init_set_nrays();
-  
+  init_set_nrays(opts.compact);
   
-  /* Open DS9 in a separate thread while the code computes the geometry and
-     initializes the gazillion rays needed. */
-  int       ds9stat = DS9_WHATEVER; //DS9_CANIBALIZE;
-  pthread_t tid_ds9;
-  pthread_create(&tid_ds9, 0, display_ds9_open, &ds9stat);
+  /* Start the worker threads, pinned NUMA node by node */
+  pool = pool_create(0);
+  fitsw_set_pool(pool);
+  printf("Worker threads: %d\n",pool->nthreads);
   
+  /* DS9 is not opened here: the first display call finds (or launches) it,
+     so modes that never display anything never wait for it */
   
   
   /* Set up the telescope geometry */
@@ -122,12 +199,140 @@ int main(int argc, char *argv[])
   scope_scope    telescope;
   scope_element *elements;
   
-  sval = setup_initialize_geometry(&telescope,elements,&nelem);
+  sval = setup_initialize_geometry(&telescope,&elements,&nelem);
+  if(demo_lens(&telescope, &elements, &nelem, opts.lens, opts.glass))
+    return 1;
   printf("Number of elements rays must interact with: %d\n",nelem);
+  if(opts.footprint != NULL &&
+     footprint_attach(&telescope, elements, nelem, opts.footprint))
+    return 1;
+  printf("Trace kernel: %s\n",
+	 kernels_name(kernels_match(&telescope, elements, nelem)));
   
   
   /* Set up the illumination environment */
-  sval = setup_initialize_illumination(TARGET_POINT);
+  illum.angle    = opts.field * M_PI / 648000.;        // arcsec -> radians
+  illum.lambda   = 5500.;
+  illum.image    = opts.image;
+  illum.pixscale = opts.pixscale * M_PI / 648000.;     // arcsec -> radians
+  illum.fov      = opts.fov * M_PI / 648000.;          // arcsec -> radians
+  illum.ngrid[0] = VIGNET_NGRID;
+  illum.ngrid[1] = VIGNET_NGRID;
+  
+  /* Indices of refraction at the wavelength(s) in use, once for the run */
+  glass_tabulate(&illum.lambda, 1);
+  
+  printf("Startup: %0.3f ms\n", 1.e3 * (progress_time() - tstart));
+  
+  /* Server mode: keep everything warm and trace on request over XPA */
+  if(opts.serve){
+    sval = server_run(&telescope, elements, nelem, &illum, pool, opts.nrays,
+		      opts.nsample);
+    free(elements);
+    pool_destroy(pool);
+    return sval;
+  }
+  
+  /* Sweep mode: trace a grid of Newtonian prescriptions around the demo
+     design, all with the same pupil sample, and tabulate their merit */
+  if(opts.sweep != NULL){
+    sval = sweep_parse(opts.sweep, &sweep);
+    if(sval == 0){
+      if(opts.field > 0)
+	sweep.field = illum.angle;
+      sweep.lambda = illum.lambda;
+      sval = sweep_run(&sweep, opts.sweepout, pool);
+    }
+    free(elements);
+    pool_destroy(pool);
+    return sval;
+  }
+  
+  /* Optimizer mode: adjust the listed optic parameters to minimize the RMS
+     spot on axis and at the field angle */
+  if(opts.optimize != NULL){
+    sval = optim_parse(opts.optimize, &optim);
+    if(sval == 0){
+      if(opts.field > 0)
+	optim.field[1] = illum.angle;
+      optim.lambda = illum.lambda;
+      sval = optim_run(&optim, &telescope, elements, nelem, pool);
+    }
+    free(elements);
+    pool_destroy(pool);
+    return sval;
+  }
+  
+  /* Tolerancing mode: thousands of cheaply traced, randomly perturbed copies
+     of the design, each refocused, for the spread of the RMS spot */
+  if(opts.tolerance != NULL){
+    sval = tolerance_parse(opts.tolerance, &tolerance);
+    if(sval == 0){
+      if(opts.field > 0)
+	tolerance.field[1] = illum.angle;
+      tolerance.lambda = illum.lambda;
+      tolerance.ntrial = opts.trials;
+      sval = tolerance_run(&tolerance, &telescope, elements, nelem, pool);
+    }
+    free(elements);
+    pool_destroy(pool);
+    return sval;
+  }
+  
+  /* Vignetting mode: relative illumination over a flat field of point
+     sources, one small stratified sample per field point */
+  if(opts.vignetting != NULL){
+    if(illum.fov <= 0.)
+      illum.fov = VIGNET_FOV * M_PI / 648000.;
+    sval = setup_initialize_illumination(TARGET_POINTS, &illum);
+    if(sval == 0)
+      sval = vignet_map(&illum, opts.vignetting, &telescope, elements, nelem,
+			pool);
+    free(elements);
+    pool_destroy(pool);
+    return sval;
+  }
+  
+  /* Diffraction mode: OPD, Zernikes, PSF & MTF for the point source */
+  if(opts.diffraction != NULL){
+    sval = pupil_diffraction(&telescope, elements, nelem, illum.angle, 0.,
+			     illum.lambda, opts.diffraction);
+    free(elements);
+    pool_destroy(pool);
+    return sval;
+  }
+  
+  /* Compact mode: trace the point source using compact ray bundles, which
+     fit ~3.6x as many rays into the same memory */
+  if(opts.compact){
+    sval = main_trace_compact(&telescope, elements, nelem, &illum, pool,
+			      &opts);
+    footprint_detach(elements, nelem);
+    free(elements);
+    pool_destroy(pool);
+    return sval;
+  }
+  
+  /* Image-simulation mode: convolve the source image with a grid of traced
+     PSFs, rather than tracing rays drawn from it */
+  if(opts.simulate != NULL){
+    imsim_defaults(&imsim);
+    imsim.lambda = illum.lambda;
+    if(opts.psfcache != NULL)
+      cache = psfcache_open(opts.psfcache, opts.cachesize);
+    sval = imsim_simulate(&illum, opts.simulate, &telescope, elements, nelem,
+			  &imsim, cache);
+    psfcache_close(cache);
+    free(elements);
+    pool_destroy(pool);
+    return sval;
+  }
+  
+  sval = setup_initialize_illumination(opts.target, &illum);
+  if(sval){
+    fprintf(stderr,"Unable to set up the illumination environment.\n");
+    return 1;
+  }
   
   
   
@@ -135,7 +340,7 @@ int main(int argc, char *argv[])
   /* Initialize the rays, and write out FITS containing:
      starting positions
      starting angles */
-  rays = rays_initialize(TARGET_POINT, &ir_stat, &over);
+  rays = rays_initialize(&illum, pool, &ir_stat, &over);
   
   printf("N_RAYS = %lu\n",N_RAYS);
   
@@ -143,11 +348,16 @@ int main(int argc, char *argv[])
   printf("Ray status = %d, Overshoot = %0.3f, Theory = %0.3f\n",
 	 ir_stat,over,4./M_PI);
   
+  /* The ray starting locations go straight to the DS9 window */
+  memset(&display_str, 0, sizeof(scope_display));
+  display_str.cmap = strdup(CMAP_BB);
+  
+  /* Display ray starting location in the DS9 window (and write it out) */
+  writer = writer_create(0);
   fn_startpos = images_write_locations(rays, OPTIC_INF, telescope.name,
-				       &wfp_stat);
+				       writer, &display_str, &wfp_stat);
   printf("File location and status: %s %d\n",fn_startpos, wfp_stat);
   
-  /* Display ray starting location in the DS9 window */
   display_ds9_talk(DS9_GET, &display_str);
   
   
@@ -157,13 +367,13 @@ int main(int argc, char *argv[])
 	 sizeof(scope_ray),sizeof(double),sizeof(int),sizeof(bool));
   printf("Rays: %0.3e\n",sizeof(scope_ray)*(double)N_RAYS);
   
-  free(rays);
+  wfp_stat = writer_destroy(writer);   // Waits for the files to be written
+  printf("Writer status: %d\n",wfp_stat);
+  alloc_free(rays);
+  pool_destroy(pool);
   free(elements);
   free(fn_startpos);  
-  
-  /* Rejoin DS9 thread here... */
-  printf("Pausing here until the Open_DS9 thread rejoins...\n");
-  pthread_join(tid_ds9, 0);
+  sampler_alias_free(illum.table);
 
   /* TEST CODE */
   
@@ -213,7 +423,9 @@ int main(int argc, char *argv[])
   
   // display_ds9_talk();
   
-  sleep(5);
+  /* Leave the window up a moment before closing it; never in batch mode */
+  if(!opts.batch && display_ds9_active())
+    sleep(5);
   
   display_ds9_close();
   
@@ -222,6 +434,222 @@ int main(int argc, char *argv[])
 
 
 
+/* Trace rays from the point source as compact bundles, and report the spot
+   on the detector */
+/* The trace is set by the command-line options in opts.  Its nrays rays
+   (<= 0: N_RAYS, unsharded only) are split into shard[1] slices, of which
+   this process traces slice shard[0], N_RAYS at a time.  Rays are seeded
+   by their index in the whole trace (rays_fill_counter()), so the
+   accumulators written to the spot files by the shards merge into exactly
+   the trace a single process would have done.  A small pilot trace, the
+   same in every shard, sets the histogram window.  With progress > 0, a
+   preview of the spot is shown every `progress' seconds.  A random sample
+   of nsample of the rays reaching the detector goes into the spot file
+   too, for spot diagrams.
+
+   Every `checkpoint' seconds the accumulator so far is written to
+   <spot>.ckpt in the background.  Since the rays are seeded by index,
+   the next ray index is the whole state of the trace, and with resume
+   the trace picks up there (with the batch size of the original run) and
+   finishes exactly as it would have without the interruption.  A
+   checkpoint that cannot be written is warned about, and the trace goes
+   on.
+
+   With render, every ray reaching the detector also goes into a quadtree
+   rooted QUADTREE_ROOT RMS radii around the pilot spot, which is rendered
+   at the end into the FITS file render, rnpix pixels across, over region
+   (u0,u1,v0,v1; the whole root if u1 <= u0).  The tree only sees the rays
+   traced by this run, so render cannot be combined with resume.  Its
+   points stay within QUADTREE_BUDGET (coarser cells past that); should
+   the tree run out of memory anyway, it is dropped with a warning and
+   the trace goes on without it.
+
+   Elements carrying footprint maps (see footprint_attach()) have them
+   filled by the same trace, and written at the end to footroot_<e>.fits;
+   like render, they cannot be combined with resume. */
+static int main_trace_compact(scope_scope *scope, scope_element *elements,
+			      int nelem, scope_illum *illum, scope_pool *pool,
+			      args *opts){
+  
+  /* Variable Declarations */
+  int    e,status=0,footprints=0,ckstat;
+  int   *shard=opts->shard;
+  long   k,k0,k1,n,nrays=opts->nrays;
+  double cen[2],rms,tlast,rlo[2],rhi[2];
+  char  *ckfile;
+  scope_bundle *bundle,*pilot;
+  scope_progress *prog=NULL;
+  scope_spot *spot=NULL;
+  scope_quadtree *qt=NULL;
+  scope_writer *writer;
+  
+  for(e=0;e<nelem;e++)
+    footprints += (elements[e].footprint != NULL);
+  if((opts->render != NULL || footprints) && opts->resume){
+    fprintf(stderr,"Error: --render and --footprint need the whole trace; "
+	    "they cannot be used with --resume.\n");
+    return -1;
+  }
+  
+  ckfile = (char *)malloc(strlen(opts->spot) + 6);
+  sprintf(ckfile, "%s.ckpt", opts->spot);
+  
+  /* Pick up the accumulator from the checkpoint, or start a new one */
+  if(opts->resume){
+    if((spot = spot_read(ckfile, &status)) == NULL){
+      fprintf(stderr,"Error: no checkpoint %s to resume from.\n",ckfile);
+      free(ckfile);
+      return (status) ? status : -1;
+    }
+    if(nrays <= 0)
+      nrays = spot->ntotal;
+  } else if(nrays <= 0)
+    nrays = N_RAYS;                     // Unsharded: --rays is optional
+  k0 = (long)((double)nrays * shard[0] / shard[1]);
+  k1 = (long)((double)nrays * (shard[0] + 1) / shard[1]);
+  
+  if(opts->resume){
+    if(spot->seed != SPOT_SEED || spot->ntotal != nrays ||
+       spot->range[0] != k0 || spot->range[1] > k1){
+      fprintf(stderr,"Error: checkpoint %s covers rays %ld to %ld of %ld, "
+	      "not shard %d/%d.\n",ckfile,spot->range[0],spot->range[1]-1,
+	      spot->ntotal,shard[0],shard[1]);
+      spot_free(spot);
+      free(ckfile);
+      return -1;
+    }
+    printf("Resuming from %s at ray %ld\n",ckfile,spot->range[1]);
+    cen[0] = spot->lo[0] + 0.5 * spot->npix * spot->pix;
+    cen[1] = spot->lo[1] + 0.5 * spot->npix * spot->pix;
+    rms    = 0.1 * spot->npix * spot->pix;
+  }
+  
+  printf("Compact rays: %0.3f bytes each (vs. %ld), %0.3e rays in %0.3e B\n",
+	 bundle_raysize(),sizeof(scope_ray),(double)N_RAYS,
+	 bundle_raysize()*(double)N_RAYS);
+  if(shard[1] > 1)
+    printf("Shard %d of %d: rays %ld to %ld of %ld\n",shard[0],shard[1],
+	   k0,k1-1,nrays);
+  
+  /* Pilot trace to find where (and how big) the spot is */
+  if(spot == NULL){
+    pilot = bundle_alloc(PROGRESS_PILOT, NULL, &status);
+    if(!status)
+      status = bundle_fill_counter(pilot, 0, SPOT_SEED + 1, &scope->primary,
+				   illum->angle, 0., illum->lambda);
+    if(!status)
+      status = bundle_trace(pilot, NULL, scope, elements, nelem, NULL);
+    if(!status){
+      bundle_spot(pilot, cen, &rms);
+      spot = spot_create(cen, 5. * rms, k0, nrays, SPOT_SEED,
+			 opts->nsample);
+      /* Bundles of N_RAYS, but no bigger than this shard's slice */
+      spot->batch = GSL_MIN((long)N_RAYS, GSL_MAX(k1 - k0, 1));
+    }
+    bundle_free(pilot);
+    footprint_clear(elements, nelem);  // The pilot is not part of the trace
+    if(status){
+      free(ckfile);
+      return status;
+    }
+  }
+  
+  bundle = bundle_alloc(spot->batch, pool, &status);
+  if(status){
+    spot_free(spot);
+    free(ckfile);
+    return status;
+  }
+  printf("Bundle memory: %s pages\n",alloc_kind(bundle->pos));
+  
+  if(opts->render != NULL){
+    rlo[0] = cen[0] - QUADTREE_ROOT * rms;
+    rlo[1] = cen[1] - QUADTREE_ROOT * rms;
+    if((qt = quadtree_create(rlo, 2. * QUADTREE_ROOT * rms, 0, 0, 0.))
+       == NULL)
+      fprintf(stderr,"Warning: no quadtree, so no %s.\n",opts->render);
+  }
+  
+  if(opts->progress > 0.)
+    prog = progress_create(pool->nthreads, k1 - spot->range[1], cen,
+			   5. * rms, opts->progress);
+  writer = writer_create(0);
+  tlast  = progress_time();
+  
+  /* This shard's slice of the trace, a bundle at a time */
+  for(k=spot->range[1]; k < k1 && !status; k += n){
+    n = GSL_MIN(spot->batch, k1 - k);
+    bundle->n = n;
+    status = bundle_fill_counter(bundle, k, SPOT_SEED, &scope->primary,
+				 illum->angle, 0., illum->lambda);
+    if(!status)
+      status = bundle_trace(bundle, pool, scope, elements, nelem, prog);
+    if(status)
+      break;
+    spot_add(spot, bundle, 0, n);
+    if(qt != NULL && quadtree_add_bundle(qt, bundle, 0, n)){
+      /* The spot is what matters: drop the tree, keep tracing */
+      fprintf(stderr,"Warning: quadtree out of memory, so no %s.\n",
+	      opts->render);
+      quadtree_free(qt);
+      qt = NULL;
+    }
+    
+    /* A failed checkpoint only costs the ability to resume: warn and
+       trace on.  The writer works in the background, so its errors show
+       up a checkpoint late. */
+    if(opts->checkpoint > 0. && k + n < k1 &&
+       progress_time() - tlast >= opts->checkpoint){
+      ckstat = spot_checkpoint(spot, writer, ckfile, scope->name);
+      if(writer_take_status(writer) || ckstat)
+	fprintf(stderr,"Warning: unable to write checkpoint %s; tracing "
+		"on.\n",ckfile);
+      tlast = progress_time();
+    }
+  }
+  progress_finish(prog);
+  if(writer_flush(writer) && writer_take_status(writer))
+    fprintf(stderr,"Warning: unable to write checkpoint %s.\n",ckfile);
+  
+  /* Render the tree, through the writer like the checkpoints */
+  if(qt != NULL && !status){
+    printf("Quadtree: %ld cells for %ld rays (%ld outside the root)\n",
+	   qt->nnode,qt->node[0].count,qt->nout);
+    rlo[0] = opts->region[0];
+    rhi[0] = opts->region[1];
+    rlo[1] = opts->region[2];
+    rhi[1] = opts->region[3];
+    if(quadtree_write(qt, writer, opts->render,
+		      (rhi[0] > rlo[0]) ? rlo : NULL,
+		      (rhi[0] > rlo[0]) ? rhi : NULL, opts->rnpix, scope->name))
+      fprintf(stderr,"Warning: unable to write %s.\n",opts->render);
+  }
+  if(footprints && !status &&
+     footprint_write_all(elements, nelem, writer, opts->footroot,
+			 scope->name))
+    fprintf(stderr,"Warning: unable to write the footprint maps.\n");
+  if(writer_destroy(writer))
+    fprintf(stderr,"Warning: the --render image or footprint maps could not"
+	    " be written.\n");
+  quadtree_free(qt);
+  
+  if(!status){
+    printf("%ld of %0.3e rays reach the detector; centroid (%+0.3f, %+0.3f)"
+	   " mm, RMS %0.3f um\n",spot->ngood,(double)spot->nray,
+	   spot->mean[0]*1.e3,spot->mean[1]*1.e3,spot_rms(spot)*1.e6);
+    spot_write(spot, opts->spot, scope->name, &status);
+    if(!status)
+      remove(ckfile);                  // Finished: the checkpoint is stale
+  }
+  
+  spot_free(spot);
+  bundle_free(bundle);
+  free(ckfile);
+  
+  return status;
+}
+
+
 /* prints out usage information if command line arguments are not correct */
 static void print_usage(){
   
@@ -247,21 +675,53 @@ static void *print_it(void * data)
 
 
 
-static void parse_argtable(int argc, char *argv[]){
-  /* TEST ARGTABLE */
-  struct arg_lit  *list    = arg_lit0("lL",NULL,                      "list files");
-  struct arg_lit  *recurse = arg_lit0("R",NULL,                       "recurse through subdirectories");
-  struct arg_int  *repeat  = arg_int0("k","scalar",NULL,              "define scalar value k (default is 3)");
-  struct arg_str  *defines = arg_strn("D","define","MACRO",0,argc+2,  "macro definitions");
-  struct arg_file *outfile = arg_file0("o",NULL,"<output>",           "output file (default is \"-\")");
-  struct arg_lit  *verbose = arg_lit0("v","verbose,debug",            "verbose messages");
-  struct arg_lit  *help    = arg_lit0(NULL,"help",                    "print this help and exit");
-  struct arg_lit  *version = arg_lit0(NULL,"version",                 "print version information and exit");
-  struct arg_file *infiles = arg_filen(NULL,NULL,NULL,1,argc+2,       "input file(s)");
-  struct arg_end  *end     = arg_end(20);
-  void* argtable[] = {list,recurse,repeat,defines,outfile,verbose,help,version,infiles,end};
-  const char* progname = "myprog";
-  int nerrors;
+static void parse_argtable(int argc, char *argv[], args *opts){
+  
+  struct arg_file *image    = arg_file0("i","image","<fits>",            "sample ray directions from a FITS image");
+  struct arg_dbl  *pixscale = arg_dbl0(NULL,"pixscale","<arcsec>",       "image pixel scale (default is 1.0)");
+  struct arg_file *simulate = arg_file0(NULL,"simulate","<fits>",        "simulate the focal-plane image of --image");
+  struct arg_dbl  *field    = arg_dbl0(NULL,"field","<arcsec>",          "field angle of the point source (default is 0)");
+  struct arg_str  *diffract = arg_str0(NULL,"diffraction","<root>",      "write diffraction OPD, PSF & MTF to <root>_*.fits");
+  struct arg_lit  *compact  = arg_lit0(NULL,"compact",                   "trace the point source with compact (float) rays");
+  struct arg_dbl  *progress = arg_dbl0(NULL,"progress","<sec>",          "with --compact, preview the spot every <sec> s");
+  struct arg_str  *sweep    = arg_str0(NULL,"sweep","<spec>",           "sweep designs, e.g. fratio=4:8:5,dsec=0.04:0.06:3");
+  struct arg_file *sweepout = arg_file0(NULL,"sweep-out","<fits>",       "FITS table for --sweep (default is sweep.fits)");
+  struct arg_str  *optimize = arg_str0(NULL,"optimize","<list>",        "optimize optic parameters, e.g. fp.cx,sec.cz,pri.k");
+  struct arg_str  *tolerance= arg_str0(NULL,"tolerance","<spec>",       "tolerance trials, e.g. sec.tilt=2e-3,pri.decenter=1e-3");
+  struct arg_int  *trials   = arg_int0(NULL,"trials","<n>",              "number of --tolerance trials (default is 2000)");
+  struct arg_file *vignet   = arg_file0(NULL,"vignetting","<fits>",      "write a relative-illumination map of the field");
+  struct arg_dbl  *fov      = arg_dbl0(NULL,"fov","<arcsec>",            "half-width of a flat field of point sources");
+  struct arg_str  *shard    = arg_str0(NULL,"shard","<i/N>",            "with --compact, trace slice i (0..N-1) of N");
+  struct arg_dbl  *nrays    = arg_dbl0(NULL,"rays","<n>",               "rays in the whole --compact or --serve trace (needed with --shard)");
+  struct arg_file *spot     = arg_file0(NULL,"spot","<fits>",           "spot accumulator (default is spot.fits or spot_<i>.fits)");
+  struct arg_file *merge    = arg_file0(NULL,"merge","<fits>",          "merge the shard accumulators <file>... into <fits>");
+  struct arg_file *parts    = arg_filen(NULL,NULL,"<file>",0,1024,      "shard accumulators for --merge");
+  struct arg_dbl  *ckpt     = arg_dbl0(NULL,"checkpoint","<sec>",        "with --compact, checkpoint every <sec> s (default is 600)");
+  struct arg_lit  *resume   = arg_lit0(NULL,"resume",                    "with --compact, resume the trace from its checkpoint");
+  struct arg_int  *nsample  = arg_int0(NULL,"sample","<n>",              "with --compact, rays kept for spot diagrams (default is 10000)");
+  struct arg_lit  *batch    = arg_lit0(NULL,"batch",                     "headless: no splash, GUI or DS9, and no pause at exit");
+  struct arg_lit  *display  = arg_lit0(NULL,"display",                   "with --batch, still send images to DS9");
+  struct arg_lit  *serve    = arg_lit0(NULL,"serve",                     "stay up as XPA server " SERVER_NAME " for re-traces");
+  struct arg_file *render   = arg_file0(NULL,"render","<fits>",          "with --compact, render an adaptive-resolution spot image");
+  struct arg_int  *rnpix    = arg_int0(NULL,"render-npix","<n>",         "pixels across the --render image (default is 1024)");
+  struct arg_str  *region   = arg_str0(NULL,"render-region","<u0,u1,v0,v1>","detector region (m) to --render (default is all)");
+  struct arg_str  *footprt  = arg_str0(NULL,"footprint","<list>",        "with --compact, map where rays strike elements, e.g. 1,2 or all");
+  struct arg_str  *footroot = arg_str0(NULL,"footprint-out","<root>",    "write footprint maps to <root>_<e>.fits (default is footprint)");
+  struct arg_str  *lens     = arg_str0(NULL,"lens","<name>",           "lens ahead of the focal plane: barlow or window");
+  struct arg_str  *glass    = arg_str0(NULL,"glass","<name>",          "glass of the --lens, e.g. F2 or CaF2 (default is N-BK7)");
+  struct arg_file *psfdir   = arg_file0(NULL,"psfcache","<dir>",         "PSF cache directory (default is \"" PSFCACHE_DIR "\")");
+  struct arg_dbl  *psfsize  = arg_dbl0(NULL,"psfcache-size","<MB>",      "PSF cache size cap (default is 256)");
+  struct arg_lit  *nocache  = arg_lit0(NULL,"no-psfcache",               "always trace PSFs, never use the cache");
+  struct arg_lit  *help     = arg_lit0(NULL,"help",                      "print this help and exit");
+  struct arg_lit  *version  = arg_lit0(NULL,"version",                   "print version information and exit");
+  struct arg_end  *end      = arg_end(20);
+  void* argtable[] = {image,pixscale,simulate,field,diffract,compact,progress,
+		     sweep,sweepout,optimize,tolerance,trials,vignet,fov,
+		     shard,nrays,spot,merge,parts,ckpt,resume,nsample,
+		     batch,display,serve,render,rnpix,region,footprt,footroot,
+		     lens,glass,psfdir,psfsize,nocache,help,version,end};
+  const char* progname = "scopedesign";
+  int nerrors,i;
   int exitcode=0;
   
   
@@ -270,13 +730,195 @@ static void parse_argtable(int argc, char *argv[]){
     {
       /* NULL entries were detected, some allocations must have failed */
       printf("%s: insufficient memory\n",progname);
+      exit(1);
+    }
+  
+  /* Set defaults, then parse */
+  pixscale->dval[0] = 1.0;
+  field->dval[0]    = 0.0;
+  sweepout->filename[0] = "sweep.fits";
+  trials->ival[0]   = TOLERANCE_TRIALS;
+  ckpt->dval[0]     = SPOT_CHECKPOINT;
+  nsample->ival[0]  = SPOT_SAMPLE;
+  rnpix->ival[0]    = QUADTREE_NPIX;
+  psfdir->filename[0] = PSFCACHE_DIR;
+  psfsize->dval[0]  = PSFCACHE_MAXSIZE;
+  nerrors = arg_parse(argc,argv,argtable);
+  
+  if (help->count > 0)
+    {
+      print_usage();
+      arg_print_glossary(stdout,argtable,"  %-25s %s\n");
+      arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
+      exit(0);
+    }
+  
+  if (version->count > 0)
+    {
+      printf("%s version %s\n",progname,PACKAGE_VERSION);
+      arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
+      exit(0);
+    }
+  
+  if (nerrors > 0)
+    {
+      arg_print_errors(stdout,end,progname);
+      printf("Try '%s --help' for more information.\n",progname);
       exitcode=1;
+      arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
+      exit(exitcode);
+    }
+  
+  /* Copy the results into the options structure */
+  opts->target   = TARGET_POINT;
+  opts->image    = NULL;
+  if (image->count > 0)
+    {
+      opts->target = TARGET_IMAGE;
+      opts->image  = strdup(image->filename[0]);
+    }
+  if (fov->count > 0 && image->count == 0)
+    opts->target = TARGET_POINTS;              // Flat field of point sources
+  opts->pixscale = pixscale->dval[0];
+  opts->simulate = NULL;
+  if (simulate->count > 0)
+    {
+      if (image->count == 0)
+	{
+	  printf("%s: --simulate requires an --image to simulate\n",progname);
+	  arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
+	  exit(1);
+	}
+      opts->simulate = strdup(simulate->filename[0]);
+    }
+  opts->field       = field->dval[0];
+  opts->compact     = (compact->count > 0);
+  opts->progress    = (progress->count > 0) ? progress->dval[0] : 0.;
+  opts->diffraction = (diffract->count > 0) ? strdup(diffract->sval[0]) : NULL;
+  opts->sweep       = (sweep->count > 0) ? strdup(sweep->sval[0]) : NULL;
+  opts->sweepout    = strdup(sweepout->filename[0]);
+  opts->optimize    = (optimize->count > 0) ? strdup(optimize->sval[0]) : NULL;
+  opts->tolerance   = (tolerance->count > 0) ? strdup(tolerance->sval[0]) : NULL;
+  opts->trials      = GSL_MAX_INT(trials->ival[0], 1);
+  opts->vignetting  = (vignet->count > 0) ? strdup(vignet->filename[0]) : NULL;
+  opts->fov         = (fov->count > 0) ? fov->dval[0] : 0.;
+  opts->shard[0] = 0;
+  opts->shard[1] = 1;
+  if (shard->count > 0 &&
+      (sscanf(shard->sval[0], "%d/%d", &opts->shard[0], &opts->shard[1]) != 2
+       || opts->shard[1] < 1 || opts->shard[0] < 0
+       || opts->shard[0] >= opts->shard[1]))
+    {
+      printf("%s: --shard must be i/N with 0 <= i < N\n",progname);
+      arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
+      exit(1);
+    }
+  opts->nrays = (nrays->count > 0) ? (long)nrays->dval[0] : 0;
+  if (opts->shard[1] > 1 && opts->nrays <= 0)
+    {
+      /* N_RAYS follows each host's RAM, so shards on different nodes would
+	 not agree on the total (and --merge would refuse them) */
+      printf("%s: --shard i/N with N > 1 needs the total --rays\n",progname);
+      arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
+      exit(1);
+    }
+  if (spot->count > 0)
+    opts->spot = strdup(spot->filename[0]);
+  else
+    {
+      opts->spot = (char *)malloc(32 * sizeof(char));
+      if (opts->shard[1] > 1)
+	sprintf(opts->spot, "spot_%d.fits", opts->shard[0]);
+      else
+	sprintf(opts->spot, "spot.fits");
+    }
+  opts->checkpoint = GSL_MAX(ckpt->dval[0], 0.);
+  opts->resume     = (resume->count > 0);
+  opts->nsample    = GSL_MAX_INT(nsample->ival[0], 0);
+  opts->batch      = (batch->count > 0);
+  opts->display    = (display->count > 0);
+  opts->serve      = (serve->count > 0);
+  opts->render     = (render->count > 0) ? strdup(render->filename[0]) : NULL;
+  opts->rnpix      = GSL_MAX_INT(rnpix->ival[0], 1);
+  opts->region[0]  = opts->region[1] = opts->region[2] = opts->region[3] = 0.;
+  if (region->count > 0 &&
+      (sscanf(region->sval[0], "%lf,%lf,%lf,%lf", &opts->region[0],
+	      &opts->region[1], &opts->region[2], &opts->region[3]) != 4
+       || opts->region[1] <= opts->region[0]
+       || opts->region[3] <= opts->region[2]))
+    {
+      printf("%s: --render-region must be u0,u1,v0,v1 with u0 < u1, v0 < v1\n",
+	     progname);
+      arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
+      exit(1);
+    }
+  opts->merge  = NULL;
+  opts->nparts = parts->count;
+  if (merge->count > 0)
+    {
+      if (parts->count == 0)
+	{
+	  printf("%s: --merge needs the shard files to merge\n",progname);
+	  arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
+	  exit(1);
+	}
+      opts->merge = strdup(merge->filename[0]);
+      opts->parts = (char **)malloc(parts->count * sizeof(char *));
+      for (i=0; i < parts->count; i++)
+	opts->parts[i] = strdup(parts->filename[i]);
+    }
+  opts->footprint = NULL;
+  if (footprt->count > 0)
+    {
+      if (!opts->compact)
+	{
+	  printf("%s: --footprint needs --compact\n",progname);
+	  arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
+	  exit(1);
+	}
+      opts->footprint = strdup(footprt->sval[0]);
+    }
+  if (footroot->count > 0)
+    opts->footroot = strdup(footroot->sval[0]);
+  else
+    {
+      opts->footroot = (char *)malloc(32 * sizeof(char));
+      if (opts->shard[1] > 1)
+	sprintf(opts->footroot, "footprint_%d", opts->shard[0]);
+      else
+	sprintf(opts->footroot, "footprint");
     }
+  opts->lens  = DEMO_LENS_NONE;
+  opts->glass = GLASS_BK7;
+  if (lens->count > 0 &&
+      (opts->lens = demo_lens_lookup((char *)lens->sval[0])) == DEMO_LENS_NONE)
+    {
+      printf("%s: unknown --lens %s (barlow or window)\n",progname,
+	     lens->sval[0]);
+      arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
+      exit(1);
+    }
+  if (glass->count > 0 &&
+      ((opts->glass = glass_lookup((char *)glass->sval[0])) < 0 ||
+       opts->glass == GLASS_AIR))
+    {
+      printf("%s: unknown --glass %s (N-BK7, F2, N-SF11, silica or CaF2)\n",
+	     progname,glass->sval[0]);
+      arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
+      exit(1);
+    }
+  if (lens->count > 0 && opts->sweep != NULL)
+    {
+      /* The sweep builds its own bare Newtonians */
+      printf("%s: --sweep does not take a --lens\n",progname);
+      arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
+      exit(1);
+    }
+  opts->psfcache  = (nocache->count > 0) ? NULL : strdup(psfdir->filename[0]);
+  opts->cachesize = psfsize->dval[0];
   
   /* deallocate each non-null entry in argtable[] */
   arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
   
-  // printf("ARGTABLE exit code (really): %d\n",exitcode);
-
   return;
 }
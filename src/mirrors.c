@@ -62,3 +62,195 @@ double focalplane_z(double x, double y, raytrace_geom *geom){
 }
 
 
+
+
+/***** Surfaces described by a scope_optic *****/
+/* Each optic is a conic of revolution about its normal (nx,ny,nz), with its
+   vertex at (cx,cy,cz).  In the local frame (u,v,w) of the optic the surface
+   is c(u^2 + v^2) - 2w + c(1+k)w^2 = 0, where c = 1/(2f) is the vertex
+   curvature.  A plane (f = infinity) is simply w = 0. */
+
+/* Function to build the local (u,v,w) frame of an optic */
+/* w is the unit normal, v lies along the minor diameter (if any), and
+   u = v x w completes the right-handed set. */
+void mirrors_set_frame(scope_optic *optic){
+  
+  /* Variable Declarations */
+  int    i,axis;
+  double norm,dot,e[3]={0.,0.,0.};
+  double *u = optic->frame[0];
+  double *v = optic->frame[1];
+  double *w = optic->frame[2];
+  
+  norm = hypot3(optic->nx, optic->ny, optic->nz);
+  w[0] = optic->nx / norm;
+  w[1] = optic->ny / norm;
+  w[2] = optic->nz / norm;
+  
+  /* Pick the helper axis for v: the minor-diameter direction if given,
+     otherwise whichever axis is least aligned with w */
+  switch(optic->vmin){
+  case NHAT_X:
+    axis = 0;
+    break;
+  case NHAT_Y:
+    axis = 1;
+    break;
+  case NHAT_Z:
+    axis = 2;
+    break;
+  default:
+    axis = 0;
+    for(i=1;i<3;i++)
+      if(fabs(w[i]) < fabs(w[axis]))
+	axis = i;
+  }
+  e[axis] = 1.;
+  
+  /* Gram-Schmidt against w */
+  dot = e[0]*w[0] + e[1]*w[1] + e[2]*w[2];
+  for(i=0;i<3;i++)
+    v[i] = e[i] - dot*w[i];
+  norm = hypot3(v[0], v[1], v[2]);
+  for(i=0;i<3;i++)
+    v[i] /= norm;
+  
+  /* u = v x w */
+  u[0] = v[1]*w[2] - v[2]*w[1];
+  u[1] = v[2]*w[0] - v[0]*w[2];
+  u[2] = v[0]*w[1] - v[1]*w[0];
+  
+  return;
+}
+
+
+/* Function to return the vertex curvature c = 1/(2f) of an optic */
+double mirrors_curvature(scope_optic *optic){
+  
+  if(optic->type == OPTIC_PLANE || !gsl_finite(optic->f) || optic->f == 0.)
+    return 0.;
+  
+  return 1. / (2. * optic->f);
+}
+
+
+/* Function to rotate a (global) vector into the local frame of an optic */
+void mirrors_to_local(scope_optic *optic, double x, double y, double z,
+		      double *loc){
+  
+  int i;
+  
+  for(i=0;i<3;i++)
+    loc[i] = optic->frame[i][0]*x + optic->frame[i][1]*y +
+      optic->frame[i][2]*z;
+  
+  return;
+}
+
+
+/* Function to rotate a local-frame vector back into the global frame */
+void mirrors_to_global(scope_optic *optic, double *loc,
+		       double *x, double *y, double *z){
+  
+  *x = optic->frame[0][0]*loc[0] + optic->frame[1][0]*loc[1] +
+    optic->frame[2][0]*loc[2];
+  *y = optic->frame[0][1]*loc[0] + optic->frame[1][1]*loc[1] +
+    optic->frame[2][1]*loc[2];
+  *z = optic->frame[0][2]*loc[0] + optic->frame[1][2]*loc[1] +
+    optic->frame[2][2]*loc[2];
+  
+  return;
+}
+
+
+/* Function to find the distance along a ray to the surface of an optic */
+/* Returns NaN if the ray misses the surface or the surface is behind it. */
+double mirrors_intersect(scope_optic *optic, scope_ray *ray){
+  
+  /* Variable Declarations */
+  double p[3],d[3];
+  double c,k1,a,b,cc,disc,q,t;
+  
+  /* Move the ray into the local frame of the optic */
+  mirrors_to_local(optic, ray->x - optic->cx, ray->y - optic->cy,
+		   ray->z - optic->cz, p);
+  mirrors_to_local(optic, ray->vx, ray->vy, ray->vz, d);
+  
+  c  = mirrors_curvature(optic);
+  k1 = 1. + optic->k;
+  
+  /* Quadratic in t:  a t^2 + b t + cc = 0 */
+  a  = c*(d[0]*d[0] + d[1]*d[1] + k1*d[2]*d[2]);
+  b  = 2.*(c*(p[0]*d[0] + p[1]*d[1] + k1*p[2]*d[2]) - d[2]);
+  cc = c*(p[0]*p[0] + p[1]*p[1] + k1*p[2]*p[2]) - 2.*p[2];
+  
+  if(fabs(a) <= GSL_DBL_EPSILON * fabs(b)){
+    if(b == 0.)
+      return nan;                   // Parallel to a plane
+    t = -cc / b;
+  } else {
+    disc = b*b - 4.*a*cc;
+    if(disc < 0.)
+      return nan;                   // Misses the surface entirely
+    
+    /* Take the root on the branch through the vertex (the one that goes
+       over to -cc/b as the curvature vanishes), in a stable form */
+    q = b + copysign(sqrt(disc), b);
+    t = -2.*cc / q;
+    
+    /* A ray starting inside a strongly curved surface (beyond the center
+       of a lens surface) can get a root behind it or on the far branch
+       (where 1 - c(1+k)w < 0) that way, and meets the vertex at the other */
+    if(!(t > 0.) || c*k1*(p[2] + t*d[2]) >= 1.)
+      t = -q / (2.*a);
+    if(c*k1*(p[2] + t*d[2]) >= 1.)
+      return nan;
+  }
+  
+  return (t > 0.) ? t : nan;
+}
+
+
+/* Function to compute the unit surface normal of an optic at (x,y,z) */
+/* The normal is returned in the direction components of n, for use with
+   rays_reflect(). */
+void mirrors_normal(scope_optic *optic, double x, double y, double z,
+		    scope_ray *n){
+  
+  /* Variable Declarations */
+  double p[3],loc[3],c,norm;
+  
+  mirrors_to_local(optic, x - optic->cx, y - optic->cy, z - optic->cz, p);
+  c = mirrors_curvature(optic);
+  
+  /* Gradient of the conic, flipped to point along +w at the vertex */
+  loc[0] = -c*p[0];
+  loc[1] = -c*p[1];
+  loc[2] = 1. - c*(1. + optic->k)*p[2];
+  norm = hypot3(loc[0], loc[1], loc[2]);
+  loc[0] /= norm;
+  loc[1] /= norm;
+  loc[2] /= norm;
+  
+  mirrors_to_global(optic, loc, &n->vx, &n->vy, &n->vz);
+  n->x = x;
+  n->y = y;
+  n->z = z;
+  
+  return;
+}
+
+
+/* Function to check whether (x,y,z) on an optic lies within its outline */
+/* The outline is an ellipse with dmaj along u and dmin along v. */
+int mirrors_inside(scope_optic *optic, double x, double y, double z){
+  
+  /* Variable Declarations */
+  double p[3],a,b;
+  
+  mirrors_to_local(optic, x - optic->cx, y - optic->cy, z - optic->cz, p);
+  a = p[0] / (0.5 * optic->dmaj);
+  b = p[1] / (0.5 * optic->dmin);
+  
+  return (a*a + b*b <= 1.);
+}
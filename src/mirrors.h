@@ -31,6 +31,17 @@ double primary_z(double x, double y, raytrace_geom *geom);
 double secondary_z(double x, double y, raytrace_geom *geom);
 double focalplane_z(double x, double y, raytrace_geom *geom);
 
+void   mirrors_set_frame(scope_optic *optic);
+double mirrors_curvature(scope_optic *optic);
+void   mirrors_to_local(scope_optic *optic, double x, double y, double z,
+			double *loc);
+void   mirrors_to_global(scope_optic *optic, double *loc,
+			 double *x, double *y, double *z);
+double mirrors_intersect(scope_optic *optic, scope_ray *ray);
+void   mirrors_normal(scope_optic *optic, double x, double y, double z,
+		      scope_ray *n);
+int    mirrors_inside(scope_optic *optic, double x, double y, double z);
+
 
 
 #endif  /* MIRRORS_H */
@@ -0,0 +1,737 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: optim.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Levenberg-Marquardt design optimizer.  Chosen parameters of the optics
+   (focal length, vertex position, normal, conic constant) are adjusted to
+   minimize the mean-square spot radius about the centroid, summed over a
+   few field points.  The Jacobian comes from forward-mode differentiation:
+   each ray of a small, fixed pupil sample is traced once with dual numbers
+   carrying d/d(parameter) through the intersect, normal, reflect and
+   refract kernels, rather than re-tracing 2 x npar times for finite
+   differences.  The dual kernels mirror mirrors_intersect(),
+   mirrors_normal(), rays_reflect() and rays_snell(); lost / inside / TIR
+   decisions are made on the values alone. */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_linalg.h>
+
+/* Local headers */
+#include "optim.h"
+#include "mirrors.h"
+#include "rays.h"
+#include "setup.h"
+#include "pool.h"
+#include "glass.h"
+
+
+/* Names of the optics and parameters on the command line */
+static const struct{ const char *name; int elem; } optim_optics[] =
+  {{"pri",OPTIC_PRI}, {"sec",OPTIC_SEC}, {"tri",OPTIC_TRI},
+   {"qua",OPTIC_QUA}, {"qui",OPTIC_QUI}, {"sen",OPTIC_SEN},
+   {"sep",OPTIC_SEP}, {"oct",OPTIC_OCT}, {"non",OPTIC_NON},
+   {"den",OPTIC_DEN}, {"fp",OPTIC_NFP}};
+static const char *optim_names[] = {"f","cx","cy","cz","nx","ny","nz","k"};
+
+
+/* Arguments for the dual-number trace of one field point */
+typedef struct{
+  scope_scope   *scope;
+  scope_element *elements;
+  int            nelem;
+  optim_surf    *surf;          // One per element
+  scope_ray     *rays;          // Fixed pupil sample for this field
+  optim_dual    *uv;            // Focal-plane (u,v) of each ray, 2 per ray
+  char          *ok;            // Ray reached the focal plane
+} optim_trace_arg;
+
+
+/***** Dual-number arithmetic *****/
+
+static inline optim_dual od_const(double v){
+  optim_dual a;
+  memset(a.d, 0, sizeof(a.d));
+  a.v = v;
+  return a;
+}
+
+static inline optim_dual od_add(optim_dual a, optim_dual b){
+  int j;
+  a.v += b.v;
+  for(j=0;j<OPTIM_MAXPAR;j++)
+    a.d[j] += b.d[j];
+  return a;
+}
+
+static inline optim_dual od_sub(optim_dual a, optim_dual b){
+  int j;
+  a.v -= b.v;
+  for(j=0;j<OPTIM_MAXPAR;j++)
+    a.d[j] -= b.d[j];
+  return a;
+}
+
+static inline optim_dual od_scale(optim_dual a, double s){
+  int j;
+  a.v *= s;
+  for(j=0;j<OPTIM_MAXPAR;j++)
+    a.d[j] *= s;
+  return a;
+}
+
+static inline optim_dual od_mul(optim_dual a, optim_dual b){
+  int j;
+  for(j=0;j<OPTIM_MAXPAR;j++)
+    a.d[j] = a.d[j]*b.v + a.v*b.d[j];
+  a.v *= b.v;
+  return a;
+}
+
+static inline optim_dual od_div(optim_dual a, optim_dual b){
+  int j;
+  a.v /= b.v;
+  for(j=0;j<OPTIM_MAXPAR;j++)
+    a.d[j] = (a.d[j] - a.v*b.d[j]) / b.v;
+  return a;
+}
+
+static inline optim_dual od_sqrt(optim_dual a){
+  int j;
+  a.v = sqrt(a.v);
+  for(j=0;j<OPTIM_MAXPAR;j++)
+    a.d[j] /= 2.*a.v;
+  return a;
+}
+
+static inline optim_dual od_dot(optim_dual *a, optim_dual *b){
+  return od_add(od_add(od_mul(a[0],b[0]), od_mul(a[1],b[1])), od_mul(a[2],b[2]));
+}
+
+
+/***** Public-Facing Functions *****/
+
+/* Function to parse the list of parameters to optimize into opt */
+/* The list is comma-separated OPTIC.PARAM, e.g. "sec.cz,fp.cx,pri.k", with
+   OPTIC one of pri, sec, ..., den, fp and PARAM one of f, cx, cy, cz, nx,
+   ny, nz, k.  The merit sample (fields, rays, seed) is set to defaults.
+   Returns 0 on success. */
+int optim_parse(char *spec, scope_optim *opt){
+  
+  /* Variable Declarations */
+  int   i,j,no,np;
+  char *copy,*tok,*dot;
+  
+  no = sizeof(optim_optics) / sizeof(optim_optics[0]);
+  np = sizeof(optim_names) / sizeof(optim_names[0]);
+  
+  memset(opt, 0, sizeof(scope_optim));
+  opt->nfield   = 2;
+  opt->field[0] = 0.;
+  opt->field[1] = OPTIM_FIELD * M_PI / 648000.;
+  opt->nrays    = OPTIM_NRAYS;
+  opt->maxiter  = OPTIM_MAXITER;
+  opt->lambda   = 5500.;
+  
+  copy = strdup(spec);
+  for(tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ",")){
+    if((dot = strchr(tok, '.')) == NULL){
+      fprintf(stderr,"Error: optimizer term \"%s\" is not OPTIC.PARAM.\n",tok);
+      free(copy);
+      return -1;
+    }
+    *dot++ = '\0';
+    for(i=0; i < no; i++)
+      if(strcmp(tok, optim_optics[i].name) == 0)
+	break;
+    for(j=0; j < np; j++)
+      if(strcmp(dot, optim_names[j]) == 0)
+	break;
+    if(i == no || j == np){
+      fprintf(stderr,"Error: unknown optimizer parameter \"%s.%s\".\n",
+	      tok,dot);
+      free(copy);
+      return -1;
+    }
+    if(opt->npar == OPTIM_MAXPAR){
+      fprintf(stderr,"Error: at most %d parameters can be optimized.\n",
+	      OPTIM_MAXPAR);
+      free(copy);
+      return -1;
+    }
+    opt->elem[opt->npar]  = optim_optics[i].elem;
+    opt->which[opt->npar] = j;
+    opt->npar++;
+  }
+  free(copy);
+  
+  if(opt->npar == 0){
+    fprintf(stderr,"Error: no parameters to optimize.\n");
+    return -1;
+  }
+  
+  return 0;
+}
+
+
+/* Function to optimize the design in place */
+/* Each step solves (J^T J + mu diag(J^T J)) dp = -J^T r, accepting the step
+   (and relaxing mu) if the merit improves, and otherwise stiffening mu and
+   trying again.  The pupil sample is drawn once and reused for every
+   evaluation, so the merit is a smooth function of the parameters.  Returns
+   0 on success. */
+int optim_run(scope_optim *opt, scope_scope *scope, scope_element *elements,
+	      int nelem, scope_pool *pool){
+  
+  /* Variable Declarations */
+  int    i,j,f,iter,np=opt->npar;
+  double merit,trial,mu=OPTIM_MU,diag;
+  double jtj[OPTIM_MAXPAR*OPTIM_MAXPAR],jtr[OPTIM_MAXPAR];
+  double p0[OPTIM_MAXPAR];
+  scope_ray  *pupil[OPTIM_MAXFIELD];
+  scope_optic *optic;
+  gsl_matrix *a;
+  gsl_vector *b,*x;
+  gsl_rng    *r;
+  
+  /* Check the parameters exist on these optics */
+  for(j=0;j<np;j++){
+    optic = setup_get_optic(scope, opt->elem[j]);
+    if(optic == NULL || (opt->which[j] == OPTIM_F &&
+			 optic->type == OPTIC_PLANE)){
+      fprintf(stderr,"Error: parameter %d (%s) cannot be optimized.\n",
+	      j+1, optim_names[opt->which[j]]);
+      return -1;
+    }
+  }
+  
+  /* Fixed pupil sample, one per field point */
+  r = gsl_rng_alloc(gsl_rng_taus2);
+  for(f=0; f < opt->nfield; f++){
+    pupil[f] = (scope_ray *)malloc(opt->nrays * sizeof(scope_ray));
+    gsl_rng_set(r, opt->seed);
+    rays_fill_pupil(pupil[f], opt->nrays, &scope->primary, opt->field[f], 0.,
+		    opt->lambda, r);
+  }
+  gsl_rng_free(r);
+  
+  a = gsl_matrix_alloc(np, np);
+  b = gsl_vector_alloc(np);
+  x = gsl_vector_alloc(np);
+  
+  merit = optim_merit(opt, pupil, scope, elements, nelem, pool, jtj, jtr);
+  printf("Optimizing %d parameters over %d field points, %ld rays each\n",
+	 np, opt->nfield, opt->nrays);
+  printf("  Step %2d: RMS spot %0.4f um\n", 0,
+	 sqrt(merit / opt->nfield) * 1.e6);
+  
+  for(iter=1; iter <= opt->maxiter && gsl_finite(merit); iter++){
+    
+    for(j=0;j<np;j++)
+      p0[j] = *optim_param(setup_get_optic(scope, opt->elem[j]),
+			   opt->which[j]);
+    
+    /* Damp until a step improves the merit (or mu runs away) */
+    trial = GSL_POSINF;
+    while(mu < 1.e10){
+      for(i=0;i<np;i++){
+	for(j=0;j<np;j++)
+	  gsl_matrix_set(a, i, j, jtj[i*np+j]);
+	diag = (jtj[i*np+i] > 0.) ? jtj[i*np+i] : 1.;
+	gsl_matrix_set(a, i, i, jtj[i*np+i] + mu*diag);
+	gsl_vector_set(b, i, -jtr[i]);
+      }
+      gsl_set_error_handler_off();
+      if(gsl_linalg_cholesky_decomp(a) ||
+	 gsl_linalg_cholesky_solve(a, b, x)){
+	mu *= 10.;
+	continue;
+      }
+      
+      for(j=0;j<np;j++){
+	optic = setup_get_optic(scope, opt->elem[j]);
+	*optim_param(optic, opt->which[j]) = p0[j] + gsl_vector_get(x, j);
+	setup_orient_optic(optic);
+      }
+      trial = optim_merit(opt, pupil, scope, elements, nelem, pool,
+			  NULL, NULL);
+      if(trial < merit)
+	break;
+      
+      /* Rejected: put the parameters back and damp harder */
+      for(j=0;j<np;j++){
+	optic = setup_get_optic(scope, opt->elem[j]);
+	*optim_param(optic, opt->which[j]) = p0[j];
+	setup_orient_optic(optic);
+      }
+      mu *= 10.;
+    }
+    if(!(trial < merit))
+      break;                            // No downhill step left
+    
+    mu = GSL_MAX(mu / 10., 1.e-12);
+    printf("  Step %2d: RMS spot %0.4f um  (mu = %0.1e)\n", iter,
+	   sqrt(trial / opt->nfield) * 1.e6, mu);
+    if(merit - trial < OPTIM_TOL * merit){
+      merit = trial;
+      break;
+    }
+    merit = optim_merit(opt, pupil, scope, elements, nelem, pool, jtj, jtr);
+  }
+  
+  printf("Optimized parameters:\n");
+  for(j=0;j<np;j++){
+    for(i=0; optim_optics[i].elem != opt->elem[j]; i++);
+    printf("  %s.%-2s = %0.9g\n", optim_optics[i].name,
+	   optim_names[opt->which[j]],
+	   *optim_param(setup_get_optic(scope, opt->elem[j]), opt->which[j]));
+  }
+  
+  gsl_matrix_free(a);
+  gsl_vector_free(b);
+  gsl_vector_free(x);
+  for(f=0; f < opt->nfield; f++)
+    free(pupil[f]);
+  
+  return gsl_finite(merit) ? 0 : -1;
+}
+
+
+/***** Internal Functions *****/
+
+/* Function to return a pointer to parameter which of an optic */
+double *optim_param(scope_optic *optic, int which){
+  
+  switch(which){
+  case OPTIM_F:
+    return &optic->f;
+  case OPTIM_CX:
+    return &optic->cx;
+  case OPTIM_CY:
+    return &optic->cy;
+  case OPTIM_CZ:
+    return &optic->cz;
+  case OPTIM_NX:
+    return &optic->nx;
+  case OPTIM_NY:
+    return &optic->ny;
+  case OPTIM_NZ:
+    return &optic->nz;
+  default:
+    return &optic->k;
+  }
+}
+
+
+/* Function to build the dual-number description of an optic, seeding the
+   derivatives of the parameters that belong to it */
+/* The frame follows mirrors_set_frame(), with the helper-axis choice made
+   on the values. */
+void optim_surface(scope_optim *opt, scope_scope *scope, scope_optic *optic,
+		   optim_surf *s){
+  
+  /* Variable Declarations */
+  int    i,j,axis;
+  optim_dual n[3],f,k,norm,dot;
+  optim_dual *u = s->frame[0];
+  optim_dual *v = s->frame[1];
+  optim_dual *w = s->frame[2];
+  
+  s->optic = optic;
+  s->c[0] = od_const(optic->cx);
+  s->c[1] = od_const(optic->cy);
+  s->c[2] = od_const(optic->cz);
+  n[0]    = od_const(optic->nx);
+  n[1]    = od_const(optic->ny);
+  n[2]    = od_const(optic->nz);
+  f       = od_const(optic->f);
+  k       = od_const(optic->k);
+  
+  for(j=0; j < opt->npar; j++){
+    if(setup_get_optic(scope, opt->elem[j]) != optic)
+      continue;
+    switch(opt->which[j]){
+    case OPTIM_F:
+      f.d[j] = 1.;
+      break;
+    case OPTIM_CX:
+    case OPTIM_CY:
+    case OPTIM_CZ:
+      s->c[opt->which[j] - OPTIM_CX].d[j] = 1.;
+      break;
+    case OPTIM_NX:
+    case OPTIM_NY:
+    case OPTIM_NZ:
+      n[opt->which[j] - OPTIM_NX].d[j] = 1.;
+      break;
+    default:
+      k.d[j] = 1.;
+    }
+  }
+  
+  /* w is the unit normal */
+  norm = od_sqrt(od_dot(n, n));
+  for(i=0;i<3;i++)
+    w[i] = od_div(n[i], norm);
+  
+  /* v: the helper axis, Gram-Schmidt against w */
+  switch(optic->vmin){
+  case NHAT_X:
+    axis = 0;
+    break;
+  case NHAT_Y:
+    axis = 1;
+    break;
+  case NHAT_Z:
+    axis = 2;
+    break;
+  default:
+    axis = 0;
+    for(i=1;i<3;i++)
+      if(fabs(w[i].v) < fabs(w[axis].v))
+	axis = i;
+  }
+  dot = w[axis];
+  for(i=0;i<3;i++)
+    v[i] = od_sub(od_const(i == axis ? 1. : 0.), od_mul(dot, w[i]));
+  norm = od_sqrt(od_dot(v, v));
+  for(i=0;i<3;i++)
+    v[i] = od_div(v[i], norm);
+  
+  /* u = v x w */
+  u[0] = od_sub(od_mul(v[1],w[2]), od_mul(v[2],w[1]));
+  u[1] = od_sub(od_mul(v[2],w[0]), od_mul(v[0],w[2]));
+  u[2] = od_sub(od_mul(v[0],w[1]), od_mul(v[1],w[0]));
+  
+  /* Curvature, as mirrors_curvature() */
+  if(optic->type == OPTIC_PLANE || !gsl_finite(optic->f) || optic->f == 0.)
+    s->curv = od_const(0.);
+  else
+    s->curv = od_div(od_const(0.5), f);
+  s->k1 = od_add(od_const(1.), k);
+  
+  return;
+}
+
+
+/* Function to trace the pupil samples and reduce them to the merit (sum
+   over field points of the mean-square spot radius about the centroid) */
+/* If jtj and jtr are given, they receive J^T J (npar x npar) and J^T r of
+   the residuals.  A field point that loses every ray makes the merit
+   infinite. */
+double optim_merit(scope_optim *opt, scope_ray **pupil, scope_scope *scope,
+		   scope_element *elements, int nelem, scope_pool *pool,
+		   double *jtj, double *jtr){
+  
+  /* Variable Declarations */
+  int    e,f,c,i,j,np=opt->npar;
+  long   k,n;
+  double merit=0.,res,jac[OPTIM_MAXPAR];
+  optim_dual mean;
+  optim_trace_arg arg;
+  
+  if(jtj != NULL){
+    memset(jtj, 0, np * np * sizeof(double));
+    memset(jtr, 0, np * sizeof(double));
+  }
+  
+  arg.scope    = scope;
+  arg.elements = elements;
+  arg.nelem    = nelem;
+  arg.surf     = (optim_surf *)malloc(nelem * sizeof(optim_surf));
+  arg.uv       = (optim_dual *)malloc(2 * opt->nrays * sizeof(optim_dual));
+  arg.ok       = (char *)malloc(opt->nrays);
+  for(e=0;e<nelem;e++)
+    optim_surface(opt, scope, setup_get_optic(scope, elements[e].elem),
+		  &arg.surf[e]);
+  
+  for(f=0; f < opt->nfield && gsl_finite(merit); f++){
+    arg.rays = pupil[f];
+    pool_run(pool, optim_trace_job, &arg, opt->nrays, POOL_GRAIN);
+    
+    for(n=0,k=0; k < opt->nrays; k++)
+      n += arg.ok[k];
+    if(n == 0){
+      merit = GSL_POSINF;
+      break;
+    }
+    
+    /* Residuals about the centroid, in u and then v, weighted 1/n so each
+       field point counts the same however many rays it loses */
+    for(c=0;c<2;c++){
+      mean = od_const(0.);
+      for(k=0; k < opt->nrays; k++)
+	if(arg.ok[k])
+	  mean = od_add(mean, arg.uv[2*k+c]);
+      mean = od_scale(mean, 1./n);
+      
+      for(k=0; k < opt->nrays; k++){
+	if(!arg.ok[k])
+	  continue;
+	res    = arg.uv[2*k+c].v - mean.v;
+	merit += res * res / n;
+	if(jtj == NULL)
+	  continue;
+	for(j=0;j<np;j++)
+	  jac[j] = arg.uv[2*k+c].d[j] - mean.d[j];
+	for(i=0;i<np;i++){
+	  jtr[i] += jac[i] * res / n;
+	  for(j=0;j<np;j++)
+	    jtj[i*np+j] += jac[i] * jac[j] / n;
+	}
+      }
+    }
+  }
+  
+  free(arg.surf);
+  free(arg.uv);
+  free(arg.ok);
+  
+  return merit;
+}
+
+
+/* Job: trace rays [i0, i1) of the pupil sample with dual numbers */
+void optim_trace_job(void *data, long i0, long i1, int tid){
+  
+  /* Variable Declarations */
+  int  e,c,medium;
+  long i;
+  double t0,eta;
+  optim_dual p[3],d[3],q[3],t;
+  scope_ray ray;
+  optim_surf *s;
+  optim_trace_arg *arg = (optim_trace_arg *)data;
+  
+  for(i=i0;i<i1;i++){
+    ray = arg->rays[i];
+    arg->ok[i] = 0;
+    if(arg->scope->spider.nvanes > 0)
+      rays_spider(&ray, &arg->scope->spider);
+    if(ray.lost)
+      continue;
+    
+    p[0] = od_const(ray.x);
+    p[1] = od_const(ray.y);
+    p[2] = od_const(ray.z);
+    d[0] = od_const(ray.vx);
+    d[1] = od_const(ray.vy);
+    d[2] = od_const(ray.vz);
+    medium = GLASS_AIR;
+    
+    for(e=0; e < arg->nelem; e++){
+      s = &arg->surf[e];
+      
+      /* Obstruction: only the values matter */
+      if(arg->elements[e].block){
+	ray.x  = p[0].v;
+	ray.y  = p[1].v;
+	ray.z  = p[2].v;
+	ray.vx = d[0].v;
+	ray.vy = d[1].v;
+	ray.vz = d[2].v;
+	t0 = mirrors_intersect(s->optic, &ray);
+	if(gsl_finite(t0) &&
+	   mirrors_inside(s->optic, ray.x + t0*ray.vx, ray.y + t0*ray.vy,
+			  ray.z + t0*ray.vz))
+	  break;
+	continue;
+      }
+      
+      if(optim_intersect(s, p, d, &t))
+	break;
+      for(c=0;c<3;c++)
+	p[c] = od_add(p[c], od_mul(t, d[c]));
+      if(!mirrors_inside(s->optic, p[0].v, p[1].v, p[2].v))
+	break;
+      if(arg->elements[e].reflect)
+	optim_reflect(s, p, d);
+      if(arg->elements[e].refract){
+	eta = glass_index(medium, ray.lambda) /
+	  glass_index(s->optic->glass, ray.lambda);
+	medium = s->optic->glass;
+	if(optim_refract(s, p, d, eta))
+	  break;                        // Totally internally reflected
+      }
+    }
+    if(e < arg->nelem)
+      continue;                         // Lost on the way
+    
+    /* Position on the last element, in its local frame */
+    s = &arg->surf[arg->nelem-1];
+    for(c=0;c<3;c++)
+      q[c] = od_sub(p[c], s->c[c]);
+    arg->uv[2*i]   = od_dot(s->frame[0], q);
+    arg->uv[2*i+1] = od_dot(s->frame[1], q);
+    arg->ok[i] = 1;
+  }
+  
+  return;
+}
+
+
+/* Function to find the distance t along a (dual) ray to a surface, as
+   mirrors_intersect() */
+/* Returns -1 if the ray misses the surface or it is behind the ray. */
+int optim_intersect(optim_surf *s, optim_dual *p, optim_dual *d,
+		    optim_dual *t){
+  
+  /* Variable Declarations */
+  int    i;
+  optim_dual q[3],pl[3],dl[3],a,b,cc,disc,root;
+  
+  for(i=0;i<3;i++)
+    q[i] = od_sub(p[i], s->c[i]);
+  for(i=0;i<3;i++){
+    pl[i] = od_dot(s->frame[i], q);
+    dl[i] = od_dot(s->frame[i], d);
+  }
+  
+  /* Quadratic in t:  a t^2 + b t + cc = 0 */
+  a  = od_mul(s->curv, od_add(od_add(od_mul(dl[0],dl[0]), od_mul(dl[1],dl[1])),
+			      od_mul(s->k1, od_mul(dl[2],dl[2]))));
+  b  = od_scale(od_sub(od_mul(s->curv,
+			      od_add(od_add(od_mul(pl[0],dl[0]),
+					    od_mul(pl[1],dl[1])),
+				     od_mul(s->k1, od_mul(pl[2],dl[2])))),
+		       dl[2]), 2.);
+  cc = od_sub(od_mul(s->curv, od_add(od_add(od_mul(pl[0],pl[0]),
+					    od_mul(pl[1],pl[1])),
+				     od_mul(s->k1, od_mul(pl[2],pl[2])))),
+	      od_scale(pl[2], 2.));
+  
+  if(fabs(a.v) <= GSL_DBL_EPSILON * fabs(b.v)){
+    if(b.v == 0.)
+      return -1;
+    *t = od_scale(od_div(cc, b), -1.);
+  } else {
+    disc = od_sub(od_mul(b,b), od_scale(od_mul(a,cc), 4.));
+    if(disc.v < 0.)
+      return -1;
+    root = od_sqrt(disc);
+    root = (copysign(1., b.v) > 0.) ? od_add(b, root) : od_sub(b, root);
+    *t = od_scale(od_div(cc, root), -2.);
+    
+    /* The vertex branch may be at the other root, as in mirrors_intersect() */
+    if(!(t->v > 0.) ||
+       s->curv.v * s->k1.v * (pl[2].v + t->v * dl[2].v) >= 1.)
+      *t = od_scale(od_div(root, a), -0.5);
+    if(s->curv.v * s->k1.v * (pl[2].v + t->v * dl[2].v) >= 1.)
+      return -1;
+  }
+  
+  return (t->v > 0.) ? 0 : -1;
+}
+
+
+/* Function to find the (dual) unit normal n of a surface at p, as
+   mirrors_normal() */
+void optim_normal(optim_surf *s, optim_dual *p, optim_dual *n){
+  
+  /* Variable Declarations */
+  int    i,j;
+  optim_dual q[3],pl[3],loc[3],norm;
+  
+  for(i=0;i<3;i++)
+    q[i] = od_sub(p[i], s->c[i]);
+  for(i=0;i<3;i++)
+    pl[i] = od_dot(s->frame[i], q);
+  
+  /* Gradient of the conic, flipped to point along +w at the vertex */
+  loc[0] = od_scale(od_mul(s->curv, pl[0]), -1.);
+  loc[1] = od_scale(od_mul(s->curv, pl[1]), -1.);
+  loc[2] = od_sub(od_const(1.), od_mul(od_mul(s->curv, s->k1), pl[2]));
+  norm   = od_sqrt(od_dot(loc, loc));
+  
+  /* Back to the global frame */
+  for(j=0;j<3;j++){
+    n[j] = od_const(0.);
+    for(i=0;i<3;i++)
+      n[j] = od_add(n[j], od_mul(s->frame[i][j], loc[i]));
+    n[j] = od_div(n[j], norm);
+  }
+  
+  return;
+}
+
+
+/* Function to reflect a (dual) ray at p off a surface, as mirrors_normal()
+   and rays_reflect(): d -> d - 2 (d.n) n */
+void optim_reflect(optim_surf *s, optim_dual *p, optim_dual *d){
+  
+  /* Variable Declarations */
+  int    i;
+  optim_dual n[3],dn;
+  
+  optim_normal(s, p, n);
+  
+  dn = od_scale(od_dot(d, n), 2.);
+  for(i=0;i<3;i++)
+    d[i] = od_sub(d[i], od_mul(dn, n[i]));
+  
+  return;
+}
+
+
+/* Function to refract a (dual) ray at p through a surface with index
+   ratio eta = n_in / n_out, as rays_snell() */
+/* The index ratio is not a design parameter, so eta is a plain number.
+   Returns -1 (leaving d alone) if the ray is totally internally
+   reflected. */
+int optim_refract(optim_surf *s, optim_dual *p, optim_dual *d, double eta){
+  
+  /* Variable Declarations */
+  int    i;
+  optim_dual n[3],ci,k,g;
+  
+  optim_normal(s, p, n);
+  
+  /* Normal against the ray */
+  ci = od_scale(od_dot(d, n), -1.);
+  if(ci.v < 0.){
+    ci = od_scale(ci, -1.);
+    for(i=0;i<3;i++)
+      n[i] = od_scale(n[i], -1.);
+  }
+  
+  k = od_sub(od_const(1.),
+	     od_scale(od_sub(od_const(1.), od_mul(ci, ci)), eta*eta));
+  if(k.v < 0.)
+    return -1;
+  
+  /* d -> eta d + (eta cos i - cos t) n */
+  g = od_sub(od_scale(ci, eta), od_sqrt(k));
+  for(i=0;i<3;i++)
+    d[i] = od_add(od_scale(d[i], eta), od_mul(g, n[i]));
+  
+  return 0;
+}
@@ -0,0 +1,91 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: optim.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef OPTIM_H
+#define OPTIM_H
+
+#include "pool.h"
+
+/* Optic parameters the optimizer can vary (scope_optim.which) */
+#define OPTIM_F   0             // Focal length
+#define OPTIM_CX  1             // Vertex position
+#define OPTIM_CY  2
+#define OPTIM_CZ  3
+#define OPTIM_NX  4             // Normal (renormalized by the frame)
+#define OPTIM_NY  5
+#define OPTIM_NZ  6
+#define OPTIM_K   7             // Conic constant
+
+#define OPTIM_NRAYS   256       // Pupil sample per field point
+#define OPTIM_MAXITER 50        // Most Levenberg-Marquardt steps
+#define OPTIM_TOL     1.e-6     // Stop when the merit improves less than this
+#define OPTIM_MU      1.e-3     // Initial Marquardt damping
+#define OPTIM_FIELD   900.      // Default off-axis field point (arcsec)
+
+/* Forward-mode dual number: value and derivatives with respect to each of
+   the (up to OPTIM_MAXPAR) design parameters */
+typedef struct{
+  double v;
+  double d[OPTIM_MAXPAR];
+} optim_dual;
+
+/* An optic as dual numbers: vertex, local (u,v,w) frame, curvature 1/(2f)
+   and 1+k, all as functions of the design parameters */
+typedef struct{
+  scope_optic *optic;
+  optim_dual   c[3];
+  optim_dual   frame[3][3];
+  optim_dual   curv;
+  optim_dual   k1;
+} optim_surf;
+
+
+/* Function declarations */
+
+/* Public Functions */
+int     optim_parse(char *spec, scope_optim *opt);
+int     optim_run(scope_optim *opt, scope_scope *scope,
+		  scope_element *elements, int nelem, scope_pool *pool);
+
+/* Internal Functions */
+double *optim_param(scope_optic *optic, int which);
+void    optim_surface(scope_optim *opt, scope_scope *scope,
+		      scope_optic *optic, optim_surf *s);
+double  optim_merit(scope_optim *opt, scope_ray **pupil, scope_scope *scope,
+		    scope_element *elements, int nelem, scope_pool *pool,
+		    double *jtj, double *jtr);
+void    optim_trace_job(void *data, long i0, long i1, int tid);
+int     optim_intersect(optim_surf *s, optim_dual *p, optim_dual *d,
+			optim_dual *t);
+void    optim_normal(optim_surf *s, optim_dual *p, optim_dual *n);
+void    optim_reflect(optim_surf *s, optim_dual *p, optim_dual *d);
+int     optim_refract(optim_surf *s, optim_dual *p, optim_dual *d,
+		      double eta);
+
+#endif  /* OPTIM_H */
+
+
+
@@ -0,0 +1,299 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: pool.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE                    // For pthread_setaffinity_np()
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if HAVE_PTHREAD_SETAFFINITY_NP || HAVE_SCHED_GETAFFINITY
+# include <sched.h>
+#endif
+
+/* Local headers */
+#include "pool.h"
+
+
+#if POOL_THREADS
+/* Worker thread: wait for a job, do this thread's slice, repeat */
+static void *pool_worker(void *data){
+
+  /* Variable Declarations */
+  scope_pool   *pool = ((void **)data)[0];
+  int           t    = (int)(long)((void **)data)[1];
+  unsigned long seen = 0;
+  long          i0,i1;
+  pool_func     fn;
+  void         *arg;
+
+  free(data);
+
+  for(;;){
+    pthread_mutex_lock(&pool->lock);
+    while(pool->generation == seen && !pool->quit)
+      pthread_cond_wait(&pool->go, &pool->lock);
+    if(pool->quit){
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    seen = pool->generation;
+    fn   = pool->fn;
+    arg  = pool->arg;
+    pool_range(pool, t, pool->n, pool->grain, &i0, &i1);
+    pthread_mutex_unlock(&pool->lock);
+
+    if(i1 > i0)
+      fn(arg, i0, i1, t);
+
+    pthread_mutex_lock(&pool->lock);
+    if(--pool->pending == 0)
+      pthread_cond_signal(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+#endif
+
+
+/* Create a pool of nthreads workers (nthreads <= 0: one per online CPU) */
+scope_pool *pool_create(int nthreads){
+
+  /* Variable Declarations */
+  int  t,ncpu;
+  int  order[POOL_MAXCPU];
+  scope_pool *pool;
+
+  ncpu = pool_cpu_order(order, POOL_MAXCPU);
+  if(nthreads <= 0)
+    nthreads = GSL_MAX_INT(ncpu, 1);
+#if !POOL_THREADS
+  nthreads = 1;
+#endif
+
+  pool = (scope_pool *)calloc(1, sizeof(scope_pool));
+  pool->nthreads = nthreads;
+  pool->cpus     = (int *)malloc(nthreads * sizeof(int));
+  for(t=0;t<nthreads;t++)
+    pool->cpus[t] = (ncpu > 0) ? order[t % ncpu] : -1;
+
+#if POOL_THREADS
+  void **data;
+#if HAVE_PTHREAD_SETAFFINITY_NP
+  cpu_set_t set;
+#endif
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->go, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->tid = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+
+  for(t=0;t<nthreads;t++){
+    data = (void **)malloc(2 * sizeof(void *));
+    data[0] = pool;
+    data[1] = (void *)(long)t;
+    pthread_create(&pool->tid[t], NULL, pool_worker, data);
+#if HAVE_PTHREAD_SETAFFINITY_NP
+    if(pool->cpus[t] >= 0){
+      CPU_ZERO(&set);
+      CPU_SET(pool->cpus[t], &set);
+      pthread_setaffinity_np(pool->tid[t], sizeof(set), &set);
+    }
+#endif
+  }
+#endif
+
+  return pool;
+}
+
+
+/* Run fn over n items, split into one static slice per thread, and wait
+   for all of them to finish.  Slice boundaries fall on multiples of grain
+   items (e.g. 64 for bitmask words, or the items per huge page). */
+void pool_run(scope_pool *pool, pool_func fn, void *arg, long n, long grain){
+
+  if(pool == NULL || pool->nthreads <= 1){
+    if(n > 0)
+      fn(arg, 0, n, 0);
+    return;
+  }
+
+#if POOL_THREADS
+  pthread_mutex_lock(&pool->lock);
+  pool->fn      = fn;
+  pool->arg     = arg;
+  pool->n       = n;
+  pool->grain   = grain;
+  pool->pending = pool->nthreads;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->go);
+  while(pool->pending > 0)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+#endif
+
+  return;
+}
+
+
+/* Function to find the slice [i0, i1) of n items belonging to thread t */
+void pool_range(scope_pool *pool, int t, long n, long grain,
+		long *i0, long *i1){
+
+  /* Variable Declarations */
+  int  nt = (pool == NULL) ? 1 : pool->nthreads;
+  long ng;
+
+  if(grain < 1)
+    grain = 1;
+  ng  = (n + grain - 1) / grain;             // Number of grains
+
+  *i0 = GSL_MIN(n, (ng * t / nt) * grain);
+  *i1 = GSL_MIN(n, (ng * (t + 1) / nt) * grain);
+
+  return;
+}
+
+
+/* Stop the workers and free space occupied by the pool */
+void pool_destroy(scope_pool *pool){
+
+  if(pool == NULL)
+    return;
+
+#if POOL_THREADS
+  int t;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->go);
+  pthread_mutex_unlock(&pool->lock);
+  for(t=0;t<pool->nthreads;t++)
+    pthread_join(pool->tid[t], NULL);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->go);
+  pthread_cond_destroy(&pool->done);
+  free(pool->tid);
+#endif
+
+  free(pool->cpus);
+  free(pool);
+
+  return;
+}
+
+
+/* Function to list the CPUs this process may run on, grouped by NUMA node */
+/* On Linux the node layout comes from /sys/devices/system/node; elsewhere
+   (or if that is missing) the CPUs are simply numbered in order.  Node
+   numbers may have gaps, so every online node is read.  Where
+   sched_getaffinity() is available, CPUs outside the process's affinity
+   mask (a cpuset, a batch-system slot, taskset) are dropped, so the pool
+   is sized to what the process is actually allowed.  Returns the number
+   of CPUs listed in cpus[]. */
+int pool_cpu_order(int *cpus, int max){
+
+  /* Variable Declarations */
+  int  i,node,nnode=0,ncpu=0;
+  int  nodes[POOL_MAXCPU];
+  long nonline;
+  char fn[256],list[4096];
+  FILE *fp;
+#if HAVE_SCHED_GETAFFINITY
+  cpu_set_t allowed;
+  int masked,k,n;
+
+  masked = (sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+#endif
+
+  nonline = sysconf(_SC_NPROCESSORS_ONLN);
+
+  /* Which nodes exist (without the list, try every number) */
+  if((fp = fopen("/sys/devices/system/node/online", "r")) != NULL){
+    if(fgets(list, sizeof(list), fp) != NULL)
+      nnode = pool_parse_cpulist(list, nodes, 0, POOL_MAXCPU);
+    fclose(fp);
+  } else
+    for(nnode=0; nnode < POOL_MAXCPU; nnode++)
+      nodes[nnode] = nnode;
+
+  for(i=0; i < nnode; i++){
+    node = nodes[i];
+    snprintf(fn, sizeof(fn), "/sys/devices/system/node/node%d/cpulist", node);
+    if((fp = fopen(fn, "r")) == NULL)
+      continue;
+    if(fgets(list, sizeof(list), fp) != NULL)
+      ncpu = pool_parse_cpulist(list, cpus, ncpu, max);
+    fclose(fp);
+  }
+
+  if(ncpu == 0)
+    for(i=0; i < nonline && i < max; i++)
+      cpus[ncpu++] = i;
+
+#if HAVE_SCHED_GETAFFINITY
+  if(masked){
+    for(k=n=0; k < ncpu; k++)
+      if(cpus[k] < CPU_SETSIZE && CPU_ISSET(cpus[k], &allowed))
+	cpus[n++] = cpus[k];
+    
+    /* CPUs numbered past the online count: take the mask as it stands */
+    if(n == 0)
+      for(k=0; k < CPU_SETSIZE && n < max; k++)
+	if(CPU_ISSET(k, &allowed))
+	  cpus[n++] = k;
+    ncpu = n;
+  }
+#endif
+
+  return ncpu;
+}
+
+
+/* Function to parse a Linux CPU list (e.g. "0-3,8-11") onto the end of
+   cpus[], which already holds ncpu entries */
+int pool_parse_cpulist(char *list, int *cpus, int ncpu, int max){
+
+  /* Variable Declarations */
+  int  a,b,i;
+  char *tok;
+
+  for(tok = strtok(list, ",\n"); tok != NULL; tok = strtok(NULL, ",\n")){
+    if(sscanf(tok, "%d-%d", &a, &b) != 2){
+      if(sscanf(tok, "%d", &a) != 1)
+	continue;
+      b = a;
+    }
+    for(i=a; i <= b && ncpu < max; i++)
+      cpus[ncpu++] = i;
+  }
+
+  return ncpu;
+}
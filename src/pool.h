@@ -0,0 +1,84 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: pool.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef POOL_H
+#define POOL_H
+
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+# include <pthread.h>
+# define POOL_THREADS 1
+#else
+# define POOL_THREADS 0
+#endif
+
+#define POOL_MAXCPU 1024        // Most CPUs considered for thread placement
+#define POOL_GRAIN  64          // Default slice granularity (a bitmask word)
+
+/* Work function: process items [i0, i1) as thread number tid */
+typedef void (*pool_func)(void *arg, long i0, long i1, int tid);
+
+/* Pool of worker threads with STATIC partitioning: for a job of n items,
+   thread t always gets the same contiguous slice (see pool_range()), and
+   thread t is pinned to the t'th CPU in NUMA-node order.  Memory that is
+   first touched through the pool therefore lands on the node of the
+   thread that will later work on it.  Without pthreads, jobs simply run
+   in the calling thread. */
+typedef struct{
+  int            nthreads;      // Number of worker threads
+  int           *cpus;          // CPU each thread is pinned to (-1 = none)
+#if POOL_THREADS
+  pthread_t     *tid;
+  pthread_mutex_t lock;
+  pthread_cond_t go;            // Signalled when a job is posted
+  pthread_cond_t done;          // Signalled when the last slice finishes
+  unsigned long  generation;    // Job counter
+  int            pending;       // Threads still working on this job
+  int            quit;          // Workers should exit
+  pool_func      fn;            // The current job
+  void          *arg;
+  long           n;
+  long           grain;
+#endif
+} scope_pool;
+
+
+/* Function declarations */
+
+/* Public Functions */
+scope_pool *pool_create(int nthreads);
+void        pool_run(scope_pool *pool, pool_func fn, void *arg, long n,
+		     long grain);
+void        pool_range(scope_pool *pool, int t, long n, long grain,
+		       long *i0, long *i1);
+void        pool_destroy(scope_pool *pool);
+
+/* Internal Functions */
+int         pool_cpu_order(int *cpus, int max);
+int         pool_parse_cpulist(char *list, int *cpus, int ncpu, int max);
+
+#endif  /* POOL_H */
+
+
+
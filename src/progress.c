@@ -0,0 +1,304 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: progress.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>                    // Contains "usleep()"
+#include <time.h>
+#if !HAVE_CLOCK_GETTIME
+# include <sys/time.h>                 // Contains "gettimeofday()"
+#endif
+
+/* Local headers */
+#include "progress.h"
+#include "bundle.h"
+#include "images.h"
+#include "display.h"
+
+
+#if PROGRESS_THREADS
+/* Snapshot thread: every PROGRESS_POLL seconds, see whether a snapshot is
+   due, until told to quit */
+static void *progress_thread(void *data){
+  
+  /* Variable Declarations */
+  scope_progress *p = (scope_progress *)data;
+  int  t,quit=0;
+  long nchunk;
+  
+  while(!quit){
+    usleep((useconds_t)(PROGRESS_POLL * 1.e6));
+    
+    nchunk = 0;
+    for(t=0;t<p->nthreads;t++){
+      pthread_mutex_lock(&p->acc[t].lock);
+      nchunk += p->acc[t].nchunk;
+      pthread_mutex_unlock(&p->acc[t].lock);
+    }
+    if(nchunk - p->lastchunk >= PROGRESS_CHUNKS ||
+       progress_time() - p->tlast >= p->seconds)
+      progress_snapshot(p, 0);
+    
+    pthread_mutex_lock(&p->lock);
+    quit = p->quit;
+    pthread_mutex_unlock(&p->lock);
+  }
+  
+  return NULL;
+}
+#endif
+
+
+/* Set up progressive refinement of a trace of ntotal rays over nthreads
+   pool threads */
+/* The preview covers cen +/- halfwidth (m) on the detector, in
+   PROGRESS_NPIX pixels each way; snapshots come at least every `seconds'
+   seconds.  Starts the snapshot thread (if there are pthreads). */
+scope_progress *progress_create(int nthreads, long ntotal, double cen[2],
+				double halfwidth, double seconds){
+  
+  /* Variable Declarations */
+  int t;
+  scope_progress *p;
+  
+  p = (scope_progress *)calloc(1, sizeof(scope_progress));
+  p->nthreads = nthreads;
+  p->acc      = (progress_acc *)calloc(nthreads, sizeof(progress_acc));
+  for(t=0;t<nthreads;t++){
+    p->acc[t].hist = (double *)calloc(PROGRESS_NPIX * PROGRESS_NPIX,
+				      sizeof(double));
+#if PROGRESS_THREADS
+    pthread_mutex_init(&p->acc[t].lock, NULL);
+#endif
+  }
+  
+  halfwidth  = GSL_MAX(halfwidth, PROGRESS_MINHALF);
+  p->lo[0]   = cen[0] - halfwidth;
+  p->lo[1]   = cen[1] - halfwidth;
+  p->pix     = 2. * halfwidth / PROGRESS_NPIX;
+  p->ntotal  = ntotal;
+  p->seconds = seconds;
+  p->t0      = p->tlast = progress_time();
+  p->snap    = images_alloc(PROGRESS_NPIX, PROGRESS_NPIX);
+  p->display.cmap = strdup(CMAP_BB);
+  
+  printf("Progressive display: %0.1f um window, snapshots every %0.1f s\n",
+	 2.e6 * halfwidth, seconds);
+  
+#if PROGRESS_THREADS
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_create(&p->tid, NULL, progress_thread, p);
+#endif
+  
+  return p;
+}
+
+
+/* Add rays [i0, i0+n) of a traced bundle to thread tid's accumulator */
+/* Positions are taken in the frame of the bundle's final element, i.e.
+   (u,v) on the detector.  The chunk's own mean and spread are merged into
+   the running statistics in one step (Chan et al.), so the lock is only
+   held for the histogram update.  n must be at most BUNDLE_CHUNK. */
+void progress_add(scope_progress *p, int tid, scope_bundle *b, long i0,
+		  long n){
+  
+  /* Variable Declarations */
+  int  k;
+  long i,ix,iy,ng=0,nab;
+  long bins[BUNDLE_CHUNK];
+  double x[2],d,delta,cm[2]={0.,0.},cm2[2]={0.,0.};
+  progress_acc *a = p->acc + tid;
+  
+  /* Statistics and bins of this chunk, outside the lock */
+  for(i=i0; i < i0 + n; i++){
+    if(BUNDLE_LOST(b, i))
+      continue;
+    x[0] = b->pos[3*i];
+    x[1] = b->pos[3*i+1];
+    ng++;
+    for(k=0;k<2;k++){
+      d       = x[k] - cm[k];
+      cm[k]  += d / ng;
+      cm2[k] += d * (x[k] - cm[k]);
+    }
+    ix = (long)floor((x[0] - p->lo[0]) / p->pix);
+    iy = (long)floor((x[1] - p->lo[1]) / p->pix);
+    bins[ng-1] = (ix < 0 || iy < 0 || ix >= PROGRESS_NPIX ||
+		  iy >= PROGRESS_NPIX) ? -1 : iy * PROGRESS_NPIX + ix;
+  }
+  
+#if PROGRESS_THREADS
+  pthread_mutex_lock(&a->lock);
+#endif
+  for(i=0;i<ng;i++)
+    if(bins[i] >= 0)
+      a->hist[bins[i]] += 1.;
+  if(ng){
+    nab = a->ngood + ng;
+    for(k=0;k<2;k++){
+      delta       = cm[k] - a->mean[k];
+      a->mean[k] += delta * ng / nab;
+      a->m2[k]   += cm2[k] + delta * delta * a->ngood * ng / nab;
+    }
+    a->ngood = nab;
+  }
+  a->nray += n;
+  a->nchunk++;
+#if PROGRESS_THREADS
+  pthread_mutex_unlock(&a->lock);
+#else
+  /* No snapshot thread: the (only) worker checks for itself */
+  if(a->nchunk - p->lastchunk >= PROGRESS_CHUNKS ||
+     progress_time() - p->tlast >= p->seconds)
+    progress_snapshot(p, 0);
+#endif
+  
+  return;
+}
+
+
+/* Stop the snapshot thread, report the final state, and free space
+   occupied by the progressive display */
+void progress_finish(scope_progress *p){
+  
+  int t;
+  
+  if(p == NULL)
+    return;
+  
+#if PROGRESS_THREADS
+  pthread_mutex_lock(&p->lock);
+  p->quit = 1;
+  pthread_mutex_unlock(&p->lock);
+  pthread_join(p->tid, NULL);
+  pthread_mutex_destroy(&p->lock);
+#endif
+  
+  progress_snapshot(p, 1);
+  
+  for(t=0;t<p->nthreads;t++){
+    free(p->acc[t].hist);
+#if PROGRESS_THREADS
+    pthread_mutex_destroy(&p->acc[t].lock);
+#endif
+  }
+  free(p->acc);
+  images_free(p->snap);
+  free(p->display.cmap);
+  free(p);
+  
+  return;
+}
+
+
+/* Sum the accumulators into the preview, report, and push it to DS9 */
+/* Each worker's lock is held only while its histogram is added in, so a
+   worker waits at most that long.  Convergence is reported as the standard
+   error of the centroid and the change in RMS radius since the last
+   snapshot. */
+void progress_snapshot(scope_progress *p, int final){
+  
+  /* Variable Declarations */
+  int  t,k;
+  long i,nray=0,ngood=0,nchunk=0,nab;
+  double mean[2]={0.,0.},m2[2]={0.,0.},delta,rms,now,rate,eta;
+  progress_acc *a;
+  
+  memset(p->snap->data, 0, PROGRESS_NPIX * PROGRESS_NPIX * sizeof(double));
+  for(t=0;t<p->nthreads;t++){
+    a = p->acc + t;
+#if PROGRESS_THREADS
+    pthread_mutex_lock(&a->lock);
+#endif
+    for(i=0; i < PROGRESS_NPIX * PROGRESS_NPIX; i++)
+      p->snap->data[i] += a->hist[i];
+    if(a->ngood){
+      nab = ngood + a->ngood;
+      for(k=0;k<2;k++){
+	delta    = a->mean[k] - mean[k];
+	mean[k] += delta * a->ngood / nab;
+	m2[k]   += a->m2[k] + delta * delta * ngood * a->ngood / nab;
+      }
+      ngood = nab;
+    }
+    nray   += a->nray;
+    nchunk += a->nchunk;
+#if PROGRESS_THREADS
+    pthread_mutex_unlock(&a->lock);
+#endif
+  }
+  
+  now  = progress_time();
+  rate = nray / GSL_MAX(now - p->t0, 1.e-9);
+  eta  = (p->ntotal - nray) / GSL_MAX(rate, 1.);
+  rms  = (ngood > 0) ? sqrt((m2[0] + m2[1]) / ngood) : 0.;
+  
+  printf("%s %5.1f%% %0.3e rays/s", final ? "Done:" : "Progress:",
+	 100. * nray / GSL_MAX(p->ntotal, 1), rate);
+  if(!final)
+    printf(" (%0.0f s left)", eta);
+  if(ngood > 0){
+    printf(", centroid (%+0.4f, %+0.4f) mm +/- %0.3f um, RMS %0.3f um",
+	   mean[0] * 1.e3, mean[1] * 1.e3, rms / sqrt((double)ngood) * 1.e6,
+	   rms * 1.e6);
+    if(p->lastrms > 0.)
+      printf(" (%+0.3f%%)", 100. * (rms - p->lastrms) / p->lastrms);
+  }
+  printf("\n");
+  
+  /* Preview (the first one finds DS9; skipped if there is none) */
+  p->display.image = p->snap;
+  display_ds9_talk(DS9_ARRAY, &p->display);
+  p->display.image = NULL;
+  
+  p->tlast     = now;
+  p->lastchunk = nchunk;
+  p->lastrms   = rms;
+  
+  return;
+}
+
+
+/* Wall-clock time in seconds (monotonic where available) */
+double progress_time(void){
+  
+#if HAVE_CLOCK_GETTIME
+  struct timespec ts;
+  
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1.e-9 * ts.tv_nsec;
+#else
+  struct timeval tv;
+  
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + 1.e-6 * tv.tv_usec;
+#endif
+}
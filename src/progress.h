@@ -0,0 +1,100 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: progress.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+# include <pthread.h>
+# define PROGRESS_THREADS 1
+#else
+# define PROGRESS_THREADS 0
+#endif
+
+#define PROGRESS_NPIX    256    // Preview image is NPIX x NPIX pixels
+#define PROGRESS_CHUNKS  4096   // Snapshot after this many chunks...
+#define PROGRESS_POLL    0.1    // ...checked this often (seconds), at most
+#define PROGRESS_PILOT   4096   // Rays traced to size the preview window
+#define PROGRESS_MINHALF 10.e-6 // Smallest half-width of the window (m)
+
+/* One thread's share of the focal-plane accumulator: a histogram of where
+   its rays landed, and running (Welford) statistics of the spot */
+typedef struct{
+  double        *hist;          // NPIX x NPIX counts
+  long           nchunk;        // Chunks added
+  long           nray;          // Rays added (reaching the detector or not)
+  long           ngood;         // Rays reaching the detector
+  double         mean[2];       // Running mean of (u,v)
+  double         m2[2];         // Running sum of squared deviations
+#if PROGRESS_THREADS
+  pthread_mutex_t lock;         // Held only while adding or snapshotting
+#endif
+} progress_acc;
+
+/* Progressive refinement of a long trace: workers add each traced chunk to
+   their own accumulator, and a separate thread periodically sums them into
+   a snapshot, reports rays/s and how well the spot statistics have settled,
+   and pushes the preview image to DS9.  Snapshots happen every PROGRESS_CHUNKS
+   chunks or every `seconds', whichever is first, but never more often than
+   PROGRESS_POLL. */
+typedef struct{
+  int            nthreads;
+  progress_acc  *acc;           // One per pool thread
+  double         lo[2];         // Lower-left corner of the window (m)
+  double         pix;           // Pixel size (m)
+  long           ntotal;        // Rays in the whole trace
+  double         seconds;       // Longest time between snapshots
+  double         t0;            // Start of the trace
+  double         tlast;         // Time of the last snapshot
+  long           lastchunk;     // Chunks seen at the last snapshot
+  double         lastrms;       // RMS spot radius at the last snapshot
+  scope_image   *snap;          // Summed preview image
+  scope_display  display;       // For pushing snap to DS9
+#if PROGRESS_THREADS
+  pthread_t      tid;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int            quit;
+#endif
+} scope_progress;
+
+
+/* Function declarations */
+
+/* Public Functions */
+scope_progress *progress_create(int nthreads, long ntotal, double cen[2],
+				double halfwidth, double seconds);
+void            progress_add(scope_progress *p, int tid, scope_bundle *b,
+			     long i0, long n);
+void            progress_finish(scope_progress *p);
+
+/* Internal Functions */
+void            progress_snapshot(scope_progress *p, int final);
+double          progress_time(void);
+
+#endif  /* PROGRESS_H */
+
+
+
@@ -0,0 +1,343 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: psfcache.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>                    // Contains "unlink()"
+#include <sys/stat.h>                  // Contains "mkdir(), stat()"
+
+/* Local headers */
+#include "psfcache.h"
+#include "fitsw.h"
+#include "images.h"
+#include "setup.h"
+
+
+/* Open (creating, if necessary) the PSF cache in directory dir */
+/* maxsize is the size cap in MB.  Returns NULL if the directory cannot be
+   used, in which case the calling function should simply trace. */
+scope_psfcache *psfcache_open(char *dir, double maxsize){
+  
+  /* Variable Declarations */
+  char fn[FLEN_FILENAME];
+  FILE *fp;
+  scope_psfcache *cache;
+  scope_psfentry e;
+  
+  if(mkdir(dir, 0755) && errno != EEXIST){
+    fprintf(stderr,"Warning: unable to use PSF cache directory %s\n",dir);
+    return NULL;
+  }
+  
+  cache = (scope_psfcache *)malloc(sizeof(scope_psfcache));
+  cache->dir     = strdup(dir);
+  cache->maxsize = maxsize * 1024. * 1024.;
+  cache->size    = 0.;
+  cache->tick    = 0;
+  cache->n       = 0;
+  cache->nalloc  = 64;
+  cache->entry   = (scope_psfentry *)malloc(cache->nalloc *
+					    sizeof(scope_psfentry));
+  
+  /* Read the index, if one exists: "tick" line, then one line per entry */
+  snprintf(fn, FLEN_FILENAME, "%s/%s", dir, PSFCACHE_INDEX);
+  if((fp = fopen(fn, "r")) != NULL){
+    if(fscanf(fp, "tick %lu", &cache->tick) != 1)
+      cache->tick = 0;
+    while(fscanf(fp, "%llx %lf %lu", &e.key, &e.size, &e.used) == 3){
+      if(cache->n == cache->nalloc){
+	cache->nalloc *= 2;
+	cache->entry = (scope_psfentry *)realloc(cache->entry, cache->nalloc *
+						 sizeof(scope_psfentry));
+      }
+      cache->entry[cache->n++] = e;
+      cache->size += e.size;
+    }
+    fclose(fp);
+  }
+  
+  printf("PSF cache %s: %ld entries, %0.1f MB\n",
+	 dir,cache->n,cache->size/1024./1024.);
+  
+  return cache;
+}
+
+
+/* Write the index and free space occupied by the cache */
+void psfcache_close(scope_psfcache *cache){
+  
+  if(cache == NULL)
+    return;
+  
+  psfcache_write_index(cache);
+  free(cache->dir);
+  free(cache->entry);
+  free(cache);
+  
+  return;
+}
+
+
+/* Compute the cache key for a PSF */
+/* The key is a 64-bit FNV-1a hash of a canonical text rendering of every
+   parameter that changes the PSF: all optics of the prescription, the
+   element sequence, the spider, the field angle, wavelength, ray count, sampler (pupil
+   fill and seed), and the PSF pixel grid. */
+unsigned long long psfcache_key(scope_scope *scope, scope_element *elements,
+				int nelem, double ax, double ay,
+				scope_imsim *par, double pixscale){
+  
+  /* Variable Declarations */
+  int  i;
+  char text[512];
+  unsigned long long hash;
+  scope_optic *o;
+  scope_optic *optics[11] = {&scope->primary, &scope->secondary,
+			     &scope->tertiary, &scope->quaternary,
+			     &scope->quinary, &scope->senary,
+			     &scope->septenary, &scope->octonary,
+			     &scope->nonary, &scope->denary,
+			     &scope->focalplane};
+  
+  hash = psfcache_hash(14695981039346656037ULL, PSFCACHE_VERSION);
+  
+  /* Only the elements actually used take part (unused slots are garbage),
+     each with its optic.  Adding 0. turns -0 into +0 before printing. */
+  for(i=0;i<nelem;i++){
+    snprintf(text, sizeof(text), "E %d %d %d %d", elements[i].elem,
+	     (int)elements[i].block, (int)elements[i].reflect,
+	     (int)elements[i].refract);
+    hash = psfcache_hash(hash, text);
+  }
+  for(i=0;i<11;i++){
+    o = optics[i];
+    if(!psfcache_optic_used(scope, elements, nelem, o))
+      continue;
+    snprintf(text, sizeof(text),
+	     "O %d %d %.17g %.17g %.17g %d %.17g %.17g %.17g %.17g %.17g %.17g "
+	     "%.17g %d", i, o->type, o->f + 0., o->dmaj + 0., o->dmin + 0.,
+	     o->vmin, o->cx + 0., o->cy + 0., o->cz + 0., o->nx + 0.,
+	     o->ny + 0., o->nz + 0., o->k + 0., o->glass);
+    hash = psfcache_hash(hash, text);
+  }
+  
+  snprintf(text, sizeof(text), "V %d %.17g %.17g %.17g %.17g %.17g",
+	   scope->spider.nvanes, scope->spider.width + 0.,
+	   scope->spider.angle + 0., scope->spider.cx + 0.,
+	   scope->spider.cy + 0., scope->spider.cz + 0.);
+  hash = psfcache_hash(hash, text);
+  
+  snprintf(text, sizeof(text), "F %.17g %.17g L %.17g N %ld S pupil %lu "
+	   "G %ld %.17g", ax + 0., ay + 0., par->lambda, par->nrays,
+	   par->seed, par->npsf, pixscale);
+  hash = psfcache_hash(hash, text);
+  
+  return hash;
+}
+
+
+/* Look up a PSF in the cache; returns 1 (and fills psf) on a hit */
+int psfcache_get(scope_psfcache *cache, unsigned long long key,
+		 double *psf, long npsf){
+  
+  /* Variable Declarations */
+  int  i,status=0,cstat=0,bitpix,naxis;
+  long naxes[2],xystart[2]={0,0};
+  char fn[FLEN_FILENAME];
+  scope_image *arr;
+  fitsfile *fitsfp;
+  
+  if(cache == NULL)
+    return 0;
+  
+  for(i=0;i<cache->n;i++)
+    if(cache->entry[i].key == key)
+      break;
+  if(i == cache->n)
+    return 0;
+  
+  /* Open directly (not fw_open_r) so a missing file is just a miss */
+  psfcache_filename(cache, key, fn);
+  if(fits_open_file(&fitsfp, fn, READONLY, &status))
+    return 0;
+  fits_get_img_param(fitsfp, 2, &bitpix, &naxis, naxes, &status);
+  if(status || naxis != 2 || naxes[0] != npsf || naxes[1] != npsf){
+    fits_close_file(fitsfp, &cstat);
+    return 0;
+  }
+  
+  arr = fitsw_read2array(fitsfp, xystart, naxes, TDOUBLE, &status);
+  fits_close_file(fitsfp, &cstat);
+  if(status)
+    return 0;
+  
+  memcpy(psf, arr->data, npsf * npsf * sizeof(double));
+  images_free(arr);
+  
+  cache->entry[i].used = ++cache->tick;
+  
+  return 1;
+}
+
+
+/* Add a PSF to the cache, evicting least-recently-used entries as needed */
+int psfcache_put(scope_psfcache *cache, unsigned long long key,
+		 double *psf, long npsf, char *telname){
+  
+  /* Variable Declarations */
+  int  status=0;
+  long j;
+  char fn[FLEN_FILENAME];
+  scope_image img;
+  struct stat st;
+  scope_psfentry e;
+  
+  if(cache == NULL)
+    return 0;
+  
+  /* The (row-major) PSF goes out as-is */
+  img = images_wrap(psf, npsf, npsf);
+  
+  psfcache_filename(cache, key, fn);
+  fitsw_write_image(fn, &img, DOUBLE_IMG, telname, &status);
+  if(status || stat(fn, &st))
+    return status ? status : -1;
+  
+  /* Drop any stale entry for this key (e.g. its file went missing) */
+  for(j=0;j<cache->n;j++)
+    if(cache->entry[j].key == key){
+      cache->size -= cache->entry[j].size;
+      cache->entry[j--] = cache->entry[--cache->n];
+    }
+  
+  e.key  = key;
+  e.size = (double)st.st_size;
+  e.used = ++cache->tick;
+  
+  if(cache->n == cache->nalloc){
+    cache->nalloc *= 2;
+    cache->entry = (scope_psfentry *)realloc(cache->entry, cache->nalloc *
+					     sizeof(scope_psfentry));
+  }
+  cache->entry[cache->n++] = e;
+  cache->size += e.size;
+  
+  psfcache_evict(cache);
+  
+  return psfcache_write_index(cache);
+}
+
+
+/* Function to check whether an optic takes part in the element sequence */
+int psfcache_optic_used(scope_scope *scope, scope_element *elements,
+			int nelem, scope_optic *optic){
+  
+  int i;
+  
+  for(i=0;i<nelem;i++)
+    if(setup_get_optic(scope, elements[i].elem) == optic)
+      return 1;
+  
+  return 0;
+}
+
+
+/* Function to build the filename of a cached PSF */
+void psfcache_filename(scope_psfcache *cache, unsigned long long key,
+		       char *fn){
+  
+  snprintf(fn, FLEN_FILENAME, "%s/%016llx.fits", cache->dir, key);
+  
+  return;
+}
+
+
+/* Function to (atomically) write the cache index */
+int psfcache_write_index(scope_psfcache *cache){
+  
+  /* Variable Declarations */
+  long i;
+  char fn[FLEN_FILENAME],tmp[FLEN_FILENAME];
+  FILE *fp;
+  
+  snprintf(fn,  FLEN_FILENAME, "%s/%s", cache->dir, PSFCACHE_INDEX);
+  snprintf(tmp, FLEN_FILENAME, "%s/%s.tmp", cache->dir, PSFCACHE_INDEX);
+  
+  if((fp = fopen(tmp, "w")) == NULL){
+    fprintf(stderr,"Warning: unable to write PSF cache index %s\n",fn);
+    return -1;
+  }
+  fprintf(fp, "tick %lu\n", cache->tick);
+  for(i=0;i<cache->n;i++)
+    fprintf(fp, "%016llx %0.0f %lu\n", cache->entry[i].key,
+	    cache->entry[i].size, cache->entry[i].used);
+  fclose(fp);
+  
+  return rename(tmp, fn);
+}
+
+
+/* Function to evict least-recently-used entries until under the size cap */
+/* The newest entry is never evicted, even if it alone exceeds the cap. */
+void psfcache_evict(scope_psfcache *cache){
+  
+  /* Variable Declarations */
+  long i,oldest;
+  char fn[FLEN_FILENAME];
+  
+  while(cache->size > cache->maxsize && cache->n > 1){
+    oldest = 0;
+    for(i=1;i<cache->n;i++)
+      if(cache->entry[i].used < cache->entry[oldest].used)
+	oldest = i;
+    
+    psfcache_filename(cache, cache->entry[oldest].key, fn);
+    unlink(fn);
+    cache->size -= cache->entry[oldest].size;
+    cache->entry[oldest] = cache->entry[--cache->n];
+  }
+  
+  return;
+}
+
+
+/* 64-bit FNV-1a hash of a NULL-terminated string, continuing from hash */
+unsigned long long psfcache_hash(unsigned long long hash, char *text){
+  
+  while(*text){
+    hash ^= (unsigned char)*text++;
+    hash *= 1099511628211ULL;
+  }
+  hash ^= '\n';                   // Field separator
+  hash *= 1099511628211ULL;
+  
+  return hash;
+}
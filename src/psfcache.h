@@ -0,0 +1,61 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: psfcache.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef PSFCACHE_H
+#define PSFCACHE_H
+
+#define PSFCACHE_DIR     "psfcache"     // Default cache directory
+#define PSFCACHE_INDEX   "index.txt"    // Index file within the directory
+#define PSFCACHE_MAXSIZE 256.           // Default size cap in MB
+#define PSFCACHE_VERSION "psf-v3"       // Bump if the PSF builder changes
+
+
+/* Function declarations */
+
+/* Public Functions */
+scope_psfcache    *psfcache_open(char *dir, double maxsize);
+void               psfcache_close(scope_psfcache *cache);
+unsigned long long psfcache_key(scope_scope *scope, scope_element *elements,
+				int nelem, double ax, double ay,
+				scope_imsim *par, double pixscale);
+int                psfcache_get(scope_psfcache *cache, unsigned long long key,
+				double *psf, long npsf);
+int                psfcache_put(scope_psfcache *cache, unsigned long long key,
+				double *psf, long npsf, char *telname);
+
+/* Internal Functions */
+int                psfcache_optic_used(scope_scope *scope,
+				       scope_element *elements, int nelem,
+				       scope_optic *optic);
+void               psfcache_filename(scope_psfcache *cache,
+				     unsigned long long key, char *fn);
+int                psfcache_write_index(scope_psfcache *cache);
+void               psfcache_evict(scope_psfcache *cache);
+unsigned long long psfcache_hash(unsigned long long hash, char *text);
+
+#endif  /* PSFCACHE_H */
+
+
+
@@ -0,0 +1,458 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: pupil.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_matrix.h>            // GSL's matrices & vectors
+#include <gsl/gsl_vector.h>
+#include <gsl/gsl_multifit.h>          // GSL's linear least-squares
+
+/* Local headers */
+#include "pupil.h"
+#include "rays.h"
+#include "kernels.h"
+#include "setup.h"
+#include "fourier.h"
+#include "fitsw.h"
+#include "images.h"
+
+
+/* Trace an n x n grid of rays from field angle (ax,ay) and build the OPD map
+   across the entrance pupil (the aperture of the primary) */
+/* The wavefront is referenced to a sphere centered on the centroid P0 of the
+   spot on the detector: each ray's optical path is extended (or cut back)
+   from where it lands, Q, to its closest approach to P0 by (P0 - Q).d,
+   which is exact to first order in the aberration.  OPD = path - mean path,
+   in waves; obstructed grid points are NaN.  IMPORTANT: returned structure
+   must be freed with pupil_free(). */
+scope_wavefront *pupil_trace_opd(scope_scope *scope, scope_element *elements,
+				 int nelem, double ax, double ay,
+				 double lambda, long n, int *status){
+
+  /* Variable Declarations */
+  long i,ngood=0;
+  double p0[3]={0.,0.,0.},path,mean=0.,lo,hi,wave;
+  scope_ray *rays;
+  scope_wavefront *wf;
+
+  *status = 0;
+
+  rays = (scope_ray *)malloc(n * n * sizeof(scope_ray));
+  if(rays == NULL){
+    fprintf(stderr,"Error: unable to allocate a %ld x %ld pupil grid.\n",n,n);
+    *status = -1;
+    return NULL;
+  }
+  rays_fill_grid(rays, n, &scope->primary, ax, ay, lambda);
+  kernels_trace(rays, n * n, scope, elements, nelem);
+
+  /* Reference point: centroid of the rays reaching the detector */
+  for(i=0;i<n*n;i++){
+    if(rays[i].lost)
+      continue;
+    p0[0] += rays[i].x;
+    p0[1] += rays[i].y;
+    p0[2] += rays[i].z;
+    ngood++;
+  }
+  if(ngood == 0){
+    fprintf(stderr,"Error: no pupil rays reach the focal plane.\n");
+    free(rays);
+    *status = -1;
+    return NULL;
+  }
+  p0[0] /= ngood;
+  p0[1] /= ngood;
+  p0[2] /= ngood;
+
+  wf = (scope_wavefront *)malloc(sizeof(scope_wavefront));
+  wf->n      = n;
+  wf->dx     = scope->primary.dmaj / n;
+  wf->lambda = lambda;
+  wf->ax     = ax;
+  wf->ay     = ay;
+  wf->opd    = (double *)malloc(n * n * sizeof(double));
+  wf->nzern  = 0;
+  wf->zern   = NULL;
+  wf->rms    = 0.;
+  wf->pv     = 0.;
+  wf->strehl = nan;
+
+  /* Path to the reference sphere, then OPD about the mean */
+  for(i=0;i<n*n;i++){
+    if(rays[i].lost){
+      wf->opd[i] = nan;
+      continue;
+    }
+    path = rays[i].opl + (p0[0] - rays[i].x)*rays[i].vx +
+      (p0[1] - rays[i].y)*rays[i].vy + (p0[2] - rays[i].z)*rays[i].vz;
+    wf->opd[i] = path;
+    mean += path;
+  }
+  mean /= ngood;
+
+  wave = lambda * 1.e-10;                         // Angstroms -> meters
+  lo = posinf;
+  hi = neginf;
+  for(i=0;i<n*n;i++){
+    if(!gsl_finite(wf->opd[i]))
+      continue;
+    wf->opd[i] = (wf->opd[i] - mean) / wave;
+    lo = GSL_MIN(lo, wf->opd[i]);
+    hi = GSL_MAX(hi, wf->opd[i]);
+  }
+  wf->pv = hi - lo;
+
+  free(rays);
+
+  return wf;
+}
+
+
+/* Fit the first nzern (Noll-ordered) Zernike polynomials to the OPD map */
+/* Radius is normalized to the semi-major diameter of the primary.  The
+   polynomials are normalized to unit RMS over the full disk, so the
+   coefficients are in waves RMS.  Since the central obstruction and spider
+   make the pupil an imperfect disk, the fit is by least squares over the
+   unobstructed points rather than by projection.  The RMS wavefront error
+   with piston and tilt removed is computed from the residual map. */
+int pupil_fit_zernike(scope_wavefront *wf, int nzern){
+
+  /* Variable Declarations */
+  int  j,status=0;
+  long i,k,npts=0,n=wf->n;
+  double u,v,rho,theta,radius,chisq,res,sum=0.;
+  gsl_matrix *X,*cov;
+  gsl_vector *y,*c;
+  gsl_multifit_linear_workspace *work;
+
+  radius = 0.5 * n * wf->dx;
+
+  for(i=0;i<n*n;i++)
+    if(gsl_finite(wf->opd[i]))
+      npts++;
+  if(npts <= nzern){
+    fprintf(stderr,"Error: too few pupil points (%ld) for %d Zernikes.\n",
+	    npts,nzern);
+    return -1;
+  }
+
+  X    = gsl_matrix_alloc(npts, nzern);
+  y    = gsl_vector_alloc(npts);
+  c    = gsl_vector_alloc(nzern);
+  cov  = gsl_matrix_alloc(nzern, nzern);
+  work = gsl_multifit_linear_alloc(npts, nzern);
+
+  /* Design matrix: one row per unobstructed pupil point */
+  for(i=0,k=0;i<n*n;i++){
+    if(!gsl_finite(wf->opd[i]))
+      continue;
+    u = ((i % n) + 0.5 - 0.5*n) * wf->dx;
+    v = ((i / n) + 0.5 - 0.5*n) * wf->dx;
+    rho   = hypot(u, v) / radius;
+    theta = atan2(v, u);
+    for(j=0;j<nzern;j++)
+      gsl_matrix_set(X, k, j, pupil_zernike(j + 1, rho, theta));
+    gsl_vector_set(y, k, wf->opd[i]);
+    k++;
+  }
+
+  status = gsl_multifit_linear(X, y, c, cov, &chisq, work);
+
+  free(wf->zern);
+  wf->nzern = nzern;
+  wf->zern  = (double *)malloc(nzern * sizeof(double));
+  for(j=0;j<nzern;j++)
+    wf->zern[j] = gsl_vector_get(c, j);
+
+  /* RMS of the map with the fitted piston and tilts taken out */
+  for(k=0;k<npts;k++){
+    res = gsl_vector_get(y, k);
+    for(j=0;j<GSL_MIN(nzern,3);j++)
+      res -= wf->zern[j] * gsl_matrix_get(X, k, j);
+    sum += res*res;
+  }
+  wf->rms = sqrt(sum / npts);
+
+  /* Clean up */
+  gsl_matrix_free(X);
+  gsl_matrix_free(cov);
+  gsl_vector_free(y);
+  gsl_vector_free(c);
+  gsl_multifit_linear_free(work);
+
+  return status;
+}
+
+
+/* Compute the diffraction PSF from the wavefront, by zero-padded FFT of the
+   complex pupil function */
+/* The pupil grid is embedded in an npad x npad array (npad >= 2n samples
+   the PSF at or beyond Nyquist), and |FFT|^2 gives the PSF, centered on
+   pixel (npad/2, npad/2) and normalized to unit sum.  The angular pixel
+   scale on the sky, lambda / (npad dx), is returned in *pixscale (radians),
+   and the Strehl ratio (peak relative to that of the same pupil with no
+   aberration) is stored in wf->strehl.  IMPORTANT: returned array must be
+   freed by the calling function. */
+double *pupil_psf(scope_wavefront *wf, long npad, double *pixscale){
+
+  /* Variable Declarations */
+  long i,j,k,n=wf->n,off;
+  double *data,*psf,phase,amp=0.,sum=0.,peak=0.;
+  scope_fft *plan;
+
+  npad = fourier_good_size(GSL_MAX(npad, n));
+  off  = (npad - n) / 2;
+
+  data = (double *)calloc(2 * npad * npad, sizeof(double));
+  psf  = (double *)malloc(npad * npad * sizeof(double));
+
+  /* Complex pupil function: unit amplitude, phase from the OPD */
+  for(j=0;j<n;j++)
+    for(i=0;i<n;i++){
+      if(!gsl_finite(wf->opd[j*n + i]))
+	continue;
+      phase = 2.*M_PI * wf->opd[j*n + i];
+      k = (j + off)*npad + (i + off);
+      data[2*k]   = cos(phase);
+      data[2*k+1] = sin(phase);
+      amp += 1.;
+    }
+
+  plan = fourier_plan_alloc(npad, npad);
+  fourier_fft2d(plan, data, FOURIER_FORWARD);
+  fourier_plan_free(plan);
+
+  /* Intensity, shifted so that zero frequency sits at the center */
+  for(j=0;j<npad;j++)
+    for(i=0;i<npad;i++){
+      k = j*npad + i;
+      psf[((j + npad/2) % npad)*npad + (i + npad/2) % npad] =
+	data[2*k]*data[2*k] + data[2*k+1]*data[2*k+1];
+      sum  += data[2*k]*data[2*k] + data[2*k+1]*data[2*k+1];
+      peak  = GSL_MAX(peak, data[2*k]*data[2*k] + data[2*k+1]*data[2*k+1]);
+    }
+  free(data);
+
+  /* The unaberrated peak is |sum of amplitudes|^2 */
+  wf->strehl = (amp > 0.) ? peak / (amp*amp) : 0.;
+
+  if(sum > 0.)
+    for(k=0;k<npad*npad;k++)
+      psf[k] /= sum;
+
+  *pixscale = wf->lambda * 1.e-10 / (npad * wf->dx);
+
+  return psf;
+}
+
+
+/* Compute the MTF from a (centered, npad x npad) PSF */
+/* MTF = |FT(PSF)|, normalized to unity at zero frequency and centered on
+   pixel (npad/2, npad/2).  The frequency step is 1 / (npad * pixscale)
+   cycles per radian, so for a PSF from pupil_psf() the cutoff D/lambda
+   falls n pixels from the center.  IMPORTANT:
+   returned array must be freed by the calling function. */
+double *pupil_mtf(double *psf, long npad){
+
+  /* Variable Declarations */
+  long i,j,k;
+  double *data,*mtf,dc;
+  scope_fft *plan;
+
+  data = (double *)calloc(2 * npad * npad, sizeof(double));
+  mtf  = (double *)malloc(npad * npad * sizeof(double));
+
+  for(k=0;k<npad*npad;k++)
+    data[2*k] = psf[k];
+
+  plan = fourier_plan_alloc(npad, npad);
+  fourier_fft2d(plan, data, FOURIER_FORWARD);
+  fourier_plan_free(plan);
+
+  dc = hypot(data[0], data[1]);
+  for(j=0;j<npad;j++)
+    for(i=0;i<npad;i++){
+      k = j*npad + i;
+      mtf[((j + npad/2) % npad)*npad + (i + npad/2) % npad] =
+	(dc > 0.) ? hypot(data[2*k], data[2*k+1]) / dc : 0.;
+    }
+  free(data);
+
+  return mtf;
+}
+
+
+/* Diffraction analysis of one field point: trace the pupil grid, fit the
+   Zernikes, and write the OPD map, PSF and MTF as <root>_opd.fits,
+   <root>_psf.fits and <root>_mtf.fits */
+int pupil_diffraction(scope_scope *scope, scope_element *elements, int nelem,
+		      double ax, double ay, double lambda, char *root){
+
+  /* Variable Declarations */
+  int  j,status=0;
+  long npad,naxes[2];
+  double pixscale,*psf,*mtf;
+  char fn[FLEN_FILENAME];
+  scope_wavefront *wf;
+
+  printf("Tracing %d x %d pupil grid at field (%0.1f\", %0.1f\")...\n",
+	 PUPIL_NGRID,PUPIL_NGRID,ax*648000./M_PI,ay*648000./M_PI);
+
+  wf = pupil_trace_opd(scope, elements, nelem, ax, ay, lambda, PUPIL_NGRID,
+		       &status);
+  if(status)
+    return status;
+
+  status = pupil_fit_zernike(wf, PUPIL_NZERN);
+  if(status){
+    pupil_free(wf);
+    return status;
+  }
+
+  psf  = pupil_psf(wf, PUPIL_PAD * wf->n, &pixscale);
+  npad = fourier_good_size(PUPIL_PAD * wf->n);
+  mtf  = pupil_mtf(psf, npad);
+
+  /* Report */
+  printf("Wavefront at %0.0f A: %0.4f waves RMS, %0.4f waves P-V, "
+	 "Strehl %0.4f\n",lambda,wf->rms,wf->pv,wf->strehl);
+  printf("Zernike coefficients (Noll, waves RMS):\n");
+  for(j=0;j<wf->nzern;j++)
+    printf("  Z%-2d %+0.5f%s",j+1,wf->zern[j],(j % 4 == 3) ? "\n" : "");
+  printf("\nPSF pixel scale: %0.4f mas;  MTF step: %0.4f cycles/arcsec\n",
+	 pixscale*648000.e3/M_PI, M_PI/648000./(npad*pixscale));
+
+  /* Write it all out */
+  naxes[0] = naxes[1] = wf->n;
+  snprintf(fn, FLEN_FILENAME, "%s_opd.fits", root);
+  status = pupil_write_array(fn, wf->opd, naxes, scope->name);
+
+  naxes[0] = naxes[1] = npad;
+  snprintf(fn, FLEN_FILENAME, "%s_psf.fits", root);
+  if(!status)
+    status = pupil_write_array(fn, psf, naxes, scope->name);
+  snprintf(fn, FLEN_FILENAME, "%s_mtf.fits", root);
+  if(!status)
+    status = pupil_write_array(fn, mtf, naxes, scope->name);
+  if(!status)
+    printf("OPD, PSF and MTF written to %s_{opd,psf,mtf}.fits\n",root);
+
+  /* Clean up */
+  free(psf);
+  free(mtf);
+  pupil_free(wf);
+
+  return status;
+}
+
+
+/* Free space occupied by a wavefront */
+void pupil_free(scope_wavefront *wf){
+
+  if(wf == NULL)
+    return;
+
+  free(wf->opd);
+  free(wf->zern);
+  free(wf);
+
+  return;
+}
+
+
+/* Function to evaluate Zernike polynomial Z_j (Noll ordering) */
+/* Z_j = sqrt(n+1) R_n^0(rho)                     for m = 0
+       = sqrt(2(n+1)) R_n^m(rho) cos(m theta)     for m != 0, j even
+       = sqrt(2(n+1)) R_n^m(rho) sin(m theta)     for m != 0, j odd  */
+double pupil_zernike(int j, double rho, double theta){
+
+  /* Variable Declarations */
+  int n,m,s;
+  double r=0.,term;
+
+  pupil_noll(j, &n, &m);
+
+  /* Radial polynomial */
+  for(s=0;s<=(n-m)/2;s++){
+    term = pupil_factorial(n - s) /
+      (pupil_factorial(s) * pupil_factorial((n + m)/2 - s) *
+       pupil_factorial((n - m)/2 - s));
+    r += ((s % 2) ? -term : term) * pow(rho, n - 2*s);
+  }
+
+  if(m == 0)
+    return sqrt(n + 1.) * r;
+
+  return sqrt(2.*(n + 1.)) * r * ((j % 2) ? sin(m*theta) : cos(m*theta));
+}
+
+
+/* Function to convert the Noll index j (from 1) into radial order n and
+   azimuthal order m >= 0 */
+void pupil_noll(int j, int *n, int *m){
+
+  /* Variable Declarations */
+  int p;
+
+  *n = 0;
+  while((*n + 1)*(*n + 2)/2 < j)
+    (*n)++;
+  p  = j - (*n)*(*n + 1)/2;              // Position within the order, from 1
+  *m = (*n % 2) ? 2*((p + 1)/2) - 1 : 2*(p/2);
+
+  return;
+}
+
+
+/* Function to compute n! for the (small) orders used here */
+double pupil_factorial(int n){
+
+  double f=1.;
+
+  while(n > 1)
+    f *= n--;
+
+  return f;
+}
+
+
+/* Function to write a row-major array as a FITS image */
+int pupil_write_array(char *fn, double *arr, long naxes[2], char *telname){
+
+  /* Variable Declarations */
+  int  status=0;
+  scope_image img = images_wrap(arr, naxes[0], naxes[1]);
+
+  fitsw_write_image(fn, &img, DOUBLE_IMG, telname, &status);
+
+  return status;
+}
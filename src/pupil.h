@@ -0,0 +1,60 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: pupil.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef PUPIL_H
+#define PUPIL_H
+
+/* Defaults for the diffraction analysis */
+#define PUPIL_NGRID  256        // Pupil grid is 256 x 256 rays
+#define PUPIL_NZERN  15         // Zernikes fitted, through 4th order (Z15)
+#define PUPIL_PAD    2          // Zero-pad factor (2 = Nyquist-sampled PSF)
+
+
+/* Function declarations */
+
+/* Public Functions */
+scope_wavefront *pupil_trace_opd(scope_scope *scope, scope_element *elements,
+				 int nelem, double ax, double ay,
+				 double lambda, long n, int *status);
+int              pupil_fit_zernike(scope_wavefront *wf, int nzern);
+double          *pupil_psf(scope_wavefront *wf, long npad, double *pixscale);
+double          *pupil_mtf(double *psf, long npad);
+int              pupil_diffraction(scope_scope *scope,
+				   scope_element *elements, int nelem,
+				   double ax, double ay, double lambda,
+				   char *root);
+void             pupil_free(scope_wavefront *wf);
+
+/* Internal Functions */
+double           pupil_zernike(int j, double rho, double theta);
+void             pupil_noll(int j, int *n, int *m);
+double           pupil_factorial(int n);
+int              pupil_write_array(char *fn, double *arr, long naxes[2],
+				   char *telname);
+
+#endif  /* PUPIL_H */
+
+
+
@@ -0,0 +1,512 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: quadtree.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* Quadtree focal-plane accumulator.  A leaf keeps the positions of its
+   first QUADTREE_SPLIT points; the next one splits it, and the buffered
+   points are pushed down into the four children.  Positions are stored
+   as floats relative to the root (24 bits, finer than the 2^-maxdepth
+   cells), so nothing is lost to binning: for pixels no finer than the
+   cells at maximum depth, a rendered image is the dense histogram of the
+   same rays, up to float rounding of points on pixel edges.  Only the
+   cells at maximum depth are plain counts, spread over the pixels they
+   overlap when rendered.
+
+   The point storage is capped by a memory budget, and the nodes by their
+   int indices.  Past either cap the tree degrades instead of failing: new
+   leaves only count their points, and a full leaf that cannot split gives
+   up its buffer and counts from then on, so it renders like a cell at
+   maximum depth. */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <fitsio.h>                    // CFITSIO
+
+/* Local headers */
+#include "quadtree.h"
+#include "bundle.h"
+#include "images.h"
+#include "writer.h"
+
+
+/* Header keywords of a rendered image (see quadtree_write_keys()) */
+typedef struct{
+  double lo[2];                 // Lower-left corner of the image (m)
+  double pix[2];                // Pixel size (m)
+  long   nray;                  // Points in the tree
+  long   nout;                  // Points outside the root
+  long   nnode;
+  int    maxdepth;
+  int    split;
+  int    capped;                // Tree hit a memory cap
+} quadtree_keys;
+
+
+/* Function to create an empty tree over the square of edge size (m) with
+   lower-left corner lo */
+/* split <= 0, maxdepth <= 0 and budget <= 0 select QUADTREE_SPLIT,
+   QUADTREE_MAXDEPTH and QUADTREE_BUDGET; budget (MB) caps the point
+   pool.  Returns NULL on failure. */
+scope_quadtree *quadtree_create(double lo[2], double size, int split,
+				int maxdepth, double budget){
+  
+  /* Variable Declarations */
+  scope_quadtree *qt;
+  
+  qt = (scope_quadtree *)calloc(1, sizeof(scope_quadtree));
+  qt->lo[0]    = lo[0];
+  qt->lo[1]    = lo[1];
+  qt->size     = size;
+  qt->split    = (split > 0) ? split : QUADTREE_SPLIT;
+  qt->maxdepth = (maxdepth > 0) ? GSL_MIN_INT(maxdepth, 24)
+    : QUADTREE_MAXDEPTH;
+  if(budget <= 0.)
+    budget = QUADTREE_BUDGET;
+  qt->bufcap   = (long)GSL_MIN(budget * 1024. * 1024. /
+			       (2 * qt->split * sizeof(float)), INT_MAX);
+  qt->bufcap   = GSL_MAX(qt->bufcap, 1);
+  qt->maxnode  = 1024;
+  qt->node     = (quadtree_node *)malloc(qt->maxnode * sizeof(quadtree_node));
+  qt->maxbuf   = GSL_MIN(256, qt->bufcap);
+  qt->pts      = (float *)malloc(qt->maxbuf * 2 * qt->split * sizeof(float));
+  qt->freebuf  = (int *)malloc(qt->maxbuf * sizeof(int));
+  if(qt->node == NULL || qt->pts == NULL || qt->freebuf == NULL){
+    fprintf(stderr,"Error: unable to allocate a quadtree.\n");
+    quadtree_free(qt);
+    return NULL;
+  }
+  
+  /* The root: an empty leaf */
+  qt->nnode = 1;
+  qt->node[0].count = 0;
+  qt->node[0].child = -1;
+  qt->node[0].buf   = -1;
+  
+  return qt;
+}
+
+
+/* Free space occupied by a tree */
+void quadtree_free(scope_quadtree *qt){
+  
+  if(qt == NULL)
+    return;
+  
+  free(qt->node);
+  free(qt->pts);
+  free(qt->freebuf);
+  free(qt);
+  
+  return;
+}
+
+
+/* Function to add the point (u,v) (m) to a tree */
+/* Points outside the root are only counted (in nout).  Returns 0 on
+   success, -1 if a pool could not be grown below its cap. */
+int quadtree_add(scope_quadtree *qt, double u, double v){
+  
+  /* Variable Declarations */
+  double a,b;
+  
+  a = (u - qt->lo[0]) / qt->size;
+  b = (v - qt->lo[1]) / qt->size;
+  if(!(a >= 0. && a < 1. && b >= 0. && b < 1.)){
+    qt->nout++;
+    return 0;
+  }
+  
+  return quadtree_insert(qt, 0, 0, 0., 0., 1., (float)a, (float)b);
+}
+
+
+/* Function to add rays [i0, i0+n) of a traced bundle that were not lost */
+/* Positions are taken in the frame of the bundle's final element, i.e.
+   (u,v) on the detector.  Returns 0 on success. */
+int quadtree_add_bundle(scope_quadtree *qt, scope_bundle *b, long i0,
+			long n){
+  
+  /* Variable Declarations */
+  long i;
+  
+  for(i=i0; i < i0 + n; i++)
+    if(!BUNDLE_LOST(b, i) &&
+       quadtree_add(qt, b->pos[3*i], b->pos[3*i+1]))
+      return -1;
+  
+  return 0;
+}
+
+
+/* Function to render the part of a tree in [lo, hi) (m) into img */
+/* The pixel size follows from the size of img; img is cleared first. */
+void quadtree_render(scope_quadtree *qt, scope_image *img, double lo[2],
+		     double hi[2]){
+  
+  /* Variable Declarations */
+  long   y;
+  double pix[2];
+  
+  for(y=0; y < img->ny; y++)
+    memset(img->data + y * img->stride, 0, img->nx * sizeof(double));
+  
+  pix[0] = (hi[0] - lo[0]) / img->nx;
+  pix[1] = (hi[1] - lo[1]) / img->ny;
+  quadtree_render_node(qt, 0, qt->lo[0], qt->lo[1], qt->size, img, lo, pix);
+  
+  return;
+}
+
+
+/* Function to render a tree into a FITS file through the writer */
+/* The image covers [lo, hi) (m) in nx pixels across (<= 0:
+   QUADTREE_NPIX), with square pixels; lo or hi NULL means the whole root.
+   The corner, pixel size and tree statistics go in the header.  Returns
+   the status of writer_submit_keys(). */
+int quadtree_write(scope_quadtree *qt, scope_writer *w, char *fileout,
+		   double lo[2], double hi[2], long nx, char *telname){
+  
+  /* Variable Declarations */
+  long   ny;
+  double rlo[2],rhi[2];
+  scope_image   *img;
+  quadtree_keys *keys;
+  
+  if(lo == NULL || hi == NULL){
+    rlo[0] = qt->lo[0];
+    rlo[1] = qt->lo[1];
+    rhi[0] = qt->lo[0] + qt->size;
+    rhi[1] = qt->lo[1] + qt->size;
+  } else {
+    rlo[0] = lo[0];
+    rlo[1] = lo[1];
+    rhi[0] = hi[0];
+    rhi[1] = hi[1];
+  }
+  if(nx <= 0)
+    nx = QUADTREE_NPIX;
+  ny = GSL_MAX(1, lround(nx * (rhi[1] - rlo[1]) / (rhi[0] - rlo[0])));
+  
+  if((img = writer_get_buffer(w, nx, ny)) == NULL)
+    return -1;
+  quadtree_render(qt, img, rlo, rhi);
+  
+  keys = (quadtree_keys *)malloc(sizeof(quadtree_keys));
+  keys->lo[0]    = rlo[0];
+  keys->lo[1]    = rlo[1];
+  keys->pix[0]   = (rhi[0] - rlo[0]) / nx;
+  keys->pix[1]   = (rhi[1] - rlo[1]) / ny;
+  keys->nray     = qt->node[0].count;
+  keys->nout     = qt->nout;
+  keys->nnode    = qt->nnode;
+  keys->maxdepth = qt->maxdepth;
+  keys->split    = qt->split;
+  keys->capped   = qt->capped;
+  
+  return writer_submit_keys(w, img, fileout, DOUBLE_IMG, telname,
+			    quadtree_write_keys, keys);
+}
+
+
+/***** Internal Functions *****/
+
+/* Function to insert a point (a,b) (root units) below node n, a cell of
+   edge size at (x0,y0) and the given depth */
+/* A leaf already holding points but no buffer is count-only (see the
+   top of the file), and just counts this one too. */
+int quadtree_insert(scope_quadtree *qt, long n, int depth, double x0,
+		    double y0, double size, float a, float b){
+  
+  /* Variable Declarations */
+  int    r;
+  long   q;
+  float *p;
+  
+  for(;;){
+    qt->node[n].count++;
+    
+    if(qt->node[n].child < 0){
+      if(depth == qt->maxdepth ||
+	 (qt->node[n].buf < 0 && qt->node[n].count > 1))
+	return 0;                       // Finest or count-only cell
+      
+      if(qt->node[n].count <= qt->split){
+	if(qt->node[n].buf < 0){
+	  if((r = quadtree_new_buf(qt)) < 0)
+	    return (r == -1) ? -1 : 0;  // Over budget: count only
+	  qt->node[n].buf = r;
+	}
+	p = qt->pts + 2 * ((long)qt->node[n].buf * qt->split +
+			   qt->node[n].count - 1);
+	p[0] = a;
+	p[1] = b;
+	return 0;
+      }
+      
+      /* Full: push the buffered points down, then go on with this one */
+      if((r = quadtree_split(qt, n, depth, x0, y0, size)) == -2){
+	qt->freebuf[qt->nfree++] = qt->node[n].buf;
+	qt->node[n].buf = -1;           // No nodes left: count only
+	return 0;
+      }
+      if(r)
+	return -1;
+    }
+    
+    size *= 0.5;
+    q = 0;
+    if(a >= x0 + size){
+      x0 += size;
+      q  += 1;
+    }
+    if(b >= y0 + size){
+      y0 += size;
+      q  += 2;
+    }
+    n = qt->node[n].child + q;
+    depth++;
+  }
+}
+
+
+/* Function to give leaf n its four children and move its points to them */
+/* Returns 0 on success, -1 on failure, or -2 (with n untouched) if the
+   node pool is at its cap. */
+int quadtree_split(scope_quadtree *qt, long n, int depth, double x0,
+		   double y0, double size){
+  
+  /* Variable Declarations */
+  int    buf,i;
+  long   c,q;
+  float  a,b;
+  double half = 0.5 * size,cx,cy;
+  
+  if((c = quadtree_new_nodes(qt)) < 0)
+    return (int)c;
+  qt->node[n].child = (int)c;
+  buf = qt->node[n].buf;
+  qt->node[n].buf = -1;
+  if(buf < 0)
+    return 0;
+  
+  for(i=0; i < qt->split; i++){
+    a  = qt->pts[2 * ((long)buf * qt->split + i)];
+    b  = qt->pts[2 * ((long)buf * qt->split + i) + 1];
+    q  = (a >= x0 + half) + 2 * (b >= y0 + half);
+    cx = x0 + (q & 1) * half;
+    cy = y0 + (q >> 1) * half;
+    if(quadtree_insert(qt, c + q, depth + 1, cx, cy, half, a, b))
+      return -1;
+  }
+  qt->freebuf[qt->nfree++] = buf;       // Only now: the loop reads it
+  
+  return 0;
+}
+
+
+/* Function to add four empty leaves to the node pool */
+/* Returns the index of the first, -1 if the pool could not grow, or -2
+   if it is at its cap of INT_MAX nodes. */
+long quadtree_new_nodes(scope_quadtree *qt){
+  
+  /* Variable Declarations */
+  int  k;
+  long c,m;
+  quadtree_node *grown;
+  
+  if(qt->nnode + 4 > qt->maxnode){
+    if(qt->maxnode == INT_MAX){
+      quadtree_capped(qt);
+      return -2;
+    }
+    m     = GSL_MIN(2 * qt->maxnode, INT_MAX);
+    grown = (quadtree_node *)realloc(qt->node, m * sizeof(quadtree_node));
+    if(grown == NULL){
+      fprintf(stderr,"Error: unable to grow the quadtree.\n");
+      return -1;
+    }
+    qt->node    = grown;
+    qt->maxnode = m;
+  }
+  
+  c = qt->nnode;
+  for(k=0;k<4;k++){
+    qt->node[c+k].count = 0;
+    qt->node[c+k].child = -1;
+    qt->node[c+k].buf   = -1;
+  }
+  qt->nnode += 4;
+  
+  return c;
+}
+
+
+/* Function to get a point buffer, reusing one given back by a split */
+/* Returns its index, -1 if the pool could not grow, or -2 if it is at
+   the cap set by the budget. */
+int quadtree_new_buf(scope_quadtree *qt){
+  
+  /* Variable Declarations */
+  long   m;
+  float *grown;
+  int   *fgrown;
+  
+  if(qt->nfree > 0)
+    return qt->freebuf[--qt->nfree];
+  
+  if(qt->nbuf == qt->maxbuf){
+    if(qt->maxbuf == qt->bufcap){
+      quadtree_capped(qt);
+      return -2;
+    }
+    m      = GSL_MIN(2 * qt->maxbuf, qt->bufcap);
+    grown  = (float *)realloc(qt->pts, m * 2 * qt->split * sizeof(float));
+    if(grown == NULL){
+      fprintf(stderr,"Error: unable to grow the quadtree.\n");
+      return -1;
+    }
+    qt->pts = grown;
+    fgrown  = (int *)realloc(qt->freebuf, m * sizeof(int));
+    if(fgrown == NULL){
+      fprintf(stderr,"Error: unable to grow the quadtree.\n");
+      return -1;
+    }
+    qt->freebuf = fgrown;
+    qt->maxbuf  = m;
+  }
+  
+  return (int)qt->nbuf++;
+}
+
+
+/* Function to note, once, that a pool of the tree is at its cap */
+void quadtree_capped(scope_quadtree *qt){
+  
+  if(!qt->capped)
+    fprintf(stderr,"Warning: quadtree is at its memory cap; from here on, "
+	    "new cells only count rays.\n");
+  qt->capped = 1;
+  
+  return;
+}
+
+
+/* Function to render node n, a cell of edge size (m) at (x0,y0) */
+/* Buffered points go to the pixels they fall in; a count-only cell is
+   spread over the pixels it overlaps, in proportion to the overlap. */
+void quadtree_render_node(scope_quadtree *qt, long n, double x0, double y0,
+			  double size, scope_image *img, double lo[2],
+			  double pix[2]){
+  
+  /* Variable Declarations */
+  int    k;
+  long   i,ix,iy,ix0,ix1,iy0,iy1,c;
+  double half,ox,oy,w;
+  float *p;
+  quadtree_node *node = qt->node + n;
+  
+  if(node->count == 0 ||
+     x0 >= lo[0] + img->nx * pix[0] || x0 + size <= lo[0] ||
+     y0 >= lo[1] + img->ny * pix[1] || y0 + size <= lo[1])
+    return;
+  
+  if(node->child >= 0){
+    half = 0.5 * size;
+    c    = node->child;
+    for(k=0;k<4;k++)
+      quadtree_render_node(qt, c + k, x0 + (k & 1) * half,
+			   y0 + (k >> 1) * half, half, img, lo, pix);
+    return;
+  }
+  
+  if(node->buf >= 0){
+    p = qt->pts + 2 * (long)node->buf * qt->split;
+    for(i=0; i < node->count; i++){
+      ix = (long)floor((qt->lo[0] + p[2*i] * qt->size - lo[0]) / pix[0]);
+      iy = (long)floor((qt->lo[1] + p[2*i+1] * qt->size - lo[1]) / pix[1]);
+      if(ix >= 0 && iy >= 0 && ix < img->nx && iy < img->ny)
+	IMAGES_PIX(img, ix, iy) += 1.;
+    }
+    return;
+  }
+  
+  /* Count-only cell */
+  ix0 = GSL_MAX(0, (long)floor((x0 - lo[0]) / pix[0]));
+  ix1 = GSL_MIN(img->nx - 1, (long)floor((x0 + size - lo[0]) / pix[0]));
+  iy0 = GSL_MAX(0, (long)floor((y0 - lo[1]) / pix[1]));
+  iy1 = GSL_MIN(img->ny - 1, (long)floor((y0 + size - lo[1]) / pix[1]));
+  w   = node->count / (size * size);
+  for(iy=iy0; iy <= iy1; iy++){
+    oy = GSL_MIN(y0 + size, lo[1] + (iy + 1) * pix[1]) -
+      GSL_MAX(y0, lo[1] + iy * pix[1]);
+    if(oy <= 0.)
+      continue;
+    for(ix=ix0; ix <= ix1; ix++){
+      ox = GSL_MIN(x0 + size, lo[0] + (ix + 1) * pix[0]) -
+	GSL_MAX(x0, lo[0] + ix * pix[0]);
+      if(ox > 0.)
+	IMAGES_PIX(img, ix, iy) += w * ox * oy;
+    }
+  }
+  
+  return;
+}
+
+
+/* Header hook for quadtree_write(): where the image is, and the tree */
+void quadtree_write_keys(fitsfile *fitsfp, void *data, int *status){
+  
+  quadtree_keys *k = (quadtree_keys *)data;
+  
+  fits_update_key_dbl(fitsfp, "LOU", k->lo[0], -17,
+		      "u of the lower-left image corner (m)", status);
+  fits_update_key_dbl(fitsfp, "LOV", k->lo[1], -17,
+		      "v of the lower-left image corner (m)", status);
+  fits_update_key_dbl(fitsfp, "PIXU", k->pix[0], -17,
+		      "pixel size in u (m)", status);
+  fits_update_key_dbl(fitsfp, "PIXV", k->pix[1], -17,
+		      "pixel size in v (m)", status);
+  fits_update_key(fitsfp, TLONG, "NRAY", &k->nray,
+		  "rays in the quadtree", status);
+  fits_update_key(fitsfp, TLONG, "NOUT", &k->nout,
+		  "rays outside the quadtree root", status);
+  fits_update_key(fitsfp, TLONG, "QTNODES", &k->nnode,
+		  "quadtree cells", status);
+  fits_update_key(fitsfp, TINT, "QTDEPTH", &k->maxdepth,
+		  "quadtree maximum depth", status);
+  fits_update_key(fitsfp, TINT, "QTSPLIT", &k->split,
+		  "points a quadtree leaf holds before splitting", status);
+  fits_update_key(fitsfp, TLOGICAL, "QTCAPPED", &k->capped,
+		  "quadtree hit its memory cap (coarser cells)", status);
+  
+  return;
+}
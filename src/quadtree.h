@@ -0,0 +1,111 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: quadtree.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef QUADTREE_H
+#define QUADTREE_H
+
+#include "bundle.h"
+#include "writer.h"
+
+#define QUADTREE_SPLIT    32    // Points a leaf holds before it splits
+#define QUADTREE_MAXDEPTH 16    // Finest cell is 2^-16 of the root
+#define QUADTREE_ROOT     20.   // Root half-width, in RMS spot radii
+#define QUADTREE_NPIX     1024  // Default width of a rendered image
+#define QUADTREE_BUDGET   1024. // Default point storage cap (MB)
+
+/* One cell of the tree.  The four children of a node are consecutive in
+   the node pool; a leaf keeps the (root-relative) positions of its points
+   in a buffer from the point pool until it splits, except at the maximum
+   depth, where it only counts them.  Once the pools are at their caps,
+   new leaves only count too, and full leaves stop splitting. */
+typedef struct{
+  long  count;                  // Points in this cell
+  int   child;                  // First of the four children (-1: leaf)
+  int   buf;                    // Leaf's point buffer (-1: none)
+} quadtree_node;
+
+/* Adaptive-resolution focal-plane accumulator.  Cells split once they
+   hold more than `split' points, down to `maxdepth', so resolution goes
+   where the rays are: a diffraction-sized core is resolved to 2^-maxdepth
+   of the root while empty sky costs nothing.  Everything lives in two
+   pools that grow by doubling; nothing is dense.  The point pool stops at
+   bufcap buffers (the memory budget) and the node pool at INT_MAX nodes;
+   past either, the tree keeps counting at the resolution it has reached.
+   Render any sub-region at any resolution with quadtree_render(). */
+typedef struct{
+  double         lo[2];         // Lower-left corner of the root (m)
+  double         size;          // Edge of the root square (m)
+  int            split;
+  int            maxdepth;
+  quadtree_node *node;          // Node pool
+  long           nnode;
+  long           maxnode;
+  float         *pts;           // Point pool: split (u,v) pairs per buffer,
+  long           nbuf;          //   in units of size from lo
+  long           maxbuf;
+  long           bufcap;        // Most buffers the budget allows
+  int            capped;        // A pool hit its cap: some cells only count
+  int           *freebuf;       // Buffers given back by split leaves
+  long           nfree;
+  long           nout;          // Points that fell outside the root
+} scope_quadtree;
+
+
+/* Function declarations */
+
+/* Public Functions */
+scope_quadtree *quadtree_create(double lo[2], double size, int split,
+				int maxdepth, double budget);
+void            quadtree_free(scope_quadtree *qt);
+int             quadtree_add(scope_quadtree *qt, double u, double v);
+int             quadtree_add_bundle(scope_quadtree *qt, scope_bundle *b,
+				    long i0, long n);
+void            quadtree_render(scope_quadtree *qt, scope_image *img,
+				double lo[2], double hi[2]);
+int             quadtree_write(scope_quadtree *qt, scope_writer *w,
+			       char *fileout, double lo[2], double hi[2],
+			       long nx, char *telname);
+
+/* Internal Functions */
+int             quadtree_insert(scope_quadtree *qt, long n, int depth,
+				double x0, double y0, double size,
+				float a, float b);
+int             quadtree_split(scope_quadtree *qt, long n, int depth,
+			       double x0, double y0, double size);
+long            quadtree_new_nodes(scope_quadtree *qt);
+int             quadtree_new_buf(scope_quadtree *qt);
+void            quadtree_capped(scope_quadtree *qt);
+void            quadtree_render_node(scope_quadtree *qt, long n,
+				     double x0, double y0, double size,
+				     scope_image *img, double lo[2],
+				     double pix[2]);
+void            quadtree_write_keys(fitsfile *fitsfp, void *data,
+				    int *status);
+
+#endif  /* QUADTREE_H */
+
+
+
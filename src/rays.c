@@ -27,6 +27,8 @@
 #undef wombat
 
 /* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <gsl/gsl_rng.h>               // Includes GSL's rng routine defs
 #include <gsl/gsl_roots.h>             // Includes GSL's root-finder algorithms
@@ -35,17 +37,28 @@
 /* Local headers */
 #include "rays.h"
 #include "vectors.h"
+#include "sampler.h"
+#include "mirrors.h"
+#include "setup.h"
+#include "alloc.h"
+#include "glass.h"
+#include "footprint.h"
 
 
-scope_ray *rays_initialize(int ray_setup, int *ray_status, double *overshoot){
+/* The ray array is placed by alloc_buffer(), first touched through pool;
+   it must be freed with alloc_free(). */
+scope_ray *rays_initialize(scope_illum *illum, scope_pool *pool,
+			   int *ray_status, double *overshoot){
   
   /* Variable Declarations */
   long i,j;
   scope_ray *rays,normal,g,det_plane;
-  double angle=0.;
+  double angle=illum->angle;
+  double ax,ay;
   
   printf("Initializing %0.3e rays...\n",(double)N_RAYS);
-  rays = (scope_ray *)malloc(N_RAYS * sizeof(scope_ray));
+  rays = (scope_ray *)alloc_buffer(N_RAYS, sizeof(scope_ray), pool,
+				   POOL_GRAIN);
   *ray_status = 2222;
 
   /* Initialize ray position randomly across the aperture */ 
@@ -72,8 +85,9 @@ scope_ray *rays_initialize(int ray_setup, int *ray_status, double *overshoot){
     
     rays[i].x = x*radius;
     rays[i].y = y*radius;
-    rays[i].z = +10.;                                    // Start way up high
+    rays[i].z = RAYS_START_Z;                            // Start way up high
     
+    rays[i].lambda = illum->lambda;
     rays[i].lost = false;                                // Not lost yet
   }
   *overshoot = (double)j/(double)i;
@@ -81,7 +95,7 @@ scope_ray *rays_initialize(int ray_setup, int *ray_status, double *overshoot){
   
   
   /* Initialize ray direction based on setup criteria */
-  switch(ray_setup){
+  switch(illum->type){
   case(TARGET_POINT):
     printf("Serving up a single point source...\n");
     
@@ -97,26 +111,52 @@ scope_ray *rays_initialize(int ray_setup, int *ray_status, double *overshoot){
     
     break;
   case(TARGET_POINTS):
+    printf("Serving up a %d x %d grid of point sources...\n",
+	   illum->ngrid[0],illum->ngrid[1]);
     
+    /* Variable Declaration */
+    long   nf,f;
+    double cell[2];
     
+    /* A flat field: ray i comes from field cell i % nf, jittered within the
+       cell, so every cell gets the same number of rays and together they
+       fill the square of half-width fov evenly */
+    nf      = (long)illum->ngrid[0] * illum->ngrid[1];
+    cell[0] = 2. * illum->fov / illum->ngrid[0];
+    cell[1] = 2. * illum->fov / illum->ngrid[1];
+    for(i=0;i<N_RAYS;i++){
+      f  = i % nf;
+      ax = ((double)(f % illum->ngrid[0]) + gsl_rng_uniform(r)) * cell[0] -
+	illum->fov;
+      ay = ((double)(f / illum->ngrid[0]) + gsl_rng_uniform(r)) * cell[1] -
+	illum->fov;
+      rays[i].vx = sin(ax);
+      rays[i].vy = sin(ay);
+      rays[i].vz = -sqrt(1. - rays[i].vx*rays[i].vx - rays[i].vy*rays[i].vy);
+    }
     
     break;
   case(TARGET_IMAGE):
+    printf("Drawing ray directions from %s...\n",illum->image);
     
-    i=0;
     /* Variable Declaration */
-    int stat;
-    gsl_histogram2d imghist;
-    gsl_histogram2d_pdf imgpdf;
-    double x,y;
-    
-    stat = gsl_histogram2d_pdf_sample(&imgpdf, 
-				      gsl_rng_uniform(r), gsl_rng_uniform(r),
-				      &x, &y);
+    unsigned long k;
     
-    rays[i].x = x;
-    rays[i].y = y;
-    rays[i].z = +10.;
+    for(i=0;i<N_RAYS;i++){
+      
+      /* Pick a pixel with probability proportional to its flux, then
+	 jitter uniformly within the pixel */
+      k  = sampler_alias_draw(illum->table, r);
+      ax = ((double)(k % illum->naxes[0]) + gsl_rng_uniform(r) -
+	    0.5*(double)illum->naxes[0]) * illum->pixscale;
+      ay = ((double)(k / illum->naxes[0]) + gsl_rng_uniform(r) -
+	    0.5*(double)illum->naxes[1]) * illum->pixscale;
+      
+      /* Image center is on-axis; rays travel in -z */
+      rays[i].vx = sin(ax);
+      rays[i].vy = sin(ay);
+      rays[i].vz = -sqrt(1. - rays[i].vx*rays[i].vx - rays[i].vy*rays[i].vy);
+    }
     
     break;
     
@@ -130,6 +170,13 @@ scope_ray *rays_initialize(int ray_setup, int *ray_status, double *overshoot){
   
   
   
+  /* Measure optical path from the plane wavefront through the origin that
+     is normal to each ray, so path lengths are comparable */
+  for(i=0;i<N_RAYS;i++)
+    rays[i].opl = rays[i].x*rays[i].vx + rays[i].y*rays[i].vy +
+      rays[i].z*rays[i].vz;
+  
+  
   /* Clean up */
   gsl_rng_free(r);
   
@@ -352,6 +399,424 @@ int rays_reflect(scope_ray *a, scope_ray n){
 }
 
 
+/* Function to fill a bundle of rays uniformly across the aperture of an
+   optic (usually the primary), arriving from field angle (ax,ay) radians */
+/* Rays are launched from z = RAYS_START_Z, aimed so that, undeviated, they
+   would cross the plane of the optic's vertex inside its outline. */
+void rays_fill_pupil(scope_ray *rays, long n, scope_optic *pupil,
+		     double ax, double ay, double lambda, gsl_rng *r){
+  
+  /* Variable Declarations */
+  long   i;
+  double x,y,s,vx,vy,vz;
+  double radius = 0.5 * pupil->dmaj;
+  
+  vx = sin(ax);
+  vy = sin(ay);
+  vz = -sqrt(1. - vx*vx - vy*vy);
+  s  = (RAYS_START_Z - pupil->cz) / -vz;     // Path back up to launch height
+  
+  for(i=0;i<n;i++){
+    do{
+      x = gsl_rng_uniform(r)*2. - 1.;
+      y = gsl_rng_uniform(r)*2. - 1.;
+    } while(x*x + y*y > 1.);
+    
+    rays[i].x  = pupil->cx + x*radius - s*vx;
+    rays[i].y  = pupil->cy + y*radius - s*vy;
+    rays[i].z  = RAYS_START_Z;
+    rays[i].vx = vx;
+    rays[i].vy = vy;
+    rays[i].vz = vz;
+    rays[i].lambda = lambda;
+    rays[i].opl    = rays[i].x*vx + rays[i].y*vy + rays[i].z*vz;
+    rays[i].lost   = false;
+  }
+  
+  return;
+}
+
+
+/* Function to fill a bundle of rays across the aperture of an optic by
+   stratified sampling, arriving from field angle (ax,ay) radians */
+/* The aperture is cut into equal-area cells, nr rings by ns sectors with
+   nr * ns <= n as close to square as possible, and one ray is jittered
+   within each; any remaining rays are drawn at random.  The fraction of
+   rays getting through then has far less scatter than with
+   rays_fill_pupil(). */
+void rays_fill_strata(scope_ray *rays, long n, scope_optic *pupil,
+		      double ax, double ay, double lambda, gsl_rng *r){
+  
+  /* Variable Declarations */
+  long   i,nr,ns;
+  double x,y,rho,phi,s,vx,vy,vz;
+  double radius = 0.5 * pupil->dmaj;
+  
+  vx = sin(ax);
+  vy = sin(ay);
+  vz = -sqrt(1. - vx*vx - vy*vy);
+  s  = (RAYS_START_Z - pupil->cz) / -vz;
+  
+  ns = GSL_MAX((long)sqrt((double)n), 1);
+  nr = n / ns;
+  
+  for(i=0;i<n;i++){
+    if(i < nr * ns){
+      rho = sqrt(((i / ns) + gsl_rng_uniform(r)) / nr);   // Equal-area rings
+      phi = 2. * M_PI * ((i % ns) + gsl_rng_uniform(r)) / ns;
+    } else {
+      rho = sqrt(gsl_rng_uniform(r));
+      phi = 2. * M_PI * gsl_rng_uniform(r);
+    }
+    x = rho * cos(phi);
+    y = rho * sin(phi);
+    
+    rays[i].x  = pupil->cx + x*radius - s*vx;
+    rays[i].y  = pupil->cy + y*radius - s*vy;
+    rays[i].z  = RAYS_START_Z;
+    rays[i].vx = vx;
+    rays[i].vy = vy;
+    rays[i].vz = vz;
+    rays[i].lambda = lambda;
+    rays[i].opl    = rays[i].x*vx + rays[i].y*vy + rays[i].z*vz;
+    rays[i].lost   = false;
+  }
+  
+  return;
+}
+
+
+/* Function to return uniform deviate k in [0,1) of the stream seed */
+/* Counter-based: the value depends only on (seed, k), by a splitmix64
+   finalizer, so any slice of a long trace can be generated on its own. */
+double rays_counter_uniform(unsigned long seed, unsigned long k){
+  
+  /* Variable Declarations */
+  unsigned long long z;
+  
+  z  = (unsigned long long)seed * 0x9E3779B97F4A7C15ULL + k;
+  z += 0x9E3779B97F4A7C15ULL;
+  z  = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z  = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= (z >> 31);
+  
+  return (z >> 11) * (1. / 9007199254740992.);          // 53-bit mantissa
+}
+
+
+/* Function to fill rays k0 .. k0+n-1 of a trace uniformly across the
+   aperture of an optic, with rays arriving from field angle (ax,ay) */
+/* Unlike rays_fill_pupil() there is no rejection: ray k takes deviates
+   2k and 2k+1 of the stream seed, mapped to the disk by equal-area polar
+   coordinates, so ray k is the same however the trace is split up. */
+void rays_fill_counter(scope_ray *rays, long n, unsigned long k0,
+		       unsigned long seed, scope_optic *pupil, double ax,
+		       double ay, double lambda){
+  
+  /* Variable Declarations */
+  long   i;
+  double x,y,rho,phi,s,vx,vy,vz;
+  double radius = 0.5 * pupil->dmaj;
+  
+  vx = sin(ax);
+  vy = sin(ay);
+  vz = -sqrt(1. - vx*vx - vy*vy);
+  s  = (RAYS_START_Z - pupil->cz) / -vz;
+  
+  for(i=0;i<n;i++){
+    rho = sqrt(rays_counter_uniform(seed, 2 * (k0 + i)));
+    phi = 2. * M_PI * rays_counter_uniform(seed, 2 * (k0 + i) + 1);
+    x = rho * cos(phi);
+    y = rho * sin(phi);
+    
+    rays[i].x  = pupil->cx + x*radius - s*vx;
+    rays[i].y  = pupil->cy + y*radius - s*vy;
+    rays[i].z  = RAYS_START_Z;
+    rays[i].vx = vx;
+    rays[i].vy = vy;
+    rays[i].vz = vz;
+    rays[i].lambda = lambda;
+    rays[i].opl    = rays[i].x*vx + rays[i].y*vy + rays[i].z*vz;
+    rays[i].lost   = false;
+  }
+  
+  return;
+}
+
+
+/* Function to fill an n x n square grid of rays across the aperture of an
+   optic, arriving from field angle (ax,ay) radians */
+/* Grid points fall at the centers of n x n cells spanning the major
+   diameter, in row-major order; those outside the outline are marked lost
+   so that the grid stays intact.  rays must have space for n*n rays. */
+void rays_fill_grid(scope_ray *rays, long n, scope_optic *pupil,
+		    double ax, double ay, double lambda){
+  
+  /* Variable Declarations */
+  long   i,j,k;
+  double u,v,s,vx,vy,vz;
+  double dx = pupil->dmaj / n;
+  
+  vx = sin(ax);
+  vy = sin(ay);
+  vz = -sqrt(1. - vx*vx - vy*vy);
+  s  = (RAYS_START_Z - pupil->cz) / -vz;
+  
+  for(j=0;j<n;j++)
+    for(i=0;i<n;i++){
+      k = j*n + i;
+      u = (i + 0.5 - 0.5*n) * dx;
+      v = (j + 0.5 - 0.5*n) * dx;
+      rays[k].x  = pupil->cx + u - s*vx;
+      rays[k].y  = pupil->cy + v - s*vy;
+      rays[k].z  = RAYS_START_Z;
+      rays[k].vx = vx;
+      rays[k].vy = vy;
+      rays[k].vz = vz;
+      rays[k].lambda = lambda;
+      rays[k].opl    = rays[k].x*vx + rays[k].y*vy + rays[k].z*vz;
+      rays[k].lost   = (u*u + v*v > 0.25 * pupil->dmaj * pupil->dmaj);
+    }
+  
+  return;
+}
+
+
+/* Function to check a ray against the vanes of the spider */
+/* Only rays travelling down (-z) through the plane of the vanes can be
+   blocked; the vanes extend from the hub out to the tube. */
+void rays_spider(scope_ray *ray, scope_spider *spider){
+  
+  /* Variable Declarations */
+  int    k;
+  double t,dx,dy,phi,along,perp;
+  
+  if(ray->lost || spider->nvanes <= 0 || ray->vz >= 0.)
+    return;
+  
+  t = (spider->cz - ray->z) / ray->vz;
+  if(t < 0.)
+    return;
+  dx = ray->x + t*ray->vx - spider->cx;
+  dy = ray->y + t*ray->vy - spider->cy;
+  
+  for(k=0;k<spider->nvanes;k++){
+    phi   = spider->angle + 2.*M_PI*k / spider->nvanes;
+    along =  dx*cos(phi) + dy*sin(phi);
+    perp  = -dx*sin(phi) + dy*cos(phi);
+    if(along > 0. && fabs(perp) < 0.5*spider->width){
+      ray->lost = true;
+      return;
+    }
+  }
+  
+  return;
+}
+
+
+/* Function to carry a single ray through its interaction with one element */
+/* Blocking elements mark rays that HIT them as lost and leave the ray where
+   it is; all other elements mark rays that MISS them as lost, otherwise the
+   ray is moved onto the surface and reflected if requested. */
+int rays_interact(scope_ray *ray, scope_optic *optic, scope_element *element){
+  
+  /* Variable Declarations */
+  int    status=0;
+  double t,x,y,z;
+  scope_ray n;
+  
+  if(ray->lost)
+    return 0;
+  
+  t = mirrors_intersect(optic, ray);
+  
+  if(element->block){
+    if(gsl_finite(t)){
+      x = ray->x + t*ray->vx;
+      y = ray->y + t*ray->vy;
+      z = ray->z + t*ray->vz;
+      if(mirrors_inside(optic, x, y, z))
+	ray->lost = true;
+    }
+    return 0;
+  }
+  
+  /* Non-blocking element: must hit it inside the outline */
+  if(!gsl_finite(t)){
+    ray->lost = true;
+    return 0;
+  }
+  rays_advance_ray(ray, t);
+  if(!mirrors_inside(optic, ray->x, ray->y, ray->z)){
+    ray->lost = true;
+    return 0;
+  }
+  
+  if(element->reflect){
+    mirrors_normal(optic, ray->x, ray->y, ray->z, &n);
+    status = rays_reflect(ray, n);
+  }
+  
+  return status;
+}
+
+
+/* Function to trace a bundle of rays through the ordered list of elements */
+/* Refracting elements bend the rays from the medium they are in (the glass
+   behind the last refracting element, air to start with) into the glass
+   behind this one; the medium also scales the optical path.  Elements
+   carrying a footprint map have it filled on the way, RAYS_BATCH rays at a
+   time. */
+void rays_trace(scope_ray *rays, long n, scope_scope *scope,
+		scope_element *elements, int nelem){
+  
+  /* Variable Declarations */
+  int  e,medium=GLASS_AIR;
+  long i,i0,m;
+  double opl;
+  char live[RAYS_BATCH];
+  scope_optic *optic;
+  scope_footprint *fp;
+  
+  /* The spider sits in the incoming beam, ahead of every element */
+  if(scope->spider.nvanes > 0)
+    for(i=0;i<n;i++)
+      rays_spider(&rays[i], &scope->spider);
+  
+  /* Element-by-element over the bundle, so each optic stays in cache */
+  for(e=0;e<nelem;e++){
+    optic = setup_get_optic(scope, elements[e].elem);
+    if(optic == NULL){
+      printf("Element %d (%d) has no matching optic!\n",e,elements[e].elem);
+      continue;
+    }
+    fp = elements[e].footprint;
+    
+    for(i0=0; i0 < n; i0 += RAYS_BATCH){
+      m = GSL_MIN(RAYS_BATCH, n - i0);
+      if(fp != NULL)
+	for(i=0;i<m;i++)
+	  live[i] = !rays[i0+i].lost;
+      
+      /* Inside glass, the optical path is n times the distance travelled */
+      if(medium == GLASS_AIR)
+	for(i=i0;i<i0+m;i++)
+	  rays_interact(&rays[i], optic, &elements[e]);
+      else
+	for(i=i0;i<i0+m;i++){
+	  opl = rays[i].opl;
+	  rays_interact(&rays[i], optic, &elements[e]);
+	  rays[i].opl += (glass_index(medium, rays[i].lambda) - 1.) *
+	    (rays[i].opl - opl);
+	}
+      
+      if(fp != NULL)
+	footprint_add(fp, optic, rays + i0, m, live);
+    }
+    
+    if(elements[e].refract){
+      rays_refract(rays, n, optic, medium, optic->glass);
+      medium = optic->glass;
+    }
+  }
+  
+  return;
+}
+
+
+/* Function to refract rays that have reached a refracting surface, going
+   from glass gin into glass gout */
+/* Rays are taken RAYS_BATCH at a time: the surface normals and index
+   ratios are gathered into arrays, bent by the branch-free rays_snell()
+   kernel, and scattered back.  Rays that are totally internally reflected
+   are lost. */
+void rays_refract(scope_ray *rays, long n, scope_optic *optic, int gin,
+		  int gout){
+  
+  /* Variable Declarations */
+  long   i,i0,m;
+  double vx[RAYS_BATCH],vy[RAYS_BATCH],vz[RAYS_BATCH];
+  double nx[RAYS_BATCH],ny[RAYS_BATCH],nz[RAYS_BATCH],eta[RAYS_BATCH];
+  double tir[RAYS_BATCH];
+  scope_ray nrm;
+  
+  for(i0=0; i0 < n; i0 += RAYS_BATCH){
+    m = GSL_MIN(RAYS_BATCH, n - i0);
+    
+    /* Gather (lost rays go straight through a unit-index surface) */
+    for(i=0;i<m;i++){
+      vx[i] = rays[i0+i].vx;
+      vy[i] = rays[i0+i].vy;
+      vz[i] = rays[i0+i].vz;
+      if(rays[i0+i].lost){
+	nx[i]  = vx[i];
+	ny[i]  = vy[i];
+	nz[i]  = vz[i];
+	eta[i] = 1.;
+	continue;
+      }
+      mirrors_normal(optic, rays[i0+i].x, rays[i0+i].y, rays[i0+i].z, &nrm);
+      nx[i]  = nrm.vx;
+      ny[i]  = nrm.vy;
+      nz[i]  = nrm.vz;
+      eta[i] = glass_index(gin, rays[i0+i].lambda) /
+	glass_index(gout, rays[i0+i].lambda);
+    }
+    
+    rays_snell(m, vx, vy, vz, nx, ny, nz, eta, tir);
+    
+    /* Scatter */
+    for(i=0;i<m;i++){
+      if(rays[i0+i].lost)
+	continue;
+      if(tir[i] > 0.){
+	rays[i0+i].lost = true;
+	continue;
+      }
+      rays[i0+i].vx = vx[i];
+      rays[i0+i].vy = vy[i];
+      rays[i0+i].vz = vz[i];
+    }
+  }
+  
+  return;
+}
+
+
+/* Snell's law for a batch of m directions v, in place, across surfaces
+   with unit normals n and index ratios eta = n_in / n_out */
+/* Either orientation of n will do.  tir[i] is set to 1 where the ray is
+   totally internally reflected (v[i] is then left unchanged), else 0.
+   The loop is branch-free, with the mask kept as a double, so that GCC
+   vectorizes it (at -O3, given -fno-math-errno -fno-trapping-math). */
+void rays_snell(long m, double *restrict vx, double *restrict vy,
+		double *restrict vz, const double *restrict nx,
+		const double *restrict ny, const double *restrict nz,
+		const double *restrict eta, double *restrict tir){
+  
+  /* Variable Declarations */
+  long   i;
+  double ci,s,k,g,ct;
+  
+  for(i=0;i<m;i++){
+    ci = -(vx[i]*nx[i] + vy[i]*ny[i] + vz[i]*nz[i]);
+    s  = copysign(1., ci);                 // Normal against the ray
+    ci = s * ci;
+    k  = 1. - eta[i]*eta[i] * (1. - ci*ci);
+    g  = (k < 0.) ? 0. : 1.;               // 0 = TIR
+    tir[i] = 1. - g;
+    ct = sqrt(g * k);
+    s  = g * s * (eta[i]*ci - ct);
+    g  = 1. + g * (eta[i] - 1.);           // eta, or 1 for TIR
+    vx[i] = g*vx[i] + s*nx[i];
+    vy[i] = g*vy[i] + s*ny[i];
+    vz[i] = g*vz[i] + s*nz[i];
+  }
+  
+  return;
+}
+
+
 /*************************************************************************/
 /* The following functions are type void.  There are no internal checks, */
 /* so no status return values are required.  These functions replace the */
@@ -360,11 +825,14 @@ int rays_reflect(scope_ray *a, scope_ray n){
 /*************************************************************************/
 
 /* Function for advancing rays along path; x = x0 + v*t */
+/* The optical path length grows by the geometric distance d; inside
+   glass, rays_trace() scales that step by the index afterwards */
 void rays_advance_ray(scope_ray *beam, double d){
   
   beam->x = beam->x + d * beam->vx;
   beam->y = beam->y + d * beam->vy;
   beam->z = beam->z + d * beam->vz;
+  beam->opl += d;
   
   return;
 }
@@ -26,8 +26,37 @@
 #define RAYS_H
 
 
+#include <gsl/gsl_rng.h>        // GSL's rng routine defs
+#include "pool.h"
+
+#define RAYS_START_Z 10.        // Height (m) from which rays are launched
+#define RAYS_BATCH   256        // Rays refracted per rays_snell() call
+
+
 /* Function declarations */
-scope_ray *rays_initialize(int ray_setup, int *ray_status, double *overshoot);
+scope_ray *rays_initialize(scope_illum *illum, scope_pool *pool,
+			   int *ray_status, double *overshoot);
+void       rays_fill_pupil(scope_ray *rays, long n, scope_optic *pupil,
+			   double ax, double ay, double lambda, gsl_rng *r);
+void       rays_fill_strata(scope_ray *rays, long n, scope_optic *pupil,
+			    double ax, double ay, double lambda, gsl_rng *r);
+double     rays_counter_uniform(unsigned long seed, unsigned long k);
+void       rays_fill_counter(scope_ray *rays, long n, unsigned long k0,
+			     unsigned long seed, scope_optic *pupil,
+			     double ax, double ay, double lambda);
+void       rays_fill_grid(scope_ray *rays, long n, scope_optic *pupil,
+			  double ax, double ay, double lambda);
+void       rays_spider(scope_ray *ray, scope_spider *spider);
+int        rays_interact(scope_ray *ray, scope_optic *optic,
+			 scope_element *element);
+void       rays_trace(scope_ray *rays, long n, scope_scope *scope,
+		      scope_element *elements, int nelem);
+void       rays_refract(scope_ray *rays, long n, scope_optic *optic,
+			int gin, int gout);
+void       rays_snell(long m, double *restrict vx, double *restrict vy,
+		      double *restrict vz, const double *restrict nx,
+		      const double *restrict ny, const double *restrict nz,
+		      const double *restrict eta, double *restrict tir);
 double     raytrace_free_distance(scope_ray ray, raytrace_geom geom, int surf);
 double     raytrace_distroot(double t, void *params);
 void       rays_advance_ray(scope_ray *beam, double d);
@@ -0,0 +1,220 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: sampler.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <gsl/gsl_rng.h>               // Includes GSL's rng routine defs
+
+/* Local headers */
+#include "sampler.h"
+#include "fitsw.h"
+#include "images.h"
+
+
+/* Build a Walker / Vose alias table from a set of (non-negative) weights.
+   Each draw from the table then costs O(1), regardless of the number of
+   bins.  NOTE: the weights array is taken over by the table and becomes its
+   probability column, so the calling function must NOT free it.  */
+scope_alias *sampler_alias_build(double *weights, unsigned long n,
+				 int *status){
+
+  /* Variable Declarations */
+  unsigned long i,s,l,nsmall=0,nlarge=0;
+  unsigned long *work;
+  double total=0.;
+  scope_alias *table;
+
+  *status = 0;
+
+  /* Normalization -- there must be SOMETHING to sample from */
+  for(i=0;i<n;i++)
+    total += weights[i];
+  if(n == 0 || !(total > 0.)){
+    fprintf(stderr,"Error: alias table requested for an empty distribution.\n");
+    *status = -1;
+    return NULL;
+  }
+
+  table = (scope_alias *)malloc(sizeof(scope_alias));
+  table->n     = n;
+  table->prob  = weights;
+  table->alias = (unsigned long *)malloc(n * sizeof(unsigned long));
+
+  /* One work array holds both stacks: the "small" bins grow up from the
+     front, the "large" bins grow down from the back. */
+  work = (unsigned long *)malloc(n * sizeof(unsigned long));
+  if(table->alias == NULL || work == NULL){
+    fprintf(stderr,"Error: unable to allocate alias table of %lu bins.\n",n);
+    free(table->alias);
+    free(table);
+    free(work);
+    *status = -1;
+    return NULL;
+  }
+
+  /* Scale so that the mean weight is 1, and sort into the stacks */
+  for(i=0;i<n;i++){
+    weights[i] *= (double)n / total;
+    if(weights[i] < 1.)
+      work[nsmall++] = i;
+    else
+      work[n - ++nlarge] = i;
+  }
+
+  /* Pair off each small bin with a large one, which donates its excess */
+  while(nsmall && nlarge){
+    s = work[--nsmall];
+    l = work[n - nlarge];
+    table->alias[s] = l;
+    weights[l] -= 1. - weights[s];
+    if(weights[l] < 1.){           // Large bin is now small, move it over
+      nlarge--;
+      work[nsmall++] = l;
+    }
+  }
+
+  /* Anything left over is full (to within round-off) */
+  while(nlarge){
+    l = work[n - nlarge--];
+    weights[l] = 1.;
+    table->alias[l] = l;
+  }
+  while(nsmall){
+    s = work[--nsmall];
+    weights[s] = 1.;
+    table->alias[s] = s;
+  }
+
+  free(work);
+
+  return table;
+}
+
+
+/* Draw a single bin index from the alias table */
+/* A bin is chosen uniformly, then a biased coin decides between it and its
+   alias.  The bin index uses gsl_rng_uniform_int() rather than scaling a
+   single uniform deviate so that tables with >1e9 bins remain unbiased. */
+unsigned long sampler_alias_draw(scope_alias *table, gsl_rng *r){
+
+  unsigned long i;
+
+  i = gsl_rng_uniform_int(r, table->n);
+
+  return (gsl_rng_uniform(r) < table->prob[i]) ? i : table->alias[i];
+}
+
+
+/* Free space occupied by an alias table */
+void sampler_alias_free(scope_alias *table){
+
+  if(table == NULL)
+    return;
+
+  free(table->prob);
+  free(table->alias);
+  free(table);
+
+  return;
+}
+
+
+/* Function to read a FITS image into a 1-D array of sampling weights */
+/* The image is read in tiles of SAMPLER_TILE_ROWS rows at a time, each
+   straight into its own rows of the (row-major) weight array, so nothing
+   beyond the weights themselves is allocated.  Negative
+   and non-finite pixels are given zero weight.  The image size is returned
+   in naxes[2].  Returns NULL, with *status set, if the image cannot be
+   read.  IMPORTANT: returned array must be freed by calling function
+   (or handed off to sampler_alias_build()). */
+double *sampler_load_weights(char *filename, long naxes[2], int *status){
+
+  /* Variable Declarations */
+  int  bitpix,naxis,cstat=0;
+  long i,j,row,xystart[2];
+  double *weights,val;
+  scope_image all,tile;
+  fitsfile *fitsfp;
+
+  *status = 0;
+
+  /* Open the image and find out how big it is (directly, not through
+     fw_open_r(), so a bad file is an error returned rather than an exit) */
+  if(fits_open_file(&fitsfp, filename, READONLY, status)){
+    fits_report_error(stderr,*status);
+    fprintf(stderr,"Error: unable to open illumination image %s\n",filename);
+    return NULL;
+  }
+  if(fits_get_img_param(fitsfp, 2, &bitpix, &naxis, naxes, status)){
+    fits_report_error(stderr,*status);
+    fits_close_file(fitsfp, &cstat);
+    return NULL;
+  }
+
+  printf("Reading %ld x %ld illumination image %s...\n",
+	 naxes[0],naxes[1],filename);
+
+  weights = (double *)malloc(naxes[0] * naxes[1] * sizeof(double));
+  if(weights == NULL){
+    fprintf(stderr,"Error: unable to allocate weights for %s\n",filename);
+    fits_close_file(fitsfp, &cstat);
+    *status = MEMORY_ALLOCATION;
+    return NULL;
+  }
+
+  /* Read the image tile by tile */
+  all = images_wrap(weights, naxes[0], naxes[1]);
+  xystart[0] = 0;
+  for(row=0; row < naxes[1]; row += SAMPLER_TILE_ROWS){
+    xystart[1] = row;
+    tile = images_view(&all, 0, row, naxes[0],
+		       GSL_MIN(SAMPLER_TILE_ROWS, naxes[1] - row), status);
+
+    fitsw_read_image(fitsfp, xystart, &tile, TDOUBLE, status);
+
+    for(i=0; i < tile.ny; i++)
+      for(j=0; j < tile.nx; j++){
+	val = IMAGES_PIX(&tile, j, i);
+	IMAGES_PIX(&tile, j, i) = (gsl_finite(val) && val > 0.) ? val : 0.;
+      }
+
+    if(*status)
+      break;
+  }
+
+  /* Clean up */
+  fits_close_file(fitsfp, &cstat);
+
+  if(*status){
+    free(weights);
+    return NULL;
+  }
+
+  return weights;
+}
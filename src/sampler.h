@@ -0,0 +1,45 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: sampler.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <gsl/gsl_rng.h>        // GSL's rng routine defs
+
+#define SAMPLER_TILE_ROWS 256   // Image rows read from disk per tile
+
+
+/* Function declarations */
+scope_alias  *sampler_alias_build(double *weights, unsigned long n,
+				  int *status);
+unsigned long sampler_alias_draw(scope_alias *table, gsl_rng *r);
+void          sampler_alias_free(scope_alias *table);
+double       *sampler_load_weights(char *filename, long naxes[2],
+				   int *status);
+
+#endif  /* SAMPLER_H */
+
+
+
@@ -116,6 +116,7 @@ wombat double SYS_RAM;       // System RAM in MB
 #define DS9_WHATEVER   452   // If extant, use (with conditions), otherwise new
 #define DS9_GET        453   // Read XPA handles from DS9
 #define DS9_SET        454   // Set new XPA handle to DS9
+#define DS9_ARRAY      455   // Push an in-memory image to DS9
 
 /* Typedef structures needed */
 
@@ -128,6 +129,7 @@ typedef struct{
   double vy;       // 
   double vz;       // 
   double lambda;   // Wavelength in Angstroms
+  double opl;      // Optical path length accumulated so far (m)
 #if HAVE__BOOL
   bool   lost;     // Indicates whether a ray has been "lost"
 #else
@@ -148,7 +150,11 @@ typedef struct{
   double nx;     // N_x for center of element
   double ny;     // N_y for center of element
   double nz;     // N_z for center of element
+  double k;      // Conic constant (0 = sphere, -1 = parabola, <-1 = hyper)
   int    nhat;   // Primary direction of nhat - set by setup_orient_optic()
+  double frame[3][3]; // Local u,v,w axes - set by setup_orient_optic()
+  int    glass;  // Medium behind a refracting surface (GLASS_AIR, ...);
+                 // for a lens surface f is half the radius of curvature
 } scope_optic;
 
 // Structure for Obstruction / Reflection / Refraction information
@@ -163,9 +169,38 @@ typedef struct{
   int  reflect;
   int  refract;
 #endif
+  struct scope_footprint *footprint; // Where rays struck it (NULL = not
+                                     // recorded), see footprint.c
 } scope_element;
 
 
+// Compact storage for a bundle of rays (see bundle.c)
+// Positions are float offsets in the local frame of the anchor surface (where
+// the rays currently sit), directions are float octahedral-encoded unit
+// vectors, wavelength is a palette index, and lost is a single bit.
+typedef struct{
+  long                n;            // Number of rays
+  float              *pos;          // (u,v,w) offsets from the anchor, 3n
+  float              *dir;          // Octahedral-encoded directions, 2n
+  unsigned char      *lam;          // Palette index (NULL: all palette[0])
+  double              palette[256]; // Wavelengths in Angstroms
+  int                 npalette;     // Number of palette entries in use
+  unsigned long long *lost;         // Lost flags, one bit per ray
+  scope_optic         anchor;       // Surface whose frame pos is measured in
+} scope_bundle;
+
+
+// Spider holding the secondary: thin radial vanes in a plane normal to z
+typedef struct{
+  int    nvanes;     // Number of vanes (0 = no spider)
+  double width;      // Width of each vane (m)
+  double angle;      // Position angle of the first vane from +x (radians)
+  double cx;         // Center of the spider hub
+  double cy;         //
+  double cz;         // Height of the plane of the vanes
+} scope_spider;
+
+
 // Telescope Structure for ScopeDesign Consumption
 typedef struct{
   char        *name;        // Name of telescope design
@@ -179,22 +214,196 @@ typedef struct{
   scope_optic octonary;     //
   scope_optic nonary;       //
   scope_optic denary;       //
+  scope_optic focalplane;   // Detector (Newtonian or Cassegrain focal plane)
+  scope_spider spider;      // Vanes supporting the secondary
 } scope_scope;
 
 
 
+// Image held in one contiguous block; pixel (x,y) is data[y*stride + x].
+// A view into part of another image shares its data (owner = IMAGES_VIEW).
+typedef struct{
+  double *data;              // First pixel
+  long    nx;                // Width in pixels
+  long    ny;                // Height in pixels
+  long    stride;            // Pixels from one row to the next (>= nx)
+  int     owner;             // How data was obtained (IMAGES_HEAP, etc.)
+} scope_image;
+
+
+// Arena for temporary images: one big block, handed out by bumping a pointer
+// and released all at once
+typedef struct{
+  char   *base;              // Start of the block
+  size_t  size;              // Size of the block in bytes
+  size_t  used;              // Bytes handed out so far
+} scope_arena;
+
+
+// Prescription of a Newtonian telescope (see demo_newtonian_design())
+typedef struct{
+  double fratio;             // Primary focal ratio
+  double dmaj;               // Primary diameter (m)
+  double dsec;               // Minor axis of the flat secondary (m)
+  double offset;             // Offset of the secondary in its own plane (m)
+  double backfocus;          // Fold point to focal plane (m)
+} scope_newtonian;
+
+
+// Grid of Newtonian prescriptions for a design-space sweep; parameter k
+// (in scope_newtonian order) takes n[k] values evenly from lo[k] to hi[k]
+#define SWEEP_NPAR 5
+typedef struct{
+  double        lo[SWEEP_NPAR];
+  double        hi[SWEEP_NPAR];
+  int           n[SWEEP_NPAR];
+  long          nrays;       // Rays traced per design and field point
+  unsigned long seed;        // RNG seed (the same pupil sample for every design)
+  double        field;       // Off-axis field angle for the merit figures (rad)
+  double        lambda;      // Wavelength (Angstroms)
+} scope_sweep;
+
+
+// Design parameters and merit sample for the optimizer (see optim.c);
+// parameter j is field which[j] (OPTIM_F, OPTIM_CX, ...) of optic elem[j]
+#define OPTIM_MAXPAR   16
+#define OPTIM_MAXFIELD 8
+typedef struct{
+  int           npar;
+  int           elem[OPTIM_MAXPAR];    // Optic (OPTIC_PRI, OPTIC_SEC, ...)
+  int           which[OPTIM_MAXPAR];   // Parameter of that optic
+  int           nfield;
+  double        field[OPTIM_MAXFIELD]; // Field angles along x (rad)
+  long          nrays;       // Fixed pupil sample per field point
+  unsigned long seed;        // RNG seed for the pupil sample
+  int           maxiter;     // Most Levenberg-Marquardt steps
+  double        lambda;      // Wavelength (Angstroms)
+} scope_optim;
+
+
+// Tolerances for a Monte Carlo tolerance analysis (see tolerance.c); term
+// j perturbs optic elem[j] by up to tol[j] in the way given by kind[j]
+#define TOLERANCE_MAXTERM  16
+#define TOLERANCE_MAXFIELD 8
+typedef struct{
+  int           nterm;
+  int           elem[TOLERANCE_MAXTERM];   // Optic (OPTIC_PRI, ...)
+  int           kind[TOLERANCE_MAXTERM];   // TOLERANCE_DECENTER, ...
+  double        tol[TOLERANCE_MAXTERM];    // Tolerance (m, or rad for tilts)
+  int           nfield;
+  double        field[TOLERANCE_MAXFIELD]; // Field angles along x (rad)
+  long          ntrial;      // Number of perturbed trials
+  long          nrays;       // Shared pupil sample per field point
+  unsigned long seed;        // RNG seed (trial t uses seed + 1 + t)
+  double        lambda;      // Wavelength (Angstroms)
+} scope_tolerance;
+
+
+// Focal-plane accumulator for long traces: a histogram of where the rays
+// land on the detector, running (Welford) statistics of the spot, and a
+// fixed-size random sample of the rays themselves.  It
+// covers rays [range[0], range[1]) of a trace of ntotal; partial ones from
+// shards of a trace are written out and merged exactly (see spot.c).
+typedef struct{
+  long          npix;        // Histogram is npix x npix
+  double        lo[2];       // Lower-left corner of the histogram (m)
+  double        pix;         // Pixel size (m)
+  double       *hist;        // Counts
+  long          nray;        // Rays added (reaching the detector or not)
+  long          ngood;       // Rays reaching the detector
+  double        mean[2];     // Running mean of (u,v)
+  double        m2[2];       // Running sum of squared deviations
+  long          range[2];    // Ray indices covered
+  long          ntotal;      // Rays in the whole trace
+  unsigned long seed;        // Counter-based RNG seed of the trace
+  long          batch;       // Rays traced per bundle
+  long          nsample;     // Reservoir size (rays kept for spot diagrams)
+  double       *sample[3];   // Reservoir: u, v (m) and ray index
+} scope_spot;
+
+
 // Structure containing DS9 XPA handles for the open window
 typedef struct{
   char  *file;               // Filename
   int    frame;              // Frame Number
-  char  *cmap;               // Colormap
+  char  *cmap;               // Colormap (heap, like file and scale)
   char  *scale;              // Color scale type
   double min_scale;          // Color scale minimum
   double max_scale;          // Color scale maximum
   int    zoom;               // Zoom
+  scope_image *image;        // Image to push as an array (DS9_ARRAY)
 } scope_display;
 
 
+// Walker / Vose alias table for O(1) sampling of a discrete distribution
+typedef struct{
+  unsigned long  n;          // Number of bins (e.g. image pixels)
+  double        *prob;       // Probability of keeping bin i over its alias
+  unsigned long *alias;      // Bin to use when bin i is not kept
+} scope_alias;
+
+
+// Illumination environment, filled in by setup_initialize_illumination()
+typedef struct{
+  int          type;         // TARGET type (TARGET_POINT, TARGET_IMAGE, etc.)
+  double       angle;        // Field angle of a single point source (radians)
+  double       lambda;       // Wavelength in Angstroms
+  char        *image;        // FITS image used for TARGET_IMAGE
+  long         naxes[2];     // Size of the illumination image
+  double       pixscale;     // Angular size of an image pixel (radians)
+  scope_alias *table;        // Alias table built from the image pixels
+  double       fov;          // Half-width of the TARGET_POINTS field (radians)
+  int          ngrid[2];     // Grid of TARGET_POINTS field points
+} scope_illum;
+
+
+// Parameters for PSF-grid image simulation of an extended source
+typedef struct{
+  int           ngrid[2];    // Number of field points (PSFs) in x and y
+  long          npsf;        // Size of each PSF image in pixels (odd)
+  long          ntile;       // Size of the overlap-add tiles in pixels
+  long          nrays;       // Rays traced per field point
+  double        lambda;      // Wavelength in Angstroms
+  unsigned long seed;        // RNG seed (shared by every field point)
+} scope_imsim;
+
+
+// Wavefront (OPD map) across the entrance pupil for one field point
+typedef struct{
+  long    n;           // Pupil grid is n x n samples
+  double  dx;          // Spacing of the samples in the entrance pupil (m)
+  double  lambda;      // Wavelength in Angstroms
+  double  ax;          // Field angle (radians)
+  double  ay;          //
+  double *opd;         // OPD in waves, row-major (NaN where obstructed)
+  int     nzern;       // Number of (Noll-ordered) Zernike terms fitted
+  double *zern;        // Zernike coefficients in waves RMS (zern[0] = Z1)
+  double  rms;         // RMS wavefront error, piston & tilt removed (waves)
+  double  pv;          // Peak-to-valley wavefront error (waves)
+  double  strehl;      // Strehl ratio (set by pupil_psf())
+} scope_wavefront;
+
+
+// One entry in the on-disk PSF cache index
+typedef struct{
+  unsigned long long key;    // Hash of prescription, field, wavelength, etc.
+  double             size;   // Size of the cached FITS file in bytes
+  unsigned long      used;   // LRU clock value at last use
+} scope_psfentry;
+
+
+// On-disk PSF cache (FITS images plus a small index file)
+typedef struct{
+  char           *dir;       // Cache directory
+  double          maxsize;   // Size cap in bytes, enforced by LRU eviction
+  double          size;      // Current total size in bytes
+  unsigned long   tick;      // LRU clock
+  long            n;         // Number of entries
+  long            nalloc;    // Space allocated for entries
+  scope_psfentry *entry;     // The entries themselves
+} scope_psfcache;
+
+
 // Leftover structure from raytrace program... still here to allow compile...
 typedef struct{
   double f;      // Focal Length of Primary
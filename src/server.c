@@ -0,0 +1,532 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: server.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* XPA server: a warm ScopeDesign process that scripts and DS9 analysis
+   menus can drive, e.g.
+
+     xpaset -p scopedesign param sec.cz 1.32
+     xpaset -p scopedesign trace spot.fits
+     xpaget scopedesign progress
+     xpaget scopedesign stats
+
+   The access points are registered with XPACmdNew() / XPACmdAdd() under
+   SERVER_CLASS:SERVER_NAME, and served from XPAPoll() in the main thread.
+   Each trace is a compact trace like --compact (counter-based rays, the
+   same pilot and spot accumulator), so a re-trace costs only the trace
+   itself: no process start, geometry setup, buffer allocation or DS9
+   connection. */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xpa.h>                       // XPA Headers for the access points
+
+/* Local headers */
+#include "server.h"
+#include "bundle.h"
+#include "setup.h"
+#include "optim.h"
+#include "spot.h"
+#include "glass.h"
+#include "progress.h"
+
+
+/* Function to serve re-trace requests over XPA until told to quit */
+/* Traces are of nrays rays (<= 0: SERVER_NRAYS), keeping nsample of them
+   for spot diagrams.  Returns 0 on a clean exit. */
+int server_run(scope_scope *scope, scope_element *elements, int nelem,
+	       scope_illum *illum, scope_pool *pool, long nrays,
+	       long nsample){
+  
+  /* Variable Declarations */
+  int  status=0;
+  XPA  xpa;
+  scope_server srv;
+  
+  memset(&srv, 0, sizeof(scope_server));
+  srv.scope    = scope;
+  srv.elements = elements;
+  srv.nelem    = nelem;
+  srv.illum    = illum;
+  srv.pool     = pool;
+  srv.nrays    = (nrays > 0) ? nrays : (long)SERVER_NRAYS;
+  srv.nsample  = nsample;
+#if SERVER_THREADS
+  pthread_mutex_init(&srv.lock, NULL);
+#endif
+  
+  xpa = XPACmdNew(SERVER_CLASS, SERVER_NAME);
+  if(xpa == NULL){
+    fprintf(stderr,"Error: unable to register XPA access point %s:%s.\n",
+	    SERVER_CLASS,SERVER_NAME);
+    return -1;
+  }
+  XPACmdAdd(xpa, "param",
+	    "get or set a prescription parameter: pri.f, sec.cz, fp.cx, "
+	    "... (as for --optimize), field (arcsec), lambda (A) or rays",
+	    server_get_param, &srv, NULL, server_set_param, &srv, NULL);
+  XPACmdAdd(xpa, "trace",
+	    "start a trace, writing the spot to <fits> if given; "
+	    "get: idle, running, cancelled or failed",
+	    server_get_trace, &srv, NULL, server_set_trace, &srv, NULL);
+  XPACmdAdd(xpa, "cancel", "stop the running trace",
+	    NULL, NULL, NULL, server_set_cancel, &srv, NULL);
+  XPACmdAdd(xpa, "progress", "rays traced, rays in all, rays/s, seconds",
+	    server_get_progress, &srv, NULL, NULL, NULL, NULL);
+  XPACmdAdd(xpa, "stats",
+	    "rays traced, rays on the detector, centroid u v (m), RMS (m)",
+	    server_get_stats, &srv, NULL, NULL, NULL, NULL);
+  XPACmdAdd(xpa, "quit", "stop serving (the running trace is cancelled)",
+	    NULL, NULL, NULL, server_set_quit, &srv, NULL);
+  
+  printf("Serving XPA requests as %s:%s\n",SERVER_CLASS,SERVER_NAME);
+  while(!srv.quit)
+    XPAPoll(SERVER_POLL, 1);
+  
+  server_wait(&srv);
+  XPAFree(xpa);
+  status = srv.status;
+  spot_free(srv.spot);
+  bundle_free(srv.bundle);
+  bundle_free(srv.pilot);
+#if SERVER_THREADS
+  pthread_mutex_destroy(&srv.lock);
+#endif
+  
+  return status;
+}
+
+
+/***** Internal Functions *****/
+
+/* Trace job: pilot, then the whole trace a bundle at a time */
+/* Replaces srv->spot when the pilot is done, so statistics queries see the
+   new trace from then on. */
+void *server_trace(void *data){
+  
+  /* Variable Declarations */
+  int    status,cancel=0;
+  long   k,n,batch;
+  double cen[2],rms;
+  scope_server *srv = (scope_server *)data;
+  scope_spot   *spot=NULL,*old;
+  
+  batch  = srv->batch;
+  status = bundle_fill_counter(srv->pilot, 0, SPOT_SEED + 1,
+			       &srv->scope->primary, srv->illum->angle, 0.,
+			       srv->illum->lambda);
+  if(!status)
+    status = bundle_trace(srv->pilot, NULL, srv->scope, srv->elements,
+			  srv->nelem, NULL);
+  if(!status){
+    bundle_spot(srv->pilot, cen, &rms);
+    spot = spot_create(cen, 5. * rms, 0, srv->nrays, SPOT_SEED, srv->nsample);
+    spot->batch = batch;
+#if SERVER_THREADS
+    pthread_mutex_lock(&srv->lock);
+#endif
+    old       = srv->spot;
+    srv->spot = spot;
+#if SERVER_THREADS
+    pthread_mutex_unlock(&srv->lock);
+#endif
+    spot_free(old);
+  }
+  
+  for(k=0; k < srv->nrays && !status && !cancel; k += n){
+    n = GSL_MIN(batch, srv->nrays - k);
+    srv->bundle->n = n;
+    status = bundle_fill_counter(srv->bundle, k, SPOT_SEED,
+				 &srv->scope->primary, srv->illum->angle, 0.,
+				 srv->illum->lambda);
+    if(!status)
+      status = bundle_trace(srv->bundle, srv->pool, srv->scope,
+			    srv->elements, srv->nelem, NULL);
+    if(status)
+      break;
+#if SERVER_THREADS
+    pthread_mutex_lock(&srv->lock);
+#endif
+    spot_add(spot, srv->bundle, 0, n);
+    cancel = srv->cancel;
+#if SERVER_THREADS
+    pthread_mutex_unlock(&srv->lock);
+#endif
+  }
+  
+  if(!status && !cancel && srv->spotfile != NULL)
+    spot_write(spot, srv->spotfile, srv->scope->name, &status);
+  
+#if SERVER_THREADS
+  pthread_mutex_lock(&srv->lock);
+#endif
+  srv->status  = status;
+  srv->running = 0;
+  srv->t1      = progress_time();
+#if SERVER_THREADS
+  pthread_mutex_unlock(&srv->lock);
+#endif
+  
+  return NULL;
+}
+
+
+/* Function to start a trace, with the bundles allocated on first use */
+/* The bundle holds up to N_RAYS rays, and is only reallocated if a trace
+   wants a bigger one.  Returns 0 if the trace is under way (or, without
+   threads, done). */
+int server_start(scope_server *srv, char *spotfile){
+  
+  /* Variable Declarations */
+  int  status=0;
+  long want;
+  
+  server_wait(srv);                     // Reap the last trace, if any
+  
+  want = GSL_MIN((long)N_RAYS, srv->nrays);
+  if(srv->bundle == NULL || want > srv->batch){
+    bundle_free(srv->bundle);
+    srv->bundle = bundle_alloc(want, srv->pool, &status);
+    if(status)
+      return status;
+    srv->batch = want;
+  }
+  if(srv->pilot == NULL){
+    srv->pilot = bundle_alloc(PROGRESS_PILOT, NULL, &status);
+    if(status)
+      return status;
+  }
+  
+  free(srv->spotfile);
+  srv->spotfile = (spotfile != NULL) ? strdup(spotfile) : NULL;
+  srv->running  = 1;
+  srv->cancel   = 0;
+  srv->status   = 0;
+  srv->t0       = progress_time();
+  srv->ntrace++;
+  
+#if SERVER_THREADS
+  if(pthread_create(&srv->tid, NULL, server_trace, srv)){
+    srv->running = 0;
+    return -1;
+  }
+  srv->thread = 1;
+#else
+  server_trace(srv);
+#endif
+  
+  return 0;
+}
+
+
+/* Function to wait for the trace thread (if any) to finish */
+void server_wait(scope_server *srv){
+  
+#if SERVER_THREADS
+  if(srv->thread){
+    pthread_join(srv->tid, NULL);
+    srv->thread = 0;
+  }
+#endif
+  free(srv->spotfile);
+  srv->spotfile = NULL;
+  
+  return;
+}
+
+
+/* Function to find a prescription parameter by name (e.g. "sec.cz") */
+/* The names are those of --optimize; the optic it belongs to is returned
+   in optic.  Returns NULL for an unknown name. */
+double *server_param(scope_server *srv, char *name, scope_optic **optic){
+  
+  /* Variable Declarations */
+  scope_optim opt;
+  
+  if(optim_parse(name, &opt) || opt.npar != 1)
+    return NULL;
+  if((*optic = setup_get_optic(srv->scope, opt.elem[0])) == NULL)
+    return NULL;
+  
+  return optim_param(*optic, opt.which[0]);
+}
+
+
+/* XPA get param: the value of one parameter */
+int server_get_param(void *client_data, void *call_data, char *paramlist,
+		     char **buf, size_t *len){
+  
+  /* Variable Declarations */
+  double val,*p;
+  char   name[64];
+  scope_optic  *optic;
+  scope_server *srv = (scope_server *)client_data;
+  
+  if(paramlist == NULL || sscanf(paramlist, "%63s", name) != 1){
+    XPAError((XPA)call_data, "which parameter?");
+    return -1;
+  }
+  
+  if(strcmp(name, "field") == 0)
+    val = srv->illum->angle * 648000. / M_PI;         // radians -> arcsec
+  else if(strcmp(name, "lambda") == 0)
+    val = srv->illum->lambda;
+  else if(strcmp(name, "rays") == 0)
+    val = srv->nrays;
+  else if((p = server_param(srv, name, &optic)) != NULL)
+    val = *p;
+  else {
+    XPAError((XPA)call_data, "unknown parameter");
+    return -1;
+  }
+  
+  *buf = (char *)malloc(32);
+  snprintf(*buf, 32, "%0.17g\n", val);
+  *len = strlen(*buf);
+  
+  return 0;
+}
+
+
+/* XPA set param: "NAME VALUE", or NAME with the value as the data */
+/* Refused while a trace is running, since the trace reads the
+   prescription as it goes. */
+int server_set_param(void *client_data, void *call_data, char *paramlist,
+		     char *buf, size_t len){
+  
+  /* Variable Declarations */
+  int    running;
+  double val,old,*p;
+  char   name[64];
+  scope_optic  *optic;
+  scope_server *srv = (scope_server *)client_data;
+  
+  if(paramlist == NULL || sscanf(paramlist, "%63s %lf", name, &val) < 1){
+    XPAError((XPA)call_data, "usage: param NAME VALUE");
+    return -1;
+  }
+  if(sscanf(paramlist, "%*s %lf", &val) != 1 &&
+     (buf == NULL || len == 0 || sscanf(buf, "%lf", &val) != 1)){
+    XPAError((XPA)call_data, "usage: param NAME VALUE");
+    return -1;
+  }
+  
+#if SERVER_THREADS
+  pthread_mutex_lock(&srv->lock);
+#endif
+  running = srv->running;
+#if SERVER_THREADS
+  pthread_mutex_unlock(&srv->lock);
+#endif
+  if(running){
+    XPAError((XPA)call_data, "a trace is running; cancel it first");
+    return -1;
+  }
+  
+  if(strcmp(name, "field") == 0)
+    srv->illum->angle = val * M_PI / 648000.;         // arcsec -> radians
+  else if(strcmp(name, "lambda") == 0){
+    srv->illum->lambda = val;
+    glass_tabulate(&srv->illum->lambda, 1);
+  } else if(strcmp(name, "rays") == 0){
+    if(val < 1.){
+      XPAError((XPA)call_data, "rays must be at least 1");
+      return -1;
+    }
+    srv->nrays = (long)val;
+  } else if((p = server_param(srv, name, &optic)) != NULL){
+    old = *p;
+    *p  = val;
+    if(setup_orient_optic(optic)){
+      *p = old;
+      setup_orient_optic(optic);
+      XPAError((XPA)call_data, "not a valid surface normal");
+      return -1;
+    }
+  } else {
+    XPAError((XPA)call_data, "unknown parameter");
+    return -1;
+  }
+  
+  return 0;
+}
+
+
+/* XPA get trace: state of the current (or last) trace */
+int server_get_trace(void *client_data, void *call_data, char *paramlist,
+		     char **buf, size_t *len){
+  
+  /* Variable Declarations */
+  const char   *state;
+  scope_server *srv = (scope_server *)client_data;
+  
+#if SERVER_THREADS
+  pthread_mutex_lock(&srv->lock);
+#endif
+  if(srv->running)
+    state = "running";
+  else if(srv->status)
+    state = "failed";
+  else if(srv->cancel)
+    state = "cancelled";
+  else
+    state = "idle";
+#if SERVER_THREADS
+  pthread_mutex_unlock(&srv->lock);
+#endif
+  
+  *buf = (char *)malloc(64);
+  snprintf(*buf, 64, "%s %ld\n", state, srv->ntrace);
+  *len = strlen(*buf);
+  
+  return 0;
+}
+
+
+/* XPA set trace: start a trace, writing the spot to the file named in
+   paramlist (if any) when it is done */
+int server_set_trace(void *client_data, void *call_data, char *paramlist,
+		     char *buf, size_t len){
+  
+  /* Variable Declarations */
+  int    running;
+  char   fn[1024];
+  scope_server *srv = (scope_server *)client_data;
+  
+#if SERVER_THREADS
+  pthread_mutex_lock(&srv->lock);
+#endif
+  running = srv->running;
+#if SERVER_THREADS
+  pthread_mutex_unlock(&srv->lock);
+#endif
+  if(running){
+    XPAError((XPA)call_data, "a trace is already running");
+    return -1;
+  }
+  
+  if(paramlist == NULL || sscanf(paramlist, "%1023s", fn) != 1)
+    fn[0] = '\0';
+  if(server_start(srv, (fn[0] != '\0') ? fn : NULL)){
+    XPAError((XPA)call_data, "unable to start the trace");
+    return -1;
+  }
+  
+  return 0;
+}
+
+
+/* XPA set cancel: stop the running trace after the current bundle */
+int server_set_cancel(void *client_data, void *call_data, char *paramlist,
+		      char *buf, size_t len){
+  
+  scope_server *srv = (scope_server *)client_data;
+  
+#if SERVER_THREADS
+  pthread_mutex_lock(&srv->lock);
+#endif
+  if(srv->running)
+    srv->cancel = 1;
+#if SERVER_THREADS
+  pthread_mutex_unlock(&srv->lock);
+#endif
+  
+  return 0;
+}
+
+
+/* XPA get progress: rays traced, rays in all, rays/s, seconds */
+int server_get_progress(void *client_data, void *call_data,
+			char *paramlist, char **buf, size_t *len){
+  
+  /* Variable Declarations */
+  long   nray=0,ntotal;
+  double dt;
+  scope_server *srv = (scope_server *)client_data;
+  
+#if SERVER_THREADS
+  pthread_mutex_lock(&srv->lock);
+#endif
+  if(srv->spot != NULL)
+    nray = srv->spot->nray;
+  ntotal = (srv->spot != NULL) ? srv->spot->ntotal : srv->nrays;
+  dt     = (srv->running ? progress_time() : srv->t1) - srv->t0;
+#if SERVER_THREADS
+  pthread_mutex_unlock(&srv->lock);
+#endif
+  if(srv->ntrace == 0)
+    dt = 0.;
+  
+  *buf = (char *)malloc(128);
+  snprintf(*buf, 128, "%ld %ld %0.4e %0.3f\n", nray, ntotal,
+	   nray / GSL_MAX(dt, 1.e-9), dt);
+  *len = strlen(*buf);
+  
+  return 0;
+}
+
+
+/* XPA get stats: rays traced, rays on the detector, centroid, RMS radius */
+int server_get_stats(void *client_data, void *call_data, char *paramlist,
+		     char **buf, size_t *len){
+  
+  /* Variable Declarations */
+  scope_server *srv = (scope_server *)client_data;
+  
+  *buf = (char *)malloc(160);
+#if SERVER_THREADS
+  pthread_mutex_lock(&srv->lock);
+#endif
+  if(srv->spot == NULL)
+    snprintf(*buf, 160, "0 0 0 0 0\n");
+  else
+    snprintf(*buf, 160, "%ld %ld %0.10e %0.10e %0.10e\n", srv->spot->nray,
+	     srv->spot->ngood, srv->spot->mean[0], srv->spot->mean[1],
+	     spot_rms(srv->spot));
+#if SERVER_THREADS
+  pthread_mutex_unlock(&srv->lock);
+#endif
+  *len = strlen(*buf);
+  
+  return 0;
+}
+
+
+/* XPA set quit: cancel any trace and leave server_run() */
+int server_set_quit(void *client_data, void *call_data, char *paramlist,
+		    char *buf, size_t len){
+  
+  scope_server *srv = (scope_server *)client_data;
+  
+  server_set_cancel(client_data, call_data, paramlist, buf, len);
+  srv->quit = 1;
+  
+  return 0;
+}
@@ -0,0 +1,111 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: server.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+# include <pthread.h>
+# define SERVER_THREADS 1
+#else
+# define SERVER_THREADS 0
+#endif
+
+#include "bundle.h"
+#include "pool.h"
+
+#define SERVER_CLASS "SCOPEDESIGN"  // XPA class:name of the access points
+#define SERVER_NAME  "scopedesign"
+#define SERVER_POLL  100        // Longest wait for an XPA request (ms)
+#define SERVER_NRAYS 1.e7       // Default rays per trace
+
+/* A long-running ScopeDesign process, driven over XPA (by scripts or DS9
+   analysis menus) instead of being restarted for every change.  The
+   prescription, thread pool, ray bundles and glass tables stay warm
+   between traces.  Traces run in their own thread, so the server keeps
+   answering progress, statistics and cancel requests while one is going;
+   the prescription can only be changed between traces. */
+typedef struct{
+  scope_scope   *scope;
+  scope_element *elements;
+  int            nelem;
+  scope_illum   *illum;
+  scope_pool    *pool;
+  scope_bundle  *bundle;        // Reused by every trace
+  long           batch;         // Rays the bundle has room for
+  scope_bundle  *pilot;         // Sizes the spot window of every trace
+  scope_spot    *spot;          // Accumulator of the current (or last) trace
+  long           nrays;         // Rays per trace
+  long           nsample;       // Rays kept for spot diagrams
+  char          *spotfile;      // Where to write the spot (NULL: nowhere)
+  int            running;       // A trace is going
+  int            cancel;        // Ask it to stop after the current bundle
+  int            quit;          // Leave server_run()
+  int            status;        // Of the last trace
+  long           ntrace;        // Traces started
+  double         t0;            // Start of the current (or last) trace
+  double         t1;            // End of the last trace
+#if SERVER_THREADS
+  pthread_t      tid;
+  int            thread;        // tid has yet to be joined
+  pthread_mutex_t lock;         // Guards spot and the flags above
+#endif
+} scope_server;
+
+
+/* Function declarations */
+
+/* Public Functions */
+int     server_run(scope_scope *scope, scope_element *elements, int nelem,
+		   scope_illum *illum, scope_pool *pool, long nrays,
+		   long nsample);
+
+/* Internal Functions */
+void   *server_trace(void *data);
+int     server_start(scope_server *srv, char *spotfile);
+void    server_wait(scope_server *srv);
+double *server_param(scope_server *srv, char *name, scope_optic **optic);
+int     server_get_param(void *client_data, void *call_data, char *paramlist,
+			 char **buf, size_t *len);
+int     server_set_param(void *client_data, void *call_data, char *paramlist,
+			 char *buf, size_t len);
+int     server_get_trace(void *client_data, void *call_data, char *paramlist,
+			 char **buf, size_t *len);
+int     server_set_trace(void *client_data, void *call_data, char *paramlist,
+			 char *buf, size_t len);
+int     server_set_cancel(void *client_data, void *call_data,
+			  char *paramlist, char *buf, size_t len);
+int     server_get_progress(void *client_data, void *call_data,
+			    char *paramlist, char **buf, size_t *len);
+int     server_get_stats(void *client_data, void *call_data, char *paramlist,
+			 char **buf, size_t *len);
+int     server_set_quit(void *client_data, void *call_data, char *paramlist,
+			char *buf, size_t len);
+
+#endif  /* SERVER_H */
+
+
+
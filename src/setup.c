@@ -28,12 +28,15 @@
 
 /* Include packages */
 #include <stdio.h>
+#include <stdlib.h>
 #include <gsl/gsl_vector.h>            // Contains GSL's vector headers
 
 /* Local headers */
 #include "setup.h"
 #include "vectors.h"
+#include "mirrors.h"
 #include "demo.h"
+#include "sampler.h"
 
 
 int setup_orient_optic(scope_optic *optic){
@@ -46,6 +49,7 @@ int setup_orient_optic(scope_optic *optic){
   /* Test that the vectors routine did not fail */
   if(nhat > 0){
     optic->nhat = nhat;
+    mirrors_set_frame(optic);
     return 0;             // Return value = 0 is a good thing
   } else {
     return nhat;          // Return value = -1 is NOT a good thing
@@ -53,9 +57,42 @@ int setup_orient_optic(scope_optic *optic){
 }
 
 
+/* Function to return the optic in a telescope matching a symbolic element */
+scope_optic *setup_get_optic(scope_scope *scope, int elem){
+  
+  switch(elem){
+  case OPTIC_PRI:
+    return &scope->primary;
+  case OPTIC_SEC:
+    return &scope->secondary;
+  case OPTIC_TRI:
+    return &scope->tertiary;
+  case OPTIC_QUA:
+    return &scope->quaternary;
+  case OPTIC_QUI:
+    return &scope->quinary;
+  case OPTIC_SEN:
+    return &scope->senary;
+  case OPTIC_SEP:
+    return &scope->septenary;
+  case OPTIC_OCT:
+    return &scope->octonary;
+  case OPTIC_NON:
+    return &scope->nonary;
+  case OPTIC_DEN:
+    return &scope->denary;
+  case OPTIC_NFP:
+  case OPTIC_CFP:
+    return &scope->focalplane;
+  default:
+    return NULL;
+  }
+}
+
+
 /* Function to initialize the geometry to be used */
 int setup_initialize_geometry(scope_scope *scope,         // Info about elements
-			      scope_element *elements,    // Order of impact
+			      scope_element **elements,   // Order of impact
 			      int *nelem){                // How many impacts?
   
   /* In principle, this function could call an external .txt configuration
@@ -74,15 +111,56 @@ int setup_initialize_geometry(scope_scope *scope,         // Info about elements
 
 
 /* Function to initialize the illumination environment */
-int setup_initialize_illumination(int value){
-  
-  
-  
-  
-  
-  
-  
+/* On input, illum->image and illum->pixscale (radians) describe the sky image
+   for TARGET_IMAGE; the alias table for sampling it is built here so that
+   rays_initialize() can draw ray directions in O(1) apiece. */
+int setup_initialize_illumination(int value, scope_illum *illum){
   
+  /* Variable Declarations */
+  int     status=0;
+  double *weights;
+  
+  illum->type  = value;
+  illum->table = NULL;
+  if(illum->lambda <= 0.)
+    illum->lambda = 5500.;       // Default to V-band
+  
+  switch(value){
+  case(TARGET_POINT):
+    break;
+  case(TARGET_POINTS):
+    if(illum->fov <= 0. || illum->ngrid[0] < 1 || illum->ngrid[1] < 1){
+      fprintf(stderr,"Error: TARGET_POINTS requires a field and a grid.\n");
+      return -1;
+    }
+    break;
+    
+  case(TARGET_IMAGE):
+    
+    if(illum->image == NULL){
+      fprintf(stderr,"Error: TARGET_IMAGE requires an illumination image.\n");
+      return -1;
+    }
+    
+    /* Read in the image, pixel values become the sampling weights */
+    weights = sampler_load_weights(illum->image, illum->naxes, &status);
+    if(status)
+      return status;
+    
+    /* Build the alias table (takes over the weights array) */
+    illum->table = sampler_alias_build(weights,
+				       illum->naxes[0] * illum->naxes[1],
+				       &status);
+    if(status){
+      free(weights);
+      return status;
+    }
+    break;
+    
+  default:
+    printf("Unknown illumination type %d.\n",value);
+    return -1;
+  }
   
   return 0;
 }
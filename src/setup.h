@@ -29,8 +29,9 @@
 
 /* Function declarations */
 int setup_orient_optic();
-int setup_initialize_geometry(scope_scope *, scope_element *, int *);
-int setup_initialize_illumination(int);
+scope_optic *setup_get_optic(scope_scope *, int);
+int setup_initialize_geometry(scope_scope *, scope_element **, int *);
+int setup_initialize_illumination(int, scope_illum *);
 
 #endif  /* SETUP_H */
 
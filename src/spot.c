@@ -0,0 +1,516 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: spot.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Focal-plane accumulator for long traces.  Rays are added a chunk at a
+   time, in ray order: each chunk's mean and spread are merged into the
+   running statistics in one step (Chan et al.), and its hits are binned.
+   Partial accumulators from shards of a trace are written to FITS (the
+   histogram as the image, the statistics as full-precision header
+   keywords) and merged with the same pairwise formulas, in ray order, so
+   the merged statistics do not depend on the order the files are given
+   in.
+
+   For spot diagrams, a reservoir of up to nsample of the rays reaching
+   the detector is kept as well (algorithm R), a uniform random subset
+   however long the trace.  The replacement draws are counter-based, keyed
+   on the ray index, so the sample does not depend on the thread count or
+   on a checkpoint and resume; the reservoirs of shards are merged by
+   drawing from each in proportion to the rays it has seen. */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_rng.h>
+
+/* Local headers */
+#include "spot.h"
+#include "bundle.h"
+#include "rays.h"
+#include "fitsw.h"
+#include "images.h"
+#include "progress.h"
+#include "writer.h"
+
+
+/* Function to create an empty accumulator for a trace of ntotal rays,
+   starting at ray k0, with a histogram of half-width halfwidth (m) around
+   cen and a reservoir of nsample rays */
+scope_spot *spot_create(double cen[2], double halfwidth, long k0,
+			long ntotal, unsigned long seed, long nsample){
+  
+  /* Variable Declarations */
+  int c;
+  scope_spot *s;
+  
+  s = (scope_spot *)calloc(1, sizeof(scope_spot));
+  s->npix     = SPOT_NPIX;
+  s->hist     = (double *)calloc(SPOT_NPIX * SPOT_NPIX, sizeof(double));
+  halfwidth   = GSL_MAX(halfwidth, PROGRESS_MINHALF);
+  s->lo[0]    = cen[0] - halfwidth;
+  s->lo[1]    = cen[1] - halfwidth;
+  s->pix      = 2. * halfwidth / SPOT_NPIX;
+  s->range[0] = k0;
+  s->range[1] = k0;
+  s->ntotal   = ntotal;
+  s->seed     = seed;
+  s->nsample  = GSL_MAX(nsample, 0);
+  for(c=0;c<3;c++)
+    s->sample[c] = (double *)malloc(GSL_MAX(s->nsample, 1) * sizeof(double));
+  
+  return s;
+}
+
+
+/* Free space occupied by an accumulator */
+void spot_free(scope_spot *s){
+  
+  if(s == NULL)
+    return;
+  
+  free(s->hist);
+  free(s->sample[0]);
+  free(s->sample[1]);
+  free(s->sample[2]);
+  free(s);
+  
+  return;
+}
+
+
+/* Add rays [i0, i0+n) of a traced bundle, the next n rays of the trace,
+   to the accumulator */
+/* Positions are (u,v) in the frame of the bundle's final element. */
+void spot_add(scope_spot *s, scope_bundle *b, long i0, long n){
+  
+  /* Variable Declarations */
+  int  k;
+  long i,ix,iy,ng=0,nab,m,j,ray;
+  double x[2],d,delta,cm[2]={0.,0.},cm2[2]={0.,0.};
+  
+  for(i=i0; i < i0 + n; i++){
+    if(BUNDLE_LOST(b, i))
+      continue;
+    x[0] = b->pos[3*i];
+    x[1] = b->pos[3*i+1];
+    ng++;
+    for(k=0;k<2;k++){
+      d       = x[k] - cm[k];
+      cm[k]  += d / ng;
+      cm2[k] += d * (x[k] - cm[k]);
+    }
+    ix = (long)floor((x[0] - s->lo[0]) / s->pix);
+    iy = (long)floor((x[1] - s->lo[1]) / s->pix);
+    if(ix >= 0 && iy >= 0 && ix < s->npix && iy < s->npix)
+      s->hist[iy * s->npix + ix] += 1.;
+    
+    /* Reservoir: the m'th good ray replaces a random slot with
+       probability nsample / (m+1); the draw has its own stream (~seed) */
+    m   = s->ngood + ng - 1;
+    ray = s->range[1] + (i - i0);
+    if(m < s->nsample)
+      j = m;
+    else
+      j = (long)(rays_counter_uniform(~s->seed, ray) * (m + 1));
+    if(j < s->nsample){
+      s->sample[0][j] = x[0];
+      s->sample[1][j] = x[1];
+      s->sample[2][j] = ray;
+    }
+  }
+  
+  if(ng){
+    nab = s->ngood + ng;
+    for(k=0;k<2;k++){
+      delta       = cm[k] - s->mean[k];
+      s->mean[k] += delta * ng / nab;
+      s->m2[k]   += cm2[k] + delta * delta * s->ngood * ng / nab;
+    }
+    s->ngood = nab;
+  }
+  s->nray     += n;
+  s->range[1] += n;
+  
+  return;
+}
+
+
+/* Function to merge accumulator t into s */
+/* The histograms must share a window, and the reservoirs a size.  Returns
+   non-zero if they do not. */
+int spot_merge(scope_spot *s, scope_spot *t){
+  
+  /* Variable Declarations */
+  int  k;
+  long i,nab;
+  double delta;
+  
+  if(s->npix != t->npix || s->pix != t->pix || s->nsample != t->nsample ||
+     s->lo[0] != t->lo[0] || s->lo[1] != t->lo[1])
+    return -1;
+  
+  spot_merge_sample(s, t);
+  
+  for(i=0; i < s->npix * s->npix; i++)
+    s->hist[i] += t->hist[i];
+  
+  if(t->ngood){
+    nab = s->ngood + t->ngood;
+    for(k=0;k<2;k++){
+      delta       = t->mean[k] - s->mean[k];
+      s->mean[k] += delta * t->ngood / nab;
+      s->m2[k]   += t->m2[k] + delta * delta * s->ngood * t->ngood / nab;
+    }
+    s->ngood = nab;
+  }
+  s->nray    += t->nray;
+  s->range[0] = GSL_MIN(s->range[0], t->range[0]);
+  s->range[1] = GSL_MAX(s->range[1], t->range[1]);
+  
+  return 0;
+}
+
+
+/* Function to merge the reservoir of t into that of s */
+/* Each reservoir is a uniform sample of the good rays it has seen, so a
+   uniform sample of the union takes each ray from s with probability
+   (rays of s not yet taken) / (rays of both not yet taken), i.e. a
+   hypergeometric split, and then that many rays at random from each
+   reservoir.  Draws are seeded by t's first ray, so merges repeat. */
+void spot_merge_sample(scope_spot *s, scope_spot *t){
+  
+  /* Variable Declarations */
+  int  c;
+  long i,j,m,na,nb,fa,fb,ta=0,tb=0;
+  double *out[3],tmp;
+  gsl_rng *r;
+  
+  na = s->ngood;
+  nb = t->ngood;
+  fa = GSL_MIN(na, s->nsample);
+  fb = GSL_MIN(nb, t->nsample);
+  m  = GSL_MIN(na + nb, s->nsample);
+  if(nb == 0 || m == 0)
+    return;
+  
+  r = gsl_rng_alloc(gsl_rng_taus2);
+  gsl_rng_set(r, s->seed ^ (unsigned long)t->range[0]);
+  for(c=0;c<3;c++)
+    out[c] = (double *)malloc(m * sizeof(double));
+  
+  for(i=0;i<m;i++){
+    if(gsl_rng_uniform(r) * ((na - ta) + (nb - tb)) < (na - ta)){
+      j = ta + gsl_rng_uniform_int(r, fa - ta);      // Partial shuffle of s
+      for(c=0;c<3;c++){
+	tmp = s->sample[c][j];
+	s->sample[c][j]  = s->sample[c][ta];
+	s->sample[c][ta] = tmp;
+	out[c][i] = tmp;
+      }
+      ta++;
+    } else {
+      j = tb + gsl_rng_uniform_int(r, fb - tb);      // ...and of t
+      for(c=0;c<3;c++){
+	tmp = t->sample[c][j];
+	t->sample[c][j]  = t->sample[c][tb];
+	t->sample[c][tb] = tmp;
+	out[c][i] = tmp;
+      }
+      tb++;
+    }
+  }
+  
+  for(c=0;c<3;c++){
+    free(s->sample[c]);
+    s->sample[c] = (double *)realloc(out[c], GSL_MAX(s->nsample, 1) *
+				     sizeof(double));
+  }
+  gsl_rng_free(r);
+  
+  return;
+}
+
+
+/* Function to return the RMS spot radius about the centroid (m) */
+double spot_rms(scope_spot *s){
+  
+  return (s->ngood > 0) ? sqrt((s->m2[0] + s->m2[1]) / s->ngood) : 0.;
+}
+
+
+/* Function to write an accumulator to FITS */
+/* The statistics go into the header with 17 significant digits, so they
+   read back bit for bit. */
+void spot_write(scope_spot *s, char *fileout, char *telname, int *status){
+  
+  /* Variable Declarations */
+  scope_image img;
+  fitsfile   *fitsfp;
+  
+  img = images_wrap(s->hist, s->npix, s->npix);
+  fitsw_write_image(fileout, &img, DOUBLE_IMG, telname, status);
+  if(*status)
+    return;
+  
+  fitsfp = fw_open_rw(fileout, status);
+  spot_write_keys(fitsfp, s, status);
+  if( fits_close_file(fitsfp, status) )
+    fw_catcherror(status);
+  
+  return;
+}
+
+
+/* Function to checkpoint an accumulator through the background writer */
+/* A copy of the histogram and statistics is queued, so the trace carries
+   on at once; the file is replaced atomically (see writer_submit_keys()),
+   so a job killed at any point leaves a complete checkpoint behind. */
+int spot_checkpoint(scope_spot *s, scope_writer *w, char *fileout,
+		    char *telname){
+  
+  /* Variable Declarations */
+  int  c;
+  long nfill = GSL_MIN(s->ngood, s->nsample);
+  scope_image *img;
+  scope_spot  *copy;
+  
+  if((img = writer_get_buffer(w, s->npix, s->npix)) == NULL)
+    return -1;
+  memcpy(img->data, s->hist, s->npix * s->npix * sizeof(double));
+  
+  /* One block, as the writer frees it with a single free() */
+  copy  = (scope_spot *)malloc(sizeof(scope_spot) +
+			       3 * GSL_MAX(nfill, 1) * sizeof(double));
+  *copy = *s;
+  copy->hist = NULL;
+  for(c=0;c<3;c++){
+    copy->sample[c] = (double *)(copy + 1) + c * GSL_MAX(nfill, 1);
+    memcpy(copy->sample[c], s->sample[c], nfill * sizeof(double));
+  }
+  
+  return writer_submit_keys(w, img, fileout, DOUBLE_IMG, telname,
+			    spot_write_keys, copy);
+}
+
+
+/* Header hook: write the statistics and ray range of accumulator data,
+   and append its reservoir as the binary table RAYS */
+void spot_write_keys(fitsfile *fitsfp, void *data, int *status){
+  
+  /* Variable Declarations */
+  scope_spot *s = (scope_spot *)data;
+  char *ttype[3] = {"U","V","RAY"};
+  char *tunit[3] = {"m","m",""};
+  
+  fits_update_key(fitsfp, TLONG, "NRAY", &s->nray,
+		  "rays added (reaching the detector or not)", status);
+  fits_update_key(fitsfp, TLONG, "NGOOD", &s->ngood,
+		  "rays reaching the detector", status);
+  fits_update_key_dbl(fitsfp, "MEANU", s->mean[0], -17,
+		      "running mean of u (m)", status);
+  fits_update_key_dbl(fitsfp, "MEANV", s->mean[1], -17,
+		      "running mean of v (m)", status);
+  fits_update_key_dbl(fitsfp, "M2U", s->m2[0], -17,
+		      "sum of squared deviations in u (m^2)", status);
+  fits_update_key_dbl(fitsfp, "M2V", s->m2[1], -17,
+		      "sum of squared deviations in v (m^2)", status);
+  fits_update_key_dbl(fitsfp, "LOU", s->lo[0], -17,
+		      "u of the lower-left histogram corner (m)", status);
+  fits_update_key_dbl(fitsfp, "LOV", s->lo[1], -17,
+		      "v of the lower-left histogram corner (m)", status);
+  fits_update_key_dbl(fitsfp, "PIX", s->pix, -17,
+		      "histogram pixel size (m)", status);
+  fits_update_key(fitsfp, TLONG, "RAYK0", &s->range[0],
+		  "first ray index covered", status);
+  fits_update_key(fitsfp, TLONG, "RAYK1", &s->range[1],
+		  "last ray index covered + 1", status);
+  fits_update_key(fitsfp, TLONG, "RAYTOT", &s->ntotal,
+		  "rays in the whole trace", status);
+  fits_update_key(fitsfp, TULONG, "RAYSEED", &s->seed,
+		  "counter-based RNG seed of the trace", status);
+  fits_update_key(fitsfp, TLONG, "BATCH", &s->batch,
+		  "rays traced per bundle", status);
+  fits_update_key(fitsfp, TLONG, "NSAMPLE", &s->nsample,
+		  "size of the ray reservoir (extension RAYS)", status);
+  
+  fitsw_append_table(fitsfp, "RAYS", 3, ttype, tunit, s->sample,
+		     GSL_MIN(s->ngood, s->nsample), status);
+  
+  return;
+}
+
+
+/* Function to read an accumulator written by spot_write() */
+/* Returns NULL (with *status set) on error. */
+scope_spot *spot_read(char *filename, int *status){
+  
+  /* Variable Declarations */
+  int  bitpix,naxis,c,anynul,cstat=0;
+  long naxes[2],xystart[2]={0,0},nfill;
+  scope_image *img;
+  scope_spot  *s;
+  fitsfile    *fitsfp;
+  
+  *status = 0;
+  if(fits_open_file(&fitsfp, filename, READONLY, status)){
+    fw_catcherror(status);
+    return NULL;
+  }
+  fits_get_img_param(fitsfp, 2, &bitpix, &naxis, naxes, status);
+  if(*status || naxis != 2 || naxes[0] != naxes[1]){
+    fprintf(stderr,"Error: %s is not a spot accumulator.\n",filename);
+    fits_close_file(fitsfp, &cstat);
+    *status = (*status) ? *status : BAD_NAXIS;
+    return NULL;
+  }
+  
+  s = (scope_spot *)calloc(1, sizeof(scope_spot));
+  s->npix = naxes[0];
+  fits_read_key(fitsfp, TLONG, "NRAY", &s->nray, NULL, status);
+  fits_read_key(fitsfp, TLONG, "NGOOD", &s->ngood, NULL, status);
+  fits_read_key(fitsfp, TDOUBLE, "MEANU", &s->mean[0], NULL, status);
+  fits_read_key(fitsfp, TDOUBLE, "MEANV", &s->mean[1], NULL, status);
+  fits_read_key(fitsfp, TDOUBLE, "M2U", &s->m2[0], NULL, status);
+  fits_read_key(fitsfp, TDOUBLE, "M2V", &s->m2[1], NULL, status);
+  fits_read_key(fitsfp, TDOUBLE, "LOU", &s->lo[0], NULL, status);
+  fits_read_key(fitsfp, TDOUBLE, "LOV", &s->lo[1], NULL, status);
+  fits_read_key(fitsfp, TDOUBLE, "PIX", &s->pix, NULL, status);
+  fits_read_key(fitsfp, TLONG, "RAYK0", &s->range[0], NULL, status);
+  fits_read_key(fitsfp, TLONG, "RAYK1", &s->range[1], NULL, status);
+  fits_read_key(fitsfp, TLONG, "RAYTOT", &s->ntotal, NULL, status);
+  fits_read_key(fitsfp, TULONG, "RAYSEED", &s->seed, NULL, status);
+  fits_read_key(fitsfp, TLONG, "BATCH", &s->batch, NULL, status);
+  fits_read_key(fitsfp, TLONG, "NSAMPLE", &s->nsample, NULL, status);
+  if(*status){
+    fprintf(stderr,"Error: %s lacks the spot statistics.\n",filename);
+    fits_close_file(fitsfp, &cstat);
+    free(s);
+    return NULL;
+  }
+  
+  img = fitsw_read2array(fitsfp, xystart, naxes, TDOUBLE, status);
+  if(img == NULL){
+    fits_close_file(fitsfp, &cstat);
+    free(s);
+    return NULL;
+  }
+  s->hist = (double *)malloc(s->npix * s->npix * sizeof(double));
+  memcpy(s->hist, img->data, s->npix * s->npix * sizeof(double));
+  images_free(img);
+  
+  /* The reservoir */
+  nfill = GSL_MIN(s->ngood, s->nsample);
+  for(c=0;c<3;c++)
+    s->sample[c] = (double *)malloc(GSL_MAX(s->nsample, 1) * sizeof(double));
+  if(nfill > 0 &&
+     fits_movnam_hdu(fitsfp, BINARY_TBL, "RAYS", 0, status) == 0)
+    for(c=0; c < 3 && *status == 0; c++)
+      fits_read_col(fitsfp, TDOUBLE, c+1, 1, 1, nfill, NULL, s->sample[c],
+		    &anynul, status);
+  fits_close_file(fitsfp, &cstat);
+  if(*status){
+    fprintf(stderr,"Error: unable to read the ray reservoir of %s.\n",
+	    filename);
+    spot_free(s);
+    return NULL;
+  }
+  
+  return s;
+}
+
+
+/* Function to merge the partial accumulators of a sharded trace */
+/* The shards are merged in ray order, and must be from the same trace
+   (seed, total, window) and cover it exactly once between them; a missing
+   or overlapping range is an error.  Returns 0 on success. */
+int spot_merge_files(char **files, int nfiles, char *fileout){
+  
+  /* Variable Declarations */
+  int  i,status=0;
+  long next=0;
+  scope_spot **part,*sum=NULL;
+  
+  part = (scope_spot **)calloc(nfiles, sizeof(scope_spot *));
+  for(i=0; i < nfiles && !status; i++)
+    if((part[i] = spot_read(files[i], &status)) == NULL)
+      fprintf(stderr,"Error: unable to read %s.\n",files[i]);
+  
+  if(!status){
+    qsort(part, nfiles, sizeof(scope_spot *), spot_compare);
+    for(i=0; i < nfiles; i++){
+      if(part[i]->range[0] != next || part[i]->seed != part[0]->seed ||
+	 part[i]->ntotal != part[0]->ntotal){
+	fprintf(stderr,"Error: shard covering rays [%ld, %ld) does not follow"
+		" on from ray %ld of the same trace.\n",
+		part[i]->range[0],part[i]->range[1],next);
+	status = -1;
+	break;
+      }
+      next = part[i]->range[1];
+      if(i > 0 && spot_merge(part[0], part[i])){
+	fprintf(stderr,"Error: shards have different histogram windows or "
+		"sample sizes.\n");
+	status = -1;
+	break;
+      }
+    }
+    if(!status && next != part[0]->ntotal){
+      fprintf(stderr,"Error: shards cover %ld of %ld rays.\n",
+	      next,part[0]->ntotal);
+      status = -1;
+    }
+  }
+  
+  if(!status){
+    sum = part[0];
+    printf("Merged %d shards: %ld of %ld rays reach the detector; centroid"
+	   " (%+0.4f, %+0.4f) mm, RMS %0.3f um\n", nfiles, sum->ngood,
+	   sum->nray, sum->mean[0]*1.e3, sum->mean[1]*1.e3,
+	   spot_rms(sum)*1.e6);
+    spot_write(sum, fileout, "Merged shards", &status);
+  }
+  
+  for(i=0; i < nfiles; i++)
+    spot_free(part[i]);
+  free(part);
+  
+  return status;
+}
+
+
+/* qsort() comparison: accumulators in order of their first ray */
+int spot_compare(const void *a, const void *b){
+  
+  /* Variable Declarations */
+  scope_spot *sa = *(scope_spot **)a;
+  scope_spot *sb = *(scope_spot **)b;
+  
+  return (sa->range[0] > sb->range[0]) - (sa->range[0] < sb->range[0]);
+}
@@ -0,0 +1,63 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: spot.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef SPOT_H
+#define SPOT_H
+
+#include "bundle.h"
+#include "writer.h"
+
+#define SPOT_NPIX 512           // Histogram is NPIX x NPIX pixels
+#define SPOT_SEED 5760          // Counter-based RNG seed of compact traces
+#define SPOT_CHECKPOINT 600.    // Default seconds between checkpoints
+#define SPOT_SAMPLE 10000       // Default rays kept for spot diagrams
+
+
+/* Function declarations */
+
+/* Public Functions */
+scope_spot *spot_create(double cen[2], double halfwidth, long k0,
+			long ntotal, unsigned long seed, long nsample);
+void        spot_free(scope_spot *s);
+void        spot_add(scope_spot *s, scope_bundle *b, long i0, long n);
+int         spot_merge(scope_spot *s, scope_spot *t);
+double      spot_rms(scope_spot *s);
+void        spot_write(scope_spot *s, char *fileout, char *telname,
+		       int *status);
+int         spot_checkpoint(scope_spot *s, scope_writer *w, char *fileout,
+			    char *telname);
+scope_spot *spot_read(char *filename, int *status);
+int         spot_merge_files(char **files, int nfiles, char *fileout);
+
+/* Internal Functions */
+void        spot_merge_sample(scope_spot *s, scope_spot *t);
+void        spot_write_keys(fitsfile *fitsfp, void *data, int *status);
+int         spot_compare(const void *a, const void *b);
+
+#endif  /* SPOT_H */
+
+
+
@@ -0,0 +1,337 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: sweep.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Design-space sweep over the prescription of the demo Newtonian.  Every
+   point of a grid of (f/ratio, primary diameter, secondary size, secondary
+   offset, back focus) is built with demo_newtonian_design() and traced on
+   and off axis.  All designs see the same pupil sample (the same seed
+   through imsim_trace_field()), so differences between the figures of merit
+   come from the designs and not from Monte Carlo noise.  Designs are spread
+   over the thread pool, and the results go out as a FITS binary table with
+   one row per design. */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_sort.h>
+#include <gsl/gsl_statistics.h>
+
+/* Local headers */
+#include "sweep.h"
+#include "demo.h"
+#include "fitsw.h"
+#include "imsim.h"
+#include "pool.h"
+
+
+/* Names of the swept parameters on the command line, and their columns */
+static const char *sweep_names[SWEEP_NPAR] =
+  {"fratio", "dmaj", "dsec", "offset", "backfocus"};
+
+static char *sweep_ttype[SWEEP_NCOL] =
+  {"FRATIO", "DMAJ", "DSEC", "OFFSET", "BACKFOC",
+   "THRU_0", "RMS_0", "EE80_0", "THRU_F", "RMS_F", "EE80_F"};
+static char *sweep_tunit[SWEEP_NCOL] =
+  {"", "m", "m", "m", "m", "", "um", "um", "", "um", "um"};
+
+
+/* Arguments for the per-design job */
+typedef struct{
+  scope_sweep *sw;
+  double     **cols;            // SWEEP_NCOL columns of one row per design
+} sweep_job_arg;
+
+
+/* Function to parse a sweep specification into sw */
+/* The specification is a comma-separated list of NAME=LO:HI:N (N values
+   evenly spaced from LO to HI) or NAME=VALUE, with NAME one of fratio,
+   dmaj, dsec, offset or backfocus, and lengths in meters.  Parameters not
+   listed keep the demo Newtonian values; an unlisted backfocus stays at
+   DEMO_BACKFOCUS times the focal length of each design.  Returns 0 on
+   success. */
+int sweep_parse(char *spec, scope_sweep *sw){
+  
+  /* Variable Declarations */
+  int   k,n;
+  char *copy,*tok,*val;
+  double lo,hi;
+  scope_imsim imsim;
+  
+  memset(sw, 0, sizeof(scope_sweep));       // n[k] = 0: demo default
+  imsim_defaults(&imsim);
+  sw->nrays  = SWEEP_NRAYS;
+  sw->seed   = imsim.seed;
+  sw->lambda = imsim.lambda;
+  sw->field  = SWEEP_FIELD * M_PI / 648000.;
+  
+  copy = strdup(spec);
+  for(tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ",")){
+    if((val = strchr(tok, '=')) == NULL){
+      fprintf(stderr,"Error: sweep term \"%s\" is not NAME=LO:HI:N.\n",tok);
+      free(copy);
+      return -1;
+    }
+    *val++ = '\0';
+    for(k=0; k < SWEEP_NPAR; k++)
+      if(strcmp(tok, sweep_names[k]) == 0)
+	break;
+    if(k == SWEEP_NPAR){
+      fprintf(stderr,"Error: unknown sweep parameter \"%s\".\n",tok);
+      free(copy);
+      return -1;
+    }
+    
+    if(sscanf(val, "%lf:%lf:%d", &lo, &hi, &n) != 3){
+      if(sscanf(val, "%lf", &lo) != 1){
+	fprintf(stderr,"Error: bad range \"%s\" for %s.\n",val,tok);
+	free(copy);
+	return -1;
+      }
+      hi = lo;
+      n  = 1;
+    }
+    if(n < 1 || (n == 1 && hi != lo)){
+      fprintf(stderr,"Error: bad number of steps for %s.\n",tok);
+      free(copy);
+      return -1;
+    }
+    sw->lo[k] = lo;
+    sw->hi[k] = hi;
+    sw->n[k]  = n;
+  }
+  free(copy);
+  
+  return 0;
+}
+
+
+/* Function to trace every design of the sweep and write the table */
+/* Returns 0 on success, or the CFITSIO status of the write. */
+int sweep_run(scope_sweep *sw, char *outfile, scope_pool *pool){
+  
+  /* Variable Declarations */
+  int  c,status=0;
+  long d,nd,best=-1;
+  double *cols[SWEEP_NCOL];
+  double  nrays,seed,field;
+  fitsfile *fitsfp;
+  sweep_job_arg arg;
+  
+  nd = sweep_count(sw);
+  printf("Sweeping %ld designs, %ld rays each at 0 and %0.0f arcsec...\n",
+	 nd, sw->nrays, sw->field * 648000. / M_PI);
+  
+  for(c=0; c < SWEEP_NCOL; c++)
+    cols[c] = (double *)calloc(nd, sizeof(double));
+  
+  /* One design per item: designs are independent, each with scratch rays */
+  arg.sw   = sw;
+  arg.cols = cols;
+  pool_run(pool, sweep_design_job, &arg, nd, 1);
+  
+  /* Report the design with the smallest off-axis spot */
+  for(d=0; d < nd; d++)
+    if(cols[SWEEP_NPAR+3][d] > 0 &&
+       (best < 0 || cols[SWEEP_NPAR+4][d] < cols[SWEEP_NPAR+4][best]))
+      best = d;
+  if(best >= 0)
+    printf("Best off-axis design: f/%0.2f, D = %0.4f m, secondary %0.4f m, "
+	   "offset %0.4f m, back focus %0.4f m: RMS %0.2f um\n",
+	   cols[SWEEP_FRATIO][best], cols[SWEEP_DMAJ][best],
+	   cols[SWEEP_DSEC][best], cols[SWEEP_OFFSET][best],
+	   cols[SWEEP_BACKFOCUS][best], cols[SWEEP_NPAR+4][best]);
+  
+  /* Write the table, and record how the designs were traced */
+  fitsw_write_table(outfile, "SWEEP", SWEEP_NCOL, sweep_ttype, sweep_tunit,
+		    cols, nd, "Newtonian Sweep", &status);
+  if(status == 0){
+    nrays = (double)sw->nrays;
+    seed  = (double)sw->seed;
+    field = sw->field * 648000. / M_PI;
+    fitsfp = fw_open_rw(outfile, &status);
+    fits_movnam_hdu(fitsfp, BINARY_TBL, "SWEEP", 0, &status);
+    fits_update_key(fitsfp, TDOUBLE, "NRAYS", &nrays,
+		    "rays per design and field point", &status);
+    fits_update_key(fitsfp, TDOUBLE, "SEED", &seed,
+		    "RNG seed shared by all designs", &status);
+    fits_update_key(fitsfp, TDOUBLE, "FIELD", &field,
+		    "off-axis field angle (arcsec)", &status);
+    fits_update_key(fitsfp, TDOUBLE, "LAMBDA", &sw->lambda,
+		    "wavelength (Angstroms)", &status);
+    fits_close_file(fitsfp, &status);
+    fw_catcherror(&status);
+  }
+  
+  for(c=0; c < SWEEP_NCOL; c++)
+    free(cols[c]);
+  
+  return status;
+}
+
+
+/***** Internal Functions *****/
+
+/* Function to count the designs in the sweep */
+long sweep_count(scope_sweep *sw){
+  
+  /* Variable Declarations */
+  int  k;
+  long nd=1;
+  
+  for(k=0; k < SWEEP_NPAR; k++)
+    nd *= GSL_MAX_INT(sw->n[k], 1);
+  
+  return nd;
+}
+
+
+/* Function to get the prescription of design number d, with the first
+   parameter varying fastest */
+void sweep_get_design(scope_sweep *sw, long d, scope_newtonian *par){
+  
+  /* Variable Declarations */
+  int    k;
+  long   i;
+  double val[SWEEP_NPAR];
+  
+  demo_newtonian_defaults(par);
+  val[SWEEP_FRATIO]    = par->fratio;
+  val[SWEEP_DMAJ]      = par->dmaj;
+  val[SWEEP_DSEC]      = par->dsec;
+  val[SWEEP_OFFSET]    = par->offset;
+  val[SWEEP_BACKFOCUS] = par->backfocus;
+  
+  for(k=0; k < SWEEP_NPAR; k++){
+    if(sw->n[k] < 1)
+      continue;
+    i = d % sw->n[k];
+    d = d / sw->n[k];
+    val[k] = (sw->n[k] == 1) ? sw->lo[k] :
+      sw->lo[k] + (sw->hi[k] - sw->lo[k]) * i / (sw->n[k] - 1);
+  }
+  
+  par->fratio    = val[SWEEP_FRATIO];
+  par->dmaj      = val[SWEEP_DMAJ];
+  par->dsec      = val[SWEEP_DSEC];
+  par->offset    = val[SWEEP_OFFSET];
+  par->backfocus = (sw->n[SWEEP_BACKFOCUS] < 1) ?
+    DEMO_BACKFOCUS * par->fratio * par->dmaj : val[SWEEP_BACKFOCUS];
+  
+  return;
+}
+
+
+/* Job: build and trace designs [i0, i1) */
+void sweep_design_job(void *data, long i0, long i1, int tid){
+  
+  /* Variable Declarations */
+  int  nelem;
+  long d,n;
+  double *uv,*r;
+  scope_scope      scope;
+  scope_element   *elements;
+  scope_newtonian  par;
+  scope_imsim      imsim;
+  sweep_job_arg   *arg = (sweep_job_arg *)data;
+  double         **cols = arg->cols;
+  
+  imsim_defaults(&imsim);
+  imsim.nrays  = arg->sw->nrays;
+  imsim.seed   = arg->sw->seed;
+  imsim.lambda = arg->sw->lambda;
+  uv = (double *)malloc(2 * imsim.nrays * sizeof(double));
+  r  = (double *)malloc(imsim.nrays * sizeof(double));
+  
+  for(d=i0; d < i1; d++){
+    sweep_get_design(arg->sw, d, &par);
+    demo_newtonian_design(&scope, &elements, &nelem, &par);
+    
+    cols[SWEEP_FRATIO][d]    = par.fratio;
+    cols[SWEEP_DMAJ][d]      = par.dmaj;
+    cols[SWEEP_DSEC][d]      = par.dsec;
+    cols[SWEEP_OFFSET][d]    = par.offset;
+    cols[SWEEP_BACKFOCUS][d] = par.backfocus;
+    
+    /* Same seed for every design and field: common random numbers */
+    n = imsim_trace_field(&scope, elements, nelem, 0., 0., &imsim, uv);
+    sweep_merit(uv, n, imsim.nrays, r, &cols[SWEEP_NPAR][d],
+		&cols[SWEEP_NPAR+1][d], &cols[SWEEP_NPAR+2][d]);
+    n = imsim_trace_field(&scope, elements, nelem, arg->sw->field, 0.,
+			  &imsim, uv);
+    sweep_merit(uv, n, imsim.nrays, r, &cols[SWEEP_NPAR+3][d],
+		&cols[SWEEP_NPAR+4][d], &cols[SWEEP_NPAR+5][d]);
+    
+    free(elements);
+    free(scope.name);
+  }
+  
+  free(uv);
+  free(r);
+  
+  return;
+}
+
+
+/* Function to reduce n focal-plane positions (of nrays launched) to the
+   throughput, the RMS spot radius and the SWEEP_EE encircled-energy radius
+   about the centroid (microns); r is scratch space for n radii */
+void sweep_merit(double *uv, long n, long nrays, double *r, double *thru,
+		 double *rms, double *ee){
+  
+  /* Variable Declarations */
+  long   i;
+  double uc=0.,vc=0.,du,dv,sum=0.;
+  
+  *thru = (double)n / nrays;
+  *rms  = 0.;
+  *ee   = 0.;
+  if(n == 0)
+    return;
+  
+  for(i=0;i<n;i++){
+    uc += uv[2*i];
+    vc += uv[2*i+1];
+  }
+  uc /= n;
+  vc /= n;
+  
+  for(i=0;i<n;i++){
+    du   = uv[2*i]   - uc;
+    dv   = uv[2*i+1] - vc;
+    r[i] = sqrt(du*du + dv*dv);
+    sum += r[i] * r[i];
+  }
+  gsl_sort(r, 1, n);
+  
+  *rms = sqrt(sum / n) * 1.e6;
+  *ee  = gsl_stats_quantile_from_sorted_data(r, 1, n, SWEEP_EE) * 1.e6;
+  
+  return;
+}
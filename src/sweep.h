@@ -0,0 +1,61 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: sweep.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "pool.h"
+
+/* Indices of the swept parameters (scope_newtonian order) */
+#define SWEEP_FRATIO    0
+#define SWEEP_DMAJ      1
+#define SWEEP_DSEC      2
+#define SWEEP_OFFSET    3
+#define SWEEP_BACKFOCUS 4
+
+#define SWEEP_NRAYS     20000   // Rays per design and field point
+#define SWEEP_FIELD     900.    // Default off-axis field angle (arcsec)
+#define SWEEP_EE        0.8     // Encircled-energy fraction reported
+#define SWEEP_NCOL      (SWEEP_NPAR + 6)  // Parameters, then merit figures
+
+
+/* Function declarations */
+
+/* Public Functions */
+int  sweep_parse(char *spec, scope_sweep *sw);
+int  sweep_run(scope_sweep *sw, char *outfile, scope_pool *pool);
+
+/* Internal Functions */
+long sweep_count(scope_sweep *sw);
+void sweep_get_design(scope_sweep *sw, long d, scope_newtonian *par);
+void sweep_design_job(void *data, long i0, long i1, int tid);
+void sweep_merit(double *uv, long n, long nrays, double *r, double *thru,
+		 double *rms, double *ee);
+
+#endif  /* SWEEP_H */
+
+
+
@@ -0,0 +1,388 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: tolerance.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Monte Carlo tolerance analysis.  Each trial perturbs the optics (decenter,
+   tilt, despace, focal length) uniformly within the given tolerances,
+   traces a small pupil sample shared by every trial, refocuses
+   analytically, and records the RMS spot.  Trials are spread over the
+   thread pool; trial t draws its perturbations from its own seed, so the
+   results do not depend on the number of threads.  The report gives
+   percentiles of the merit over all trials. */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_sort.h>
+#include <gsl/gsl_statistics.h>
+
+/* Local headers */
+#include "tolerance.h"
+#include "mirrors.h"
+#include "rays.h"
+#include "kernels.h"
+#include "setup.h"
+#include "pool.h"
+
+
+/* Names of the optics and perturbations on the command line */
+static const struct{ const char *name; int elem; } tolerance_optics[] =
+  {{"pri",OPTIC_PRI}, {"sec",OPTIC_SEC}, {"tri",OPTIC_TRI},
+   {"qua",OPTIC_QUA}, {"qui",OPTIC_QUI}, {"sen",OPTIC_SEN},
+   {"sep",OPTIC_SEP}, {"oct",OPTIC_OCT}, {"non",OPTIC_NON},
+   {"den",OPTIC_DEN}, {"fp",OPTIC_NFP}};
+static const char *tolerance_names[] = {"decenter","tilt","despace","f"};
+
+
+/* Arguments for the trial job */
+typedef struct{
+  scope_tolerance *tol;
+  scope_scope     *scope;       // Nominal design
+  scope_element   *elements;
+  int              nelem;
+  scope_ray      **pupil;       // Shared pupil sample, one per field point
+  double          *rms;         // Per-trial results
+  double          *focus;
+  double          *thru;
+} tolerance_trial_arg;
+
+
+/***** Public-Facing Functions *****/
+
+/* Function to parse a tolerance specification into tol */
+/* The specification is a comma-separated list of OPTIC.KIND=TOL, e.g.
+   "sec.decenter=1e-3,sec.tilt=2e-3,pri.tilt=5e-4", with OPTIC one of pri,
+   sec, ..., den, fp and KIND one of decenter (m), tilt (rad), despace (m)
+   or f (m).  The trial count and merit sample are set to defaults.
+   Returns 0 on success. */
+int tolerance_parse(char *spec, scope_tolerance *tol){
+  
+  /* Variable Declarations */
+  int   i,j,no,nk;
+  char *copy,*tok,*dot,*val;
+  
+  no = sizeof(tolerance_optics) / sizeof(tolerance_optics[0]);
+  nk = sizeof(tolerance_names) / sizeof(tolerance_names[0]);
+  
+  memset(tol, 0, sizeof(scope_tolerance));
+  tol->nfield   = 2;
+  tol->field[0] = 0.;
+  tol->field[1] = TOLERANCE_FIELD * M_PI / 648000.;
+  tol->ntrial   = TOLERANCE_TRIALS;
+  tol->nrays    = TOLERANCE_NRAYS;
+  tol->lambda   = 5500.;
+  
+  copy = strdup(spec);
+  for(tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ",")){
+    if((dot = strchr(tok, '.')) == NULL || (val = strchr(dot, '=')) == NULL){
+      fprintf(stderr,"Error: tolerance term \"%s\" is not OPTIC.KIND=TOL.\n",
+	      tok);
+      free(copy);
+      return -1;
+    }
+    *dot++ = '\0';
+    *val++ = '\0';
+    for(i=0; i < no; i++)
+      if(strcmp(tok, tolerance_optics[i].name) == 0)
+	break;
+    for(j=0; j < nk; j++)
+      if(strcmp(dot, tolerance_names[j]) == 0)
+	break;
+    if(i == no || j == nk){
+      fprintf(stderr,"Error: unknown tolerance \"%s.%s\".\n",tok,dot);
+      free(copy);
+      return -1;
+    }
+    if(tol->nterm == TOLERANCE_MAXTERM){
+      fprintf(stderr,"Error: at most %d tolerances can be given.\n",
+	      TOLERANCE_MAXTERM);
+      free(copy);
+      return -1;
+    }
+    tol->elem[tol->nterm] = tolerance_optics[i].elem;
+    tol->kind[tol->nterm] = j;
+    tol->tol[tol->nterm]  = fabs(atof(val));
+    tol->nterm++;
+  }
+  free(copy);
+  
+  if(tol->nterm == 0){
+    fprintf(stderr,"Error: no tolerances given.\n");
+    return -1;
+  }
+  
+  return 0;
+}
+
+
+/* Function to run the trials and report the distribution of the merit */
+/* Returns 0 on success. */
+int tolerance_run(scope_tolerance *tol, scope_scope *scope,
+		  scope_element *elements, int nelem, scope_pool *pool){
+  
+  /* Variable Declarations */
+  int    f,j;
+  double rms0,focus0,thru0;
+  scope_ray *pupil[TOLERANCE_MAXFIELD],*rays;
+  gsl_rng   *r;
+  tolerance_trial_arg arg;
+  
+  for(j=0; j < tol->nterm; j++)
+    if(setup_get_optic(scope, tol->elem[j]) == NULL){
+      fprintf(stderr,"Error: tolerance %d is on a missing optic.\n",j+1);
+      return -1;
+    }
+  
+  /* Shared pupil sample, one per field point */
+  r = gsl_rng_alloc(gsl_rng_taus2);
+  for(f=0; f < tol->nfield; f++){
+    pupil[f] = (scope_ray *)malloc(tol->nrays * sizeof(scope_ray));
+    gsl_rng_set(r, tol->seed);
+    rays_fill_pupil(pupil[f], tol->nrays, &scope->primary, tol->field[f], 0.,
+		    tol->lambda, r);
+  }
+  gsl_rng_free(r);
+  
+  /* The nominal design, for reference */
+  rays = (scope_ray *)malloc(tol->nrays * sizeof(scope_ray));
+  rms0 = tolerance_merit(tol, pupil, rays, scope, elements, nelem,
+			 &focus0, &thru0);
+  free(rays);
+  
+  printf("Tolerancing: %ld trials, %d field points, %ld rays each\n",
+	 tol->ntrial, tol->nfield, tol->nrays);
+  printf("  Nominal: RMS spot %0.3f um, throughput %0.4f\n",
+	 rms0 * 1.e6, thru0);
+  
+  arg.tol      = tol;
+  arg.scope    = scope;
+  arg.elements = elements;
+  arg.nelem    = nelem;
+  arg.pupil    = pupil;
+  arg.rms      = (double *)malloc(tol->ntrial * sizeof(double));
+  arg.focus    = (double *)malloc(tol->ntrial * sizeof(double));
+  arg.thru     = (double *)malloc(tol->ntrial * sizeof(double));
+  pool_run(pool, tolerance_trial_job, &arg, tol->ntrial, 1);
+  
+  printf("  Percentile          50%%       80%%       90%%       95%%"
+	 "       99%%\n");
+  tolerance_report("RMS spot (um)", arg.rms, tol->ntrial, 1.e6);
+  tolerance_report("|Refocus| (mm)", arg.focus, tol->ntrial, 1.e3);
+  tolerance_report("Light lost", arg.thru, tol->ntrial, 1.);
+  
+  free(arg.rms);
+  free(arg.focus);
+  free(arg.thru);
+  for(f=0; f < tol->nfield; f++)
+    free(pupil[f]);
+  
+  return 0;
+}
+
+
+/***** Internal Functions *****/
+
+/* Function to perturb the optics of scope, drawing from r */
+/* Decenters and tilts are uniform over a disk of radius tol in the plane
+   of the optic, despaces and focal-length errors uniform over +/- tol. */
+void tolerance_perturb(scope_tolerance *tol, scope_scope *scope, gsl_rng *r){
+  
+  /* Variable Declarations */
+  int    j;
+  double a,b,rad,phi;
+  scope_optic *optic;
+  
+  for(j=0; j < tol->nterm; j++){
+    optic = setup_get_optic(scope, tol->elem[j]);
+    
+    rad = tol->tol[j] * sqrt(gsl_rng_uniform(r));
+    phi = 2. * M_PI * gsl_rng_uniform(r);
+    a   = rad * cos(phi);
+    b   = rad * sin(phi);
+    
+    switch(tol->kind[j]){
+    case TOLERANCE_DECENTER:
+      optic->cx += a * optic->frame[0][0] + b * optic->frame[1][0];
+      optic->cy += a * optic->frame[0][1] + b * optic->frame[1][1];
+      optic->cz += a * optic->frame[0][2] + b * optic->frame[1][2];
+      break;
+    case TOLERANCE_TILT:
+      optic->nx = optic->frame[2][0] + a * optic->frame[0][0] +
+	b * optic->frame[1][0];
+      optic->ny = optic->frame[2][1] + a * optic->frame[0][1] +
+	b * optic->frame[1][1];
+      optic->nz = optic->frame[2][2] + a * optic->frame[0][2] +
+	b * optic->frame[1][2];
+      break;
+    case TOLERANCE_DESPACE:
+      a = tol->tol[j] * (2. * gsl_rng_uniform(r) - 1.);
+      optic->cx += a * optic->frame[2][0];
+      optic->cy += a * optic->frame[2][1];
+      optic->cz += a * optic->frame[2][2];
+      break;
+    case TOLERANCE_FOCAL:
+      if(optic->type != OPTIC_PLANE && gsl_finite(optic->f))
+	optic->f += tol->tol[j] * (2. * gsl_rng_uniform(r) - 1.);
+      break;
+    }
+    setup_orient_optic(optic);
+  }
+  
+  return;
+}
+
+
+/* Job: run trials [i0, i1) */
+void tolerance_trial_job(void *data, long i0, long i1, int tid){
+  
+  /* Variable Declarations */
+  long t;
+  double thru;
+  scope_scope  scope;
+  scope_ray   *rays;
+  gsl_rng     *r;
+  tolerance_trial_arg *arg = (tolerance_trial_arg *)data;
+  
+  rays = (scope_ray *)malloc(arg->tol->nrays * sizeof(scope_ray));
+  r    = gsl_rng_alloc(gsl_rng_taus2);
+  
+  for(t=i0; t < i1; t++){
+    scope = *arg->scope;                // Fresh copy of the nominal design
+    gsl_rng_set(r, arg->tol->seed + 1 + t);
+    tolerance_perturb(arg->tol, &scope, r);
+    
+    arg->rms[t]   = tolerance_merit(arg->tol, arg->pupil, rays, &scope,
+				    arg->elements, arg->nelem,
+				    &arg->focus[t], &thru);
+    arg->focus[t] = fabs(arg->focus[t]);
+    arg->thru[t]  = 1. - thru;
+  }
+  
+  gsl_rng_free(r);
+  free(rays);
+  
+  return;
+}
+
+
+/* Function to trace the pupil sample through scope and return the RMS spot
+   radius (m) over the field points after the best common refocus */
+/* Moving the focal plane by dz along its normal moves a ray's (u,v) by
+   dz (d_u, d_v) / d_w, so the mean-square spot about the centroid is a
+   quadratic in dz whose minimum is found in closed form.  The refocus
+   (m) goes into *focus and the fraction of rays reaching the focal plane
+   into *thru.  Returns infinity if a field point loses every ray. */
+double tolerance_merit(scope_tolerance *tol, scope_ray **pupil,
+		       scope_ray *rays, scope_scope *scope,
+		       scope_element *elements, int nelem, double *focus,
+		       double *thru){
+  
+  /* Variable Declarations */
+  int    f;
+  long   i,n,ntot=0;
+  double p[3],d[3],u,v,su,sv,mu,mv,ms,mt;
+  double rr=0.,rs=0.,ss=0.,ru,rv;
+  scope_optic *det;
+  
+  det = setup_get_optic(scope, elements[nelem-1].elem);
+  *focus = 0.;
+  *thru  = 0.;
+  
+  /* Two passes per field: centroids of (u,v) and of the slopes, then the
+     sums for the quadratic */
+  for(f=0; f < tol->nfield; f++){
+    memcpy(rays, pupil[f], tol->nrays * sizeof(scope_ray));
+    kernels_trace(rays, tol->nrays, scope, elements, nelem);
+    
+    n = 0;
+    mu = mv = ms = mt = 0.;
+    for(i=0; i < tol->nrays; i++){
+      if(rays[i].lost)
+	continue;
+      mirrors_to_local(det, rays[i].x - det->cx, rays[i].y - det->cy,
+		       rays[i].z - det->cz, p);
+      mirrors_to_local(det, rays[i].vx, rays[i].vy, rays[i].vz, d);
+      mu += p[0];
+      mv += p[1];
+      ms += d[0] / d[2];
+      mt += d[1] / d[2];
+      n++;
+    }
+    if(n == 0)
+      return GSL_POSINF;
+    mu /= n;
+    mv /= n;
+    ms /= n;
+    mt /= n;
+    ntot += n;
+    
+    for(i=0; i < tol->nrays; i++){
+      if(rays[i].lost)
+	continue;
+      mirrors_to_local(det, rays[i].x - det->cx, rays[i].y - det->cy,
+		       rays[i].z - det->cz, p);
+      mirrors_to_local(det, rays[i].vx, rays[i].vy, rays[i].vz, d);
+      u  = p[0] - mu;
+      v  = p[1] - mv;
+      su = d[0] / d[2] - ms;
+      sv = d[1] / d[2] - mt;
+      ru = u*u + v*v;
+      rv = u*su + v*sv;
+      rr += ru / n;                     // Weight 1/n: fields count equally
+      rs += rv / n;
+      ss += (su*su + sv*sv) / n;
+    }
+  }
+  
+  *thru  = (double)ntot / (tol->nfield * tol->nrays);
+  *focus = (ss > 0.) ? -rs / ss : 0.;
+  
+  return sqrt(GSL_MAX(rr + 2.*rs * *focus + ss * *focus * *focus, 0.) /
+	      tol->nfield);
+}
+
+
+/* Function to print percentiles of n values of x (times scale) */
+void tolerance_report(char *label, double *x, long n, double scale){
+  
+  /* Variable Declarations */
+  int    i;
+  double pct[5] = {0.5, 0.8, 0.9, 0.95, 0.99};
+  
+  gsl_sort(x, 1, n);
+  printf("  %-16s", label);
+  for(i=0;i<5;i++)
+    printf(" %9.4f", gsl_stats_quantile_from_sorted_data(x, 1, n, pct[i]) *
+	   scale);
+  printf("\n");
+  
+  return;
+}
@@ -0,0 +1,63 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: tolerance.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef TOLERANCE_H
+#define TOLERANCE_H
+
+#include <gsl/gsl_rng.h>        // GSL's rng routine defs
+#include "pool.h"
+
+/* Kinds of perturbation (scope_tolerance.kind) */
+#define TOLERANCE_DECENTER 0    // Vertex shift across the normal (m)
+#define TOLERANCE_TILT     1    // Tilt of the normal (rad)
+#define TOLERANCE_DESPACE  2    // Vertex shift along the normal (m)
+#define TOLERANCE_FOCAL    3    // Change of focal length (m)
+
+#define TOLERANCE_TRIALS   2000 // Default number of trials
+#define TOLERANCE_NRAYS    256  // Pupil sample per field point
+#define TOLERANCE_FIELD    900. // Default off-axis field point (arcsec)
+
+
+/* Function declarations */
+
+/* Public Functions */
+int  tolerance_parse(char *spec, scope_tolerance *tol);
+int  tolerance_run(scope_tolerance *tol, scope_scope *scope,
+		   scope_element *elements, int nelem, scope_pool *pool);
+
+/* Internal Functions */
+void tolerance_perturb(scope_tolerance *tol, scope_scope *scope, gsl_rng *r);
+void tolerance_trial_job(void *data, long i0, long i1, int tid);
+double tolerance_merit(scope_tolerance *tol, scope_ray **pupil,
+		       scope_ray *rays, scope_scope *scope,
+		       scope_element *elements, int nelem, double *focus,
+		       double *thru);
+void tolerance_report(char *label, double *x, long n, double scale);
+
+#endif  /* TOLERANCE_H */
+
+
+
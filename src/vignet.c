@@ -0,0 +1,164 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: vignet.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Field vignetting and relative illumination.  A flat (TARGET_POINTS) field
+   is sampled on the illum->ngrid grid of field angles, and each field point
+   gets a small stratified pupil sample.  Only whether each ray survives to
+   the focal plane is kept, so the whole map costs about one modest trace
+   rather than one full trace per field point. */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_rng.h>
+
+/* Local headers */
+#include "vignet.h"
+#include "fitsw.h"
+#include "images.h"
+#include "rays.h"
+#include "kernels.h"
+#include "pool.h"
+
+
+/* Arguments for the per-field-point job */
+typedef struct{
+  scope_illum   *illum;
+  scope_scope   *scope;
+  scope_element *elements;
+  int            nelem;
+  scope_image   *map;           // Fraction of rays reaching the focal plane
+} vignet_field_arg;
+
+
+/* Function to map the relative illumination over the field and write it
+   to outfile */
+/* Pixel (i,j) of the map is the field point at the center of grid cell
+   (i,j) of the square of half-width illum->fov, and holds the fraction of
+   the light reaching the focal plane relative to on axis.  Returns 0 on
+   success. */
+int vignet_map(scope_illum *illum, char *outfile, scope_scope *scope,
+	       scope_element *elements, int nelem, scope_pool *pool){
+  
+  /* Variable Declarations */
+  int    status=0;
+  long   i,j,nx,ny;
+  double ref,ax,ay,rad,full=GSL_POSINF;
+  scope_image     *map;
+  vignet_field_arg arg;
+  
+  nx = illum->ngrid[0];
+  ny = illum->ngrid[1];
+  if((map = images_alloc(nx, ny)) == NULL)
+    return -1;
+  printf("Mapping vignetting at %ld x %ld field points, %d rays each...\n",
+	 nx, ny, VIGNET_NRAYS);
+  
+  /* One field point per item, rows of the map in order */
+  arg.illum    = illum;
+  arg.scope    = scope;
+  arg.elements = elements;
+  arg.nelem    = nelem;
+  arg.map      = map;
+  pool_run(pool, vignet_field_job, &arg, nx * ny, 1);
+  
+  /* Normalize to the center of the field, and find the radius out to which
+     it stays fully illuminated */
+  ref = IMAGES_PIX(map, nx/2, ny/2);
+  if(ref <= 0.){
+    fprintf(stderr,"Error: no light reaches the focal plane on axis.\n");
+    images_free(map);
+    return -1;
+  }
+  for(j=0;j<ny;j++)
+    for(i=0;i<nx;i++){
+      IMAGES_PIX(map, i, j) /= ref;
+      if(IMAGES_PIX(map, i, j) < VIGNET_FULL){
+	ax  = ((i + 0.5) / nx * 2. - 1.) * illum->fov;
+	ay  = ((j + 0.5) / ny * 2. - 1.) * illum->fov;
+	rad = hypot(ax, ay);
+	if(rad < full)
+	  full = rad;
+      }
+    }
+  
+  printf("On-axis throughput: %0.4f\n", ref);
+  if(gsl_finite(full))
+    printf("Fully illuminated (>= %0.0f%%) out to %0.1f arcsec off axis\n",
+	   VIGNET_FULL * 100., full * 648000. / M_PI);
+  else
+    printf("Fully illuminated (>= %0.0f%%) over the whole field\n",
+	   VIGNET_FULL * 100.);
+  
+  fitsw_write_image(outfile, map, DOUBLE_IMG, scope->name, &status);
+  images_free(map);
+  
+  return status;
+}
+
+
+/* Job: trace field points [i0, i1), keeping only the survivors */
+/* Field point k seeds its own RNG with k, so the map does not depend on
+   the number of threads. */
+void vignet_field_job(void *data, long i0, long i1, int tid){
+  
+  /* Variable Declarations */
+  long   k,i,n;
+  double ax,ay;
+  scope_ray *rays;
+  gsl_rng   *r;
+  vignet_field_arg *arg = (vignet_field_arg *)data;
+  scope_illum      *illum = arg->illum;
+  
+  rays = (scope_ray *)malloc(VIGNET_NRAYS * sizeof(scope_ray));
+  r    = gsl_rng_alloc(gsl_rng_taus2);
+  
+  for(k=i0;k<i1;k++){
+    ax = ((k % illum->ngrid[0] + 0.5) / illum->ngrid[0] * 2. - 1.) *
+      illum->fov;
+    ay = ((k / illum->ngrid[0] + 0.5) / illum->ngrid[1] * 2. - 1.) *
+      illum->fov;
+    
+    gsl_rng_set(r, k);
+    rays_fill_strata(rays, VIGNET_NRAYS, &arg->scope->primary, ax, ay,
+		     illum->lambda, r);
+    kernels_trace(rays, VIGNET_NRAYS, arg->scope, arg->elements, arg->nelem);
+    
+    for(n=0,i=0;i<VIGNET_NRAYS;i++)
+      n += !rays[i].lost;
+    IMAGES_PIX(arg->map, k % illum->ngrid[0], k / illum->ngrid[0]) =
+      (double)n / VIGNET_NRAYS;
+  }
+  
+  gsl_rng_free(r);
+  free(rays);
+  
+  return;
+}
@@ -0,0 +1,50 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: vignet.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef VIGNET_H
+#define VIGNET_H
+
+#include "pool.h"
+
+#define VIGNET_NGRID 33         // Field points across the map (odd: on-axis)
+#define VIGNET_NRAYS 256        // Stratified pupil sample per field point
+#define VIGNET_FOV   1800.      // Default half-width of the field (arcsec)
+#define VIGNET_FULL  0.99       // Relative illumination counted as full
+
+
+/* Function declarations */
+
+/* Public Functions */
+int  vignet_map(scope_illum *illum, char *outfile, scope_scope *scope,
+		scope_element *elements, int nelem, scope_pool *pool);
+
+/* Internal Functions */
+void vignet_field_job(void *data, long i0, long i1, int tid);
+
+#endif  /* VIGNET_H */
+
+
+
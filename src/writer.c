@@ -0,0 +1,359 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: writer.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define wombat extern                  // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Local headers */
+#include "writer.h"
+#include "images.h"
+#include "fitsw.h"
+
+
+#if WRITER_THREADS
+/* Writer thread: take jobs off the queue and write them, until told to quit
+   with the queue empty */
+static void *writer_thread(void *data){
+  
+  /* Variable Declarations */
+  scope_writer *w = (scope_writer *)data;
+  writer_job    job;
+  
+  pthread_mutex_lock(&w->lock);
+  for(;;){
+    while(w->count == 0 && !w->quit)
+      pthread_cond_wait(&w->ready, &w->lock);
+    if(w->count == 0)
+      break;                            // quit, and nothing left to write
+    
+    job      = w->queue[w->head];
+    w->head  = (w->head + 1) % w->depth;
+    w->count--;
+    w->busy  = 1;
+    pthread_cond_broadcast(&w->room);
+    pthread_mutex_unlock(&w->lock);
+    
+    writer_write_job(w, &job);
+    
+    pthread_mutex_lock(&w->lock);
+    w->busy = 0;
+    if(w->count == 0)
+      pthread_cond_broadcast(&w->idle);
+  }
+  pthread_mutex_unlock(&w->lock);
+  
+  return NULL;
+}
+#endif
+
+
+/* Create a writer with a queue of depth jobs (depth <= 0: WRITER_DEPTH) */
+/* Up to depth + 1 buffers circulate: depth queued and one being filled. */
+scope_writer *writer_create(int depth){
+  
+  scope_writer *w;
+  
+  if(depth <= 0)
+    depth = WRITER_DEPTH;
+  
+  w = (scope_writer *)calloc(1, sizeof(scope_writer));
+  w->depth = depth;
+  w->nbuf  = depth + 1;
+  w->queue = (writer_job *)calloc(depth, sizeof(writer_job));
+  w->spare = (scope_image **)calloc(w->nbuf, sizeof(scope_image *));
+  
+#if WRITER_THREADS
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->ready, NULL);
+  pthread_cond_init(&w->room, NULL);
+  pthread_cond_init(&w->idle, NULL);
+  pthread_create(&w->tid, NULL, writer_thread, w);
+#endif
+  
+  return w;
+}
+
+
+/* Get a zeroed nx x ny image to fill and hand to writer_submit() */
+/* Spare buffers of the right size are reused; otherwise a new one is made,
+   unless nbuf are already out, in which case this waits for the writer to
+   return one.  A caller must therefore not hold more than nbuf - 1 buffers
+   it has not submitted.  Returns NULL if allocation fails. */
+scope_image *writer_get_buffer(scope_writer *w, long nx, long ny){
+  
+  /* Variable Declarations */
+  int i;
+  scope_image *img = NULL;
+  
+#if WRITER_THREADS
+  pthread_mutex_lock(&w->lock);
+#endif
+  for(;;){
+    for(i=0;i<w->nspare;i++)
+      if(w->spare[i]->nx == nx && w->spare[i]->ny == ny){
+	img = w->spare[i];
+	w->spare[i] = w->spare[--w->nspare];
+	break;
+      }
+    if(img != NULL)
+      break;
+    
+    /* Make room by dropping a spare of the wrong size */
+    if(w->nalloc >= w->nbuf && w->nspare > 0){
+      images_free(w->spare[--w->nspare]);
+      w->nalloc--;
+    }
+    if(w->nalloc < w->nbuf){
+      w->nalloc++;
+      break;
+    }
+#if WRITER_THREADS
+    pthread_cond_wait(&w->room, &w->lock);
+#else
+    w->nalloc++;                        // Nothing to wait for: overcommit
+    break;
+#endif
+  }
+#if WRITER_THREADS
+  pthread_mutex_unlock(&w->lock);
+#endif
+  
+  if(img != NULL){
+    memset(img->data, 0, nx * ny * sizeof(double));
+    return img;
+  }
+  
+  if((img = images_alloc(nx, ny)) == NULL){
+#if WRITER_THREADS
+    pthread_mutex_lock(&w->lock);
+#endif
+    w->nalloc--;
+#if WRITER_THREADS
+    pthread_mutex_unlock(&w->lock);
+#endif
+  }
+  
+  return img;
+}
+
+
+/* Queue img to be written to fn; waits while the queue is full */
+/* The writer owns img from here on (it goes back to the buffer pool once
+   written), and fn and telname are copied.  Returns the first error from
+   any earlier write, so failures surface on the next call. */
+int writer_submit(scope_writer *w, scope_image *img, char *fn, int bitpix,
+		  char *telname){
+  
+  return writer_submit_keys(w, img, fn, bitpix, telname, NULL, NULL);
+}
+
+
+/* As writer_submit(), but keys(fitsfp, keyarg, &status) is then called to
+   add header keywords, and the file is replaced atomically */
+/* With a hook, the file is written as fn.part and renamed over fn once
+   complete, so a crash mid-write leaves the previous fn intact.  The
+   writer owns keyarg (a malloc'ed block) and frees it once written. */
+int writer_submit_keys(scope_writer *w, scope_image *img, char *fn,
+		       int bitpix, char *telname, writer_keys keys,
+		       void *keyarg){
+  
+  /* Variable Declarations */
+  writer_job job;
+  int status;
+  
+  job.img     = img;
+  job.fn      = strdup(fn);
+  job.telname = strdup(telname);
+  job.bitpix  = bitpix;
+  job.keys    = keys;
+  job.keyarg  = keyarg;
+  
+#if WRITER_THREADS
+  pthread_mutex_lock(&w->lock);
+  while(w->count == w->depth)
+    pthread_cond_wait(&w->room, &w->lock);
+  w->queue[(w->head + w->count) % w->depth] = job;
+  w->count++;
+  pthread_cond_signal(&w->ready);
+  status = w->status;
+  pthread_mutex_unlock(&w->lock);
+#else
+  writer_write_job(w, &job);
+  status = w->status;
+#endif
+  
+  return status;
+}
+
+
+/* Wait until everything submitted so far is on disk */
+/* Returns the first error from any write (0 if all went well). */
+int writer_flush(scope_writer *w){
+  
+  int status;
+  
+  if(w == NULL)
+    return 0;
+  
+#if WRITER_THREADS
+  pthread_mutex_lock(&w->lock);
+  while(w->count > 0 || w->busy)
+    pthread_cond_wait(&w->idle, &w->lock);
+  status = w->status;
+  pthread_mutex_unlock(&w->lock);
+#else
+  status = w->status;
+#endif
+  
+  return status;
+}
+
+
+/* Return the first error from any write since the last call, and clear
+   it */
+/* Does not wait for pending writes (see writer_flush()), so an error shows
+   up here once its job has been written.  Lets a long run warn about one
+   failed file and carry on, rather than have every later call report
+   the same error. */
+int writer_take_status(scope_writer *w){
+  
+  int status;
+  
+  if(w == NULL)
+    return 0;
+  
+#if WRITER_THREADS
+  pthread_mutex_lock(&w->lock);
+#endif
+  status    = w->status;
+  w->status = 0;
+#if WRITER_THREADS
+  pthread_mutex_unlock(&w->lock);
+#endif
+  
+  return status;
+}
+
+
+/* Finish all pending writes, stop the thread and free the buffers */
+/* Returns the first error from any write. */
+int writer_destroy(scope_writer *w){
+  
+  /* Variable Declarations */
+  int i,status;
+  
+  if(w == NULL)
+    return 0;
+  
+  status = writer_flush(w);
+  
+#if WRITER_THREADS
+  pthread_mutex_lock(&w->lock);
+  w->quit = 1;
+  pthread_cond_signal(&w->ready);
+  pthread_mutex_unlock(&w->lock);
+  pthread_join(w->tid, NULL);
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->ready);
+  pthread_cond_destroy(&w->room);
+  pthread_cond_destroy(&w->idle);
+#endif
+  
+  for(i=0;i<w->nspare;i++)
+    images_free(w->spare[i]);
+  free(w->spare);
+  free(w->queue);
+  free(w);
+  
+  return status;
+}
+
+
+/* Write one job and recycle its buffer */
+/* Goes through fitsw_try_write_image(), so a CFITSIO error (a full disk,
+   an unwritable directory) becomes w->status rather than an exit(). */
+void writer_write_job(scope_writer *w, writer_job *job){
+  
+  /* Variable Declarations */
+  int  status=0;
+  char *fn=job->fn;
+  
+  if(job->keys != NULL){
+    fn = (char *)malloc(strlen(job->fn) + 6);
+    sprintf(fn, "%s.part", job->fn);
+  }
+  
+  /* Errors come back here (never exit()) and are kept for writer_flush() */
+  if(fitsw_try_write_image(fn, job->img, job->bitpix, job->telname,
+			   job->keys, job->keyarg, &status))
+    fprintf(stderr,"Error: unable to write %s.\n",job->fn);
+  
+  if(job->keys != NULL){
+    if(!status && rename(fn, job->fn)){
+      fprintf(stderr,"Error: unable to rename %s to %s.\n",fn,job->fn);
+      status = -1;
+    }
+    if(status)
+      remove(fn);                       // No stale .part left behind
+    free(fn);
+    free(job->keyarg);
+  }
+  
+#if WRITER_THREADS
+  pthread_mutex_lock(&w->lock);
+#endif
+  if(status && !w->status)
+    w->status = status;
+  w->nwritten++;
+  writer_recycle(w, job->img);
+#if WRITER_THREADS
+  pthread_cond_broadcast(&w->room);
+  pthread_mutex_unlock(&w->lock);
+#endif
+  
+  free(job->fn);
+  free(job->telname);
+  
+  return;
+}
+
+
+/* Return a written buffer to the spare list (lock held) */
+void writer_recycle(scope_writer *w, scope_image *img){
+  
+  if(w->nspare < w->nbuf)
+    w->spare[w->nspare++] = img;
+  else {
+    images_free(img);
+    w->nalloc--;
+  }
+  
+  return;
+}
@@ -0,0 +1,103 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: writer.h
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <fitsio.h>             // CFITSIO
+
+#if ASYNC_EXEC && HAVE_PTHREAD_H
+# include <pthread.h>
+# define WRITER_THREADS 1
+#else
+# define WRITER_THREADS 0
+#endif
+
+#define WRITER_DEPTH 2          // Default queue depth (double buffering)
+
+/* Hook to add header keywords to a file once its image is written */
+typedef void (*writer_keys)(fitsfile *fitsfp, void *arg, int *status);
+
+/* One queued FITS write */
+typedef struct{
+  scope_image   *img;           // Buffer from writer_get_buffer()
+  char          *fn;            // Output filename
+  char          *telname;       // For the TELESCOP keyword
+  int            bitpix;
+  writer_keys    keys;          // Header hook (NULL = none)
+  void          *keyarg;        // Its argument, freed once written
+} writer_job;
+
+/* Background FITS writer: finished images are queued with writer_submit()
+   and written through CFITSIO by one thread while the caller carries on.
+   Written buffers go back to a small pool for writer_get_buffer() to hand
+   out again, so at most nbuf images are ever in circulation.  A failed
+   write is reported and kept in status; it never ends the run.  Without
+   pthreads, writer_submit() simply writes in the calling thread. */
+typedef struct{
+  int            depth;         // Queue capacity
+  int            nbuf;          // Most buffers in circulation
+  writer_job    *queue;         // Ring of pending jobs
+  int            head;          // Next job to write
+  int            count;         // Jobs in the queue
+  int            busy;          // A job is being written right now
+  int            status;        // First error from any write
+  long           nwritten;      // Files written so far
+  scope_image  **spare;         // Buffers returned after writing
+  int            nspare;
+  int            nalloc;        // Buffers allocated (spare or in use)
+#if WRITER_THREADS
+  pthread_t      tid;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;         // Queue gained a job (or quit)
+  pthread_cond_t room;          // Queue lost a job, or a buffer came back
+  pthread_cond_t idle;          // Queue empty and nothing being written
+  int            quit;
+#endif
+} scope_writer;
+
+
+/* Function declarations */
+
+/* Public Functions */
+scope_writer *writer_create(int depth);
+scope_image  *writer_get_buffer(scope_writer *w, long nx, long ny);
+int           writer_submit(scope_writer *w, scope_image *img, char *fn,
+			    int bitpix, char *telname);
+int           writer_submit_keys(scope_writer *w, scope_image *img,
+				 char *fn, int bitpix, char *telname,
+				 writer_keys keys, void *keyarg);
+int           writer_flush(scope_writer *w);
+int           writer_take_status(scope_writer *w);
+int           writer_destroy(scope_writer *w);
+
+/* Internal Functions */
+void          writer_write_job(scope_writer *w, writer_job *job);
+void          writer_recycle(scope_writer *w, scope_image *img);
+
+#endif  /* WRITER_H */
+
+
+
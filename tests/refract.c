@@ -0,0 +1,267 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: refract.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+
+/* Test of refraction (rays_trace() through refracting elements).  Lenses
+   are put ahead of the focal plane of the demo Newtonian with demo_lens():
+   near-axis rays must come to the paraxial focus worked out here from the
+   lens surfaces alone (t (1 - 1/n) beyond the bare focus for a window,
+   surface by surface imaging for the Barlow), which is also where the
+   focal plane must have been moved, and rays over the whole pupil must get
+   through the Barlow (the first surface is met from beyond its center of
+   curvature) to land near the focus.  Rays meeting a glass-air surface past
+   the critical angle must be lost, and those short of it bent by Snell's
+   law.  Returns 0 if all is well. */
+
+#define wombat                         // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Local headers */
+#include "demo.h"
+#include "glass.h"
+#include "rays.h"
+#include "setup.h"
+
+#define TEST_LAMBDA 5500.              // Angstroms
+#define TEST_H      1.e-5              // Ray heights for the paraxial trace
+#define TEST_FOCUS  1.e-7              // Focus tolerance (m)
+#define TEST_SPOT   5.e-5              // Barlow's marginal blur bound (m)
+
+
+/* Where a meridional ray crosses the folded axis of the demo Newtonian,
+   which runs along x at y = 0, z = zfold */
+static double test_axis_crossing(scope_ray *ray, double zfold){
+  
+  return ray->x - (ray->z - zfold) * ray->vx / ray->vz;
+}
+
+
+/* Put lens on the demo Newtonian in glass, and check the traced focus, and
+   the focal plane, against the paraxial focus of the lens surfaces */
+static int test_focus(int lens, int glass){
+  
+  /* Variable Declarations */
+  int    i,nelem,bad=0;
+  double f0,zfold,n,t,c1,c2,s,focus,x;
+  scope_scope    scope;
+  scope_element *elements;
+  scope_ray      ray;
+  
+  memset(&scope, 0, sizeof(scope_scope));
+  demo_newtonian(&scope, &elements, &nelem);
+  f0    = scope.focalplane.cx;
+  zfold = scope.focalplane.cz;
+  if(demo_lens(&scope, &elements, &nelem, lens, glass)){
+    fprintf(stderr,"refract: demo_lens(%d, %d) failed\n",lens,glass);
+    return 1;
+  }
+  
+  /* The prescription, back from the surfaces (R = -2f, normals along -x) */
+  n  = glass_index(glass, TEST_LAMBDA);
+  t  = scope.quaternary.cx - scope.tertiary.cx;
+  c1 = (scope.tertiary.type == OPTIC_PLANE) ? 0. : -0.5 / scope.tertiary.f;
+  c2 = (scope.quaternary.type == OPTIC_PLANE) ? 0. : -0.5 / scope.quaternary.f;
+  
+  /* Image the bare focus through one surface, then the other:
+     n'/s' - n/s = (n' - n) / R, distances from each vertex along the light */
+  if(c1 == 0. && c2 == 0.)
+    focus = f0 + t * (1. - 1. / n);
+  else {
+    s = f0 - scope.tertiary.cx;
+    s = n / (1. / s + (n - 1.) * c1) - t;
+    s = 1. / (n / s + (1. - n) * c2);
+    focus = scope.quaternary.cx + s;
+  }
+  
+  if(fabs(scope.focalplane.cx - focus) > TEST_FOCUS){
+    fprintf(stderr,"refract: %s focal plane at %.9f m, paraxial focus %.9f m\n",
+	    scope.name,scope.focalplane.cx,focus);
+    bad++;
+  }
+  
+  /* Near-axis rays from the fold, aimed at the bare focus, through the
+     lens and onto the focal plane */
+  for(i=-1; i <= 1; i += 2){
+    memset(&ray, 0, sizeof(scope_ray));
+    ray.x  = f0 - 0.1;
+    ray.z  = zfold + i * TEST_H;
+    ray.vx = 0.1 / hypot(0.1, TEST_H);
+    ray.vz = -i * TEST_H / hypot(0.1, TEST_H);
+    ray.lambda = TEST_LAMBDA;
+    rays_trace(&ray, 1, &scope, elements + nelem - 3, 3);
+    x = test_axis_crossing(&ray, zfold);
+    if(ray.lost || fabs(x - focus) > TEST_FOCUS){
+      fprintf(stderr,"refract: %s ray (lost=%d) focused at %.9f m, "
+	      "paraxial focus %.9f m\n",scope.name,(int)ray.lost,x,focus);
+      bad++;
+    }
+  }
+  
+  printf("refract: %s in glass %d, focus %+.6f m from the bare focus\n",
+	 scope.name,glass,focus - f0);
+  
+  free(scope.name);
+  free(elements);
+  return bad;
+}
+
+
+/* Trace a ring of rays near the edge of the pupil, between the spider
+   vanes, through the demo Newtonian with a Barlow */
+static int test_pupil(int glass){
+  
+  /* Variable Declarations */
+  int    i,nelem,bad=0;
+  double a,r;
+  scope_scope    scope;
+  scope_element *elements;
+  scope_ray      rays[8];
+  
+  memset(&scope, 0, sizeof(scope_scope));
+  demo_newtonian(&scope, &elements, &nelem);
+  if(demo_lens(&scope, &elements, &nelem, DEMO_LENS_BARLOW, glass)){
+    fprintf(stderr,"refract: demo_lens(%d, %d) failed\n",DEMO_LENS_BARLOW,
+	    glass);
+    return 1;
+  }
+  
+  for(i=0;i<8;i++){
+    a = (i + 0.5) * M_PI / 4.;
+    memset(&rays[i], 0, sizeof(scope_ray));
+    rays[i].x  = 0.35 * scope.primary.dmaj * cos(a);
+    rays[i].y  = 0.35 * scope.primary.dmaj * sin(a);
+    rays[i].z  = 2. * scope.primary.f;
+    rays[i].vz = -1.;
+    rays[i].lambda = TEST_LAMBDA;
+  }
+  rays_trace(rays, 8, &scope, elements, nelem);
+  
+  for(i=0;i<8;i++){
+    r = hypot(rays[i].y, rays[i].z - scope.focalplane.cz);
+    if(rays[i].lost || r > TEST_SPOT){
+      fprintf(stderr,"refract: %s pupil ray %d (lost=%d) lands %.3g m "
+	      "off axis\n",scope.name,i,(int)rays[i].lost,r);
+      bad++;
+    }
+  }
+  
+  free(scope.name);
+  free(elements);
+  return bad;
+}
+
+
+/* Set up a glass-air surface at z in the direction (sin a, 0, cos a) */
+static void test_surface(scope_optic *s, double z, double a, int glass){
+  
+  memset(s, 0, sizeof(scope_optic));
+  s->type  = OPTIC_PLANE;
+  s->f     = posinf;
+  s->dmaj  = 0.05;
+  s->dmin  = 0.05;
+  s->glass = glass;
+  s->cz    = z;
+  s->nx    = sin(a);
+  s->nz    = cos(a);
+  setup_orient_optic(s);
+  
+  return;
+}
+
+
+/* A ray goes straight into a block of glass and meets the far face, tilted
+   by a, from inside: past the critical angle it must be lost, short of it
+   it must leave at asin(n sin a) to the face normal */
+static int test_tir(int glass){
+  
+  /* Variable Declarations */
+  int    j,bad=0;
+  double n,crit,a,sout;
+  scope_scope   scope;
+  scope_element elements[2];
+  scope_ray     ray;
+  
+  memset(&scope, 0, sizeof(scope_scope));
+  memset(elements, 0, sizeof(elements));
+  elements[0].elem    = OPTIC_TRI;
+  elements[0].refract = true;
+  elements[1].elem    = OPTIC_QUA;
+  elements[1].refract = true;
+  
+  n    = glass_index(glass, TEST_LAMBDA);
+  crit = asin(1. / n);
+  test_surface(&scope.tertiary, 1., 0., glass);
+  
+  for(j=-1; j <= 1; j += 2){
+    a = crit + j * 0.01;
+    test_surface(&scope.quaternary, 0.99, a, GLASS_AIR);
+    memset(&ray, 0, sizeof(scope_ray));
+    ray.z  = 2.;
+    ray.vz = -1.;
+    ray.lambda = TEST_LAMBDA;
+    rays_trace(&ray, 1, &scope, elements, 2);
+    
+    /* Sine of the angle out, from |v x nhat| */
+    sout = fabs(ray.vx * cos(a) - ray.vz * sin(a));
+    if((j > 0) != ray.lost ||
+       (j < 0 && fabs(sout - n * sin(a)) > 1.e-12)){
+      fprintf(stderr,"refract: glass %d at %.4f rad (critical %.4f): "
+	      "lost=%d, sin out %.12f, n sin a %.12f\n",glass,a,crit,
+	      (int)ray.lost,sout,n * sin(a));
+      bad++;
+    }
+  }
+  
+  return bad;
+}
+
+
+int main(){
+  
+  /* Variable Declarations */
+  int    g,nbad=0;
+  double lambda=TEST_LAMBDA;
+  
+  glass_tabulate(&lambda, 1);
+  
+  for(g=GLASS_BK7; g < GLASS_NGLASS; g++){
+    nbad += test_focus(DEMO_LENS_WINDOW, g);
+    nbad += test_tir(g);
+  }
+  nbad += test_focus(DEMO_LENS_BARLOW, GLASS_BK7);
+  nbad += test_focus(DEMO_LENS_BARLOW, GLASS_F2);
+  nbad += test_pupil(GLASS_BK7);
+  
+  printf("refract: %s\n",(nbad) ? "FAILED" : "ok");
+  return (nbad > 0);
+}
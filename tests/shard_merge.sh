@@ -0,0 +1,115 @@
+#!/bin/sh
+#
+# shard_merge.sh -- check that a --compact trace split over several
+# processes with --shard i/N and put back together with --merge gives the
+# trace a single process (--shard 0/1) does: the histogram must be
+# identical and the statistics the same to 1e-12.
+#
+# Usage: shard_merge.sh [N [rays]]   (default 4 shards of 2e6 rays)
+#
+# Run by `make check'; top_builddir locates scopedesign and the CFITSIO
+# utilities in cexamples/.
+
+nshard=${1:-4}
+nrays=${2:-2e6}
+top=`cd "${top_builddir:-..}" && pwd`
+scope=$top/src/scopedesign
+cex=$top/cexamples
+
+for prog in "$scope" "$cex/imarith" "$cex/imstat" "$cex/listhead"; do
+    if test ! -x "$prog"; then
+	echo "shard_merge: $prog not built, skipping"
+	exit 77
+    fi
+done
+
+tmp=`mktemp -d "${TMPDIR:-/tmp}/shard_merge.XXXXXX"` || exit 1
+trap 'rm -rf "$tmp"' 0 1 2 15
+cd "$tmp" || exit 1
+
+# The shards, all at once, each as its own process
+pids=
+i=0
+while test $i -lt $nshard; do
+    "$scope" --batch --compact --shard $i/$nshard --rays $nrays \
+	--spot shard_$i.fits > shard_$i.log 2>&1 &
+    pids="$pids $!"
+    i=`expr $i + 1`
+done
+for pid in $pids; do
+    if ! wait $pid; then
+	echo "shard_merge: a shard failed:"
+	cat shard_*.log
+	exit 1
+    fi
+done
+
+parts=
+i=0
+while test $i -lt $nshard; do
+    parts="$parts shard_$i.fits"
+    i=`expr $i + 1`
+done
+"$scope" --batch --merge merged.fits $parts > merge.log 2>&1 || {
+    echo "shard_merge: --merge failed:"; cat merge.log; exit 1; }
+
+# The same trace in one process
+"$scope" --batch --compact --shard 0/1 --rays $nrays --spot single.fits \
+    > single.log 2>&1 || {
+    echo "shard_merge: single-process trace failed:"; cat single.log; exit 1; }
+
+# Histograms: the difference image must be all zeros
+"$cex/imarith" merged.fits single.fits sub '!diff.fits' > /dev/null || exit 1
+"$cex/imstat" diff.fits | awk '
+    /minimum value/ || /maximum value/ { if ($NF + 0 != 0) bad = 1; n++ }
+    END { if (bad || n != 2) { print "shard_merge: histograms differ"; exit 1 } }
+' || exit 1
+
+# Statistics from the primary header of each file
+"$cex/listhead" 'merged.fits[0]' > merged.hdr || exit 1
+"$cex/listhead" 'single.fits[0]' > single.hdr || exit 1
+awk '
+    function val(card) {
+	sub(/^[^=]*= */, "", card)
+	sub(/ *\/.*$/, "", card)
+	return card
+    }
+    FNR == 1 { f++ }
+    { key = $1 }
+    key == "NRAY" || key == "NGOOD" || key == "RAYTOT" || key == "LOU" ||
+    key == "LOV"  || key == "PIX"   || key == "MEANU"  || key == "MEANV" ||
+    key == "M2U"  || key == "M2V" { v[f, key] = val($0) }
+    END {
+	split("NRAY NGOOD RAYTOT LOU LOV PIX", exact, " ")
+	for (i = 1; i <= 6; i++) {
+	    k = exact[i]
+	    if (!((1, k) in v) || v[1, k] + 0 != v[2, k] + 0) {
+		print "shard_merge: " k " differs: " v[1, k] " vs " v[2, k]
+		bad = 1
+	    }
+	}
+	n = v[2, "NGOOD"] + 0
+	split("U V", ax, " ")
+	for (i = 1; i <= 2; i++) {
+	    m2 = "M2" ax[i]; mean = "MEAN" ax[i]
+	    a = v[1, m2] + 0; b = v[2, m2] + 0
+	    d = a - b; if (d < 0) d = -d
+	    if (b < 0) b = -b
+	    if (d > 1e-12 * b) {
+		print "shard_merge: " m2 " differs: " v[1, m2] " vs " v[2, m2]
+		bad = 1
+	    }
+	    # Means are compared on the scale of the spot, not of their offset
+	    rms = n > 0 ? sqrt(b / n) : 0
+	    d = v[1, mean] - v[2, mean]; if (d < 0) d = -d
+	    if (d > 1e-12 * rms) {
+		print "shard_merge: " mean " differs: " v[1, mean] " vs " v[2, mean]
+		bad = 1
+	    }
+	}
+	exit bad
+    }
+' merged.hdr single.hdr || exit 1
+
+echo "shard_merge: $nshard shards of $nrays rays merge into the single trace"
+exit 0
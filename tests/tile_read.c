@@ -0,0 +1,168 @@
+/* ScopeDesign
+ *
+ * A tool for determining the optical consequences of telescope design
+ * through ray tracing and simulated focal planes.
+ *
+ * FILE: tile_read.c
+ *
+ * Copyright (C) 2016-2021  Timothy P. Ellsworth Bowers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+/* Test of the parallel read of tile-compressed images (fw_read_tiles()).
+   A RICE-compressed image is written, and subsections starting on and off
+   tile boundaries are read serially and over a pool: the two must agree
+   with each other and with what was written.  The bands handed to the
+   threads must also each stay within one tile row of the image, so that no
+   tile is decompressed twice.  Returns 0 if all is well. */
+
+#define wombat                         // wombat == protect on N_RAYS
+#include "sd_defs.h"                   // Main Package Header
+#undef wombat
+
+/* Include packages */
+#include <stdio.h>
+#include <stdlib.h>
+#include <fitsio.h>                    // CFITSIO
+
+/* Local headers */
+#include "fitsw.h"
+#include "images.h"
+#include "pool.h"
+
+#define TEST_FILE "tile_read.fits"
+#define TEST_NX   300
+#define TEST_NY   203
+#define TEST_TILE 16                   // Tile height (and width / 4)
+
+
+/* Value written at pixel (x,y) */
+static int test_value(long x, long y){
+  return (int)((x * 7919 + y * 104729) % 65521) - 32000;
+}
+
+
+/* Check that every tile row's band of a subsection (y0, ny) lies in that
+   tile row, and that the bands cover the subsection in order */
+static int test_bands(long y0, long ny){
+  
+  /* Variable Declarations */
+  long i,nrow,r0,r1,next=0;
+  
+  nrow = (y0 + ny - 1) / TEST_TILE - y0 / TEST_TILE + 1;
+  for(i=0;i<nrow;i++){
+    fw_tile_rows(y0, ny, TEST_TILE, i, i + 1, &r0, &r1);
+    if(r0 != next || r1 <= r0 ||
+       (y0 + r0) / TEST_TILE != (y0 + r1 - 1) / TEST_TILE){
+      fprintf(stderr,"tile_read: band %ld of rows %ld+%ld is [%ld, %ld)\n",
+	      i,y0,ny,r0,r1);
+      return 1;
+    }
+    next = r1;
+  }
+  
+  return (next != ny);
+}
+
+
+/* Read the subsection at xystart of size xysize serially and over pool,
+   and compare both with the written values */
+static int test_read(fitsfile *fitsfp, scope_pool *pool, long xystart[2],
+		     long xysize[2]){
+  
+  /* Variable Declarations */
+  int  status=0,bad=0;
+  long x,y;
+  scope_image *serial,*parallel;
+  
+  fitsw_set_pool(NULL);
+  serial = fitsw_read2array(fitsfp, xystart, xysize, TDOUBLE, &status);
+  fitsw_set_pool(pool);
+  parallel = fitsw_read2array(fitsfp, xystart, xysize, TDOUBLE, &status);
+  fitsw_set_pool(NULL);
+  if(serial == NULL || parallel == NULL){
+    fprintf(stderr,"tile_read: read failed (status %d)\n",status);
+    return 1;
+  }
+  
+  for(y=0;y<xysize[1];y++)
+    for(x=0;x<xysize[0];x++)
+      if(IMAGES_PIX(serial, x, y) != IMAGES_PIX(parallel, x, y) ||
+	 IMAGES_PIX(serial, x, y) != test_value(xystart[0] + x,
+						xystart[1] + y))
+	bad++;
+  if(bad)
+    fprintf(stderr,"tile_read: %d pixels differ reading %ldx%ld at "
+	    "(%ld,%ld)\n",bad,xysize[0],xysize[1],xystart[0],xystart[1]);
+  
+  images_free(serial);
+  images_free(parallel);
+  
+  return (bad > 0) + test_bands(xystart[1], xysize[1]);
+}
+
+
+int main(){
+  
+  /* Variable Declarations */
+  int  status=0,nbad=0,*row;
+  long x,y,naxes[2]={TEST_NX,TEST_NY},fpixel[2]={1,1};
+  long xystart[2],xysize[2];
+  char fn[FLEN_FILENAME];
+  fitsfile *fitsfp;
+  scope_pool *pool;
+  
+  /* A RICE-compressed image of TEST_TILE-row tiles */
+  snprintf(fn, FLEN_FILENAME, "!%s[compress R %d,%d]", TEST_FILE,
+	   4 * TEST_TILE, TEST_TILE);
+  row = (int *)malloc(TEST_NX * sizeof(int));
+  fits_create_file(&fitsfp, fn, &status);
+  fits_create_img(fitsfp, LONG_IMG, 2, naxes, &status);
+  for(y=0; y < TEST_NY && !status; y++){
+    for(x=0;x<TEST_NX;x++)
+      row[x] = test_value(x, y);
+    fpixel[1] = y + 1;
+    fits_write_pix(fitsfp, TINT, fpixel, TEST_NX, row, &status);
+  }
+  fits_close_file(fitsfp, &status);
+  free(row);
+  if(status || fits_open_file(&fitsfp, TEST_FILE, READONLY, &status)){
+    fits_report_error(stderr, status);
+    return 1;
+  }
+  
+  pool = pool_create(4);
+  
+  /* On a tile boundary, then off one by a little and by a lot */
+  xystart[0] = 0;   xystart[1] = 0;
+  xysize[0]  = 300; xysize[1]  = 203;
+  nbad += test_read(fitsfp, pool, xystart, xysize);
+  xystart[0] = 7;   xystart[1] = 5;
+  xysize[0]  = 250; xysize[1]  = 170;
+  nbad += test_read(fitsfp, pool, xystart, xysize);
+  xystart[0] = 33;  xystart[1] = 15;
+  xysize[0]  = 200; xysize[1]  = 66;
+  nbad += test_read(fitsfp, pool, xystart, xysize);
+  
+  pool_destroy(pool);
+  fits_close_file(fitsfp, &status);
+  remove(TEST_FILE);
+  
+  printf("tile_read: %s\n",(nbad) ? "FAILED" : "ok");
+  return (nbad > 0);
+}